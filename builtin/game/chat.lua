@@ -753,6 +753,41 @@ core.register_chatcommand("deleteblocks", {
 	end,
 })
 
+core.register_chatcommand("pregen", {
+	params = "[pause | resume]",
+	description = S("Show or control the progress of the background "
+		.. "map generation"),
+	func = function(name, param)
+		if param == "pause" or param == "resume" then
+			if not core.check_player_privs(name, {server=true}) then
+				return false, S("You don't have permission to run "
+					.. "this command (missing privilege: @1).", "server")
+			end
+			core.set_pregen_paused(param == "pause")
+		elseif param ~= "" then
+			return false
+		end
+
+		local progress = core.get_pregen_progress()
+		if not progress then
+			return true, S("Background map generation is disabled.")
+		end
+		local state
+		if progress.paused then
+			state = S("paused")
+		elseif progress.done >= progress.total then
+			state = S("done")
+		elseif progress.throttled then
+			state = S("waiting for the server to catch up")
+		else
+			state = S("running")
+		end
+		return true, S("Background map generation: @1 of @2 mapchunks (@3%), @4.",
+			progress.done, progress.total,
+			math.floor(progress.done * 100 / progress.total), state)
+	end,
+})
+
 core.register_chatcommand("fixlight", {
 	params = S("(here [<radius>]) | (<pos1> <pos2>)"),
 	description = S("Resets lighting in the area between pos1 and pos2 "
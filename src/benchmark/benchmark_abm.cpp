@@ -0,0 +1,122 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <iostream>
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "porting.h"
+#include "server/abmscanner.h"
+
+namespace {
+
+// Stone below, dirt in the middle layer with some grass on it, air above
+void buildTerrain(DummyMap &map, v3s16 bpmin, v3s16 bpmax,
+		content_t c_stone, content_t c_dirt, content_t c_grass)
+{
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(x, y, z));
+		for (s16 k = 0; k < MAP_BLOCKSIZE; k++)
+		for (s16 j = 0; j < MAP_BLOCKSIZE; j++)
+		for (s16 i = 0; i < MAP_BLOCKSIZE; i++) {
+			s16 height = 4 + (i * 3 + k * 5) % 8;
+			content_t c = CONTENT_AIR;
+			if (y < 0)
+				c = c_stone;
+			else if (y == 0 && j < height)
+				c = c_dirt;
+			else if (y == 0 && j == height && (i + k) % 3 == 0)
+				c = c_grass;
+			block->setNodeNoCheck(i, j, k, MapNode(c));
+		}
+	}
+}
+
+}
+
+TEST_CASE("benchmark_abm_scan")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	auto addNode = [ndef] (const char *name) {
+		ContentFeatures f;
+		f.name = name;
+		return ndef->set(f.name, f);
+	};
+	content_t c_stone = addNode("stone");
+	content_t c_dirt = addNode("dirt");
+	content_t c_grass = addNode("grass");
+
+	v3s16 bpmin(-8, -1, -8), bpmax(7, 0, 7);
+	DummyMap map(&gamedef, bpmin, bpmax);
+	buildTerrain(map, bpmin, bpmax, c_stone, c_dirt, c_grass);
+
+	std::vector<MapBlock *> blocks;
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++)
+		blocks.push_back(map.getBlockNoCreateNoEx(v3s16(x, y, z)));
+
+	// Dirt turning into grass next to grass, and grass spreading into air
+	ActiveABM spread;
+	spread.abm = nullptr;
+	spread.chance = 50;
+	spread.required_neighbors = {c_grass};
+	spread.check_required_neighbors = true;
+	spread.min_y = -MAX_MAP_GENERATION_LIMIT;
+	spread.max_y = MAX_MAP_GENERATION_LIMIT;
+	ActiveABM decay = spread;
+	decay.chance = 200;
+	decay.required_neighbors.clear();
+	decay.check_required_neighbors = false;
+
+	for (u32 threads : {1, 2, 4}) {
+		ABMScanner scanner(threads);
+		scanner.addABM(spread, {c_dirt});
+		scanner.addABM(decay, {c_stone, c_grass});
+
+		std::vector<ABMTrigger> triggers;
+		ABMScanStats stats;
+		const int rounds = 10;
+		u64 t0 = porting::getTimeUs();
+		for (int i = 0; i < rounds; i++) {
+			triggers.clear();
+			scanner.scan(&map, blocks, triggers, &stats);
+		}
+		u64 t1 = porting::getTimeUs();
+		std::cout << "ABM scan with " << scanner.getThreadCount() << " threads: "
+			<< (u64)stats.blocks_scanned * 1000000 / MYMAX(t1 - t0, (u64)1)
+			<< " blocks/s, " << triggers.size() << " triggers per scan" << std::endl;
+
+		BENCHMARK_ADVANCED("scan_" + std::to_string(threads) + "threads")(
+				Catch::Benchmark::Chronometer meter) {
+			meter.measure([&] {
+				triggers.clear();
+				scanner.scan(&map, blocks, triggers, &stats);
+				return triggers.size();
+			});
+		};
+	}
+}
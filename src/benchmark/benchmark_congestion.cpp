@@ -0,0 +1,272 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include "network/connection.h"
+#include "network/networkpacket.h"
+#include "network/networkprotocol.h"
+#include "network/socket.h"
+#include "noise.h"
+#include "porting.h"
+#include "settings.h"
+#include "threading/thread.h"
+
+namespace {
+
+struct LinkProfile
+{
+	const char *name;
+	u32 latency_ms; // one way
+	u32 bandwidth; // bytes per second
+	float loss;
+	u32 queue_size; // bytes
+};
+
+/*
+	Forwards datagrams between a client and a server as if they went
+	through a link with the given latency, bandwidth, random loss and
+	queue size in each direction. Datagrams that don't fit into the
+	queue are dropped.
+*/
+class LinkEmulator : public Thread
+{
+public:
+	LinkEmulator(const LinkProfile &profile, const Address &bind_address,
+			const Address &server_address) :
+		Thread("LinkEmulator"),
+		m_profile(profile),
+		m_server_address(server_address),
+		m_client_socket(false),
+		m_server_socket(false),
+		m_random(profile.latency_ms)
+	{
+		m_client_socket.Bind(bind_address);
+		m_server_socket.Bind(Address(0, 0, 0, 0, 0));
+	}
+
+	u32 getDropped() const { return m_dropped; }
+
+	void *run() override
+	{
+		Direction to_server, to_client;
+		Address client_address;
+		bool have_client = false;
+		u8 buf[0x10000];
+
+		while (!stopRequested()) {
+			u64 now = porting::getTimeUs();
+			bool idle = true;
+			Address sender;
+			int size;
+
+			while ((size = m_client_socket.Receive(sender, buf, sizeof(buf))) >= 0) {
+				client_address = sender;
+				have_client = true;
+				enqueue(to_server, buf, size, now);
+				idle = false;
+			}
+			while ((size = m_server_socket.Receive(sender, buf, sizeof(buf))) >= 0) {
+				enqueue(to_client, buf, size, now);
+				idle = false;
+			}
+
+			flush(to_server, m_server_socket, m_server_address, now);
+			if (have_client)
+				flush(to_client, m_client_socket, client_address, now);
+
+			if (idle)
+				sleep_ms(1);
+		}
+		return nullptr;
+	}
+
+private:
+	struct Datagram
+	{
+		u64 arrival;
+		std::vector<u8> data;
+	};
+
+	struct Direction
+	{
+		std::deque<Datagram> queue;
+		// When the last queued datagram is on the wire
+		u64 link_free = 0;
+	};
+
+	void enqueue(Direction &dir, const u8 *data, int size, u64 now)
+	{
+		u64 queued = dir.link_free > now ?
+			(dir.link_free - now) * m_profile.bandwidth / 1000000 : 0;
+		if (queued + size > m_profile.queue_size ||
+				m_random.range(0, 9999) < m_profile.loss * 10000) {
+			m_dropped++;
+			return;
+		}
+
+		dir.link_free = MYMAX(now, dir.link_free) +
+			(u64)size * 1000000 / m_profile.bandwidth;
+		dir.queue.push_back({dir.link_free + m_profile.latency_ms * 1000,
+			std::vector<u8>(data, data + size)});
+	}
+
+	void flush(Direction &dir, UDPSocket &socket, const Address &destination,
+			u64 now)
+	{
+		while (!dir.queue.empty() && dir.queue.front().arrival <= now) {
+			const std::vector<u8> &data = dir.queue.front().data;
+			socket.Send(destination, data.data(), data.size());
+			dir.queue.pop_front();
+		}
+	}
+
+	const LinkProfile m_profile;
+	const Address m_server_address;
+	UDPSocket m_client_socket;
+	UDPSocket m_server_socket;
+	PcgRandom m_random;
+	std::atomic<u32> m_dropped{0};
+};
+
+struct Handler : public con::PeerHandler
+{
+	void peerAdded(con::Peer *peer) override
+	{
+		last_id = peer->id;
+		count++;
+	}
+	void deletingPeer(con::Peer *peer, bool timeout) override
+	{
+		count--;
+	}
+
+	std::atomic<s32> count{0};
+	std::atomic<session_t> last_id{0};
+};
+
+// Number of map blocks within a view range of `range` blocks
+u32 countBlocks(s16 range)
+{
+	u32 count = 0;
+	for (s16 z = -range; z <= range; z++)
+	for (s16 y = -range; y <= range; y++)
+	for (s16 x = -range; x <= range; x++) {
+		if (x * x + y * y + z * z <= range * range)
+			count++;
+	}
+	return count;
+}
+
+/*
+	Sends the map blocks of a view range from a server to a client through
+	the emulated link and returns the milliseconds until the client has all
+	of them, 0 if it didn't get them in time.
+*/
+u64 timeToLoad(const LinkProfile &profile, bool congestion_control, s16 range,
+	u32 &dropped)
+{
+	const u32 proto_id = 0x4d54434c;
+	const u16 server_port = 30010, link_port = 30011;
+	const bool old_setting = g_settings->getBool("congestion_control");
+	g_settings->setBool("congestion_control", congestion_control);
+
+	Handler hand_server, hand_client;
+	con::Connection server(proto_id, 512, 30.0f, false, &hand_server);
+	server.Serve(Address(0, 0, 0, 0, server_port));
+	LinkEmulator link(profile, Address(127, 0, 0, 1, link_port),
+		Address(127, 0, 0, 1, server_port));
+	link.start();
+	con::Connection client(proto_id, 512, 30.0f, false, &hand_client);
+	client.Connect(Address(127, 0, 0, 1, link_port));
+
+	g_settings->setBool("congestion_control", old_setting);
+
+	u64 t0 = porting::getTimeMs();
+	while (!client.Connected() || hand_server.count == 0) {
+		if (porting::getTimeMs() - t0 > 10000)
+			break;
+		NetworkPacket pkt;
+		client.TryReceive(&pkt);
+		server.TryReceive(&pkt);
+		sleep_ms(10);
+	}
+
+	// Compressed blocks are mostly a few hundred bytes, some are larger
+	const u32 count = countBlocks(range);
+	PcgRandom pr(count);
+	t0 = porting::getTimeMs();
+	for (u32 i = 0; i < count; i++) {
+		u32 size = pr.range(0, 9) < 8 ? pr.range(200, 1200) : pr.range(2000, 6000);
+		NetworkPacket pkt(TOCLIENT_BLOCKDATA, size);
+		for (u32 j = 0; j < size / 4; j++)
+			pkt << (u32)pr.next();
+		server.Send(hand_server.last_id, 2, &pkt, true);
+	}
+
+	u32 received = 0;
+	u64 time = 0;
+	while (received < count) {
+		time = porting::getTimeMs() - t0;
+		if (time > 120000) {
+			time = 0;
+			break;
+		}
+		NetworkPacket pkt;
+		if (!client.TryReceive(&pkt)) {
+			sleep_ms(1);
+			continue;
+		}
+		if (pkt.getCommand() == TOCLIENT_BLOCKDATA)
+			received++;
+	}
+
+	link.stop();
+	link.wait();
+	dropped = link.getDropped();
+	return time;
+}
+
+}
+
+TEST_CASE("benchmark_congestion")
+{
+	const LinkProfile profiles[] = {
+		{"lan", 1, 12500000, 0.0f, 1024 * 1024},
+		{"dsl", 20, 2000000, 0.002f, 64 * 1024},
+		{"mobile", 50, 500000, 0.01f, 32 * 1024},
+	};
+	const s16 range = 5;
+
+	std::cout << "Time to load " << countBlocks(range)
+		<< " blocks of a view range of " << range << " blocks" << std::endl;
+	for (const LinkProfile &profile : profiles) {
+		for (bool congestion_control : {false, true}) {
+			u32 dropped = 0;
+			u64 time = timeToLoad(profile, congestion_control, range, dropped);
+			std::cout << "  " << profile.name << ", congestion control "
+				<< (congestion_control ? "on" : "off") << ": " << time
+				<< " ms, " << dropped << " datagrams dropped" << std::endl;
+			REQUIRE(time > 0);
+		}
+	}
+}
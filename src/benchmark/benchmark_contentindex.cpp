@@ -0,0 +1,142 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <iostream>
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "util/basic_macros.h"
+
+namespace {
+
+// Stone with scattered ores below, dirt in the middle layer, air above
+void buildTerrain(DummyMap &map, v3s16 bpmin, v3s16 bpmax,
+		content_t c_stone, content_t c_ore, content_t c_dirt)
+{
+	u32 seed = 1;
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(x, y, z));
+		for (s16 k = 0; k < MAP_BLOCKSIZE; k++)
+		for (s16 j = 0; j < MAP_BLOCKSIZE; j++)
+		for (s16 i = 0; i < MAP_BLOCKSIZE; i++) {
+			seed = seed * 1103515245 + 12345;
+			content_t c = CONTENT_AIR;
+			if (y < 0)
+				c = (seed >> 16) % 200 == 0 ? c_ore : c_stone;
+			else if (y == 0 && j < 8)
+				c = c_dirt;
+			block->setNodeNoCheck(i, j, k, MapNode(c));
+		}
+		block->expireContentIndex();
+	}
+}
+
+}
+
+TEST_CASE("benchmark_contentindex")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	auto addNode = [ndef] (const char *name) {
+		ContentFeatures f;
+		f.name = name;
+		return ndef->set(f.name, f);
+	};
+	content_t c_stone = addNode("stone");
+	content_t c_ore = addNode("ore");
+	content_t c_dirt = addNode("dirt");
+
+	v3s16 bpmin(-5, -2, -5), bpmax(4, 1, 4);
+	DummyMap map(&gamedef, bpmin, bpmax);
+	buildTerrain(map, bpmin, bpmax, c_stone, c_ore, c_dirt);
+
+	const v3s16 minp = bpmin * MAP_BLOCKSIZE;
+	const v3s16 maxp = (bpmax + v3s16(1, 1, 1)) * MAP_BLOCKSIZE - v3s16(1, 1, 1);
+	const std::vector<content_t> filter = {c_ore};
+
+	auto findScan = [&] () {
+		u32 count = 0;
+		map.forEachNodeInArea(minp, maxp, [&] (v3s16 p, MapNode n) -> bool {
+			if (CONTAINS(filter, n.getContent()))
+				count++;
+			return true;
+		});
+		return count;
+	};
+	auto findIndex = [&] () {
+		u32 count = 0;
+		map.forEachNodeInAreaWithContent(minp, maxp, filter,
+			[&] (v3s16 p, MapNode n) -> bool {
+				count++;
+				return true;
+			});
+		return count;
+	};
+
+	{
+		const u32 found = findIndex();
+		REQUIRE(found == findScan());
+
+		size_t blocks = 0, index_bytes = 0;
+		for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+		for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+		for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+			MapBlock *block = map.getBlockNoCreateNoEx(v3s16(x, y, z));
+			index_bytes += block->getContentIndex().getMemoryUsage();
+			blocks++;
+		}
+		std::cout << "Content index: " << index_bytes / blocks
+			<< " bytes per block on average (node data: "
+			<< MapBlock::nodecount * sizeof(MapNode) << " bytes), "
+			<< found << " ore nodes in " << blocks << " blocks" << std::endl;
+	}
+
+	BENCHMARK("find_nodes_full_scan") {
+		return findScan();
+	};
+
+	BENCHMARK("find_nodes_content_index") {
+		return findIndex();
+	};
+
+	BENCHMARK_ADVANCED("content_index_build")(Catch::Benchmark::Chronometer meter) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(0, -1, 0));
+		MapBlockContentIndex index;
+		meter.measure([&] {
+			index.build(block->getData());
+			return index.getEntries().size();
+		});
+	};
+
+	BENCHMARK_ADVANCED("set_node_indexed")(Catch::Benchmark::Chronometer meter) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(0, -1, 0));
+		block->getContentIndex();
+		meter.measure([&] (int i) {
+			v3s16 p(i % MAP_BLOCKSIZE, (i / 7) % MAP_BLOCKSIZE, (i / 3) % MAP_BLOCKSIZE);
+			block->setNodeNoCheck(p, MapNode(i % 2 ? c_ore : c_stone));
+			return block->getContentIndex().getEntries().size();
+		});
+	};
+}
@@ -0,0 +1,179 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include "dummygamedef.h"
+#include "inventory.h"
+
+namespace {
+
+struct Workload
+{
+	const char *name;
+	// Creates and fills the lists
+	std::function<void(Inventory &, IItemDefManager *)> setup;
+	// What a mod changes in one server step
+	std::function<void(Inventory &, IItemDefManager *, u32)> step;
+};
+
+const Workload workloads[] = {
+	{
+		// Smelts one lump per step
+		"furnace",
+		[] (Inventory &inv, IItemDefManager *idef) {
+			inv.addList("src", 1)->addItem(ItemStack("default:iron_lump", 99, 0, idef));
+			inv.addList("fuel", 1)->addItem(ItemStack("default:coal_lump", 99, 0, idef));
+			inv.addList("dst", 4)->setWidth(2);
+		},
+		[] (Inventory &inv, IItemDefManager *idef, u32 n) {
+			inv.getList("src")->takeItem(0, 1);
+			if (n % 4 == 0)
+				inv.getList("fuel")->takeItem(0, 1);
+			inv.getList("dst")->addItem(ItemStack("default:steel_ingot", 1, 0, idef));
+			if (n % 90 == 89) {
+				inv.getList("src")->changeItem(0, ItemStack("default:iron_lump", 99, 0, idef));
+				inv.getList("fuel")->changeItem(0, ItemStack("default:coal_lump", 99, 0, idef));
+				inv.getList("dst")->clearItems();
+			}
+		},
+	},
+	{
+		// Sells one item per step from a large stock of items with prices
+		"shop",
+		[] (Inventory &inv, IItemDefManager *idef) {
+			InventoryList *stock = inv.addList("stock", 64);
+			for (u32 i = 0; i < stock->getSize(); i++) {
+				ItemStack item("shop:item_" + std::to_string(i % 16), 99, 0, idef);
+				item.metadata.setString("description",
+					"Item " + std::to_string(i % 16) + ", " + std::to_string(i % 5 + 1) + " gold");
+				stock->changeItem(i, item);
+			}
+			inv.addList("payment", 4);
+			inv.addList("change", 4);
+			inv.addList("output", 1);
+		},
+		[] (Inventory &inv, IItemDefManager *idef, u32 n) {
+			InventoryList *stock = inv.getList("stock");
+			u32 i = (n * 7) % stock->getSize();
+			ItemStack sold = stock->takeItem(i, 1);
+			if (sold.empty())
+				stock->changeItem(i, ItemStack("shop:item_0", 99, 0, idef));
+			inv.getList("output")->changeItem(0, sold);
+			inv.getList("payment")->changeItem(0, ItemStack("default:gold_ingot", 1 + n % 5, 0, idef));
+		},
+	},
+	{
+		// Digs one node per step
+		"player",
+		[] (Inventory &inv, IItemDefManager *idef) {
+			InventoryList *main = inv.addList("main", 32);
+			for (u32 i = 0; i < main->getSize(); i += 2)
+				main->changeItem(i, ItemStack("default:item_" + std::to_string(i), 50, 0, idef));
+			inv.addList("craft", 9)->setWidth(3);
+			inv.addList("craftpreview", 1);
+			inv.addList("craftresult", 1);
+		},
+		[] (Inventory &inv, IItemDefManager *idef, u32 n) {
+			ItemStack dug("default:cobble", 1, 0, idef);
+			ItemStack leftover = inv.getList("main")->addItem(dug);
+			if (!leftover.empty())
+				inv.getList("main")->removeItem(ItemStack("default:cobble", 99 * 8, 0, idef));
+		},
+	},
+};
+
+struct TrafficResult
+{
+	u64 text_bytes = 0;
+	u64 delta_bytes = 0;
+};
+
+TrafficResult simulate(const Workload &workload, IItemDefManager *idef, u32 steps)
+{
+	Inventory inv(idef);
+	workload.setup(inv, idef);
+	Inventory client_inv(inv);
+	inv.setModified(false);
+
+	TrafficResult result;
+	for (u32 n = 0; n < steps; n++) {
+		workload.step(inv, idef, n);
+
+		std::ostringstream text_os(std::ios_base::binary);
+		inv.serialize(text_os, true);
+		result.text_bytes += text_os.str().size();
+
+		std::ostringstream delta_os(std::ios_base::binary);
+		REQUIRE(inv.serializeDelta(delta_os));
+		result.delta_bytes += delta_os.str().size();
+		inv.setModified(false);
+
+		std::istringstream is(delta_os.str(), std::ios_base::binary);
+		client_inv.deSerializeDelta(is);
+	}
+	REQUIRE(client_inv == inv);
+	return result;
+}
+
+void runSteps(const Workload &workload, Inventory &inv, IItemDefManager *idef,
+		u32 steps, bool delta)
+{
+	for (u32 n = 0; n < steps; n++) {
+		workload.step(inv, idef, n);
+		std::ostringstream os(std::ios_base::binary);
+		if (delta)
+			inv.serializeDelta(os);
+		else
+			inv.serialize(os, true);
+		inv.setModified(false);
+	}
+}
+
+}
+
+TEST_CASE("benchmark_inventory_delta")
+{
+	DummyGameDef gamedef;
+	IItemDefManager *idef = gamedef.getItemDefManager();
+
+	for (const Workload &workload : workloads) {
+		TrafficResult result = simulate(workload, idef, 1000);
+		std::cout << workload.name << ": text " << result.text_bytes / 1000
+			<< " B/update, delta " << result.delta_bytes / 1000 << " B/update"
+			<< std::endl;
+		REQUIRE(result.delta_bytes < result.text_bytes);
+	}
+
+	for (const Workload &workload : workloads) {
+		Inventory inv(idef);
+		workload.setup(inv, idef);
+		inv.setModified(false);
+
+		BENCHMARK_ADVANCED(std::string("text_") + workload.name)(Catch::Benchmark::Chronometer meter) {
+			meter.measure([&] { runSteps(workload, inv, idef, 100, false); });
+		};
+		BENCHMARK_ADVANCED(std::string("delta_") + workload.name)(Catch::Benchmark::Chronometer meter) {
+			meter.measure([&] { runSteps(workload, inv, idef, 100, true); });
+		};
+	}
+}
@@ -84,3 +84,100 @@ TEST_CASE("benchmark_lighting")
 		});
 	};
 }
+
+TEST_CASE("benchmark_lighting_large_edit")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	v3s16 pmin(-48, -48, -48);
+	v3s16 pmax(47, 47, 47);
+	v3s16 bpmin = getNodeBlockPos(pmin), bpmax = getNodeBlockPos(pmax);
+	DummyMap map(&gamedef, bpmin, bpmax);
+
+	content_t content_wall;
+	{
+		ContentFeatures f;
+		f.name = "stone";
+		content_wall = ndef->set(f.name, f);
+	}
+
+	content_t content_light;
+	{
+		ContentFeatures f;
+		f.name = "light";
+		f.param_type = CPT_LIGHT;
+		f.light_propagates = true;
+		f.light_source = 14;
+		content_light = ndef->set(f.name, f);
+	}
+
+	// A large cave lit by a grid of lights, in solid stone.
+	{
+		std::map<v3s16, MapBlock*> modified_blocks;
+		MMVManip vm(&map);
+		vm.initialEmerge(bpmin, bpmax, false);
+		s32 volume = vm.m_area.getVolume();
+		for (s32 i = 0; i < volume; i++)
+			vm.m_data[i] = MapNode(content_wall);
+		for (s16 z = -32; z <= 32; z++)
+		for (s16 y = -32; y <= 32; y++)
+		for (s16 x = -32; x <= 32; x++) {
+			bool light = x % 8 == 0 && y % 8 == 0 && z % 8 == 0;
+			vm.setNodeNoEmerge(v3s16(x, y, z),
+				MapNode(light ? content_light : CONTENT_AIR));
+		}
+		voxalgo::blit_back_with_light(&map, &vm, &modified_blocks);
+	}
+
+	// Like WorldEdit filling a 32^3 cuboid and clearing it again
+	BENCHMARK_ADVANCED("worldedit_fill_32")(Catch::Benchmark::Chronometer meter) {
+		std::map<v3s16, MapBlock*> modified_blocks;
+		MMVManip vm(&map);
+		vm.initialEmerge(v3s16(-1, -1, -1), v3s16(0, 0, 0), false);
+		auto fill = [&] (bool solid) {
+			for (s16 z = -16; z <= 15; z++)
+			for (s16 y = -16; y <= 15; y++)
+			for (s16 x = -16; x <= 15; x++) {
+				bool light = x % 8 == 0 && y % 8 == 0 && z % 8 == 0;
+				content_t c = solid ? content_wall :
+					light ? content_light : CONTENT_AIR;
+				vm.setNodeNoEmerge(v3s16(x, y, z), MapNode(c));
+			}
+			voxalgo::blit_back_with_light(&map, &vm, &modified_blocks);
+		};
+		meter.measure([&] {
+			fill(true);
+			fill(false);
+		});
+	};
+
+	// Like an explosion blowing a sphere of radius 8 into a wall of the
+	// cave, and the hole being filled again
+	std::vector<v3s16> sphere;
+	v3s16 center(36, 0, 0);
+	for (s16 z = -8; z <= 8; z++)
+	for (s16 y = -8; y <= 8; y++)
+	for (s16 x = -8; x <= 8; x++) {
+		if (x * x + y * y + z * z <= 64)
+			sphere.push_back(center + v3s16(x, y, z));
+	}
+
+	BENCHMARK_ADVANCED("explosion_r8")(Catch::Benchmark::Chronometer meter) {
+		std::map<v3s16, MapBlock*> modified_blocks;
+		std::vector<std::pair<v3s16, MapNode>> oldnodes;
+		oldnodes.reserve(sphere.size());
+		auto replace = [&] (MapNode n) {
+			oldnodes.clear();
+			for (v3s16 p : sphere) {
+				oldnodes.emplace_back(p, map.getNode(p));
+				map.setNode(p, n);
+			}
+			voxalgo::update_lighting_nodes(&map, oldnodes, modified_blocks);
+		};
+		meter.measure([&] {
+			replace(MapNode(CONTENT_AIR));
+			replace(MapNode(content_wall));
+		});
+	};
+}
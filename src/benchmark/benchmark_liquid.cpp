@@ -0,0 +1,159 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <iostream>
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "porting.h"
+#include "server/liquidqueue.h"
+
+namespace {
+
+// Terraces falling towards +X, with a reservoir of water on the highest one
+// whose dam just broke
+void buildFlood(DummyMap &map, v3s16 bpmin, v3s16 bpmax,
+		content_t c_stone, content_t c_water, LiquidQueue &queue)
+{
+	const s16 xmin = bpmin.X * MAP_BLOCKSIZE;
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(x, y, z));
+		const v3s16 pmin = block->getPosRelative();
+		for (s16 k = 0; k < MAP_BLOCKSIZE; k++)
+		for (s16 j = 0; j < MAP_BLOCKSIZE; j++)
+		for (s16 i = 0; i < MAP_BLOCKSIZE; i++) {
+			const v3s16 p = pmin + v3s16(i, j, k);
+			const s16 floor = 12 - (p.X - xmin) / 24;
+			content_t c = CONTENT_AIR;
+			if (p.Y < floor)
+				c = c_stone;
+			else if (p.X < xmin + 16)
+				c = c_water;
+			block->setNodeNoCheck(i, j, k, MapNode(c));
+			if (c == c_water && p.X == xmin + 15)
+				queue.push(p);
+		}
+	}
+}
+
+struct FloodResult
+{
+	u32 steps = 0;
+	u64 nodes = 0;
+	u64 time_us = 0;
+};
+
+FloodResult runFlood(DummyMap &map, LiquidQueue &queue)
+{
+	FloodResult flood;
+	const u64 t0 = porting::getTimeUs();
+	while (queue.size() > 0 && flood.steps < 1000) {
+		LiquidTransformResult result;
+		queue.transform(&map, 100000, 10000, false, result);
+		flood.nodes += result.stats.nodes_processed;
+		flood.steps++;
+	}
+	flood.time_us = porting::getTimeUs() - t0;
+	return flood;
+}
+
+std::vector<MapNode> getNodes(DummyMap &map, v3s16 bpmin, v3s16 bpmax)
+{
+	std::vector<MapNode> nodes;
+	v3s16 p;
+	for (p.Z = bpmin.Z * MAP_BLOCKSIZE; p.Z < (bpmax.Z + 1) * MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = bpmin.Y * MAP_BLOCKSIZE; p.Y < (bpmax.Y + 1) * MAP_BLOCKSIZE; p.Y++)
+	for (p.X = bpmin.X * MAP_BLOCKSIZE; p.X < (bpmax.X + 1) * MAP_BLOCKSIZE; p.X++)
+		nodes.push_back(map.getNode(p));
+	return nodes;
+}
+
+bool sameNodes(const std::vector<MapNode> &a, const std::vector<MapNode> &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].getContent() != b[i].getContent() || a[i].param2 != b[i].param2)
+			return false;
+	}
+	return true;
+}
+
+}
+
+TEST_CASE("benchmark_liquid")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	content_t c_stone, c_water;
+	{
+		ContentFeatures f;
+		f.name = "stone";
+		c_stone = ndef->set(f.name, f);
+
+		f = ContentFeatures();
+		f.name = "water_source";
+		f.liquid_type = LIQUID_SOURCE;
+		f.liquid_alternative_flowing = "water_flowing";
+		f.liquid_alternative_source = "water_source";
+		f.liquid_viscosity = 1;
+		c_water = ndef->set(f.name, f);
+
+		f.name = "water_flowing";
+		f.liquid_type = LIQUID_FLOWING;
+		ndef->set(f.name, f);
+		ndef->resolveCrossrefs();
+	}
+
+	v3s16 bpmin(-8, -1, -8), bpmax(7, 0, 7);
+	DummyMap map(&gamedef, bpmin, bpmax);
+
+	// The flood ends the same with any number of threads
+	std::vector<MapNode> expected;
+	for (u32 threads : {1, 2, 4}) {
+		LiquidQueue queue(ndef, threads, 5);
+		buildFlood(map, bpmin, bpmax, c_stone, c_water, queue);
+		FloodResult flood = runFlood(map, queue);
+		std::cout << "Liquid flood with " << queue.getThreadCount() << " threads: "
+			<< flood.nodes << " nodes in " << flood.steps << " steps, "
+			<< flood.nodes * 1000000 / MYMAX(flood.time_us, (u64)1)
+			<< " nodes/s" << std::endl;
+
+		std::vector<MapNode> nodes = getNodes(map, bpmin, bpmax);
+		if (expected.empty())
+			expected = std::move(nodes);
+		else
+			REQUIRE(sameNodes(nodes, expected));
+
+		// Includes rebuilding the terrain, which is small in comparison
+		BENCHMARK_ADVANCED("flood_" + std::to_string(threads) + "threads")(
+				Catch::Benchmark::Chronometer meter) {
+			meter.measure([&] {
+				buildFlood(map, bpmin, bpmax, c_stone, c_water, queue);
+				return runFlood(map, queue).nodes;
+			});
+		};
+	}
+}
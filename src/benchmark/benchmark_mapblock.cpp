@@ -20,6 +20,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "benchmark_setup.h"
 #include "mapblock.h"
 #include <vector>
+#ifndef SERVER
+#include <iostream>
+#include "dummygamedef.h"
+#include "settings.h"
+#include "client/content_mapblock.h"
+#include "client/mapblock_mesh.h"
+#include "client/meshgen/collector.h"
+#endif
 
 typedef std::vector<MapBlock*> MBContainer;
 
@@ -190,3 +198,97 @@ TEST_CASE("benchmark_mapblock") {
 	BENCH1(2200)
 	BENCH1(7500) // <- default client_mapblock_limit
 }
+
+#ifndef SERVER
+
+static content_t addSolidNode(NodeDefManager *ndef, const std::string &name, u32 texture)
+{
+	ContentFeatures f;
+	f.name = name;
+	f.drawtype = NDT_NORMAL;
+	f.solidness = 2;
+	for (TileSpec &tile : f.tiles)
+		tile.layers[0].texture_id = texture;
+	return ndef->set(f.name, f);
+}
+
+// Rolling terrain through the block and its neighbors: stone with a dirt
+// layer on top, sunlit air above and a few cave pockets.
+static void fillTerrain(MeshMakeData &data, content_t stone, content_t dirt)
+{
+	data.fillBlockDataBegin(v3s16(0, 0, 0));
+	v3s16 p;
+	for (p.Z = -MAP_BLOCKSIZE; p.Z < 2 * MAP_BLOCKSIZE; p.Z++)
+	for (p.X = -MAP_BLOCKSIZE; p.X < 2 * MAP_BLOCKSIZE; p.X++) {
+		s16 height = 8 + (p.X * 7 + p.Z * 3) % 5 - (p.Z / 6) % 3;
+		for (p.Y = -MAP_BLOCKSIZE; p.Y < 2 * MAP_BLOCKSIZE; p.Y++) {
+			bool cave = ((p.X / 3 + p.Y / 2 + p.Z / 4) % 7) == 0 && p.Y < height - 3;
+			if (p.Y > height || cave)
+				data.m_vmanip.setNode(p, MapNode(CONTENT_AIR, p.Y > height ? LIGHT_SUN : 0));
+			else
+				data.m_vmanip.setNode(p, MapNode(p.Y == height ? dirt : stone));
+		}
+	}
+}
+
+static void generateMesh(MeshMakeData &data, MeshCollector &collector, bool greedy)
+{
+	g_settings->setBool("enable_greedy_meshing", greedy);
+	MapblockMeshGenerator(&data, &collector, nullptr).generate();
+}
+
+static void reportMeshSize(const char *name, MeshMakeData &data, bool greedy)
+{
+	MeshCollector collector({});
+	generateMesh(data, collector, greedy);
+	size_t vertices = 0, triangles = 0;
+	for (auto &buffers : collector.prebuffers)
+	for (auto &buffer : buffers) {
+		vertices += buffer.vertices.size();
+		triangles += buffer.indices.size() / 3;
+	}
+	std::cout << name << ": " << vertices << " vertices, "
+			<< triangles << " triangles" << std::endl;
+}
+
+#define BENCH_MESH(_name, _smooth) \
+	BENCHMARK_ADVANCED("meshgen_" _name "_per_node")(Catch::Benchmark::Chronometer meter) { \
+		data.setSmoothLighting(_smooth); \
+		meter.measure([&] { \
+			MeshCollector collector({}); \
+			generateMesh(data, collector, false); \
+			return collector.m_bounding_radius_sq; \
+		}); \
+	}; \
+	BENCHMARK_ADVANCED("meshgen_" _name "_greedy")(Catch::Benchmark::Chronometer meter) { \
+		data.setSmoothLighting(_smooth); \
+		meter.measure([&] { \
+			MeshCollector collector({}); \
+			generateMesh(data, collector, true); \
+			return collector.m_bounding_radius_sq; \
+		}); \
+	};
+
+TEST_CASE("benchmark_mapblock_mesh") {
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+	content_t stone = addSolidNode(ndef, "stone", 1);
+	content_t dirt = addSolidNode(ndef, "dirt", 2);
+
+	MeshMakeData data(ndef, MAP_BLOCKSIZE, true);
+	fillTerrain(data, stone, dirt);
+
+	const bool greedy = g_settings->getBool("enable_greedy_meshing");
+	for (bool smooth : {false, true}) {
+		data.setSmoothLighting(smooth);
+		reportMeshSize(smooth ? "smooth, per node" : "flat, per node", data, false);
+		reportMeshSize(smooth ? "smooth, greedy" : "flat, greedy", data, true);
+	}
+
+	BENCH_MESH("flat", false)
+	BENCH_MESH("smooth", true)
+
+	g_settings->setBool("enable_greedy_meshing", greedy);
+}
+
+#endif
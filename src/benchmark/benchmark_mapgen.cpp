@@ -0,0 +1,185 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include "mapgen/mapgen_carpathian.h"
+#include "mapgen/mapgen_v7.h"
+#include "mapgen/mapgen_valleys.h"
+#include "noise.h"
+#include "porting.h"
+#include "util/thread.h"
+
+// A lone explorer waits for one mapchunk at a time, so its emerge latency is
+// the time to generate a single mapchunk. Most of that time goes into the
+// noise maps, which are computed here the way the mapgens do it.
+
+namespace {
+
+const s16 CHUNK_SIZE = 80;
+
+// Noises a mapgen calculates for one mapchunk with caves and caverns enabled
+struct ChunkNoises
+{
+	std::vector<std::unique_ptr<Noise>> maps_2d;
+	std::vector<std::unique_ptr<Noise>> maps_3d;
+
+	void add2D(const NoiseParams &np, s32 seed)
+	{
+		maps_2d.emplace_back(new Noise(&np, seed, CHUNK_SIZE, CHUNK_SIZE));
+	}
+
+	// Terrain noises have 1 up, 1 down overgeneration, cave noises 1 down
+	void add3D(const NoiseParams &np, s32 seed, s16 overgeneration)
+	{
+		maps_3d.emplace_back(new Noise(&np, seed, CHUNK_SIZE,
+			CHUNK_SIZE + overgeneration, CHUNK_SIZE));
+	}
+
+	void setParallelRunner(ParallelRunner *runner)
+	{
+		for (auto &noise : maps_3d)
+			noise->setParallelRunner(runner);
+	}
+
+	void calculate(ParallelRunner &runner, v3s16 node_min)
+	{
+		runner.run(maps_2d.size(), [&] (u32 begin, u32 end) {
+			for (u32 i = begin; i < end; i++)
+				maps_2d[i]->perlinMap2D(node_min.X, node_min.Z);
+		});
+		for (auto &noise : maps_3d)
+			noise->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+	}
+
+	bool operator==(const ChunkNoises &other) const
+	{
+		auto equal = [] (const Noise &a, const Noise &b) {
+			return !memcmp(a.result, b.result,
+				sizeof(float) * a.sx * a.sy * a.sz);
+		};
+		for (size_t i = 0; i < maps_2d.size(); i++)
+			if (!equal(*maps_2d[i], *other.maps_2d[i]))
+				return false;
+		for (size_t i = 0; i < maps_3d.size(); i++)
+			if (!equal(*maps_3d[i], *other.maps_3d[i]))
+				return false;
+		return true;
+	}
+};
+
+void makeNoisesV7(ChunkNoises &noises, s32 seed)
+{
+	MapgenV7Params p;
+	for (const NoiseParams *np : {&p.np_terrain_base, &p.np_terrain_alt,
+			&p.np_terrain_persist, &p.np_height_select, &p.np_filler_depth,
+			&p.np_mount_height, &p.np_ridge_uwater})
+		noises.add2D(*np, seed);
+	noises.add3D(p.np_mountain, seed, 2);
+	noises.add3D(p.np_ridge, seed, 2);
+	noises.add3D(p.np_cave1, seed, 1);
+	noises.add3D(p.np_cave2, seed, 1);
+	noises.add3D(p.np_cavern, seed, 1);
+}
+
+void makeNoisesValleys(ChunkNoises &noises, s32 seed)
+{
+	MapgenValleysParams p;
+	for (const NoiseParams *np : {&p.np_inter_valley_slope, &p.np_rivers,
+			&p.np_terrain_height, &p.np_valley_depth, &p.np_valley_profile,
+			&p.np_filler_depth})
+		noises.add2D(*np, seed);
+	noises.add3D(p.np_inter_valley_fill, seed, 2);
+	noises.add3D(p.np_cave1, seed, 1);
+	noises.add3D(p.np_cave2, seed, 1);
+	noises.add3D(p.np_cavern, seed, 1);
+}
+
+void makeNoisesCarpathian(ChunkNoises &noises, s32 seed)
+{
+	MapgenCarpathianParams p;
+	for (const NoiseParams *np : {&p.np_height1, &p.np_height2, &p.np_height3,
+			&p.np_height4, &p.np_hills_terrain, &p.np_ridge_terrain,
+			&p.np_step_terrain, &p.np_hills, &p.np_ridge_mnt, &p.np_step_mnt,
+			&p.np_rivers, &p.np_filler_depth})
+		noises.add2D(*np, seed);
+	noises.add3D(p.np_mnt_var, seed, 2);
+	noises.add3D(p.np_cave1, seed, 1);
+	noises.add3D(p.np_cave2, seed, 1);
+	noises.add3D(p.np_cavern, seed, 1);
+}
+
+// Mapchunks along the path of an explorer walking towards +X
+v3s16 getChunkMin(u32 i)
+{
+	return v3s16(-32 + (s16)(i % 16) * CHUNK_SIZE, -32, -32);
+}
+
+void benchmarkMapgen(const std::string &name,
+		void (*make_noises)(ChunkNoises &, s32))
+{
+	const s32 seed = 1234;
+	const u32 thread_counts[] = {1, 2, 4};
+	const u32 num_chunks = 4;
+
+	ChunkNoises reference;
+	make_noises(reference, seed);
+	ParallelRunner serial("Bench", 1);
+
+	for (u32 num_threads : thread_counts) {
+		ParallelRunner runner("Bench", num_threads);
+		ChunkNoises noises;
+		make_noises(noises, seed);
+		noises.setParallelRunner(&runner);
+
+		// The map must not depend on the number of threads
+		u64 time_us = 0;
+		for (u32 i = 0; i < num_chunks; i++) {
+			reference.calculate(serial, getChunkMin(i));
+			const u64 t0 = porting::getTimeUs();
+			noises.calculate(runner, getChunkMin(i));
+			time_us += porting::getTimeUs() - t0;
+			REQUIRE(noises == reference);
+		}
+		std::cout << "Mapgen " << name << " noise with " << num_threads
+			<< " threads: " << time_us / num_chunks / 1000.0
+			<< " ms per mapchunk" << std::endl;
+
+		u32 chunk = 0;
+		BENCHMARK_ADVANCED(name + "_chunk_" + std::to_string(num_threads) +
+				"threads")(Catch::Benchmark::Chronometer meter) {
+			meter.measure([&] {
+				noises.calculate(runner, getChunkMin(chunk++));
+				return noises.maps_3d.back()->result[0];
+			});
+		};
+	}
+}
+
+}
+
+TEST_CASE("benchmark_mapgen")
+{
+	benchmarkMapgen("v7", makeNoisesV7);
+	benchmarkMapgen("valleys", makeNoisesValleys);
+	benchmarkMapgen("carpathian", makeNoisesCarpathian);
+}
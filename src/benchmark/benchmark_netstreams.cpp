@@ -0,0 +1,144 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include "network/connection.h"
+#include "network/networkpacket.h"
+#include "network/networkprotocol.h"
+#include "noise.h"
+#include "porting.h"
+
+namespace {
+
+struct Handler : public con::PeerHandler
+{
+	void peerAdded(con::Peer *peer) override
+	{
+		last_id = peer->id;
+		count++;
+	}
+	void deletingPeer(con::Peer *peer, bool timeout) override
+	{
+		count--;
+	}
+
+	std::atomic<s32> count{0};
+	std::atomic<session_t> last_id{0};
+};
+
+struct Latency
+{
+	u64 avg_us = 0;
+	u64 max_us = 0;
+	// Until the client has all of the bulk data
+	u64 bulk_ms = 0;
+};
+
+/*
+	Queues `bulk_count` active object messages of about `bulk_size` bytes
+	from a server to a client over loopback and a chat message after every
+	`interval` of them, on their own stream or on the stream of the bulk
+	data, then measures how long the chat messages take to arrive.
+*/
+bool measure(u16 port, bool own_stream, u32 bulk_count, u32 bulk_size,
+	u32 interval, Latency &latency)
+{
+	const u32 proto_id = 0x4d54434c;
+	Handler hand_server, hand_client;
+	con::Connection server(proto_id, 512, 30.0f, false, &hand_server);
+	server.Serve(Address(0, 0, 0, 0, port));
+	con::Connection client(proto_id, 512, 30.0f, false, &hand_client);
+	client.Connect(Address(127, 0, 0, 1, port));
+
+	u64 t0 = porting::getTimeMs();
+	while (!client.Connected() || hand_server.count == 0) {
+		if (porting::getTimeMs() - t0 > 10000)
+			return false;
+		NetworkPacket pkt;
+		client.TryReceive(&pkt);
+		server.TryReceive(&pkt);
+		sleep_ms(10);
+	}
+
+	const u8 chat_stream = own_stream ? NETSTREAM_CHAT : NETSTREAM_DEFAULT;
+	const u32 chat_count = bulk_count / interval;
+	PcgRandom pr(bulk_count);
+	t0 = porting::getTimeMs();
+	for (u32 i = 0; i < bulk_count; i++) {
+		NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_MESSAGES, bulk_size);
+		for (u32 j = 0; j < bulk_size / 4; j++)
+			pkt << (u32)pr.next();
+		server.Send(hand_server.last_id, 0, &pkt, true, NETSTREAM_DEFAULT);
+
+		if ((i + 1) % interval == 0) {
+			NetworkPacket chat(TOCLIENT_CHAT_MESSAGE, 8);
+			chat << (u64)porting::getTimeUs();
+			server.Send(hand_server.last_id, 0, &chat, true, chat_stream);
+		}
+	}
+
+	u32 bulk_received = 0, chat_received = 0;
+	u64 total_us = 0;
+	while (bulk_received < bulk_count || chat_received < chat_count) {
+		if (porting::getTimeMs() - t0 > 60000)
+			return false;
+		NetworkPacket pkt;
+		if (!client.TryReceive(&pkt)) {
+			sleep_ms(1);
+			continue;
+		}
+
+		if (pkt.getCommand() == TOCLIENT_CHAT_MESSAGE) {
+			u64 sent;
+			pkt >> sent;
+			u64 time_us = porting::getTimeUs() - sent;
+			total_us += time_us;
+			latency.max_us = std::max(latency.max_us, time_us);
+			chat_received++;
+		} else if (++bulk_received == bulk_count) {
+			latency.bulk_ms = porting::getTimeMs() - t0;
+		}
+	}
+	latency.avg_us = total_us / std::max(chat_count, 1U);
+	return true;
+}
+
+}
+
+TEST_CASE("benchmark_netstreams")
+{
+	const u32 bulk_count = 4000, bulk_size = 1200, interval = 100;
+
+	std::cout << "Latency of chat messages queued after every " << interval
+		<< " of " << bulk_count << " active object messages of " << bulk_size
+		<< " bytes" << std::endl;
+	u16 port = 30012;
+	for (bool own_stream : {false, true}) {
+		Latency latency;
+		REQUIRE(measure(port++, own_stream, bulk_count, bulk_size, interval, latency));
+		std::cout << "  " << (own_stream ? "own stream" : "shared stream")
+			<< ": avg " << latency.avg_us / 1000.0f << " ms, max "
+			<< latency.max_us / 1000.0f << " ms, bulk data done after "
+			<< latency.bulk_ms << " ms" << std::endl;
+	}
+}
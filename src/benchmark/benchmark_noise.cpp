@@ -0,0 +1,126 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "mapgen/mapgen_carpathian.h"
+#include "mapgen/mapgen_v5.h"
+#include "mapgen/mapgen_v7.h"
+#include "mapgen/mapgen_valleys.h"
+#include "noise.h"
+#include "noise_kernels.h"
+#include "porting.h"
+
+// Throughput of the noise map kernels for the noises of the common mapgens,
+// in million map points per second, over a mapchunk sized map.
+
+namespace {
+
+const u32 CHUNK_SIZE = 80;
+
+struct NoiseCase
+{
+	std::string name;
+	NoiseParams np;
+	bool is3d;
+	bool persistence;
+};
+
+std::vector<NoiseCase> getNoiseCases()
+{
+	MapgenV5Params v5;
+	MapgenV7Params v7;
+	MapgenValleysParams valleys;
+	MapgenCarpathianParams carpathian;
+	return {
+		{"v7_terrain_base", v7.np_terrain_base, false, true},
+		{"v7_filler_depth", v7.np_filler_depth, false, false},
+		{"carpathian_height1", carpathian.np_height1, false, false},
+		{"v7_mountain", v7.np_mountain, true, false},
+		{"v7_ridge", v7.np_ridge, true, false},
+		{"v7_cave1", v7.np_cave1, true, false},
+		{"v7_cavern", v7.np_cavern, true, false},
+		{"valleys_inter_valley_fill", valleys.np_inter_valley_fill, true, false},
+		{"carpathian_mnt_var", carpathian.np_mnt_var, true, false},
+		// Eased 3D noise
+		{"v5_ground", v5.np_ground, true, false},
+	};
+}
+
+// Computes the map at the i-th mapchunk along +X
+float *calculate(Noise &noise, const NoiseCase &c, u32 i,
+		std::vector<float> &persistence)
+{
+	const float x = -32 + (float)(i % 16) * CHUNK_SIZE;
+	if (c.is3d)
+		return noise.perlinMap3D(x, -33, -32);
+	return noise.perlinMap2D(x, -32, c.persistence ? persistence.data() : nullptr);
+}
+
+void benchmarkNoise(const NoiseCase &c)
+{
+	const s32 seed = 1234;
+	const u32 sy = c.is3d ? CHUNK_SIZE + 2 : CHUNK_SIZE;
+	const u32 sz = c.is3d ? CHUNK_SIZE : 1;
+	const size_t points = (size_t)CHUNK_SIZE * sy * sz;
+	const u32 num_chunks = 8;
+
+	std::vector<float> persistence(points, 0.6f);
+	const NoiseKernels *plain = getSupportedNoiseKernels().front();
+	Noise reference(&c.np, seed, CHUNK_SIZE, sy, sz);
+	reference.setKernels(plain);
+
+	for (const NoiseKernels *kernels : getSupportedNoiseKernels()) {
+		Noise noise(&c.np, seed, CHUNK_SIZE, sy, sz);
+		noise.setKernels(kernels);
+
+		// All kernels must give the same map
+		u64 time_us = 0;
+		for (u32 i = 0; i < num_chunks; i++) {
+			calculate(reference, c, i, persistence);
+			const u64 t0 = porting::getTimeUs();
+			calculate(noise, c, i, persistence);
+			time_us += porting::getTimeUs() - t0;
+			REQUIRE(!memcmp(noise.result, reference.result, sizeof(float) * points));
+		}
+		std::cout << "Noise " << c.name << " with " << kernels->name
+			<< " kernels: " << (double)points * num_chunks / std::max<u64>(time_us, 1)
+			<< " Msamples/s" << std::endl;
+
+		u32 chunk = 0;
+		BENCHMARK_ADVANCED(c.name + "_" + kernels->name)(
+				Catch::Benchmark::Chronometer meter) {
+			meter.measure([&] {
+				return calculate(noise, c, chunk++, persistence)[0];
+			});
+		};
+	}
+}
+
+}
+
+TEST_CASE("benchmark_noise")
+{
+	for (const NoiseCase &c : getNoiseCases())
+		benchmarkNoise(c);
+}
@@ -0,0 +1,204 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <deque>
+#include <iostream>
+#include "network/connection.h"
+#include "network/objectsnapshot.h"
+#include "noise.h"
+#include "server/unit_sao.h"
+
+namespace {
+
+// Datagram headers of one unreliable packet, including the command
+constexpr u32 PACKET_OVERHEAD = BASE_HEADER_SIZE + ORIGINAL_HEADER_SIZE + 2;
+constexpr float STEP = 0.09f;
+
+struct Mob
+{
+	v3f position;
+	v3f velocity;
+	float yaw = 0.0f;
+	float think_timer = 0.0f;
+	bool was_moving = false;
+};
+
+struct TrafficResult
+{
+	u64 legacy_bytes = 0;
+	u64 snapshot_bytes = 0;
+	u64 states = 0;
+	float seconds = 0.0f;
+};
+
+/*
+	Mobs wander around a player, starting and stopping every few seconds.
+	Moving mobs send their position every server step, like
+	LuaEntitySAO::sendPosition does for changing velocities.
+	Snapshots and acknowledgements are lost at `loss` and the
+	acknowledgements arrive `ack_delay` steps late.
+*/
+TrafficResult simulate(u32 mob_count, u32 steps, float loss, u32 ack_delay)
+{
+	PcgRandom pr(mob_count + steps);
+	std::vector<Mob> mobs(mob_count);
+	for (Mob &mob : mobs) {
+		mob.position = v3f(pr.range(-400, 400), pr.range(-20, 20), pr.range(-400, 400)) * BS;
+		mob.think_timer = pr.range(0, 3000) / 1000.0f;
+	}
+
+	ObjectSnapshotEncoder encoder;
+	ObjectSnapshotDecoder decoder;
+	std::deque<std::pair<u32, u16>> acks;
+	std::vector<std::pair<u16, ObjectState>> updates;
+	std::vector<ObjectState> sent(mob_count), received(mob_count);
+	auto lost = [&] { return pr.range(0, 9999) < loss * 10000; };
+
+	TrafficResult result;
+	std::string data;
+	for (u32 n = 0; n < steps; n++) {
+		u32 legacy_size = 0;
+		for (u16 id = 0; id < mob_count; id++) {
+			Mob &mob = mobs[id];
+			mob.think_timer -= STEP;
+			if (mob.think_timer <= 0.0f) {
+				mob.think_timer = pr.range(1000, 4000) / 1000.0f;
+				mob.velocity = v3f();
+				if (pr.range(0, 9) < 6) {
+					float yaw = pr.range(0, 359) * core::DEGTORAD;
+					float speed = pr.range(10, 40) / 10.0f * BS;
+					mob.velocity = v3f(std::sin(yaw) * speed, 0, std::cos(yaw) * speed);
+					mob.yaw = yaw * core::RADTODEG;
+				}
+			}
+			mob.position += mob.velocity * STEP;
+
+			bool moving = mob.velocity != v3f();
+			if (!moving && !mob.was_moving)
+				continue;
+			mob.was_moving = moving;
+
+			std::string cmd = UnitSAO::generateUpdatePositionCommand(mob.position,
+				mob.velocity, v3f(0.0f, -9.81f * BS, 0.0f), v3f(0.0f, mob.yaw, 0.0f),
+				true, !moving, STEP);
+			legacy_size += 2 + 2 + cmd.size();
+
+			ObjectState state;
+			state.fromPositionCommand(cmd);
+			encoder.add(id, state);
+			sent[id] = state;
+			result.states++;
+		}
+		if (legacy_size > 0)
+			result.legacy_bytes += legacy_size + PACKET_OVERHEAD;
+
+		while (!acks.empty() && acks.front().first <= n) {
+			if (!lost())
+				encoder.acknowledge(acks.front().second);
+			acks.pop_front();
+		}
+
+		if (encoder.empty())
+			continue;
+		data.clear();
+		encoder.write(data);
+		result.snapshot_bytes += data.size() + PACKET_OVERHEAD;
+		if (lost())
+			continue;
+
+		updates.clear();
+		u16 seq = decoder.read((const u8 *)data.data(), data.size(), updates);
+		for (const auto &it : updates)
+			received[it.first] = it.second;
+		acks.emplace_back(n + ack_delay, seq);
+		// Count the acknowledgement too
+		result.snapshot_bytes += PACKET_OVERHEAD + 2;
+	}
+
+	// The last snapshot gets through
+	for (u16 id = 0; id < mob_count; id++)
+		encoder.add(id, sent[id]);
+	data.clear();
+	encoder.write(data);
+	updates.clear();
+	decoder.read((const u8 *)data.data(), data.size(), updates);
+	for (const auto &it : updates)
+		received[it.first] = it.second;
+	for (u16 id = 0; id < mob_count; id++)
+		REQUIRE(received[id] == sent[id]);
+
+	result.seconds = steps * STEP;
+	return result;
+}
+
+void printTraffic(const char *label, u32 mob_count, const TrafficResult &result)
+{
+	const float per_object = mob_count * result.seconds;
+	std::cout << label << ": " << result.states << " states, legacy "
+		<< (u32)(result.legacy_bytes / per_object) << " B/object/s, snapshots "
+		<< (u32)(result.snapshot_bytes / per_object) << " B/object/s ("
+		<< (float)result.snapshot_bytes / result.states << " B/state)" << std::endl;
+}
+
+void encodeSteps(u32 mob_count, u32 steps)
+{
+	ObjectSnapshotEncoder encoder;
+	ObjectSnapshotDecoder decoder;
+	std::vector<std::pair<u16, ObjectState>> updates;
+	ObjectState state;
+	state.update_interval = 90;
+	std::string data;
+	for (u32 n = 0; n < steps; n++) {
+		for (u16 id = 0; id < mob_count; id++) {
+			state.position = v3s32(id * 100 + n * 7, 640, id * 50 + n * 3);
+			state.velocity = v3s32(466, 0, 200);
+			encoder.add(id, state);
+		}
+		data.clear();
+		encoder.write(data);
+		updates.clear();
+		encoder.acknowledge(decoder.read((const u8 *)data.data(), data.size(), updates));
+	}
+}
+
+}
+
+TEST_CASE("benchmark_objectsnapshot")
+{
+	struct {
+		const char *label;
+		float loss;
+		u32 ack_delay;
+	} profiles[] = {
+		{"lan", 0.0f, 1},
+		{"internet", 0.02f, 3},
+		{"mobile", 0.1f, 6},
+	};
+	for (const auto &profile : profiles) {
+		TrafficResult result = simulate(200, 2000, profile.loss, profile.ack_delay);
+		printTraffic(profile.label, 200, result);
+		REQUIRE(result.snapshot_bytes * 2 < result.legacy_bytes);
+	}
+
+	BENCHMARK_ADVANCED("snapshot_200_objects")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] { encodeSteps(200, 10); });
+	};
+}
@@ -0,0 +1,190 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <cmath>
+#include <iostream>
+#include "client/occlusion_buffer.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "mapblock.h"
+
+namespace {
+
+struct CameraPose
+{
+	v3f position;
+	v3f direction;
+};
+
+// A grid of solid city blocks separated by one mapblock wide streets
+void buildCity(DummyMap &map, v3s16 bpmin, v3s16 bpmax, content_t c_wall)
+{
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		bool street = x % 3 == 0 || z % 3 == 0;
+		s16 height = 1 + ((x * 7 + z * 13) & 1);
+		bool solid = y < 0 || (!street && y < height);
+
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(x, y, z));
+		MapNode n(solid ? c_wall : CONTENT_AIR);
+		for (s16 k = 0; k < MAP_BLOCKSIZE; k++)
+		for (s16 j = 0; j < MAP_BLOCKSIZE; j++)
+		for (s16 i = 0; i < MAP_BLOCKSIZE; i++)
+			block->setNodeNoCheck(i, j, k, n);
+		block->solid_sides = solid ? 0x3f : 0;
+	}
+}
+
+aabb3f getBlockBox(v3s16 bp)
+{
+	v3f pmin = intToFloat(bp * MAP_BLOCKSIZE, BS) - v3f(BS / 2);
+	return aabb3f(pmin, pmin + v3f(MAP_BLOCKSIZE * BS));
+}
+
+// Blocks roughly in front of the camera, excluding the camera's own block
+void getVisibleCandidates(const CameraPose &pose, v3s16 bpmin, v3s16 bpmax,
+		std::vector<v3s16> &out)
+{
+	out.clear();
+	v3s16 cam_block = getNodeBlockPos(floatToInt(pose.position, BS));
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		v3s16 bp(x, y, z);
+		if (bp == cam_block)
+			continue;
+		v3f center = getBlockBox(bp).getCenter();
+		if ((center - pose.position).dotProduct(pose.direction) > 0)
+			out.push_back(bp);
+	}
+}
+
+u32 countRaytraced(DummyMap &map, const CameraPose &pose,
+		const std::vector<v3s16> &candidates)
+{
+	v3s16 cam_pos_nodes = floatToInt(pose.position, BS);
+	u32 culled = 0;
+	for (v3s16 bp : candidates) {
+		if (map.isBlockOccluded(bp * MAP_BLOCKSIZE, cam_pos_nodes))
+			culled++;
+	}
+	return culled;
+}
+
+u32 countOcclusionBuffer(DummyMap &map, OcclusionBuffer &buffer,
+		const CameraPose &pose, v3s16 bpmin, v3s16 bpmax,
+		const std::vector<v3s16> &candidates)
+{
+	OcclusionView view;
+	view.position = pose.position;
+	view.direction = pose.direction;
+	view.extent = std::tan(72.0f * core::DEGTORAD / 2) * std::sqrt(2.0f);
+	buffer.setView(view);
+
+	const f32 range = 64 * BS;
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(x, y, z));
+		if (!block->solid_sides)
+			continue;
+		aabb3f box = getBlockBox(v3s16(x, y, z));
+		if (box.getCenter().getDistanceFrom(pose.position) > range)
+			continue;
+		buffer.addOccluder({box, block->solid_sides});
+	}
+	buffer.buildHierarchy();
+
+	u32 culled = 0;
+	for (v3s16 bp : candidates) {
+		if (buffer.isBoxOccluded(getBlockBox(bp)))
+			culled++;
+	}
+	return culled;
+}
+
+}
+
+TEST_CASE("benchmark_occlusion")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	content_t c_wall;
+	{
+		ContentFeatures f;
+		f.name = "stone";
+		c_wall = ndef->set(f.name, f);
+	}
+
+	v3s16 bpmin(-9, -1, -9), bpmax(8, 2, 8);
+	DummyMap map(&gamedef, bpmin, bpmax);
+	buildCity(map, bpmin, bpmax, c_wall);
+
+	// Walk down a street, looking along it and at the buildings beside it
+	std::vector<CameraPose> path;
+	for (s16 z = -120; z <= 120; z += 16) {
+		v3f pos(0, 2 * BS, z * BS);
+		path.push_back({pos, v3f(0, 0, 1)});
+		path.push_back({pos, v3f(1, 0, 0)});
+		path.push_back({pos, v3f(-0.6f, -0.2f, 0.77f).normalize()});
+	}
+
+	std::vector<std::vector<v3s16>> candidates(path.size());
+	size_t total = 0;
+	for (size_t i = 0; i < path.size(); i++) {
+		getVisibleCandidates(path[i], bpmin, bpmax, candidates[i]);
+		total += candidates[i].size();
+	}
+
+	OcclusionBuffer buffer;
+	{
+		u32 culled_ray = 0, culled_buffer = 0;
+		for (size_t i = 0; i < path.size(); i++) {
+			culled_ray += countRaytraced(map, path[i], candidates[i]);
+			culled_buffer += countOcclusionBuffer(map, buffer, path[i],
+					bpmin, bpmax, candidates[i]);
+		}
+		std::cout << "Occlusion culling over " << path.size() << " views, "
+			<< total << " candidate blocks: raytraced " << culled_ray
+			<< ", occlusion buffer " << culled_buffer << std::endl;
+	}
+
+	BENCHMARK_ADVANCED("raytraced")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] {
+			u32 culled = 0;
+			for (size_t i = 0; i < path.size(); i++)
+				culled += countRaytraced(map, path[i], candidates[i]);
+			return culled;
+		});
+	};
+
+	BENCHMARK_ADVANCED("occlusion_buffer")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] {
+			u32 culled = 0;
+			for (size_t i = 0; i < path.size(); i++)
+				culled += countOcclusionBuffer(map, buffer, path[i],
+						bpmin, bpmax, candidates[i]);
+			return culled;
+		});
+	};
+}
@@ -0,0 +1,147 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include <iostream>
+#include "network/connection.h"
+#include "network/networkpacket.h"
+#include "network/networkprotocol.h"
+#include "noise.h"
+#include "porting.h"
+
+namespace {
+
+// Sizes of the packets a busy server sends, mostly small object and node
+// updates with an occasional map block
+u32 randomPacketSize(PcgRandom &pr)
+{
+	u32 r = pr.range(0, 99);
+	if (r < 50)
+		return pr.range(20, 120); // active object messages
+	if (r < 80)
+		return pr.range(100, 300); // particles, sounds
+	if (r < 97)
+		return pr.range(10, 40); // node changes
+	return pr.range(1000, 8000); // map blocks
+}
+
+void fillPacket(NetworkPacket &pkt, u32 size)
+{
+	for (u32 i = 0; i < size / 4; i++)
+		pkt << i;
+}
+
+struct SoakResult
+{
+	u64 packets = 0;
+	u64 datagrams = 0;
+	u64 time_us = 0;
+};
+
+/*
+	Builds `count` packets and turns them into reliable datagrams, keeping
+	the last `window` datagrams around like the resend buffer does.
+	in_place: use the pooled wire buffer instead of copying per header
+*/
+SoakResult soak(u32 count, u32 window, bool in_place)
+{
+	const u32 max_packet_size = 512;
+	const u32 chunksize_max = max_packet_size - BASE_HEADER_SIZE - RELIABLE_HEADER_SIZE;
+	Address address(127, 0, 0, 1, 30000);
+	PcgRandom pr(42);
+	std::vector<con::BufferedPacketPtr> in_flight(window);
+	u16 seqnum = 0, split_seqnum = 0;
+
+	SoakResult result;
+	u64 t0 = porting::getTimeUs();
+	for (u32 n = 0; n < count; n++) {
+		NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_MESSAGES, 0);
+		fillPacket(pkt, randomPacketSize(pr));
+		result.packets++;
+
+		auto put = [&] (con::BufferedPacketPtr p) {
+			in_flight[result.datagrams++ % window] = std::move(p);
+		};
+
+		if (in_place) {
+			PacketBuffer data = pkt.forgePacket(SEND_HEADROOM);
+			if (data.getSize() + ORIGINAL_HEADER_SIZE <= chunksize_max) {
+				put(con::makeOriginalReliablePacket(address, std::move(data),
+					seqnum++, PROTOCOL_ID, PEER_ID_SERVER, 0));
+				continue;
+			}
+		}
+
+		Buffer<u8> data = pkt.oldForgePacket();
+		std::list<SharedBuffer<u8>> originals;
+		con::makeAutoSplitPacket(data, chunksize_max, split_seqnum, &originals);
+		for (const SharedBuffer<u8> &original : originals) {
+			SharedBuffer<u8> reliable = con::makeReliablePacket(original, seqnum++);
+			put(con::makePacket(address, reliable, PROTOCOL_ID, PEER_ID_SERVER, 0));
+		}
+	}
+	result.time_us = MYMAX(porting::getTimeUs() - t0, 1);
+	return result;
+}
+
+void printPoolStats(const char *label, const SoakResult &result,
+	const std::vector<PacketBufferStats> &before)
+{
+	std::vector<PacketBufferStats> after;
+	PacketBufferPool::get()->getStats(after);
+
+	const double seconds = result.time_us / 1e6;
+	std::cout << label << ": " << result.packets << " packets, "
+		<< result.datagrams << " datagrams in " << result.time_us / 1000
+		<< " ms" << std::endl;
+	for (size_t i = 0; i < after.size(); i++) {
+		u64 allocations = after[i].allocations - before[i].allocations;
+		u64 reuses = after[i].reuses - before[i].reuses;
+		if (allocations + reuses == 0)
+			continue;
+		std::cout << "  size class " << after[i].size << ": "
+			<< (u64)(allocations / seconds) << " allocations/s, "
+			<< (u64)(reuses / seconds) << " reuses/s, "
+			<< after[i].in_use << " in use" << std::endl;
+	}
+}
+
+}
+
+TEST_CASE("benchmark_packetpool")
+{
+	// Warm up the free lists, then measure a longer run
+	soak(10000, 1024, true);
+	for (bool in_place : {false, true}) {
+		std::vector<PacketBufferStats> before;
+		PacketBufferPool::get()->getStats(before);
+		SoakResult result = soak(200000, 1024, in_place);
+		printPoolStats(in_place ? "soak_in_place" : "soak_copy", result, before);
+		REQUIRE(result.datagrams >= result.packets);
+	}
+
+	BENCHMARK_ADVANCED("build_packets_copy")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] { return soak(2000, 256, false).datagrams; });
+	};
+
+	BENCHMARK_ADVANCED("build_packets_in_place")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] { return soak(2000, 256, true).datagrams; });
+	};
+}
@@ -0,0 +1,78 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include "client/particles.h"
+#include "util/numeric.h"
+
+// Headless simulation only: a 60 FPS frame leaves ~16 ms for everything,
+// stepping 100k particles should take a small fraction of that.
+
+static void fillArena(ParticleArena &arena, u32 count)
+{
+	arena.clear();
+	arena.reserve(count);
+	for (u32 i = 0; i < count; i++) {
+		ParticleParameters p;
+		p.pos = v3f(myrand_range(-50.f, 50.f), myrand_range(0.f, 30.f),
+				myrand_range(-50.f, 50.f));
+		p.vel = v3f(myrand_range(-1.f, 1.f), myrand_range(-5.f, -1.f),
+				myrand_range(-1.f, 1.f));
+		p.acc = v3f(0, -9.81f, 0);
+		p.drag = v3f(0.1f);
+		p.expirationtime = 1000.0f;
+		arena.add(p, true);
+	}
+}
+
+TEST_CASE("benchmark_particles")
+{
+	const u32 count = 100000;
+	const f32 dtime = 1.0f / 60;
+	ParticleArena arena;
+	fillArena(arena, count);
+
+	BENCHMARK("integrate_100k", i) {
+		arena.integrate(dtime, 0, count);
+		return arena.getPosition(i % count);
+	};
+
+	BackgroundTask thread("ParticleArena");
+	thread.start();
+
+	BENCHMARK("integrate_100k_2threads", i) {
+		thread.run([&arena, dtime, count] {
+			arena.integrate(dtime, count / 2, count);
+		});
+		arena.integrate(dtime, 0, count / 2);
+		thread.sync();
+		return arena.getPosition(i % count);
+	};
+
+	thread.stop();
+	thread.wait();
+
+	BENCHMARK("add_remove_100k") {
+		fillArena(arena, count);
+		while (arena.size() > 0)
+			arena.swapRemove(0);
+		return arena.size();
+	};
+}
@@ -0,0 +1,143 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "log.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "noise.h"
+#include "pathfinder.h"
+#include "pathfinder_hpa.h"
+#include "porting.h"
+
+namespace {
+
+// Hills from a heightmap, with a few walls that paths have to go around
+void buildTerrain(DummyMap &map, v3s16 bpmin, v3s16 bpmax, content_t c_stone)
+{
+	NoiseParams np(0, 12, v3f(60, 60, 60), 5, 3, 0.5f, 2.0f);
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(x, y, z));
+		const v3s16 base = block->getPosRelative();
+		for (s16 k = 0; k < MAP_BLOCKSIZE; k++)
+		for (s16 i = 0; i < MAP_BLOCKSIZE; i++) {
+			const v3s16 p = base + v3s16(i, 0, k);
+			const s16 height = NoisePerlin2D(&np, p.X, p.Z, 0);
+			const bool wall = p.X % 37 == 0 && (p.Z & 31) > 4;
+			for (s16 j = 0; j < MAP_BLOCKSIZE; j++) {
+				const s16 py = base.Y + j;
+				block->setNodeNoCheck(i, j, k, MapNode(py <= height ||
+					(wall && py <= height + 3) ? c_stone : CONTENT_AIR));
+			}
+		}
+	}
+}
+
+v3s16 getSurface(Map &map, const NodeDefManager *ndef, s16 x, s16 z)
+{
+	for (s16 y = 31; y > -32; y--) {
+		if (!ndef->get(map.getNode(v3s16(x, y, z))).walkable &&
+				ndef->get(map.getNode(v3s16(x, y - 1, z))).walkable)
+			return v3s16(x, y, z);
+	}
+	return v3s16(x, 31, z);
+}
+
+}
+
+TEST_CASE("benchmark_pathfinder")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+	content_t c_stone;
+	{
+		ContentFeatures f;
+		f.name = "stone";
+		c_stone = ndef->set(f.name, f);
+	}
+
+	v3s16 bpmin(-8, -2, -8), bpmax(7, 1, 7);
+	DummyMap map(&gamedef, bpmin, bpmax);
+	buildTerrain(map, bpmin, bpmax, c_stone);
+
+	// Mobs walking to places 20 to 80 nodes away
+	std::vector<std::pair<v3s16, v3s16>> trips;
+	PcgRandom pr(7);
+	while (trips.size() < 1000) {
+		v3s16 pos1 = getSurface(map, ndef, pr.range(-100, 100), pr.range(-100, 100));
+		v3s16 pos2 = getSurface(map, ndef, pos1.X + pr.range(-60, 60),
+			pos1.Z + pr.range(-60, 60));
+		s32 d = std::abs(pos1.X - pos2.X) + std::abs(pos1.Z - pos2.Z);
+		if (d >= 20 && d <= 80)
+			trips.emplace_back(pos1, pos2);
+	}
+
+	auto runPlain = [&] () {
+		size_t waypoints = 0;
+		for (auto &trip : trips)
+			waypoints += get_path(&map, ndef, trip.first, trip.second,
+				16, 1, 2, PA_PLAIN_NP).size();
+		return waypoints;
+	};
+	auto runHierarchical = [&] (PathNavCache &nav) {
+		size_t waypoints = 0;
+		for (auto &trip : trips)
+			waypoints += nav.findPath(trip.first, trip.second, 16, 1, 2).size();
+		return waypoints;
+	};
+
+	{
+		PathNavCache nav(&map, ndef, 1);
+		u64 t0 = porting::getTimeUs();
+		size_t plain = runPlain();
+		u64 t1 = porting::getTimeUs();
+		size_t cold = runHierarchical(nav);
+		u64 t2 = porting::getTimeUs();
+		size_t warm = runHierarchical(nav);
+		u64 t3 = porting::getTimeUs();
+		rawstream << trips.size() << " paths, A*: " << (t1 - t0) / 1000 << " ms, "
+			<< plain << " waypoints; HPA*: " << (t2 - t1) / 1000 << " ms cold, "
+			<< (t3 - t2) / 1000 << " ms warm, " << warm << " waypoints" << std::endl;
+		REQUIRE(cold == warm);
+	}
+
+	BENCHMARK_ADVANCED("find_path_astar")(Catch::Benchmark::Chronometer meter) {
+		meter.measure(runPlain);
+	};
+
+	BENCHMARK_ADVANCED("find_path_hpa_cold")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] {
+			PathNavCache nav(&map, ndef, 1);
+			return runHierarchical(nav);
+		});
+	};
+
+	PathNavCache nav(&map, ndef, 1);
+	runHierarchical(nav);
+	BENCHMARK_ADVANCED("find_path_hpa_warm")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] {
+			return runHierarchical(nav);
+		});
+	};
+}
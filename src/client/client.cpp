@@ -1011,6 +1011,22 @@ void Client::request_media(const std::vector<std::string>& file_requests)
 		<< pkt.getSize() << ")" << std::endl;
 }
 
+void Client::request_media_chunks(const std::vector<std::pair<std::string, u32>> &requests)
+{
+	FATAL_ERROR_IF(requests.size() > 0xFFFF, "Unsupported number of chunk requests");
+
+	NetworkPacket pkt(TOSERVER_MEDIA_CHUNK_REQUEST, 2 + requests.size() * (2 + 20 + 4));
+
+	pkt << (u16)requests.size();
+	for (const auto &request : requests)
+		pkt << request.first << request.second;
+
+	Send(&pkt);
+
+	verbosestream << "Client: Requesting " << requests.size()
+		<< " media chunks" << std::endl;
+}
+
 void Client::initLocalMapSaving(const Address& address,
 	const std::string& hostname,
 	bool is_local_server)
@@ -1132,7 +1148,7 @@ void Client::Send(NetworkPacket* pkt)
 {
 	auto &scf = serverCommandFactoryTable[pkt->getCommand()];
 	FATAL_ERROR_IF(!scf.name, "packet type missing in table");
-	m_con->Send(PEER_ID_SERVER, scf.channel, pkt, scf.reliable);
+	m_con->Send(PEER_ID_SERVER, scf.channel, pkt, scf.reliable, scf.stream);
 }
 
 // Will fill up 12 + 12 + 4 + 4 + 4 + 1 + 1 + 1 bytes
@@ -1601,6 +1617,8 @@ void Client::removeNode(v3s16 p)
 
 	for (const auto& modified_block : modified_blocks) {
 		addUpdateMeshTaskWithEdge(modified_block.first, false, true);
+		if (m_particle_manager)
+			m_particle_manager->invalidateCollisionBlock(modified_block.first);
 	}
 }
 
@@ -1663,6 +1681,8 @@ void Client::addNode(v3s16 p, MapNode n, bool remove_metadata)
 
 	for (const auto& modified_block : modified_blocks) {
 		addUpdateMeshTaskWithEdge(modified_block.first, false, true);
+		if (m_particle_manager)
+			m_particle_manager->invalidateCollisionBlock(modified_block.first);
 	}
 }
 
@@ -33,6 +33,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "client/hud.h"
 #include "tileanimation.h"
 #include "network/address.h"
+#include "network/objectsnapshot.h"
 #include "network/peerhandler.h"
 #include "gameparams.h"
 #include "clientdynamicinfo.h"
@@ -192,10 +193,13 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	void handleCommand_NodemetaChanged(NetworkPacket* pkt);
 	void handleCommand_BlockData(NetworkPacket* pkt);
 	void handleCommand_Inventory(NetworkPacket* pkt);
+	void handleCommand_InventoryDelta(NetworkPacket* pkt);
+	void handleCommand_MediaChunk(NetworkPacket* pkt);
 	void handleCommand_TimeOfDay(NetworkPacket* pkt);
 	void handleCommand_ChatMessage(NetworkPacket* pkt);
 	void handleCommand_ActiveObjectRemoveAdd(NetworkPacket* pkt);
 	void handleCommand_ActiveObjectMessages(NetworkPacket* pkt);
+	void handleCommand_ObjectSnapshot(NetworkPacket* pkt);
 	void handleCommand_Movement(NetworkPacket* pkt);
 	void handleCommand_Fov(NetworkPacket* pkt);
 	void handleCommand_HP(NetworkPacket* pkt);
@@ -427,6 +431,8 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 
 	// Send a request for conventional media transfer
 	void request_media(const std::vector<std::string>& file_requests);
+	// `requests` are pairs of raw SHA1 and offset
+	void request_media_chunks(const std::vector<std::pair<std::string, u32>> &requests);
 
 	LocalClientState getState() { return m_state; }
 
@@ -541,6 +547,8 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	std::unique_ptr<MeshUpdateManager> m_mesh_update_manager;
 	
 	ClientEnvironment m_env;
+	// Decodes TOCLIENT_OBJECT_SNAPSHOT against the states received before
+	ObjectSnapshotDecoder m_object_snapshots;
 	std::unique_ptr<ParticleManager> m_particle_manager;
 	std::unique_ptr<con::Connection> m_con;
 	std::string m_address_name;
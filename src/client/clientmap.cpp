@@ -121,6 +121,12 @@ ClientMap::ClientMap(
 	g_settings->registerChangedCallback("occlusion_culler", on_settings_changed, this);
 	m_enable_raytraced_culling = g_settings->getBool("enable_raytraced_culling");
 	g_settings->registerChangedCallback("enable_raytraced_culling", on_settings_changed, this);
+	m_enable_occlusion_buffer = g_settings->getBool("enable_occlusion_buffer");
+	g_settings->registerChangedCallback("enable_occlusion_buffer", on_settings_changed, this);
+	m_occlusion_buffer_range = g_settings->getU16("occlusion_buffer_range");
+
+	m_occlusion_thread = std::make_unique<OcclusionBufferThread>();
+	m_occlusion_thread->start();
 
 	empty_data.set_used(1000000);
 }
@@ -131,14 +137,20 @@ void ClientMap::onSettingChanged(const std::string& name)
 		m_loops_occlusion_culler = g_settings->get("occlusion_culler") == "loops";
 	if (name == "enable_raytraced_culling")
 		m_enable_raytraced_culling = g_settings->getBool("enable_raytraced_culling");
+	if (name == "enable_occlusion_buffer")
+		m_enable_occlusion_buffer = g_settings->getBool("enable_occlusion_buffer");
 }
 
 ClientMap::~ClientMap()
 {
+	m_occlusion_thread->stop();
+	m_occlusion_thread->wait();
+
 	cache_buffers.clear();
 
 	g_settings->deregisterChangedCallback("occlusion_culler", on_settings_changed, this);
 	g_settings->deregisterChangedCallback("enable_raytraced_culling", on_settings_changed, this);
+	g_settings->deregisterChangedCallback("enable_occlusion_buffer", on_settings_changed, this);
 }
 
 void ClientMap::updateCamera(v3f pos, v3f dir, f32 fov, v3s16 offset, video::SColor light_color)
@@ -312,6 +324,19 @@ void ClientMap::updateDrawList()
 	const v3s16 camera_block = getContainerPos(cam_pos_nodes, MAP_BLOCKSIZE);
 	m_drawlist = std::map<v3s16, MapBlock*, MapBlockComparer>(MapBlockComparer(camera_block));
 
+	// Solid meshes near the camera are rasterized into the occlusion buffer
+	// on a worker thread while the map is traversed below. Blocks beyond
+	// them are tested against it at the end instead of casting rays.
+	const bool use_occlusion_buffer = occlusion_culling_enabled &&
+		m_enable_occlusion_buffer && !m_control.range_all;
+	const f32 occlusion_buffer_range_sq = std::pow(m_occlusion_buffer_range * BS, 2.0f);
+	if (use_occlusion_buffer)
+		startOcclusionBuffer(cam_pos_nodes, mesh_grid);
+	auto use_raytraced_culling = [&] (const v3f &mesh_sphere_center) {
+		return m_enable_raytraced_culling && (!use_occlusion_buffer ||
+			mesh_sphere_center.getDistanceFromSQ(m_camera_position) <= occlusion_buffer_range_sq);
+	};
+
 	auto is_frustum_culled = m_client->getCamera()->getFrustumCuller();
 
 	// Uncomment to debug occluded blocks in the wireframe mode
@@ -390,8 +415,8 @@ void ClientMap::updateDrawList()
 				}
 
 				// Raytraced occlusion culling - send rays from the camera to the block's corners
-				if (!m_control.range_all && occlusion_culling_enabled && m_enable_raytraced_culling &&
-					mesh &&
+				if (!m_control.range_all && occlusion_culling_enabled &&
+					use_raytraced_culling(mesh_sphere_center) && mesh &&
 					isMeshOccluded(block, mesh_grid.cell_size, cam_pos_nodes)) {
 					blocks_occlusion_culled++;
 					continue;
@@ -504,7 +529,7 @@ void ClientMap::updateDrawList()
 			u8 visible_outer_sides = flags & 0x07;
 
 			// Raytraced occlusion culling - send rays from the camera to the block's corners
-			if (occlusion_culling_enabled && m_enable_raytraced_culling &&
+			if (occlusion_culling_enabled && use_raytraced_culling(mesh_sphere_center) &&
 				block && mesh &&
 				visible_outer_sides != 0x07 && isMeshOccluded(block, mesh_grid.cell_size, cam_pos_nodes)) {
 				blocks_occlusion_culled++;
@@ -641,6 +666,22 @@ void ClientMap::updateDrawList()
 		}
 	}
 
+	if (use_occlusion_buffer) {
+		const OcclusionBuffer &buffer = m_occlusion_thread->sync();
+		for (auto it = m_drawlist.begin(); it != m_drawlist.end();) {
+			aabb3f box = getMeshBox(it->first, mesh_grid.cell_size);
+			if (box.getCenter().getDistanceFromSQ(m_camera_position) > occlusion_buffer_range_sq &&
+					buffer.isBoxOccluded(box)) {
+				it->second->refDrop();
+				it = m_drawlist.erase(it);
+				blocks_occlusion_culled++;
+			} else {
+				++it;
+			}
+		}
+		g_profiler->avg("CM::OcclusionBuffer occluder faces [#]", buffer.getOccluderFaceCount());
+	}
+
 	g_profiler->avg("MapBlocks occlusion culled [#]", blocks_occlusion_culled);
 	g_profiler->avg("MapBlocks frustum culled [#]", blocks_frustum_culled);
 	g_profiler->avg("MapBlocks drawn [#]", m_drawlist.size());
@@ -1709,6 +1750,14 @@ void ClientMap::updateDrawListShadow(v3f shadow_light_pos, v3f shadow_light_dir,
 	u32 blocks_loaded = 0;
 	// Number of blocks with mesh in rendering range
 	u32 blocks_in_range_with_mesh = 0;
+	// Number of blocks hidden from the light by other blocks
+	u32 blocks_occlusion_culled = 0;
+
+	// Blocks that cannot be seen from the light cannot cast shadows either,
+	// so the solid meshes in range are used as occluders from its point of view.
+	const bool use_occlusion_buffer = m_enable_occlusion_buffer && !m_control.range_all;
+	const u16 mesh_size = m_client->getMeshGrid().cell_size;
+	std::vector<OcclusionOccluder> occluders;
 
 	for (auto& sector_it : m_sectors) {
 		const MapSector* sector = sector_it.second;
@@ -1737,6 +1786,9 @@ void ClientMap::updateDrawListShadow(v3f shadow_light_pos, v3f shadow_light_dir,
 			// This block is in range. Reset usage timer.
 			block->resetUsageTimer();
 
+			if (use_occlusion_buffer && block->solid_sides)
+				occluders.push_back({getMeshBox(block->getPos(), mesh_size), block->solid_sides});
+
 			// Add to set
 			if (m_drawlist_shadow.emplace(block->getPos(), block).second) {
 				block->refGrab();
@@ -1744,6 +1796,29 @@ void ClientMap::updateDrawListShadow(v3f shadow_light_pos, v3f shadow_light_dir,
 		}
 	}
 
+	if (use_occlusion_buffer && !occluders.empty()) {
+		OcclusionView view;
+		view.position = shadow_light_pos;
+		view.direction = shadow_light_dir;
+		view.direction.normalize();
+		view.orthographic = true;
+		view.extent = radius;
+		view.near_plane = 0.0f;
+		m_occlusion_thread->rasterize(view, std::move(occluders));
+		const OcclusionBuffer &buffer = m_occlusion_thread->sync();
+
+		for (auto it = m_drawlist_shadow.begin(); it != m_drawlist_shadow.end();) {
+			if (buffer.isBoxOccluded(getMeshBox(it->first, mesh_size))) {
+				it->second->refDrop();
+				it = m_drawlist_shadow.erase(it);
+				blocks_occlusion_culled++;
+			} else {
+				++it;
+			}
+		}
+	}
+
+	g_profiler->avg("SHADOW MapBlocks occlusion culled [#]", blocks_occlusion_culled);
 	g_profiler->avg("SHADOW MapBlock meshes in range [#]", blocks_in_range_with_mesh);
 	g_profiler->avg("SHADOW MapBlocks drawn [#]", m_drawlist_shadow.size());
 	g_profiler->avg("SHADOW MapBlocks loaded [#]", blocks_loaded);
@@ -1807,6 +1882,42 @@ void ClientMap::DrawDescriptor::draw(video::IVideoDriver* driver)
 	}
 }
 
+aabb3f ClientMap::getMeshBox(v3s16 mesh_pos, u16 mesh_size)
+{
+	v3f min_edge = intToFloat(mesh_pos * MAP_BLOCKSIZE, BS) - v3f(0.5f * BS);
+	return aabb3f(min_edge, min_edge + v3f(mesh_size * MAP_BLOCKSIZE * BS));
+}
+
+void ClientMap::startOcclusionBuffer(v3s16 cam_pos_nodes, const MeshGrid &mesh_grid)
+{
+	std::vector<OcclusionOccluder> occluders;
+
+	const v3s16 camera_mesh = mesh_grid.getMeshPos(getContainerPos(cam_pos_nodes, MAP_BLOCKSIZE));
+	const s16 range = (m_occlusion_buffer_range / (MAP_BLOCKSIZE * mesh_grid.cell_size) + 1) *
+		mesh_grid.cell_size;
+	v3s16 p;
+	for (p.X = camera_mesh.X - range; p.X <= camera_mesh.X + range; p.X += mesh_grid.cell_size)
+	for (p.Z = camera_mesh.Z - range; p.Z <= camera_mesh.Z + range; p.Z += mesh_grid.cell_size) {
+		MapSector *sector = getSectorNoGenerate(v2s16(p.X, p.Z));
+		if (!sector)
+			continue;
+		for (p.Y = camera_mesh.Y - range; p.Y <= camera_mesh.Y + range; p.Y += mesh_grid.cell_size) {
+			MapBlock *block = sector->getBlockNoCreateNoEx(p.Y);
+			if (!block || !block->mesh || !block->solid_sides)
+				continue;
+			occluders.push_back({getMeshBox(p, mesh_grid.cell_size), block->solid_sides});
+		}
+	}
+
+	OcclusionView view;
+	view.position = m_camera_position;
+	view.direction = m_camera_direction;
+	view.direction.normalize();
+	// Square view that contains the camera frustum in any orientation
+	view.extent = std::tan(m_camera_fov / 2) * std::sqrt(2.0f);
+	m_occlusion_thread->rasterize(view, std::move(occluders));
+}
+
 bool ClientMap::isMeshOccluded(MapBlock* mesh_block, u16 mesh_size, v3s16 cam_pos_nodes)
 {
 	if (mesh_size == 1)
@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <map>
 #include "CNullDriver.h"
 #include "memoryManager.h"
+#include "occlusion_buffer.h"
 
 struct MapDrawControl
 {
@@ -295,6 +296,11 @@ class ClientMap : public Map, public scene::ISceneNode
 private:
 	bool isMeshOccluded(MapBlock *mesh_block, u16 mesh_size, v3s16 cam_pos_nodes);
 
+	// Returns the box covered by a mesh with the given origin block
+	static aabb3f getMeshBox(v3s16 mesh_pos, u16 mesh_size);
+	// Queues rasterization of the solid meshes around the camera
+	void startOcclusionBuffer(v3s16 cam_pos_nodes, const MeshGrid &mesh_grid);
+
 	
 
 	// update the vertex order in transparent mesh buffers
@@ -370,6 +376,9 @@ class ClientMap : public Map, public scene::ISceneNode
 
 	bool m_loops_occlusion_culler;
 	bool m_enable_raytraced_culling;
+	bool m_enable_occlusion_buffer;
+	u16 m_occlusion_buffer_range;
+	std::unique_ptr<OcclusionBufferThread> m_occlusion_thread;
 
 	TextureBufferMaps cache_buffers;
 	core::array<u32> empty_data;
@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "settings.h"
 #include "util/hex.h"
+#include "util/numeric.h"
 #include "util/serialize.h"
 #include "util/sha1.h"
 #include "util/string.h"
@@ -457,6 +458,12 @@ void ClientMediaDownloader::startConventionalTransfers(Client *client)
 	assert(m_httpfetch_active == 0);	// pre-condition
 
 	if (m_uncached_received_count != m_uncached_count) {
+		// Newer servers send files in chunks, by content
+		if (client->getProtoVersion() >= 53) {
+			startChunkTransfers(client);
+			return;
+		}
+
 		// Some media files have not been received yet, use the
 		// conventional slow method (minetest protocol) to get them
 		std::vector<std::string> file_requests;
@@ -508,6 +515,221 @@ bool ClientMediaDownloader::conventionalTransferDone(
 	return true;
 }
 
+static std::string getPartName(const std::string &sha1)
+{
+	return hex_encode(sha1) + ".part";
+}
+
+void ClientMediaDownloader::startChunkTransfers(Client *client)
+{
+	m_chunks_in_flight_limit = rangelim(
+		g_settings->getU32("media_chunk_requests"), 1, 256);
+
+	for (auto &file : m_files) {
+		FileStatus *filestatus = file.second;
+		if (filestatus->received)
+			continue;
+
+		auto it = m_chunk_transfers.find(filestatus->sha1);
+		if (it != m_chunk_transfers.end()) {
+			it->second.names.push_back(file.first);
+			continue;
+		}
+
+		ChunkTransfer &transfer = m_chunk_transfers[filestatus->sha1];
+		transfer.names.push_back(file.first);
+
+		// Resume what an earlier connection left off
+		std::ostringstream tmp_os(std::ios_base::binary);
+		if (m_media_cache.exists(getPartName(filestatus->sha1)) &&
+				m_media_cache.load(getPartName(filestatus->sha1), tmp_os)) {
+			transfer.data = tmp_os.str();
+			transfer.requested = transfer.data.size();
+			verbosestream << "Client: Resuming media file \"" << file.first
+				<< "\" at " << transfer.requested << " bytes" << std::endl;
+		}
+		m_chunk_queue.push_back(filestatus->sha1);
+	}
+
+	infostream << "Client: Requesting " << m_chunk_queue.size()
+		<< " media files in chunks" << std::endl;
+	requestChunks(client);
+}
+
+void ClientMediaDownloader::requestChunks(Client *client)
+{
+	std::vector<std::pair<std::string, u32>> requests;
+
+	for (size_t i = m_chunk_queue_pos; i < m_chunk_queue.size(); i++) {
+		if (m_chunks_in_flight + requests.size() >= m_chunks_in_flight_limit)
+			break;
+
+		const std::string &sha1 = m_chunk_queue[i];
+		auto it = m_chunk_transfers.find(sha1);
+		if (it != m_chunk_transfers.end() && !it->second.done) {
+			ChunkTransfer &transfer = it->second;
+			if (!transfer.size_known) {
+				// Ask for one chunk until the size is known
+				if (!transfer.probing) {
+					requests.emplace_back(sha1, transfer.requested);
+					transfer.probing = true;
+					transfer.in_flight++;
+				}
+			} else {
+				while (transfer.requested < transfer.size &&
+						m_chunks_in_flight + requests.size() < m_chunks_in_flight_limit) {
+					requests.emplace_back(sha1, transfer.requested);
+					transfer.requested += MYMIN((u32)MEDIA_CHUNK_SIZE,
+						transfer.size - transfer.requested);
+					transfer.in_flight++;
+				}
+			}
+			if (!transfer.size_known || transfer.requested < transfer.size)
+				continue;
+		}
+		if (i == m_chunk_queue_pos)
+			m_chunk_queue_pos++;
+	}
+
+	if (requests.empty())
+		return;
+	m_chunks_in_flight += requests.size();
+	client->request_media_chunks(requests);
+}
+
+bool ClientMediaDownloader::chunkReceived(const std::string &sha1,
+		u32 file_size, u32 offset, const std::string &data, Client *client)
+{
+	auto it = m_chunk_transfers.find(sha1);
+	if (it == m_chunk_transfers.end())
+		return false;
+	ChunkTransfer &transfer = it->second;
+	if (m_chunks_in_flight > 0)
+		m_chunks_in_flight--;
+	if (transfer.in_flight > 0)
+		transfer.in_flight--;
+
+	// Requested before the transfer ended or started over
+	if (transfer.done || transfer.discard > 0) {
+		if (!transfer.done)
+			transfer.discard--;
+		requestChunks(client);
+		return true;
+	}
+
+	if (file_size == 0) {
+		SHA1 ctx;
+		if (transfer.data.empty() && ctx.getDigest() == sha1) {
+			// Nothing to fetch, the file is empty
+			chunkTransferDone(sha1, client);
+			requestChunks(client);
+			return true;
+		}
+		// The server can't send it, give up like conventional transfers do
+		errorstream << "Client: Server could not send media file \""
+			<< transfer.names.front() << "\"" << std::endl;
+		m_media_cache.remove(getPartName(sha1));
+		markChunkTransferReceived(sha1);
+		requestChunks(client);
+		return true;
+	}
+
+	if (!transfer.size_known) {
+		transfer.probing = false;
+		if (offset > file_size) {
+			// The part we have is from a different file, start over
+			verbosestream << "Client: Discarding partial media file \""
+				<< transfer.names.front() << "\"" << std::endl;
+			restartChunkTransfer(sha1, transfer);
+			requestChunks(client);
+			return true;
+		}
+		transfer.size = file_size;
+		transfer.size_known = true;
+		transfer.requested = offset + data.size();
+	}
+
+	// Chunks come in order over a reliable channel
+	if (file_size != transfer.size || offset != transfer.data.size() ||
+			data.size() > file_size - offset) {
+		errorstream << "Client: Server sent bad media chunk for \""
+			<< transfer.names.front() << "\" at " << offset << std::endl;
+		chunkTransferFailed(sha1, client);
+	} else {
+		transfer.data.append(data);
+		if (transfer.data.size() == transfer.size) {
+			chunkTransferDone(sha1, client);
+		} else if (!m_media_cache.append(getPartName(sha1), data)) {
+			// Don't resume from a file with holes
+			m_media_cache.remove(getPartName(sha1));
+		}
+	}
+
+	requestChunks(client);
+	return true;
+}
+
+void ClientMediaDownloader::restartChunkTransfer(const std::string &sha1,
+		ChunkTransfer &transfer)
+{
+	transfer.data.clear();
+	transfer.size_known = false;
+	transfer.probing = false;
+	transfer.requested = 0;
+	transfer.discard = transfer.in_flight;
+	m_media_cache.remove(getPartName(sha1));
+	m_chunk_queue.push_back(sha1);
+}
+
+void ClientMediaDownloader::chunkTransferFailed(const std::string &sha1,
+		Client *client)
+{
+	ChunkTransfer &transfer = m_chunk_transfers.at(sha1);
+	if (!transfer.retried) {
+		// Maybe the partial file was damaged, try once more from the start
+		infostream << "Client: Fetching media file \""
+			<< transfer.names.front() << "\" again" << std::endl;
+		transfer.retried = true;
+		restartChunkTransfer(sha1, transfer);
+		return;
+	}
+
+	m_media_cache.remove(getPartName(sha1));
+	markChunkTransferReceived(sha1);
+}
+
+void ClientMediaDownloader::chunkTransferDone(const std::string &sha1,
+		Client *client)
+{
+	ChunkTransfer &transfer = m_chunk_transfers.at(sha1);
+	if (!checkAndLoad(transfer.names.front(), sha1, transfer.data, false, client)) {
+		chunkTransferFailed(sha1, client);
+		return;
+	}
+
+	m_media_cache.remove(getPartName(sha1));
+	for (size_t i = 1; i < transfer.names.size(); i++)
+		loadMedia(client, transfer.data, transfer.names[i]);
+	markChunkTransferReceived(sha1);
+}
+
+void ClientMediaDownloader::markChunkTransferReceived(const std::string &sha1)
+{
+	ChunkTransfer &transfer = m_chunk_transfers.at(sha1);
+
+	// Mark files as received even if they failed, like conventional transfers
+	for (const std::string &name : transfer.names) {
+		FileStatus *filestatus = m_files[name];
+		filestatus->received = true;
+		assert(m_uncached_received_count < m_uncached_count);
+		m_uncached_received_count++;
+	}
+
+	// Keep the entry to recognize chunks that are still underway
+	transfer.done = true;
+	std::string().swap(transfer.data);
+}
+
 /*
 	IClientMediaDownloader
 */
@@ -538,23 +760,32 @@ bool IClientMediaDownloader::checkAndLoad(
 	const char *cached_or_received_uc = is_from_cache ? "Cached" : "Received";
 	std::string sha1_hex = hex_encode(sha1);
 
-	// Compute actual checksum of data
-	std::string data_sha1;
-	{
-		SHA1 ctx;
-		ctx.addBytes(data);
-		data_sha1 = ctx.getDigest();
-	}
+	// Cached files that were checked before and didn't change since
+	// don't need to be hashed again
+	bool verified = is_from_cache && m_media_cache.isVerified(sha1_hex);
+
+	if (!verified) {
+		// Compute actual checksum of data
+		std::string data_sha1;
+		{
+			SHA1 ctx;
+			ctx.addBytes(data);
+			data_sha1 = ctx.getDigest();
+		}
 
-	// Check that received file matches announced checksum
-	if (data_sha1 != sha1) {
-		std::string data_sha1_hex = hex_encode(data_sha1);
-		infostream << "Client: "
-			<< cached_or_received_uc << " media file "
-			<< sha1_hex << " \"" << name << "\" "
-			<< "mismatches actual checksum " << data_sha1_hex
-			<< std::endl;
-		return false;
+		// Check that received file matches announced checksum
+		if (data_sha1 != sha1) {
+			std::string data_sha1_hex = hex_encode(data_sha1);
+			infostream << "Client: "
+				<< cached_or_received_uc << " media file "
+				<< sha1_hex << " \"" << name << "\" "
+				<< "mismatches actual checksum " << data_sha1_hex
+				<< std::endl;
+			return false;
+		}
+
+		if (is_from_cache)
+			m_media_cache.setVerified(sha1_hex);
 	}
 
 	// Checksum is ok, try loading the file
@@ -573,8 +804,10 @@ bool IClientMediaDownloader::checkAndLoad(
 		<< std::endl;
 
 	// Update cache (unless we just loaded the file from the cache)
-	if (!is_from_cache && m_write_to_cache)
-		m_media_cache.update(sha1_hex, data);
+	if (!is_from_cache && m_write_to_cache) {
+		if (m_media_cache.update(sha1_hex, data))
+			m_media_cache.setVerified(sha1_hex);
+	}
 
 	return true;
 }
@@ -132,6 +132,11 @@ class ClientMediaDownloader : public IClientMediaDownloader
 			const std::string &data,
 			Client *client) override;
 
+	// Must be called for each TOCLIENT_MEDIA_CHUNK
+	// returns true if the chunk belongs to this downloader
+	bool chunkReceived(const std::string &sha1, u32 file_size, u32 offset,
+			const std::string &data, Client *client);
+
 protected:
 	bool loadMedia(Client *client, const std::string &data,
 			const std::string &name) override;
@@ -149,6 +154,26 @@ class ClientMediaDownloader : public IClientMediaDownloader
 		s32 active_count;
 	};
 
+	// A file fetched from the minetest server in chunks
+	struct ChunkTransfer {
+		// Files with this content
+		std::vector<std::string> names;
+		// Data received so far, also kept in the cache to resume later
+		std::string data;
+		u32 size = 0;
+		bool size_known = false;
+		// Offset of the next chunk to request
+		u32 requested = 0;
+		// Waiting for the first chunk, which tells the size
+		bool probing = false;
+		bool retried = false;
+		bool done = false;
+		// Chunks requested and not received yet
+		u32 in_flight = 0;
+		// Number of those to ignore after starting over
+		u32 discard = 0;
+	};
+
 	void initialStep(Client *client);
 	void remoteHashSetReceived(const HTTPFetchResult &fetch_result);
 	void remoteMediaReceived(const HTTPFetchResult &fetch_result,
@@ -156,6 +181,12 @@ class ClientMediaDownloader : public IClientMediaDownloader
 	s32 selectRemoteServer(FileStatus *filestatus);
 	void startRemoteMediaTransfers();
 	void startConventionalTransfers(Client *client);
+	void startChunkTransfers(Client *client);
+	void requestChunks(Client *client);
+	void restartChunkTransfer(const std::string &sha1, ChunkTransfer &transfer);
+	void chunkTransferFailed(const std::string &sha1, Client *client);
+	void chunkTransferDone(const std::string &sha1, Client *client);
+	void markChunkTransferReceived(const std::string &sha1);
 
 	static void deSerializeHashSet(const std::string &data,
 			std::set<std::string> &result);
@@ -191,6 +222,15 @@ class ClientMediaDownloader : public IClientMediaDownloader
 	// (use m_files.upper_bound(m_name_bound) to get an iterator)
 	std::string m_name_bound = "";
 
+	// Chunked transfers from the minetest server, by raw SHA1
+	std::unordered_map<std::string, ChunkTransfer> m_chunk_transfers;
+	// Order in which the transfers are requested. Everything before
+	// m_chunk_queue_pos has been requested completely.
+	std::vector<std::string> m_chunk_queue;
+	size_t m_chunk_queue_pos = 0;
+	u32 m_chunks_in_flight = 0;
+	u32 m_chunks_in_flight_limit = 1;
+
 };
 
 // A media downloader that only downloads a single file.
@@ -66,6 +66,20 @@ static const u8 light_indices[6][4] = {
 	{2, 6, 4, 0},
 };
 
+// Cuboid face directions, in the order used by ContentFeatures tiles
+static const v3s16 cube_face_dirs[6] = {
+	v3s16(0, 1, 0),
+	v3s16(0, -1, 0),
+	v3s16(1, 0, 0),
+	v3s16(-1, 0, 0),
+	v3s16(0, 0, 1),
+	v3s16(0, 0, -1)
+};
+
+// Largest side length handled by the solid cube fast path: a row of nodes
+// plus one neighbor on either side must fit into a u64
+#define SOLID_FAST_PATH_MAX_SIDE 62
+
 // Standard index set to make a quad on 4 vertices
 static constexpr u16 quad_indices_02[] = {0, 1, 2, 2, 3, 0};
 static constexpr u16 quad_indices_13[] = {0, 1, 3, 3, 1, 2};
@@ -81,7 +95,8 @@ MapblockMeshGenerator::MapblockMeshGenerator(MeshMakeData *input, MeshCollector
 	meshmanip(mm),
 	blockpos_nodes(data->m_blockpos * MAP_BLOCKSIZE),
 	enable_mesh_cache(g_settings->getBool("enable_mesh_cache") &&
-			!data->m_smooth_lighting) // Mesh cache is not supported with smooth lighting
+			!data->m_smooth_lighting), // Mesh cache is not supported with smooth lighting
+	enable_greedy_meshing(g_settings->getBool("enable_greedy_meshing"))
 {
 }
 
@@ -409,14 +424,7 @@ void MapblockMeshGenerator::drawAutoLightedCuboid(aabb3f box, const f32 *txc,
 void MapblockMeshGenerator::drawSolidNode()
 {
 	u8 faces = 0; // k-th bit will be set if k-th face is to be drawn.
-	static const v3s16 tile_dirs[6] = {
-		v3s16(0, 1, 0),
-		v3s16(0, -1, 0),
-		v3s16(1, 0, 0),
-		v3s16(-1, 0, 0),
-		v3s16(0, 0, 1),
-		v3s16(0, 0, -1)
-	};
+	const v3s16 *tile_dirs = cube_face_dirs;
 	TileSpec tiles[6];
 	u16 lights[6];
 	content_t n1 = cur_node.n.getContent();
@@ -496,6 +504,238 @@ void MapblockMeshGenerator::drawSolidNode()
 	}
 }
 
+/*
+	Solid cube fast path
+
+	Plain NDT_NORMAL cubes make up most of the world, so instead of going
+	through drawNode() for each of them, generateSolidCubes() handles all of
+	them at once:
+	- Node rows along X are packed into u64 bitmasks (solid cubes and face
+	  occluders), and the visible faces in each of the six directions are
+	  computed with a few shifts and ANDs per row.
+	- Visible faces in the same plane are merged greedily into larger quads
+	  if they share the tile, the lighting and are not animated/cracked.
+	The faces produced are the same as drawSolidNode() would draw; texture
+	coordinates are world-based and tileable, so merged quads look identical.
+*/
+
+// Returns the position with the given coordinate along each axis (0 = X, 1 = Y, 2 = Z).
+static inline v3s16 axisPos(int axis_w, s16 w, int axis_u, s16 u, int axis_v, s16 v)
+{
+	s16 c[3];
+	c[axis_w] = w;
+	c[axis_u] = u;
+	c[axis_v] = v;
+	return v3s16(c[0], c[1], c[2]);
+}
+
+bool MapblockMeshGenerator::canMergeSolidFaces(const SolidFace &a, const SolidFace &b)
+{
+	if (!a.mergeable || !b.mergeable)
+		return false;
+	if (a.light_source != b.light_source || (u16)a.lights[0] != (u16)b.lights[0])
+		return false;
+	if (a.tile.world_aligned != b.tile.world_aligned ||
+			a.tile.rotation != b.tile.rotation ||
+			a.tile.emissive_light != b.tile.emissive_light)
+		return false;
+	for (int layer = 0; layer < MAX_TILE_LAYERS; layer++) {
+		if (a.tile.layers[layer] != b.tile.layers[layer])
+			return false;
+	}
+	return true;
+}
+
+bool MapblockMeshGenerator::isSolidCubeHandled(const v3s16 &p) const
+{
+	if (solid_rows.empty())
+		return false;
+	return (solid_rows[p.Z * data->side_length + p.Y] >> p.X) & 1;
+}
+
+void MapblockMeshGenerator::getSolidFace(const v3s16 &p, int face, SolidFace &out)
+{
+	const v3s16 &dir = cube_face_dirs[face];
+	MapNode n = data->m_vmanip.getNodeNoEx(blockpos_nodes + p);
+	const ContentFeatures &f = nodedef->get(n);
+
+	getNodeTile(n, p, dir, data, out.tile);
+	out.mergeable = true;
+	for (auto &layer : out.tile.layers) {
+		layer.material_flags |= MATERIAL_FLAG_BACKFACE_CULLING;
+		layer.material_flags |= MATERIAL_FLAG_TILEABLE_HORIZONTAL;
+		layer.material_flags |= MATERIAL_FLAG_TILEABLE_VERTICAL;
+		if (layer.material_flags & (MATERIAL_FLAG_ANIMATION | MATERIAL_FLAG_CRACK))
+			out.mergeable = false;
+	}
+	out.light_source = f.light_source;
+
+	if (data->m_smooth_lighting) {
+		for (int k = 0; k < 4; k++) {
+			v3s16 corner = light_dirs[light_indices[face][k]];
+			out.lights[k] = LightPair(getSmoothLightSolid(
+					blockpos_nodes + p, dir, corner, data));
+		}
+		// Only faces with uniform lighting can be stretched over several nodes
+		for (int k = 1; k < 4; k++) {
+			if ((u16)out.lights[k] != (u16)out.lights[0])
+				out.mergeable = false;
+		}
+	} else {
+		MapNode neighbor = data->m_vmanip.getNodeNoEx(blockpos_nodes + p + dir);
+		LightPair light(getFaceLight(n, neighbor, nodedef));
+		for (auto &l : out.lights)
+			l = light;
+	}
+}
+
+// Draws one quad covering the given face of all nodes from pmin to pmax.
+void MapblockMeshGenerator::drawSolidFaces(int face, const SolidFace &sf,
+	v3s16 pmin, v3s16 pmax)
+{
+	aabb3f box(intToFloat(pmin, BS) - v3f(0.5 * BS),
+			intToFloat(pmax, BS) + v3f(0.5 * BS));
+	f32 texture_coord_buf[24];
+	generateCuboidTextureCoords(box, texture_coord_buf);
+
+	TileSpec tiles[6];
+	tiles[face] = sf.tile;
+	u8 mask = 0b0011'1111 & ~(1 << face);
+	drawCuboid(box, tiles, 6, texture_coord_buf, mask, [&] (int, video::S3DVertex vertices[4]) {
+		for (int j = 0; j < 4; j++) {
+			video::S3DVertex &vertex = vertices[j];
+			vertex.Color = encode_light(sf.lights[j], sf.light_source);
+			if (!sf.light_source)
+				applyFacesShading(vertex.Color, vertex.Normal);
+		}
+		if (lightDiff(sf.lights[1], sf.lights[3]) < lightDiff(sf.lights[0], sf.lights[2]))
+			return QuadDiagonal::Diag13;
+		return QuadDiagonal::Diag02;
+	});
+}
+
+void MapblockMeshGenerator::generateSolidCubes()
+{
+	const s16 side = data->side_length;
+	const s16 padded = side + 2;
+
+	// Bit (x + 1) of word [(z + 1) * padded + (y + 1)] describes node (x, y, z),
+	// for x, y, z in [-1, side].
+	std::vector<u64> solid(padded * padded, 0);
+	std::vector<u64> occluding(padded * padded, 0);
+	auto row = [padded] (s16 y, s16 z) { return (z + 1) * padded + (y + 1); };
+
+	v3s16 p;
+	for (p.Z = -1; p.Z <= side; p.Z++)
+	for (p.Y = -1; p.Y <= side; p.Y++) {
+		const bool inner_row = p.Y >= 0 && p.Y < side && p.Z >= 0 && p.Z < side;
+		u64 solid_word = 0, occluding_word = 0;
+		for (p.X = -1; p.X <= side; p.X++) {
+			const u64 bit = (u64)1 << (p.X + 1);
+			MapNode n = data->m_vmanip.getNodeNoEx(blockpos_nodes + p);
+			if (n.getContent() == CONTENT_IGNORE) {
+				occluding_word |= bit;
+				continue;
+			}
+			const ContentFeatures &f = nodedef->get(n);
+			if (f.solidness != 2)
+				continue;
+			occluding_word |= bit;
+			// Same-content neighbors must hide each other, which holds
+			// because every node taken here is an occluder too.
+			if (inner_row && p.X >= 0 && p.X < side && f.drawtype == NDT_NORMAL)
+				solid_word |= bit;
+		}
+		solid[row(p.Y, p.Z)] = solid_word;
+		occluding[row(p.Y, p.Z)] = occluding_word;
+	}
+
+	// Visible faces per direction; bit x of word [z * side + y]
+	std::vector<u64> faces[6];
+	for (auto &words : faces)
+		words.assign(side * side, 0);
+	solid_rows.assign(side * side, 0);
+	bool any_face = false;
+	for (s16 z = 0; z < side; z++)
+	for (s16 y = 0; y < side; y++) {
+		const u64 s = solid[row(y, z)];
+		if (!s)
+			continue;
+		const u64 occ = occluding[row(y, z)];
+		const size_t i = z * side + y;
+		solid_rows[i] = s >> 1;
+		faces[0][i] = (s & ~occluding[row(y + 1, z)]) >> 1;
+		faces[1][i] = (s & ~occluding[row(y - 1, z)]) >> 1;
+		faces[2][i] = (s & ~(occ >> 1)) >> 1;
+		faces[3][i] = (s & ~(occ << 1)) >> 1;
+		faces[4][i] = (s & ~occluding[row(y, z + 1)]) >> 1;
+		faces[5][i] = (s & ~occluding[row(y, z - 1)]) >> 1;
+		for (auto &words : faces)
+			any_face |= words[i] != 0;
+	}
+	if (!any_face)
+		return;
+
+	// Greedy merge, one slice perpendicular to the face normal at a time
+	std::vector<SolidFace> cells(side * side);
+	std::vector<bool> present(side * side);
+	for (int face = 0; face < 6; face++) {
+		const v3s16 &dir = cube_face_dirs[face];
+		const int axis_w = dir.X ? 0 : (dir.Y ? 1 : 2);
+		const int axis_u = (axis_w + 1) % 3;
+		const int axis_v = (axis_w + 2) % 3;
+
+		for (s16 w = 0; w < side; w++) {
+			bool any = false;
+			for (s16 v = 0; v < side; v++)
+			for (s16 u = 0; u < side; u++) {
+				v3s16 pos = axisPos(axis_w, w, axis_u, u, axis_v, v);
+				const size_t i = v * side + u;
+				present[i] = (faces[face][pos.Z * side + pos.Y] >> pos.X) & 1;
+				if (present[i]) {
+					getSolidFace(pos, face, cells[i]);
+					any = true;
+				}
+			}
+			if (!any)
+				continue;
+
+			for (s16 v = 0; v < side; v++)
+			for (s16 u = 0; u < side; u++) {
+				const size_t i = v * side + u;
+				if (!present[i])
+					continue;
+				const SolidFace &sf = cells[i];
+				auto can_merge = [&] (s16 u2, s16 v2) {
+					const size_t j = v2 * side + u2;
+					return present[j] && canMergeSolidFaces(sf, cells[j]);
+				};
+
+				s16 width = 1, height = 1;
+				if (sf.mergeable) {
+					while (u + width < side && can_merge(u + width, v))
+						width++;
+					for (; v + height < side; height++) {
+						bool row_matches = true;
+						for (s16 k = 0; k < width && row_matches; k++)
+							row_matches = can_merge(u + k, v + height);
+						if (!row_matches)
+							break;
+					}
+				}
+
+				for (s16 dv = 0; dv < height; dv++)
+				for (s16 du = 0; du < width; du++)
+					present[(v + dv) * side + u + du] = false;
+
+				drawSolidFaces(face, sf,
+						axisPos(axis_w, w, axis_u, u, axis_v, v),
+						axisPos(axis_w, w, axis_u, u + width - 1, axis_v, v + height - 1));
+			}
+		}
+	}
+}
+
 u8 MapblockMeshGenerator::getNodeBoxMask(aabb3f box, u8 solid_neighbors, u8 sametype_neighbors) const
 {
 	const f32 NODE_BOUNDARY = 0.5 * BS;
@@ -1743,9 +1983,15 @@ void MapblockMeshGenerator::drawNode()
 
 void MapblockMeshGenerator::generate()
 {
+	solid_rows.clear();
+	if (enable_greedy_meshing && data->side_length <= SOLID_FAST_PATH_MAX_SIDE)
+		generateSolidCubes();
+
 	for (cur_node.p.Z = 0; cur_node.p.Z < data->side_length; cur_node.p.Z++)
 	for (cur_node.p.Y = 0; cur_node.p.Y < data->side_length; cur_node.p.Y++)
 	for (cur_node.p.X = 0; cur_node.p.X < data->side_length; cur_node.p.X++) {
+		if (isSolidCubeHandled(cur_node.p))
+			continue;
 		cur_node.n = data->m_vmanip.getNodeNoEx(blockpos_nodes + cur_node.p);
 		cur_node.f = &nodedef->get(cur_node.n);
 		drawNode();
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <vector>
 #include "nodedef.h"
 #include <IMeshManipulator.h>
 
@@ -77,6 +78,7 @@ class MapblockMeshGenerator
 
 // options
 	const bool enable_mesh_cache;
+	const bool enable_greedy_meshing;
 
 // current node
 	struct {
@@ -171,6 +173,22 @@ class MapblockMeshGenerator
 	void drawFirelikeQuad(float rotation, float opening_angle,
 		float offset_h, float offset_v = 0.0);
 
+// solid cube fast path
+	struct SolidFace {
+		TileSpec tile;
+		LightPair lights[4];
+		u8 light_source;
+		bool mergeable;
+	};
+	// One bit per node along X, one word per (y, z) row; see generateSolidCubes
+	std::vector<u64> solid_rows;
+
+	static bool canMergeSolidFaces(const SolidFace &a, const SolidFace &b);
+	bool isSolidCubeHandled(const v3s16 &p) const;
+	void generateSolidCubes();
+	void getSolidFace(const v3s16 &p, int face, SolidFace &out);
+	void drawSolidFaces(int face, const SolidFace &sf, v3s16 pmin, v3s16 pmax);
+
 // drawtypes
 	void drawSolidNode();
 	void drawLiquidNode();
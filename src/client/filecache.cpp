@@ -26,8 +26,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cstdlib>
 
+#define FILECACHE_INDEX_NAME "verified.txt"
+
 void FileCache::createDir()
 {
 	if (!fs::CreateAllDirs(m_dir)) {
@@ -89,6 +92,7 @@ bool FileCache::updateByPath(const std::string &path, std::string_view data)
 bool FileCache::update(const std::string &name, std::string_view data)
 {
 	std::string path = m_dir + DIR_DELIM + name;
+	forget(name);
 	return updateByPath(path, data);
 }
 
@@ -105,10 +109,109 @@ bool FileCache::exists(const std::string &name)
 	return fis.good();
 }
 
+bool FileCache::append(const std::string &name, std::string_view data)
+{
+	std::string path = m_dir + DIR_DELIM + name;
+	forget(name);
+	createDir();
+	std::ofstream file(path.c_str(), std::ios_base::binary |
+			std::ios_base::app);
+	if (!file.good()) {
+		errorstream << "FileCache: Can't append to file at "
+				<< path << std::endl;
+		return false;
+	}
+
+	file << data;
+	file.close();
+	return !file.fail();
+}
+
+bool FileCache::remove(const std::string &name)
+{
+	std::string path = m_dir + DIR_DELIM + name;
+	forget(name);
+	return fs::DeleteSingleFileOrEmptyDirectory(path);
+}
+
 bool FileCache::updateCopyFile(const std::string &name, const std::string &src_path)
 {
 	std::string path = m_dir + DIR_DELIM + name;
 
+	forget(name);
 	createDir();
 	return fs::CopyFileContents(src_path, path);
 }
+
+/*
+	Verification index, one line per file:
+	<name> <size> <modification time>
+*/
+
+void FileCache::loadIndex()
+{
+	if (m_index_loaded)
+		return;
+	m_index_loaded = true;
+
+	std::ifstream is(m_dir + DIR_DELIM + FILECACHE_INDEX_NAME);
+	std::string line;
+	while (std::getline(is, line)) {
+		std::istringstream iss(line);
+		std::string name;
+		FileInfo info;
+		if (iss >> name >> info.size >> info.mtime)
+			m_index[name] = info;
+	}
+}
+
+void FileCache::forget(const std::string &name)
+{
+	if (m_index_loaded && m_index.erase(name) > 0)
+		m_index_modified = true;
+}
+
+bool FileCache::isVerified(const std::string &name)
+{
+	loadIndex();
+	auto it = m_index.find(name);
+	if (it == m_index.end())
+		return false;
+
+	FileInfo info;
+	if (!fs::GetFileInfo(m_dir + DIR_DELIM + name, info.size, info.mtime))
+		return false;
+	return info.size == it->second.size && info.mtime == it->second.mtime;
+}
+
+void FileCache::setVerified(const std::string &name)
+{
+	loadIndex();
+	FileInfo info;
+	if (!fs::GetFileInfo(m_dir + DIR_DELIM + name, info.size, info.mtime))
+		return;
+	m_index[name] = info;
+	m_index_modified = true;
+}
+
+void FileCache::saveIndex()
+{
+	if (!m_index_modified)
+		return;
+	m_index_modified = false;
+
+	std::ostringstream os;
+	for (const auto &it : m_index) {
+		// Drop files that were removed by other means
+		if (!fs::PathExists(m_dir + DIR_DELIM + it.first))
+			continue;
+		os << it.first << " " << it.second.size << " "
+			<< it.second.mtime << "\n";
+	}
+
+	createDir();
+	if (!fs::safeWriteToFile(m_dir + DIR_DELIM + FILECACHE_INDEX_NAME, os.str())) {
+		errorstream << "FileCache: Can't write index in "
+				<< m_dir << std::endl;
+	}
+}
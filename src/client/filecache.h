@@ -20,9 +20,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 
 class FileCache
 {
@@ -31,18 +33,42 @@ class FileCache
 		'dir' is the file cache directory to use.
 	*/
 	FileCache(const std::string &dir) : m_dir(dir) {}
+	~FileCache() { saveIndex(); }
 
 	bool update(const std::string &name, std::string_view data);
 	bool load(const std::string &name, std::ostream &os);
 	bool exists(const std::string &name);
 
+	// Append to a file, for files that arrive in parts
+	bool append(const std::string &name, std::string_view data);
+	bool remove(const std::string &name);
+
 	// Copy another file on disk into the cache
 	bool updateCopyFile(const std::string &name, const std::string &src_path);
 
+	/*
+		The cache remembers which files had their content checked, by size
+		and modification time, so they don't have to be checked again
+		until they change. The index is saved in the cache directory.
+	*/
+	bool isVerified(const std::string &name);
+	void setVerified(const std::string &name);
+	void saveIndex();
+
 private:
+	struct FileInfo {
+		uint64_t size;
+		uint64_t mtime;
+	};
+
 	std::string m_dir;
+	std::unordered_map<std::string, FileInfo> m_index;
+	bool m_index_loaded = false;
+	bool m_index_modified = false;
 
 	void createDir();
 	bool loadByPath(const std::string &path, std::ostream &os);
 	bool updateByPath(const std::string &path, std::string_view data);
+	void loadIndex();
+	void forget(const std::string &name);
 };
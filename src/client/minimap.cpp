@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "minimap.h"
 #include <cmath>
+#include <cstring>
 #include "client.h"
 #include "clientmap.h"
 #include "settings.h"
@@ -26,6 +27,46 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock.h"
 #include "client/renderingengine.h"
 #include "gettext.h"
+#include "porting.h"
+#include "profiler.h"
+
+// Tiles to combine before the work is split between threads
+#define MINIMAP_TILES_PARALLEL_MIN 16
+
+////
+//// MinimapTileJob
+////
+
+void MinimapTileJob::run(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) {
+		const v2s16 column = columns[i];
+		MinimapColumnTile &tile = tiles[i];
+		for (MinimapPixel &pixel : tile.data) {
+			pixel.n = MapNode(CONTENT_AIR);
+			pixel.height = 0;
+			pixel.air_count = 0;
+		}
+
+		// Bottom to top, so that the topmost surface wins
+		for (s16 y = block_ymin; y <= block_ymax; y++) {
+			auto it = blocks->find(v3s16(column.X, y, column.Y));
+			if (it == blocks->end())
+				continue;
+			const MinimapMapblock &block = *it->second;
+			const u16 base = (y - block_ymin) * MAP_BLOCKSIZE;
+			for (u32 k = 0; k < MAP_BLOCKSIZE * MAP_BLOCKSIZE; k++) {
+				const MinimapPixel &in_pixel = block.data[k];
+				MinimapPixel &out_pixel = tile.data[k];
+				out_pixel.air_count += in_pixel.air_count;
+				if (in_pixel.n.param0 != CONTENT_AIR) {
+					out_pixel.n = in_pixel.n;
+					out_pixel.height = base + in_pixel.height;
+				}
+			}
+		}
+	}
+}
 
 ////
 //// MinimapUpdateThread
@@ -106,66 +147,200 @@ void MinimapUpdateThread::doUpdate()
 				m_blocks_cache.erase(it);
 			}
 		}
-	}
 
+		// The column must be combined again
+		const v2s16 column(update.pos.X, update.pos.Z);
+		m_column_tiles.erase(column);
+		m_dirty_columns.insert(column);
+	}
 
-	if (data->map_invalidated && (
-				data->mode.type == MINIMAP_TYPE_RADAR ||
-				data->mode.type == MINIMAP_TYPE_SURFACE)) {
-		getMap(data->pos, data->mode.map_size, data->mode.scan_height);
-		data->map_invalidated = false;
+	if (data->mode.type == MINIMAP_TYPE_RADAR ||
+			data->mode.type == MINIMAP_TYPE_SURFACE) {
+		ScopeProfiler sp(g_profiler, "Minimap: update thread", SPT_AVG);
+		updateScan(data->pos, data->mode.map_size, data->mode.scan_height);
+	} else {
+		m_dirty_columns.clear();
 	}
 }
 
-void MinimapUpdateThread::getMap(v3s16 pos, s16 size, s16 height)
+void MinimapUpdateThread::updateScan(v3s16 pos, s16 size, s16 height)
 {
 	v3s16 pos_min(pos.X - size / 2, pos.Y - height / 2, pos.Z - size / 2);
 	v3s16 pos_max(pos_min.X + size - 1, pos.Y + height / 2, pos_min.Z + size - 1);
 	v3s16 blockpos_min = getNodeBlockPos(pos_min);
 	v3s16 blockpos_max = getNodeBlockPos(pos_max);
 
-// clear the map
-	for (int z = 0; z < size; z++)
-	for (int x = 0; x < size; x++) {
-		MinimapPixel &mmpixel = data->minimap_scan[x + z * size];
-		mmpixel.air_count = 0;
-		mmpixel.height = 0;
-		mmpixel.n = MapNode(CONTENT_AIR);
-	}
-
-// draw the map
-	v3s16 blockpos;
-	for (blockpos.Z = blockpos_min.Z; blockpos.Z <= blockpos_max.Z; ++blockpos.Z)
-	for (blockpos.Y = blockpos_min.Y; blockpos.Y <= blockpos_max.Y; ++blockpos.Y)
-	for (blockpos.X = blockpos_min.X; blockpos.X <= blockpos_max.X; ++blockpos.X) {
-		std::map<v3s16, MinimapMapblock *>::const_iterator pblock =
-			m_blocks_cache.find(blockpos);
-		if (pblock == m_blocks_cache.end())
+	// Tiles combine exactly the mapblocks of the scanned height
+	if (blockpos_min.Y != m_tiles_ymin || blockpos_max.Y != m_tiles_ymax) {
+		m_column_tiles.clear();
+		m_tiles_ymin = blockpos_min.Y;
+		m_tiles_ymax = blockpos_max.Y;
+	}
+
+	// Don't keep tiles far out of view
+	const size_t columns_in_view = (blockpos_max.X - blockpos_min.X + 1) *
+			(blockpos_max.Z - blockpos_min.Z + 1);
+	if (m_column_tiles.size() > 2 * columns_in_view) {
+		for (auto it = m_column_tiles.begin(); it != m_column_tiles.end();) {
+			const v2s16 column = it->first;
+			if (column.X < blockpos_min.X - 1 || column.X > blockpos_max.X + 1 ||
+					column.Y < blockpos_min.Z - 1 || column.Y > blockpos_max.Z + 1)
+				it = m_column_tiles.erase(it);
+			else
+				++it;
+		}
+	}
+
+	// Combine the missing tiles
+	MinimapTileJob job;
+	job.blocks = &m_blocks_cache;
+	job.block_ymin = blockpos_min.Y;
+	job.block_ymax = blockpos_max.Y;
+	for (s16 z = blockpos_min.Z; z <= blockpos_max.Z; z++)
+	for (s16 x = blockpos_min.X; x <= blockpos_max.X; x++) {
+		if (m_column_tiles.find(v2s16(x, z)) == m_column_tiles.end())
+			job.columns.emplace_back(x, z);
+	}
+	if (!job.columns.empty()) {
+		combineTiles(job);
+		for (size_t i = 0; i < job.columns.size(); i++)
+			m_column_tiles[job.columns[i]] = job.tiles[i];
+	}
+	g_profiler->avg("Minimap: tiles combined [#]", job.columns.size());
+
+	MutexAutoLock lock(data->scan_mutex);
+
+	const core::rect<s16> area(0, 0, size, size);
+	const v2s16 shift(pos.X - data->scan_pos.X, pos.Z - data->scan_pos.Z);
+	const s16 base_y = blockpos_min.Y * MAP_BLOCKSIZE;
+	if (data->map_invalidated || size != data->scan_size ||
+			base_y != data->scan_base_y ||
+			std::abs(shift.X) >= size || std::abs(shift.Y) >= size) {
+		copyFromTiles(pos_min, size, area);
+		data->scan_full = true;
+		data->scan_shift = v2s16(0, 0);
+		data->scan_dirty.clear();
+		data->map_invalidated = false;
+	} else {
+		std::vector<core::rect<s16>> changed;
+		if (shift.X != 0 || shift.Y != 0) {
+			shiftScan(size, shift);
+			data->scan_shift += shift;
+
+			// Changes not applied yet moved along
+			for (auto it = data->scan_dirty.begin(); it != data->scan_dirty.end();) {
+				*it -= shift;
+				it->clipAgainst(area);
+				if (it->getWidth() <= 0 || it->getHeight() <= 0)
+					it = data->scan_dirty.erase(it);
+				else
+					++it;
+			}
+
+			// Newly visible strips
+			if (shift.X > 0)
+				changed.emplace_back(size - shift.X, 0, size, size);
+			else if (shift.X < 0)
+				changed.emplace_back(0, 0, -shift.X, size);
+			if (shift.Y > 0)
+				changed.emplace_back(0, size - shift.Y, size, size);
+			else if (shift.Y < 0)
+				changed.emplace_back(0, 0, size, -shift.Y);
+		}
+
+		for (v2s16 column : m_dirty_columns) {
+			core::rect<s16> r(column.X * MAP_BLOCKSIZE - pos_min.X,
+					column.Y * MAP_BLOCKSIZE - pos_min.Z,
+					(column.X + 1) * MAP_BLOCKSIZE - pos_min.X,
+					(column.Y + 1) * MAP_BLOCKSIZE - pos_min.Z);
+			r.clipAgainst(area);
+			if (r.getWidth() > 0 && r.getHeight() > 0)
+				changed.push_back(r);
+		}
+
+		for (const core::rect<s16> &r : changed) {
+			copyFromTiles(pos_min, size, r);
+			data->scan_dirty.push_back(r);
+		}
+	}
+	m_dirty_columns.clear();
+
+	data->scan_pos = pos;
+	data->scan_size = size;
+	data->scan_base_y = base_y;
+}
+
+void MinimapUpdateThread::combineTiles(MinimapTileJob &job)
+{
+	const size_t count = job.columns.size();
+	job.tiles.resize(count);
+	if (count < MINIMAP_TILES_PARALLEL_MIN) {
+		job.run(0, count);
+		return;
+	}
+
+	if (!m_tile_runner) {
+		const int threads = MYMIN(4, (int)Thread::getNumberOfProcessors() / 2);
+		m_tile_runner = std::make_unique<ParallelRunner>("MinimapTile",
+				MYMAX(1, threads));
+	}
+	m_tile_runner->run(count, [&job] (u32 begin, u32 end) {
+		job.run(begin, end);
+	});
+}
+
+void MinimapUpdateThread::shiftScan(s16 size, v2s16 shift)
+{
+	// Pixel (x, z) takes the value of (x + shift.X, z + shift.Y)
+	const s16 x_dst = MYMAX(0, -shift.X);
+	const s16 x_src = MYMAX(0, shift.X);
+	const s16 width = size - std::abs(shift.X);
+	const s16 rows = size - std::abs(shift.Y);
+	MinimapPixel *scan = data->minimap_scan;
+	for (s16 i = 0; i < rows; i++) {
+		// Don't overwrite rows that are still to be read
+		const s16 z = shift.Y >= 0 ? i : size - 1 - i;
+		if (z + shift.Y < 0 || z + shift.Y >= size)
 			continue;
-		const MinimapMapblock &block = *pblock->second;
-
-		v3s16 block_node_min(blockpos * MAP_BLOCKSIZE);
-		v3s16 block_node_max(block_node_min + MAP_BLOCKSIZE - 1);
-		// clip
-		v3s16 range_min = componentwise_max(block_node_min, pos_min);
-		v3s16 range_max = componentwise_min(block_node_max, pos_max);
-
-		v3s16 pos;
-		pos.Y = range_min.Y;
-		for (pos.Z = range_min.Z; pos.Z <= range_max.Z; ++pos.Z)
-		for (pos.X = range_min.X; pos.X <= range_max.X; ++pos.X) {
-			v3s16 inblock_pos = pos - block_node_min;
-			const MinimapPixel &in_pixel =
-				block.data[inblock_pos.Z * MAP_BLOCKSIZE + inblock_pos.X];
-
-			v3s16 inmap_pos = pos - pos_min;
-			MinimapPixel &out_pixel =
-				data->minimap_scan[inmap_pos.X + inmap_pos.Z * size];
-
-			out_pixel.air_count += in_pixel.air_count;
-			if (in_pixel.n.param0 != CONTENT_AIR) {
-				out_pixel.n = in_pixel.n;
-				out_pixel.height = inmap_pos.Y + in_pixel.height;
+		memmove(&scan[x_dst + z * size], &scan[x_src + (z + shift.Y) * size],
+				width * sizeof(MinimapPixel));
+	}
+}
+
+void MinimapUpdateThread::copyFromTiles(v3s16 pos_min, s16 size,
+		const core::rect<s16> &area)
+{
+	const v2s16 column_min(
+		getContainerPos(pos_min.X + area.UpperLeftCorner.X, MAP_BLOCKSIZE),
+		getContainerPos(pos_min.Z + area.UpperLeftCorner.Y, MAP_BLOCKSIZE));
+	const v2s16 column_max(
+		getContainerPos(pos_min.X + area.LowerRightCorner.X - 1, MAP_BLOCKSIZE),
+		getContainerPos(pos_min.Z + area.LowerRightCorner.Y - 1, MAP_BLOCKSIZE));
+
+	v2s16 column;
+	for (column.Y = column_min.Y; column.Y <= column_max.Y; column.Y++)
+	for (column.X = column_min.X; column.X <= column_max.X; column.X++) {
+		auto it = m_column_tiles.find(column);
+		const MinimapColumnTile *tile =
+			it != m_column_tiles.end() ? &it->second : nullptr;
+
+		// Part of the column inside the area, in scan coordinates
+		const s16 node_x = column.X * MAP_BLOCKSIZE - pos_min.X;
+		const s16 node_z = column.Y * MAP_BLOCKSIZE - pos_min.Z;
+		const s16 x0 = MYMAX(area.UpperLeftCorner.X, node_x);
+		const s16 x1 = MYMIN(area.LowerRightCorner.X, node_x + MAP_BLOCKSIZE);
+		const s16 z0 = MYMAX(area.UpperLeftCorner.Y, node_z);
+		const s16 z1 = MYMIN(area.LowerRightCorner.Y, node_z + MAP_BLOCKSIZE);
+
+		for (s16 z = z0; z < z1; z++)
+		for (s16 x = x0; x < x1; x++) {
+			MinimapPixel &out_pixel = data->minimap_scan[x + z * size];
+			if (tile) {
+				out_pixel = tile->data[(z - node_z) * MAP_BLOCKSIZE + (x - node_x)];
+			} else {
+				out_pixel.n = MapNode(CONTENT_AIR);
+				out_pixel.height = 0;
+				out_pixel.air_count = 0;
 			}
 		}
 	}
@@ -232,6 +407,13 @@ Minimap::~Minimap()
 	driver->removeTexture(data->texture);
 	driver->removeTexture(data->heightmap_texture);
 
+	if (m_map_image)
+		m_map_image->drop();
+	if (m_heightmap_image)
+		m_heightmap_image->drop();
+	if (m_minimap_image)
+		m_minimap_image->drop();
+
 	for (MinimapMarker *m : m_markers)
 		delete m;
 	m_markers.clear();
@@ -397,30 +579,33 @@ void Minimap::setAngle(f32 angle)
 	m_angle = angle;
 }
 
-void Minimap::blitMinimapPixelsToImageRadar(video::IImage *map_image)
+void Minimap::blitMinimapPixelsToImageRadar(video::IImage *map_image,
+		const core::rect<s16> &area)
 {
+	const u16 size = data->scan_size;
 	video::SColor c(240, 0, 0, 0);
-	for (s16 x = 0; x < data->mode.map_size; x++)
-	for (s16 z = 0; z < data->mode.map_size; z++) {
-		MinimapPixel *mmpixel = &data->minimap_scan[x + z * data->mode.map_size];
+	for (s16 x = area.UpperLeftCorner.X; x < area.LowerRightCorner.X; x++)
+	for (s16 z = area.UpperLeftCorner.Y; z < area.LowerRightCorner.Y; z++) {
+		MinimapPixel *mmpixel = &data->minimap_scan[x + z * size];
 
 		if (mmpixel->air_count > 0)
 			c.setGreen(core::clamp(core::round32(32 + mmpixel->air_count * 8), 0, 255));
 		else
 			c.setGreen(0);
 
-		map_image->setPixel(x, data->mode.map_size - z - 1, c);
+		map_image->setPixel(x, size - z - 1, c);
 	}
 }
 
-void Minimap::blitMinimapPixelsToImageSurface(
-	video::IImage *map_image, video::IImage *heightmap_image)
+void Minimap::blitMinimapPixelsToImageSurface(video::IImage *map_image,
+		video::IImage *heightmap_image, const core::rect<s16> &area)
 {
+	const u16 size = data->scan_size;
 	// This variable creation/destruction has a 1% cost on rendering minimap
 	video::SColor tilecolor;
-	for (s16 x = 0; x < data->mode.map_size; x++)
-	for (s16 z = 0; z < data->mode.map_size; z++) {
-		MinimapPixel *mmpixel = &data->minimap_scan[x + z * data->mode.map_size];
+	for (s16 x = area.UpperLeftCorner.X; x < area.LowerRightCorner.X; x++)
+	for (s16 z = area.UpperLeftCorner.Y; z < area.LowerRightCorner.Y; z++) {
+		MinimapPixel *mmpixel = &data->minimap_scan[x + z * size];
 
 		const ContentFeatures &f = m_ndef->get(mmpixel->n);
 		const TileDef *tile = &f.tiledef[0];
@@ -436,12 +621,72 @@ void Minimap::blitMinimapPixelsToImageSurface(
 		tilecolor.setBlue(tilecolor.getBlue() * f.minimap_color.getBlue() / 255);
 		tilecolor.setAlpha(240);
 
-		map_image->setPixel(x, data->mode.map_size - z - 1, tilecolor);
+		map_image->setPixel(x, size - z - 1, tilecolor);
+	}
+
+	blitMinimapHeightsToImage(heightmap_image, area);
+}
+
+void Minimap::blitMinimapHeightsToImage(video::IImage *heightmap_image,
+		const core::rect<s16> &area)
+{
+	const u16 size = data->scan_size;
+	// Heights are relative to the bottom of the scanned area
+	const s32 offset = data->scan_base_y -
+		(data->scan_pos.Y - data->mode.scan_height / 2);
+	for (s16 x = area.UpperLeftCorner.X; x < area.LowerRightCorner.X; x++)
+	for (s16 z = area.UpperLeftCorner.Y; z < area.LowerRightCorner.Y; z++) {
+		const MinimapPixel &mmpixel = data->minimap_scan[x + z * size];
+		u32 h = 0;
+		if (mmpixel.n.getContent() != CONTENT_AIR)
+			h = rangelim(mmpixel.height + offset, 0, 255);
+		heightmap_image->setPixel(x, size - z - 1, video::SColor(255, h, h, h));
+	}
+}
+
+// Moves the contents of image by (dx, dy) pixels, leaving the uncovered
+// pixels as they were
+static void shiftImage(video::IImage *image, s32 dx, s32 dy)
+{
+	const s32 width = image->getDimension().Width;
+	const s32 height = image->getDimension().Height;
+	const u32 pitch = image->getPitch();
+	const u32 bpp = image->getBytesPerPixel();
+	if (std::abs(dx) >= width || std::abs(dy) >= height)
+		return;
+
+	u8 *pixels = reinterpret_cast<u8 *>(image->getData());
+	const s32 x_dst = MYMAX(0, dx);
+	const s32 x_src = MYMAX(0, -dx);
+	const u32 row_bytes = (width - std::abs(dx)) * bpp;
+	for (s32 i = 0; i < height - std::abs(dy); i++) {
+		// Rows are read before they are overwritten
+		const s32 y = dy > 0 ? height - 1 - i : i;
+		if (y - dy < 0 || y - dy >= height)
+			continue;
+		memmove(pixels + y * pitch + x_dst * bpp,
+				pixels + (y - dy) * pitch + x_src * bpp, row_bytes);
+	}
+}
 
-		u32 h = mmpixel->height;
-		heightmap_image->setPixel(x,data->mode.map_size - z - 1,
-			video::SColor(255, h, h, h));
+// Copies image into texture if they match, otherwise replaces texture
+static video::ITexture *updateTexture(video::IVideoDriver *driver,
+		video::ITexture *texture, const io::path &name, video::IImage *image)
+{
+	if (texture && texture->getSize() == image->getDimension() &&
+			texture->getColorFormat() == image->getColorFormat() &&
+			texture->getPitch() == image->getPitch()) {
+		void *pixels = texture->lock(video::ETLM_WRITE_ONLY);
+		if (pixels) {
+			memcpy(pixels, image->getData(), image->getImageDataSizeInBytes());
+			texture->unlock();
+			return texture;
+		}
 	}
+
+	if (texture)
+		driver->removeTexture(texture);
+	return driver->addTexture(name, image);
 }
 
 video::IImage *Minimap::getMinimapMask()
@@ -467,53 +712,115 @@ video::IImage *Minimap::getMinimapMask()
 	return data->minimap_mask_square;
 }
 
+void Minimap::createImages(u16 size)
+{
+	if (m_map_image)
+		m_map_image->drop();
+	if (m_heightmap_image)
+		m_heightmap_image->drop();
+
+	core::dimension2d<u32> dim(size, size);
+	m_map_image = driver->createImage(video::ECF_A8R8G8B8, dim);
+	m_heightmap_image = driver->createImage(video::ECF_A8R8G8B8, dim);
+	m_heightmap_image->fill(video::SColor(255, 0, 0, 0));
+}
+
+bool Minimap::updateScanImages()
+{
+	MutexAutoLock lock(data->scan_mutex);
+
+	// Wait for the first scan of this mode
+	const u16 size = data->scan_size;
+	if (size == 0 || size != data->mode.map_size)
+		return false;
+
+	const bool full = data->scan_full || !m_map_image ||
+		m_map_image->getDimension().Width != size ||
+		m_image_type != data->mode.type;
+	const s16 pos_min_y = data->scan_pos.Y - data->mode.scan_height / 2;
+	const bool heights_moved = data->mode.type == MINIMAP_TYPE_SURFACE &&
+		pos_min_y != m_image_pos_min_y;
+	if (!full && !heights_moved && data->scan_shift == v2s16(0, 0) &&
+			data->scan_dirty.empty())
+		return false;
+
+	const core::rect<s16> area(0, 0, size, size);
+	std::vector<core::rect<s16>> changed;
+	if (full) {
+		if (!m_map_image || m_map_image->getDimension().Width != size)
+			createImages(size);
+		changed.push_back(area);
+	} else {
+		// Image rows go from north to south
+		shiftImage(m_map_image, -data->scan_shift.X, data->scan_shift.Y);
+		shiftImage(m_heightmap_image, -data->scan_shift.X, data->scan_shift.Y);
+		changed = data->scan_dirty;
+	}
+
+	for (const core::rect<s16> &r : changed) {
+		if (data->mode.type == MINIMAP_TYPE_SURFACE)
+			blitMinimapPixelsToImageSurface(m_map_image, m_heightmap_image, r);
+		else
+			blitMinimapPixelsToImageRadar(m_map_image, r);
+	}
+	// Heights are relative to the player
+	if (heights_moved && !full)
+		blitMinimapHeightsToImage(m_heightmap_image, area);
+
+	m_image_type = data->mode.type;
+	m_image_pos_min_y = pos_min_y;
+	data->scan_full = false;
+	data->scan_shift = v2s16(0, 0);
+	data->scan_dirty.clear();
+	return true;
+}
+
+void Minimap::blitTextureModeImage()
+{
+	if (!m_map_image || m_map_image->getDimension().Width != data->mode.map_size)
+		createImages(data->mode.map_size);
+	m_image_type = MINIMAP_TYPE_TEXTURE;
+
+	// Want to use texture source, to : 1 find texture, 2 cache it
+	video::ITexture* texture = m_tsrc->getTexture(data->mode.texture);
+	video::IImage* image = driver->createImageFromData(
+		 texture->getColorFormat(), texture->getSize(),
+		 texture->lock(video::ETLM_READ_ONLY), true, false);
+	texture->unlock();
+
+	auto dim = image->getDimension();
+
+	m_map_image->fill(video::SColor(255, 0, 0, 0));
+
+	image->copyTo(m_map_image,
+		irr::core::vector2d<int> {
+			((data->mode.map_size - (static_cast<int>(dim.Width))) >> 1)
+				- data->pos.X / data->mode.scale,
+			((data->mode.map_size - (static_cast<int>(dim.Height))) >> 1)
+				+ data->pos.Z / data->mode.scale
+		});
+	image->drop();
+}
+
 video::ITexture *Minimap::getMinimapTexture()
 {
-	// update minimap textures when new scan is ready
-	if (data->map_invalidated && data->mode.type != MINIMAP_TYPE_TEXTURE)
-		return data->texture;
-
-	// create minimap and heightmap images in memory
-	core::dimension2d<u32> dim(data->mode.map_size, data->mode.map_size);
-	video::IImage *map_image       = driver->createImage(video::ECF_A8R8G8B8, dim);
-	video::IImage *heightmap_image = driver->createImage(video::ECF_A8R8G8B8, dim);
-	video::IImage *minimap_image   = driver->createImage(video::ECF_A8R8G8B8,
-		core::dimension2d<u32>(MINIMAP_MAX_SX, MINIMAP_MAX_SY));
-
-	// Blit MinimapPixels to images
-	switch(data->mode.type) {
-	case MINIMAP_TYPE_OFF:
-		break;
-	case MINIMAP_TYPE_SURFACE:
-		blitMinimapPixelsToImageSurface(map_image, heightmap_image);
-		break;
-	case MINIMAP_TYPE_RADAR:
-		blitMinimapPixelsToImageRadar(map_image);
-		break;
-	case MINIMAP_TYPE_TEXTURE:
-		// Want to use texture source, to : 1 find texture, 2 cache it
-		video::ITexture* texture = m_tsrc->getTexture(data->mode.texture);
-		video::IImage* image = driver->createImageFromData(
-			 texture->getColorFormat(), texture->getSize(),
-			 texture->lock(video::ETLM_READ_ONLY), true, false);
-		texture->unlock();
-
-		auto dim = image->getDimension();
-
-		map_image->fill(video::SColor(255, 0, 0, 0));
-
-		image->copyTo(map_image,
-			irr::core::vector2d<int> {
-				((data->mode.map_size - (static_cast<int>(dim.Width))) >> 1)
-					- data->pos.X / data->mode.scale,
-				((data->mode.map_size - (static_cast<int>(dim.Height))) >> 1)
-					+ data->pos.Z / data->mode.scale
-			});
-		image->drop();
-	}
-
-	map_image->copyToScaling(minimap_image);
-	map_image->drop();
+	ScopeProfiler sp(g_profiler, "Minimap: texture update", SPT_AVG);
+
+	// Only the pixels changed by the update thread are redrawn
+	if (data->mode.type == MINIMAP_TYPE_TEXTURE) {
+		blitTextureModeImage();
+	} else if (!updateScanImages()) {
+		// Nothing to do unless the shape changed
+		if (!m_map_image || m_image_type != data->mode.type ||
+				m_image_shape_round == data->minimap_shape_round)
+			return data->texture;
+	}
+
+	if (!m_minimap_image) {
+		m_minimap_image = driver->createImage(video::ECF_A8R8G8B8,
+			core::dimension2d<u32>(MINIMAP_MAX_SX, MINIMAP_MAX_SY));
+	}
+	m_map_image->copyToScaling(m_minimap_image);
 
 	video::IImage *minimap_mask = getMinimapMask();
 
@@ -521,21 +828,15 @@ video::ITexture *Minimap::getMinimapTexture()
 	for (s16 x = 0; x < MINIMAP_MAX_SX; x++) {
 		const video::SColor &mask_col = minimap_mask->getPixel(x, y);
 		if (!mask_col.getAlpha())
-			minimap_image->setPixel(x, y, video::SColor(0,0,0,0));
+			m_minimap_image->setPixel(x, y, video::SColor(0,0,0,0));
 	}
+	m_image_shape_round = data->minimap_shape_round;
 
-	if (data->texture)
-		driver->removeTexture(data->texture);
-	if (data->heightmap_texture)
-		driver->removeTexture(data->heightmap_texture);
-
-	data->texture = driver->addTexture("minimap__", minimap_image);
-	data->heightmap_texture =
-		driver->addTexture("minimap_heightmap__", heightmap_image);
-	minimap_image->drop();
-	heightmap_image->drop();
-
-	data->map_invalidated = true;
+	// Updated in place, the textures keep their size between updates
+	data->texture = updateTexture(driver, data->texture, "minimap__",
+		m_minimap_image);
+	data->heightmap_texture = updateTexture(driver, data->heightmap_texture,
+		"minimap_heightmap__", m_heightmap_image);
 
 	return data->texture;
 }
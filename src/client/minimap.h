@@ -24,6 +24,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/thread.h"
 #include "voxel.h"
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -68,12 +70,35 @@ struct MinimapMapblock {
 	MinimapPixel data[MAP_BLOCKSIZE * MAP_BLOCKSIZE];
 };
 
+// All mapblocks of a column within the scanned height, combined
+struct MinimapColumnTile {
+	//! height is relative to the bottom of the lowest scanned mapblock
+	MinimapPixel data[MAP_BLOCKSIZE * MAP_BLOCKSIZE];
+};
+
 struct MinimapData {
 	MinimapModeDef mode;
 	v3s16 pos;
 	v3s16 old_pos;
 	MinimapPixel minimap_scan[MINIMAP_MAX_SX * MINIMAP_MAX_SY];
+	//! Requests a full rescan from the update thread
 	bool map_invalidated;
+
+	// The update thread changes minimap_scan incrementally and records the
+	// changes here until Minimap applies them to its images.
+	// Everything below and minimap_scan are protected by scan_mutex.
+	std::mutex scan_mutex;
+	v3s16 scan_pos;
+	u16 scan_size = 0;
+	//! World Y of MinimapPixel::height 0 in minimap_scan
+	s16 scan_base_y = 0;
+	//! Everything changed
+	bool scan_full = true;
+	//! The scan was scrolled by this many nodes (X, Z)
+	v2s16 scan_shift;
+	//! Changed areas of the scan, in its current coordinates
+	std::vector<core::rect<s16>> scan_dirty;
+
 	bool minimap_shape_round;
 	video::IImage *minimap_mask_round = nullptr;
 	video::IImage *minimap_mask_square = nullptr;
@@ -91,12 +116,22 @@ struct QueuedMinimapUpdate {
 	MinimapMapblock *data = nullptr;
 };
 
+// Mapblock columns to combine into tiles, split between the tile threads
+struct MinimapTileJob {
+	const std::map<v3s16, MinimapMapblock *> *blocks = nullptr;
+	s16 block_ymin = 0;
+	s16 block_ymax = 0;
+	std::vector<v2s16> columns;
+	std::vector<MinimapColumnTile> tiles;
+
+	void run(size_t begin, size_t end);
+};
+
 class MinimapUpdateThread : public UpdateThread {
 public:
 	MinimapUpdateThread() : UpdateThread("Minimap") {}
 	virtual ~MinimapUpdateThread();
 
-	void getMap(v3s16 pos, s16 size, s16 height);
 	void enqueueBlock(v3s16 pos, MinimapMapblock *data);
 	bool pushBlockUpdate(v3s16 pos, MinimapMapblock *data);
 	bool popBlockUpdate(QueuedMinimapUpdate *update);
@@ -107,9 +142,24 @@ class MinimapUpdateThread : public UpdateThread {
 	virtual void doUpdate();
 
 private:
+	// Brings data->minimap_scan up to date for the given area
+	void updateScan(v3s16 pos, s16 size, s16 height);
+	void combineTiles(MinimapTileJob &job);
+	void shiftScan(s16 size, v2s16 shift);
+	void copyFromTiles(v3s16 pos_min, s16 size, const core::rect<s16> &area);
+
 	std::mutex m_queue_mutex;
 	std::deque<QueuedMinimapUpdate> m_update_queue;
 	std::map<v3s16, MinimapMapblock *> m_blocks_cache;
+
+	// Combined columns, valid for the mapblock Y range below
+	std::map<v2s16, MinimapColumnTile> m_column_tiles;
+	s16 m_tiles_ymin = 0;
+	s16 m_tiles_ymax = -1;
+	// Columns that received new mapblocks since the last scan
+	std::set<v2s16> m_dirty_columns;
+	// Created on first use
+	std::unique_ptr<ParallelRunner> m_tile_runner;
 };
 
 class Minimap {
@@ -144,9 +194,12 @@ class Minimap {
 	video::IImage *getMinimapMask();
 	video::ITexture *getMinimapTexture();
 
-	void blitMinimapPixelsToImageRadar(video::IImage *map_image);
+	void blitMinimapPixelsToImageRadar(video::IImage *map_image,
+		const core::rect<s16> &area);
 	void blitMinimapPixelsToImageSurface(video::IImage *map_image,
-		video::IImage *heightmap_image);
+		video::IImage *heightmap_image, const core::rect<s16> &area);
+	void blitMinimapHeightsToImage(video::IImage *heightmap_image,
+		const core::rect<s16> &area);
 
 	scene::SMeshBuffer *getMinimapMeshBuffer();
 
@@ -161,6 +214,12 @@ class Minimap {
 	MinimapData *data;
 
 private:
+	// Applies the changes of the scan to m_map_image and m_heightmap_image,
+	// false if there were none
+	bool updateScanImages();
+	void blitTextureModeImage();
+	void createImages(u16 size);
+
 	ITextureSource *m_tsrc;
 	IShaderSource *m_shdrsrc;
 	const NodeDefManager *m_ndef;
@@ -174,4 +233,12 @@ class Minimap {
 	std::mutex m_mutex;
 	std::list<MinimapMarker*> m_markers;
 	std::list<v2f> m_active_markers;
+
+	// Kept between updates, so that only changed pixels are redrawn
+	video::IImage *m_map_image = nullptr;
+	video::IImage *m_heightmap_image = nullptr;
+	video::IImage *m_minimap_image = nullptr;
+	MinimapType m_image_type = MINIMAP_TYPE_OFF;
+	s16 m_image_pos_min_y = 0;
+	bool m_image_shape_round = false;
 };
@@ -0,0 +1,264 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "occlusion_buffer.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "profiler.h"
+
+/*
+	OcclusionBuffer
+*/
+
+static u16 roundUpToPowerOfTwo(u16 size)
+{
+	u16 result = 1;
+	while (result < size && result < 0x8000)
+		result <<= 1;
+	return result;
+}
+
+OcclusionBuffer::OcclusionBuffer(u16 size) :
+	m_size(roundUpToPowerOfTwo(size))
+{
+	for (u32 level_size = m_size; level_size > 0; level_size >>= 1)
+		m_levels.emplace_back(level_size * level_size, FLT_MAX);
+}
+
+void OcclusionBuffer::setView(const OcclusionView &view)
+{
+	m_view = view;
+
+	v3f up_hint(0, 1, 0);
+	if (std::fabs(m_view.direction.Y) > 0.99f)
+		up_hint = v3f(1, 0, 0);
+	m_right = up_hint.crossProduct(m_view.direction);
+	m_right.normalize();
+	m_up = m_view.direction.crossProduct(m_right);
+
+	for (auto &level : m_levels)
+		std::fill(level.begin(), level.end(), FLT_MAX);
+	m_faces_drawn = 0;
+}
+
+bool OcclusionBuffer::project(const v3f &p, v2f *screen, f32 *depth) const
+{
+	v3f rel = p - m_view.position;
+	f32 z = rel.dotProduct(m_view.direction);
+	if (z < m_view.near_plane)
+		return false;
+
+	f32 scale = m_view.orthographic ? m_view.extent : z * m_view.extent;
+	f32 sx = rel.dotProduct(m_right) / scale;
+	f32 sy = rel.dotProduct(m_up) / scale;
+	screen->X = (sx * 0.5f + 0.5f) * m_size;
+	screen->Y = (0.5f - sy * 0.5f) * m_size;
+	*depth = z;
+	return true;
+}
+
+void OcclusionBuffer::addOccluder(const OcclusionOccluder &occluder)
+{
+	const v3f &a = occluder.box.MinEdge;
+	const v3f &b = occluder.box.MaxEdge;
+	// Corners of each side, in the bit order of solid_sides
+	const v3f sides[6][4] = {
+		{{a.X, a.Y, a.Z}, {a.X, b.Y, a.Z}, {a.X, b.Y, b.Z}, {a.X, a.Y, b.Z}}, // -X
+		{{b.X, a.Y, a.Z}, {b.X, b.Y, a.Z}, {b.X, b.Y, b.Z}, {b.X, a.Y, b.Z}}, // +X
+		{{a.X, a.Y, a.Z}, {b.X, a.Y, a.Z}, {b.X, a.Y, b.Z}, {a.X, a.Y, b.Z}}, // -Y
+		{{a.X, b.Y, a.Z}, {b.X, b.Y, a.Z}, {b.X, b.Y, b.Z}, {a.X, b.Y, b.Z}}, // +Y
+		{{a.X, a.Y, a.Z}, {b.X, a.Y, a.Z}, {b.X, b.Y, a.Z}, {a.X, b.Y, a.Z}}, // -Z
+		{{a.X, a.Y, b.Z}, {b.X, a.Y, b.Z}, {b.X, b.Y, b.Z}, {a.X, b.Y, b.Z}}, // +Z
+	};
+	static const v3f normals[6] = {
+		v3f(-1, 0, 0), v3f(1, 0, 0),
+		v3f(0, -1, 0), v3f(0, 1, 0),
+		v3f(0, 0, -1), v3f(0, 0, 1),
+	};
+
+	for (int side = 0; side < 6; side++) {
+		if (!(occluder.solid_sides & (1 << side)))
+			continue;
+		// Only sides facing the viewer; the back sides are farther away anyway
+		v3f to_side = m_view.orthographic ? m_view.direction :
+				sides[side][0] - m_view.position;
+		if (normals[side].dotProduct(to_side) >= 0)
+			continue;
+		rasterizeQuad(sides[side]);
+	}
+}
+
+void OcclusionBuffer::rasterizeQuad(const v3f corners[4])
+{
+	v2f screen[4];
+	f32 depth = 0.0f;
+	for (int i = 0; i < 4; i++) {
+		f32 d;
+		if (!project(corners[i], &screen[i], &d))
+			return; // crosses the near plane, skip rather than clip
+		depth = std::max(depth, d);
+	}
+
+	// Edge functions of the convex quad, oriented so that inside is positive
+	f32 area = (screen[2] - screen[0]).X * (screen[3] - screen[1]).Y -
+			(screen[2] - screen[0]).Y * (screen[3] - screen[1]).X;
+	if (std::fabs(area) < 1e-3f)
+		return; // seen edge-on
+	const f32 orientation = area > 0 ? 1.0f : -1.0f;
+	auto inside = [&] (f32 x, f32 y) {
+		for (int i = 0; i < 4; i++) {
+			const v2f &p0 = screen[i];
+			const v2f &p1 = screen[(i + 1) % 4];
+			f32 e = (p1.X - p0.X) * (y - p0.Y) - (p1.Y - p0.Y) * (x - p0.X);
+			if (e * orientation < 0)
+				return false;
+		}
+		return true;
+	};
+
+	f32 min_x = screen[0].X, max_x = min_x, min_y = screen[0].Y, max_y = min_y;
+	for (int i = 1; i < 4; i++) {
+		min_x = std::min(min_x, screen[i].X);
+		max_x = std::max(max_x, screen[i].X);
+		min_y = std::min(min_y, screen[i].Y);
+		max_y = std::max(max_y, screen[i].Y);
+	}
+	// Texels completely inside the quad's bounding box
+	s32 x0 = std::max<s32>(0, std::ceil(min_x));
+	s32 y0 = std::max<s32>(0, std::ceil(min_y));
+	s32 x1 = std::min<s32>(m_size, std::floor(max_x)) - 1;
+	s32 y1 = std::min<s32>(m_size, std::floor(max_y)) - 1;
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	// A texel is covered if all of its corners are inside: evaluate the
+	// corner grid once, then combine.
+	const s32 grid_w = x1 - x0 + 2;
+	const s32 grid_h = y1 - y0 + 2;
+	std::vector<bool> corner_inside(grid_w * grid_h);
+	for (s32 gy = 0; gy < grid_h; gy++)
+	for (s32 gx = 0; gx < grid_w; gx++)
+		corner_inside[gy * grid_w + gx] = inside(x0 + gx, y0 + gy);
+
+	std::vector<f32> &buffer = m_levels[0];
+	for (s32 y = y0; y <= y1; y++)
+	for (s32 x = x0; x <= x1; x++) {
+		const s32 g = (y - y0) * grid_w + (x - x0);
+		if (corner_inside[g] && corner_inside[g + 1] &&
+				corner_inside[g + grid_w] && corner_inside[g + grid_w + 1]) {
+			f32 &texel = buffer[y * m_size + x];
+			texel = std::min(texel, depth);
+		}
+	}
+	m_faces_drawn++;
+}
+
+void OcclusionBuffer::buildHierarchy()
+{
+	for (size_t level = 1; level < m_levels.size(); level++) {
+		const u32 size = m_size >> level;
+		const u32 prev_size = size * 2;
+		const std::vector<f32> &prev = m_levels[level - 1];
+		std::vector<f32> &cur = m_levels[level];
+		for (u32 y = 0; y < size; y++)
+		for (u32 x = 0; x < size; x++) {
+			const u32 i = 2 * y * prev_size + 2 * x;
+			cur[y * size + x] = std::max(
+					std::max(prev[i], prev[i + 1]),
+					std::max(prev[i + prev_size], prev[i + prev_size + 1]));
+		}
+	}
+}
+
+bool OcclusionBuffer::isBoxOccluded(const aabb3f &box) const
+{
+	if (m_faces_drawn == 0)
+		return false;
+
+	f32 min_depth = FLT_MAX;
+	f32 min_x = FLT_MAX, max_x = -FLT_MAX, min_y = FLT_MAX, max_y = -FLT_MAX;
+	for (int i = 0; i < 8; i++) {
+		v3f corner(
+			(i & 1) ? box.MaxEdge.X : box.MinEdge.X,
+			(i & 2) ? box.MaxEdge.Y : box.MinEdge.Y,
+			(i & 4) ? box.MaxEdge.Z : box.MinEdge.Z);
+		v2f screen;
+		f32 depth;
+		if (!project(corner, &screen, &depth))
+			return false;
+		min_depth = std::min(min_depth, depth);
+		min_x = std::min(min_x, screen.X);
+		max_x = std::max(max_x, screen.X);
+		min_y = std::min(min_y, screen.Y);
+		max_y = std::max(max_y, screen.Y);
+	}
+
+	// Nothing is known about occluders outside of the buffer, and the view
+	// may turn before the next update: leave such boxes to frustum culling.
+	if (min_x < 0 || min_y < 0 || max_x >= m_size || max_y >= m_size)
+		return false;
+
+	const s32 x0 = min_x, y0 = min_y, x1 = max_x, y1 = max_y;
+
+	// Pick the level where the box covers at most 2x2 texels
+	size_t level = 0;
+	while (level + 1 < m_levels.size() &&
+			((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		level++;
+
+	const std::vector<f32> &buffer = m_levels[level];
+	const s32 size = m_size >> level;
+	for (s32 y = y0 >> level; y <= y1 >> level; y++)
+	for (s32 x = x0 >> level; x <= x1 >> level; x++) {
+		if (buffer[y * size + x] >= min_depth)
+			return false;
+	}
+	return true;
+}
+
+/*
+	OcclusionBufferThread
+*/
+
+void OcclusionBufferThread::rasterize(const OcclusionView &view,
+		std::vector<OcclusionOccluder> &&occluders)
+{
+	BackgroundTask::sync();
+
+	m_view = view;
+	m_occluders = std::move(occluders);
+	run([this] { rasterizeNow(); });
+}
+
+const OcclusionBuffer &OcclusionBufferThread::sync()
+{
+	BackgroundTask::sync();
+	return m_buffer;
+}
+
+void OcclusionBufferThread::rasterizeNow()
+{
+	ScopeProfiler sp(g_profiler, "CM::OcclusionBuffer rasterize", SPT_AVG);
+
+	m_buffer.setView(m_view);
+	for (const OcclusionOccluder &occluder : m_occluders)
+		m_buffer.addOccluder(occluder);
+	m_buffer.buildHierarchy();
+}
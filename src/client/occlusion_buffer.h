@@ -0,0 +1,110 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <vector>
+#include "irrlichttypes_bloated.h"
+#include "util/thread.h"
+
+/*
+	Software hierarchical depth buffer for coarse occlusion culling.
+
+	Occluders are the fully solid sides of nearby mapblock meshes (see
+	MapBlock::solid_sides), rasterized conservatively: a texel is only
+	covered if it lies completely inside the face, and it gets the farthest
+	depth of that face. Boxes are then tested against a max-depth pyramid,
+	so a box is reported occluded only if it lies behind occluders on every
+	texel it touches.
+*/
+
+struct OcclusionView
+{
+	v3f position;
+	// Must be normalized
+	v3f direction;
+	// Perspective: tangent of half the field of view (same on both axes)
+	// Orthographic: half the width/height of the view volume
+	f32 extent = 1.0f;
+	bool orthographic = false;
+	// Geometry closer than this is never considered occluded or occluding
+	f32 near_plane = BS;
+};
+
+struct OcclusionOccluder
+{
+	aabb3f box;
+	// Bitset of fully opaque sides, +Z-Z+Y-Y+X-X
+	u8 solid_sides;
+};
+
+class OcclusionBuffer
+{
+public:
+	OcclusionBuffer(u16 size = 128);
+
+	u16 getSize() const { return m_size; }
+
+	// Resets the buffer for a new point of view
+	void setView(const OcclusionView &view);
+
+	void addOccluder(const OcclusionOccluder &occluder);
+	// Finalizes the depth pyramid; call after all occluders have been added
+	void buildHierarchy();
+
+	// True if the box is certainly hidden behind occluders
+	bool isBoxOccluded(const aabb3f &box) const;
+
+	u32 getOccluderFaceCount() const { return m_faces_drawn; }
+
+private:
+	// Projects to texel coordinates and view depth; false if in front of the near plane
+	bool project(const v3f &p, v2f *screen, f32 *depth) const;
+	void rasterizeQuad(const v3f corners[4]);
+
+	const u16 m_size;
+	OcclusionView m_view;
+	v3f m_right;
+	v3f m_up;
+	// m_levels[0] is the full resolution buffer, each further level holds
+	// the maximum depth of 2x2 texels of the previous one
+	std::vector<std::vector<f32>> m_levels;
+	u32 m_faces_drawn = 0;
+};
+
+/*
+	Rasterizes an OcclusionBuffer in the background while the caller keeps
+	traversing the map. Usage per update: rasterize(), do other work,
+	then sync() and test boxes against the returned buffer.
+*/
+class OcclusionBufferThread : public BackgroundTask
+{
+public:
+	OcclusionBufferThread() : BackgroundTask("OcclusionBuffer") {}
+
+	void rasterize(const OcclusionView &view, std::vector<OcclusionOccluder> &&occluders);
+	const OcclusionBuffer &sync();
+
+private:
+	void rasterizeNow();
+
+	OcclusionBuffer m_buffer;
+	OcclusionView m_view;
+	std::vector<OcclusionOccluder> m_occluders;
+};
@@ -0,0 +1,223 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "particle_collision.h"
+#include <cmath>
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+
+// Seconds after which an unused block is dropped from the cache
+#define CACHE_UNUSED_TIMEOUT 10.0f
+// Moves touching more nodes than this are left to collisionMoveSimple
+#define MOVE_MAX_NODES 64
+
+static inline f32 &axis(v3f &v, int i)
+{
+	return i == 0 ? v.X : (i == 1 ? v.Y : v.Z);
+}
+
+static inline f32 axis(const v3f &v, int i)
+{
+	return i == 0 ? v.X : (i == 1 ? v.Y : v.Z);
+}
+
+static inline v3s16 getNodePos(const v3f &p)
+{
+	return v3s16(std::floor(p.X + 0.5f), std::floor(p.Y + 0.5f),
+			std::floor(p.Z + 0.5f));
+}
+
+ParticleCollisionCache::ParticleCollisionCache(Map *map,
+		const NodeDefManager *ndef) :
+	m_map(map),
+	m_ndef(ndef)
+{}
+
+void ParticleCollisionCache::invalidateBlock(v3s16 blockpos)
+{
+	m_blocks.erase(blockpos);
+}
+
+void ParticleCollisionCache::clear()
+{
+	m_blocks.clear();
+	m_object_boxes.clear();
+}
+
+void ParticleCollisionCache::step(float dtime)
+{
+	for (auto it = m_blocks.begin(); it != m_blocks.end();) {
+		it->second.unused_time += dtime;
+		if (it->second.unused_time > CACHE_UNUSED_TIMEOUT)
+			it = m_blocks.erase(it);
+		else
+			++it;
+	}
+}
+
+void ParticleCollisionCache::setObjectBoxes(const std::vector<aabb3f> &boxes)
+{
+	m_object_boxes.clear();
+	for (const aabb3f &box_bs : boxes) {
+		aabb3f box(box_bs.MinEdge / BS, box_bs.MaxEdge / BS);
+		v3s16 bpmin = getNodeBlockPos(getNodePos(box.MinEdge));
+		v3s16 bpmax = getNodeBlockPos(getNodePos(box.MaxEdge));
+		v3s16 bp;
+		for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+		for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+		for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++)
+			m_object_boxes[bp].push_back(box);
+	}
+}
+
+void ParticleCollisionCache::buildBlock(v3s16 blockpos, Block &block)
+{
+	MapBlock *b = m_map->getBlockNoCreateNoEx(blockpos);
+	if (!b) {
+		// Like collisionMoveSimple, collide with unloaded areas
+		block.solid.set();
+		return;
+	}
+
+	u32 i = 0;
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++, i++) {
+		const content_t c = b->getNodeNoCheck(x, y, z).getContent();
+		if (c == CONTENT_IGNORE) {
+			block.solid.set(i);
+			continue;
+		}
+		const ContentFeatures &f = m_ndef->get(c);
+		if (!f.walkable)
+			continue;
+		// Same choice of box as MapNode::getCollisionBoxes()
+		const NodeBox &nodebox = f.collision_box.fixed.empty() ?
+				f.node_box : f.collision_box;
+		if (nodebox.type == NODEBOX_REGULAR)
+			block.solid.set(i);
+		else
+			block.complex.set(i);
+	}
+}
+
+const ParticleCollisionCache::Block &ParticleCollisionCache::getBlock(v3s16 blockpos)
+{
+	auto it = m_blocks.find(blockpos);
+	if (it == m_blocks.end()) {
+		it = m_blocks.emplace(blockpos, Block()).first;
+		buildBlock(blockpos, it->second);
+	}
+	it->second.unused_time = 0.0f;
+	return it->second;
+}
+
+bool ParticleCollisionCache::move(const aabb3f &box, f32 dtime, v3f *pos,
+		v3f *speed, v3f accel, bool object_collision, bool *collides)
+{
+	const v3f dpos = (*speed + accel * 0.5f * dtime) * dtime;
+	const v3f newpos = *pos + dpos;
+
+	aabb3f swept(box.MinEdge + *pos, box.MaxEdge + *pos);
+	swept.addInternalBox(aabb3f(box.MinEdge + newpos, box.MaxEdge + newpos));
+
+	const v3s16 nmin = getNodePos(swept.MinEdge);
+	const v3s16 nmax = getNodePos(swept.MaxEdge);
+	const v3s16 extent = nmax - nmin + v3s16(1, 1, 1);
+	if (extent.X * extent.Y * extent.Z > MOVE_MAX_NODES)
+		return false;
+
+	// Collect the obstacles in reach
+	m_obstacles.clear();
+	const Block *block = nullptr;
+	v3s16 blockpos(S16_MAX, S16_MAX, S16_MAX);
+	v3s16 p;
+	for (p.Z = nmin.Z; p.Z <= nmax.Z; p.Z++)
+	for (p.Y = nmin.Y; p.Y <= nmax.Y; p.Y++)
+	for (p.X = nmin.X; p.X <= nmax.X; p.X++) {
+		v3s16 bp = getNodeBlockPos(p);
+		if (!block || bp != blockpos) {
+			block = &getBlock(bp);
+			blockpos = bp;
+		}
+		v3s16 rel = p - bp * MAP_BLOCKSIZE;
+		u32 i = (rel.Z * MAP_BLOCKSIZE + rel.Y) * MAP_BLOCKSIZE + rel.X;
+		if (block->complex[i])
+			return false;
+		if (block->solid[i])
+			m_obstacles.emplace_back(v3f(p.X - 0.5f, p.Y - 0.5f, p.Z - 0.5f),
+					v3f(p.X + 0.5f, p.Y + 0.5f, p.Z + 0.5f));
+	}
+
+	if (object_collision && !m_object_boxes.empty()) {
+		v3s16 bpmin = getNodeBlockPos(nmin), bpmax = getNodeBlockPos(nmax);
+		v3s16 bp;
+		for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+		for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+		for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++) {
+			auto it = m_object_boxes.find(bp);
+			if (it == m_object_boxes.end())
+				continue;
+			for (const aabb3f &object_box : it->second) {
+				if (object_box.intersectsWithBox(swept))
+					m_obstacles.push_back(object_box);
+			}
+		}
+	}
+
+	*speed += accel * dtime;
+	*collides = false;
+
+	// Move along one axis at a time, vertical first. Obstacles the box
+	// already overlaps are ignored, like in collisionMoveSimple.
+	static const f32 eps = 0.0001f;
+	aabb3f cur(box.MinEdge + *pos, box.MaxEdge + *pos);
+	for (int a : {1, 0, 2}) {
+		f32 delta = axis(dpos, a);
+		if (delta == 0.0f)
+			continue;
+		const int b = (a + 1) % 3, c = (a + 2) % 3;
+		bool hit = false;
+		for (const aabb3f &o : m_obstacles) {
+			if (axis(cur.MaxEdge, b) <= axis(o.MinEdge, b) ||
+					axis(cur.MinEdge, b) >= axis(o.MaxEdge, b) ||
+					axis(cur.MaxEdge, c) <= axis(o.MinEdge, c) ||
+					axis(cur.MinEdge, c) >= axis(o.MaxEdge, c))
+				continue;
+			if (delta > 0 && axis(cur.MaxEdge, a) <= axis(o.MinEdge, a) + eps &&
+					axis(cur.MaxEdge, a) + delta > axis(o.MinEdge, a)) {
+				delta = std::fmax(0.0f, axis(o.MinEdge, a) - axis(cur.MaxEdge, a));
+				hit = true;
+			} else if (delta < 0 && axis(cur.MinEdge, a) >= axis(o.MaxEdge, a) - eps &&
+					axis(cur.MinEdge, a) + delta < axis(o.MaxEdge, a)) {
+				delta = std::fmin(0.0f, axis(o.MaxEdge, a) - axis(cur.MinEdge, a));
+				hit = true;
+			}
+		}
+		axis(cur.MinEdge, a) += delta;
+		axis(cur.MaxEdge, a) += delta;
+		axis(*pos, a) += delta;
+		if (hit) {
+			axis(*speed, a) = 0.0f;
+			*collides = true;
+		}
+	}
+	return true;
+}
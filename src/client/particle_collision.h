@@ -0,0 +1,91 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <bitset>
+#include <unordered_map>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+#include "constants.h"
+
+class Map;
+class NodeDefManager;
+
+/*
+	Cheap collision for particles.
+
+	For every mapblock particles move through, one bit per node tells whether
+	the node is a walkable full cube (or ignore), and another whether it is
+	walkable with any other collision box. The bitmasks are built lazily from
+	the MapBlock data and must be invalidated when a node of the block changes.
+
+	Particles moving only near full cubes and the collision boxes of objects
+	are resolved here without touching the map. Anything else is left to
+	collisionMoveSimple.
+*/
+class ParticleCollisionCache
+{
+public:
+	ParticleCollisionCache(Map *map, const NodeDefManager *ndef);
+
+	// Forgets the cached data of a block, e.g. after one of its nodes changed
+	void invalidateBlock(v3s16 blockpos);
+	void clear();
+
+	// Ages the cached blocks and drops those unused for a while
+	void step(float dtime);
+
+	// Collision boxes of objects, in world coordinates (BS units).
+	// Replaces the previous set.
+	void setObjectBoxes(const std::vector<aabb3f> &boxes);
+
+	/*
+		Moves a box by speed and acceleration and stops it at walkable nodes
+		and, if object_collision, at object boxes. Positions and speeds are in
+		nodes, box is relative to pos. The speed along an axis becomes zero if
+		the box collides along it.
+
+		Returns false, without changing anything, if the move cannot be
+		resolved from the cache (non-cubic collision boxes or a long move).
+	*/
+	bool move(const aabb3f &box, f32 dtime, v3f *pos, v3f *speed, v3f accel,
+			bool object_collision, bool *collides);
+
+private:
+	struct Block
+	{
+		// Walkable full cubes, and ignore
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> solid;
+		// Walkable nodes with other collision boxes
+		std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> complex;
+		f32 unused_time = 0.0f;
+	};
+
+	const Block &getBlock(v3s16 blockpos);
+	void buildBlock(v3s16 blockpos, Block &block);
+
+	Map *m_map;
+	const NodeDefManager *m_ndef;
+	std::unordered_map<v3s16, Block> m_blocks;
+	// Object boxes (in nodes), listed under every mapblock they overlap
+	std::unordered_map<v3s16, std::vector<aabb3f>> m_object_boxes;
+	// Reused by move()
+	std::vector<aabb3f> m_obstacles;
+};
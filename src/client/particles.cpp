@@ -18,11 +18,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "particles.h"
+#include <algorithm>
 #include <cmath>
 #include "client.h"
 #include "collision.h"
 #include "client/content_cao.h"
 #include "client/clientevent.h"
+#include "client/particle_collision.h"
 #include "client/renderingengine.h"
 #include "util/numeric.h"
 #include "light.h"
@@ -32,6 +34,220 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "client.h"
 #include "settings.h"
+#include "profiler.h"
+
+/*
+	ParticleArena
+*/
+
+void ParticleArena::reserve(size_t count)
+{
+	for (auto *v : {&m_pos_x, &m_pos_y, &m_pos_z, &m_vel_x, &m_vel_y, &m_vel_z,
+			&m_acc_x, &m_acc_y, &m_acc_z, &m_drag_x, &m_drag_y, &m_drag_z,
+			&m_time, &m_expiration})
+		v->reserve(count);
+	m_simple.reserve(count);
+}
+
+void ParticleArena::clear()
+{
+	for (auto *v : {&m_pos_x, &m_pos_y, &m_pos_z, &m_vel_x, &m_vel_y, &m_vel_z,
+			&m_acc_x, &m_acc_y, &m_acc_z, &m_drag_x, &m_drag_y, &m_drag_z,
+			&m_time, &m_expiration})
+		v->clear();
+	m_simple.clear();
+}
+
+void ParticleArena::add(const ParticleParameters &p, bool simple)
+{
+	m_pos_x.push_back(p.pos.X);
+	m_pos_y.push_back(p.pos.Y);
+	m_pos_z.push_back(p.pos.Z);
+	m_vel_x.push_back(p.vel.X);
+	m_vel_y.push_back(p.vel.Y);
+	m_vel_z.push_back(p.vel.Z);
+	m_acc_x.push_back(p.acc.X);
+	m_acc_y.push_back(p.acc.Y);
+	m_acc_z.push_back(p.acc.Z);
+	m_drag_x.push_back(p.drag.X);
+	m_drag_y.push_back(p.drag.Y);
+	m_drag_z.push_back(p.drag.Z);
+	m_time.push_back(0.0f);
+	m_expiration.push_back(p.expirationtime);
+	m_simple.push_back(simple);
+}
+
+void ParticleArena::swapRemove(u32 i)
+{
+	for (auto *v : {&m_pos_x, &m_pos_y, &m_pos_z, &m_vel_x, &m_vel_y, &m_vel_z,
+			&m_acc_x, &m_acc_y, &m_acc_z, &m_drag_x, &m_drag_y, &m_drag_z,
+			&m_time, &m_expiration}) {
+		(*v)[i] = v->back();
+		v->pop_back();
+	}
+	m_simple[i] = m_simple.back();
+	m_simple.pop_back();
+}
+
+void ParticleArena::integrate(f32 dtime, u32 begin, u32 end)
+{
+	// Same motion as the non-colliding case of Particle::stepPhysics():
+	// drag scales the velocity per axis, then position and velocity are
+	// advanced with constant acceleration.
+	const f32 half_dtime = 0.5f * dtime;
+	for (u32 i = begin; i < end; i++) {
+		m_time[i] += dtime;
+
+		const bool simple = m_simple[i];
+		const f32 vx = m_vel_x[i] * (1.0f - m_drag_x[i] * dtime);
+		const f32 vy = m_vel_y[i] * (1.0f - m_drag_y[i] * dtime);
+		const f32 vz = m_vel_z[i] * (1.0f - m_drag_z[i] * dtime);
+		const f32 px = m_pos_x[i] + (vx + m_acc_x[i] * half_dtime) * dtime;
+		const f32 py = m_pos_y[i] + (vy + m_acc_y[i] * half_dtime) * dtime;
+		const f32 pz = m_pos_z[i] + (vz + m_acc_z[i] * half_dtime) * dtime;
+		m_pos_x[i] = simple ? px : m_pos_x[i];
+		m_pos_y[i] = simple ? py : m_pos_y[i];
+		m_pos_z[i] = simple ? pz : m_pos_z[i];
+		m_vel_x[i] = simple ? vx + m_acc_x[i] * dtime : m_vel_x[i];
+		m_vel_y[i] = simple ? vy + m_acc_y[i] * dtime : m_vel_y[i];
+		m_vel_z[i] = simple ? vz + m_acc_z[i] * dtime : m_vel_z[i];
+	}
+}
+
+/*
+	ParticleBuffer
+*/
+
+ParticleBuffer::ParticleBuffer(scene::ISceneManager *smgr,
+		const video::SMaterial &material) :
+	scene::ISceneNode(smgr->getRootSceneNode(), smgr),
+	m_mesh_buffer(new scene::SMeshBuffer())
+{
+	m_mesh_buffer->getMaterial() = material;
+	m_depth_sort = material.BlendOperation == video::EBO_ADD &&
+			material.MaterialTypeParam == video::pack_textureBlendFunc(
+				video::EBF_SRC_ALPHA, video::EBF_ONE_MINUS_SRC_ALPHA,
+				video::EMFN_MODULATE_1X,
+				video::EAS_TEXTURE | video::EAS_VERTEX_COLOR);
+	m_mesh_buffer->setHardwareMappingHint(scene::EHM_STREAM, scene::EBT_VERTEX);
+	m_mesh_buffer->setHardwareMappingHint(
+			m_depth_sort ? scene::EHM_STREAM : scene::EHM_STATIC, scene::EBT_INDEX);
+
+	setAutomaticCulling(scene::EAC_OFF);
+}
+
+bool ParticleBuffer::allocate(u16 *index)
+{
+	m_unused_time = 0.0f;
+
+	if (!m_free_list.empty()) {
+		*index = m_free_list.back();
+		m_free_list.pop_back();
+		return true;
+	}
+	if (m_count >= MAX_PARTICLES_PER_BUFFER)
+		return false;
+
+	*index = m_count++;
+	m_mesh_buffer->Vertices.set_used(m_count * 4);
+	const u16 base = *index * 4;
+	for (u16 i : {0, 1, 2, 2, 3, 0})
+		m_mesh_buffer->Indices.push_back(base + i);
+	m_mesh_buffer->setDirty(scene::EBT_INDEX);
+	return true;
+}
+
+void ParticleBuffer::release(u16 index)
+{
+	// Collapse the quad so that nothing is drawn until it is reused
+	video::S3DVertex *vertices = getVertices(index);
+	for (u16 i = 0; i < 4; i++)
+		vertices[i].Pos = v3f();
+	m_free_list.push_back(index);
+}
+
+video::S3DVertex *ParticleBuffer::getVertices(u16 index)
+{
+	m_vertices_dirty = true;
+	m_box_dirty = true;
+	m_order_dirty = true;
+	return &m_mesh_buffer->Vertices[index * 4];
+}
+
+bool ParticleBuffer::expireIfEmpty(float dtime)
+{
+	if (!isEmpty())
+		return false;
+	m_unused_time += dtime;
+	return m_unused_time > 5.0f;
+}
+
+const aabb3f &ParticleBuffer::getBoundingBox() const
+{
+	if (m_box_dirty) {
+		m_mesh_buffer->recalculateBoundingBox();
+		m_box_dirty = false;
+	}
+	return m_mesh_buffer->getBoundingBox();
+}
+
+void ParticleBuffer::OnRegisterSceneNode()
+{
+	if (IsVisible && !isEmpty())
+		SceneManager->registerNodeForRendering(this, scene::ESNRP_TRANSPARENT_EFFECT);
+
+	ISceneNode::OnRegisterSceneNode();
+}
+
+void ParticleBuffer::sortQuads(v3f camera_pos)
+{
+	m_quad_order.clear();
+	const video::S3DVertex *vertices = m_mesh_buffer->Vertices.const_pointer();
+	for (u16 i = 0; i < m_count; i++) {
+		// Released quads are collapsed, drawing them costs nothing
+		const v3f center = (vertices[i * 4].Pos + vertices[i * 4 + 2].Pos) * 0.5f;
+		m_quad_order.emplace_back(center.getDistanceFromSQ(camera_pos), i);
+	}
+	std::sort(m_quad_order.begin(), m_quad_order.end(),
+		[] (const std::pair<f32, u16> &a, const std::pair<f32, u16> &b) {
+			return a.first > b.first;
+		});
+
+	auto &indices = m_mesh_buffer->Indices;
+	indices.set_used(m_count * 6);
+	u16 *out = indices.pointer();
+	for (const auto &it : m_quad_order) {
+		const u16 base = it.second * 4;
+		for (u16 i : {0, 1, 2, 2, 3, 0})
+			*out++ = base + i;
+	}
+	m_mesh_buffer->setDirty(scene::EBT_INDEX);
+
+	m_sort_camera_pos = camera_pos;
+	m_order_dirty = false;
+}
+
+void ParticleBuffer::render()
+{
+	if (m_depth_sort) {
+		scene::ICameraSceneNode *camera = SceneManager->getActiveCamera();
+		if (camera) {
+			const v3f camera_pos = camera->getAbsolutePosition();
+			if (m_order_dirty || camera_pos != m_sort_camera_pos)
+				sortQuads(camera_pos);
+		}
+	}
+
+	if (m_vertices_dirty) {
+		m_mesh_buffer->setDirty(scene::EBT_VERTEX);
+		m_vertices_dirty = false;
+	}
+
+	video::IVideoDriver *driver = SceneManager->getVideoDriver();
+	driver->setMaterial(m_mesh_buffer->getMaterial());
+	driver->setTransform(video::ETS_WORLD, core::IdentityMatrix);
+	driver->drawMeshBuffer(m_mesh_buffer.get());
+}
 
 /*
 	Particle
@@ -49,20 +265,11 @@ Particle::Particle(
 		ParticleSpawner *parent,
 		std::unique_ptr<ClientParticleTexture> owned_texture
 	) :
-		scene::ISceneNode(((Client *)gamedef)->getSceneManager()->getRootSceneNode(),
-				((Client *)gamedef)->getSceneManager()),
-
-		m_expiration(p.expirationtime),
-
 		m_env(env),
 		m_gamedef(gamedef),
-		m_collisionbox(aabb3f(v3f(-p.size / 2.0f), v3f(p.size / 2.0f))),
 		m_texture(texture),
 		m_texpos(texpos),
 		m_texsize(texsize),
-		m_pos(p.pos),
-		m_velocity(p.vel),
-		m_acceleration(p.acc),
 		m_p(p),
 		m_player(player),
 
@@ -128,59 +335,60 @@ Particle::Particle(
 		m_material.BlendOperation = blendop;
 		m_material.setTexture(0, m_texture.ref);
 	}
-
-	// Irrlicht stuff
-	this->setAutomaticCulling(scene::EAC_OFF);
-
-	// Init lighting
-	updateLight();
-
-	// Init model
-	updateVertices();
 }
 
-void Particle::OnRegisterSceneNode()
+Particle::~Particle()
 {
-	if (IsVisible)
-		SceneManager->registerNodeForRendering(this, scene::ESNRP_TRANSPARENT_EFFECT);
-
-	ISceneNode::OnRegisterSceneNode();
+	if (m_buffer)
+		m_buffer->release(m_buffer_index);
 }
 
-void Particle::render()
+bool Particle::isSimple() const
 {
-	video::IVideoDriver *driver = SceneManager->getVideoDriver();
-	driver->setMaterial(m_material);
-	driver->setTransform(video::ETS_WORLD, AbsoluteTransformation);
+	return !m_p.collisiondetection &&
+			m_p.jitter.min.val == v3f() && m_p.jitter.max.val == v3f();
+}
 
-	u16 indices[] = {0,1,2, 2,3,0};
-	driver->drawVertexPrimitiveList(m_vertices, 4,
-			indices, 2, video::EVT_STANDARD,
-			scene::EPT_TRIANGLES, video::EIT_16BIT);
+void Particle::attachToBuffer(ParticleBuffer *buffer, u16 index)
+{
+	m_buffer = buffer;
+	m_buffer_index = index;
 }
 
-void Particle::step(float dtime)
+void Particle::stepPhysics(float dtime, ParticleArena &arena, u32 index,
+		ParticleCollisionCache *cache)
 {
-	m_time += dtime;
+	v3f pos = arena.getPosition(index);
+	v3f velocity = arena.getVelocity(index);
 
 	// apply drag (not handled by collisionMoveSimple) and brownian motion
-	v3f av = vecAbsolute(m_velocity);
+	v3f av = vecAbsolute(velocity);
 	av -= av * (m_p.drag * dtime);
-	m_velocity = av*vecSign(m_velocity) + v3f(m_p.jitter.pickWithin())*dtime;
+	velocity = av*vecSign(velocity) + v3f(m_p.jitter.pickWithin())*dtime;
 
 	if (m_p.collisiondetection) {
-		aabb3f box = m_collisionbox;
-		v3f p_pos = m_pos * BS;
-		v3f p_velocity = m_velocity * BS;
-		collisionMoveResult r = collisionMoveSimple(m_env, m_gamedef, BS * 0.5f,
-			box, 0.0f, dtime, &p_pos, &p_velocity, m_acceleration * BS, nullptr,
-			m_p.object_collision);
+		aabb3f box(v3f(-m_p.size / 2.0f), v3f(m_p.size / 2.0f));
+		v3f new_pos = pos;
+		v3f new_velocity = velocity;
+		bool collides = false;
+		if (!cache || !cache->move(aabb3f(box.MinEdge / BS, box.MaxEdge / BS),
+				dtime, &new_pos, &new_velocity, m_p.acc,
+				m_p.object_collision, &collides)) {
+			v3f p_pos = pos * BS;
+			v3f p_velocity = velocity * BS;
+			collisionMoveResult r = collisionMoveSimple(m_env, m_gamedef, BS * 0.5f,
+				box, 0.0f, dtime, &p_pos, &p_velocity, m_p.acc * BS, nullptr,
+				m_p.object_collision);
+			collides = r.collides;
+			new_pos = p_pos / BS;
+			new_velocity = p_velocity / BS;
+		}
 
 		f32 bounciness = m_p.bounce.pickWithin();
-		if (r.collides && (m_p.collision_removal || bounciness > 0)) {
+		if (collides && (m_p.collision_removal || bounciness > 0)) {
 			if (m_p.collision_removal) {
 				// force expiration of the particle
-				m_expiration = -1.0f;
+				arena.setExpiration(index, -1.0f);
 			} else if (bounciness > 0) {
 				/* cheap way to get a decent bounce effect is to only invert the
 				 * largest component of the velocity vector, so e.g. you don't
@@ -191,26 +399,36 @@ void Particle::step(float dtime)
 				 * with diagonal angles and entities will not yield the correct
 				 * visual. this is probably unavoidable */
 				if (av.Y > av.X && av.Y > av.Z) {
-					m_velocity.Y = -(m_velocity.Y * bounciness);
+					velocity.Y = -(velocity.Y * bounciness);
 				} else if (av.X > av.Y && av.X > av.Z) {
-					m_velocity.X = -(m_velocity.X * bounciness);
+					velocity.X = -(velocity.X * bounciness);
 				} else if (av.Z > av.Y && av.Z > av.X) {
-					m_velocity.Z = -(m_velocity.Z * bounciness);
+					velocity.Z = -(velocity.Z * bounciness);
 				} else { // well now we're in a bit of a pickle
-					m_velocity = -(m_velocity * bounciness);
+					velocity = -(velocity * bounciness);
 				}
 			}
 		} else {
-			m_velocity = p_velocity / BS;
+			velocity = new_velocity;
 		}
-		m_pos = p_pos / BS;
+		pos = new_pos;
 	} else {
 		// apply velocity and acceleration to position
-		m_pos += (m_velocity + m_acceleration * 0.5f * dtime) * dtime;
+		pos += (velocity + m_p.acc * 0.5f * dtime) * dtime;
 		// apply acceleration to velocity
-		m_velocity += m_acceleration * dtime;
+		velocity += m_p.acc * dtime;
 	}
 
+	arena.setPosition(index, pos);
+	arena.setVelocity(index, velocity);
+}
+
+void Particle::stepVisuals(float dtime, const ParticleArena &arena, u32 index)
+{
+	const v3f pos = arena.getPosition(index);
+	const float time = arena.getTime(index);
+	const float expiration = arena.getExpiration(index);
+
 	if (m_p.animation.type != TAT_NONE) {
 		m_animation_time += dtime;
 		int frame_length_i = 0;
@@ -226,30 +444,26 @@ void Particle::step(float dtime)
 
 	// animate particle alpha in accordance with settings
 	if (m_texture.tex != nullptr)
-		m_alpha = m_texture.tex -> alpha.blend(m_time / (m_expiration+0.1f));
+		m_alpha = m_texture.tex -> alpha.blend(time / (expiration+0.1f));
 	else
 		m_alpha = 1.f;
 
 	// Update lighting
-	updateLight();
+	updateLight(pos);
 
 	// Update model
-	updateVertices();
-
-	// Update position -- see #10398
-	v3s16 camera_offset = m_env->getCameraOffset();
-	setPosition(m_pos*BS - intToFloat(camera_offset, BS));
+	updateVertices(pos, time, expiration);
 }
 
-void Particle::updateLight()
+void Particle::updateLight(v3f pos)
 {
 	u8 light = 0;
 	bool pos_ok;
 
 	v3s16 p = v3s16(
-		floor(m_pos.X+0.5),
-		floor(m_pos.Y+0.5),
-		floor(m_pos.Z+0.5)
+		floor(pos.X+0.5),
+		floor(pos.Y+0.5),
+		floor(pos.Z+0.5)
 	);
 	MapNode n = m_env->getClientMap().getNode(p, &pos_ok);
 	if (pos_ok)
@@ -265,13 +479,16 @@ void Particle::updateLight()
 		m_light * m_base_color.getBlue() / 255);
 }
 
-void Particle::updateVertices()
+void Particle::updateVertices(v3f pos, float time, float expiration)
 {
+	if (!m_buffer)
+		return;
+
 	f32 tx0, tx1, ty0, ty1;
 	v2f scale;
 
 	if (m_texture.tex != nullptr)
-		scale = m_texture.tex -> scale.blend(m_time / (m_expiration+0.1));
+		scale = m_texture.tex -> scale.blend(time / (expiration+0.1));
 	else
 		scale = v2f(1.f, 1.f);
 
@@ -297,31 +514,31 @@ void Particle::updateVertices()
 	auto half = m_p.size * .5f,
 	     hx   = half * scale.X,
 	     hy   = half * scale.Y;
-	m_vertices[0] = video::S3DVertex(-hx, -hy,
+	video::S3DVertex *vertices = m_buffer->getVertices(m_buffer_index);
+	vertices[0] = video::S3DVertex(-hx, -hy,
 		0, 0, 0, 0, m_color, tx0, ty1);
-	m_vertices[1] = video::S3DVertex(hx, -hy,
+	vertices[1] = video::S3DVertex(hx, -hy,
 		0, 0, 0, 0, m_color, tx1, ty1);
-	m_vertices[2] = video::S3DVertex(hx, hy,
+	vertices[2] = video::S3DVertex(hx, hy,
 		0, 0, 0, 0, m_color, tx1, ty0);
-	m_vertices[3] = video::S3DVertex(-hx, hy,
+	vertices[3] = video::S3DVertex(-hx, hy,
 		0, 0, 0, 0, m_color, tx0, ty0);
 
+	// Vertices are relative to the camera offset -- see #10398
+	v3s16 camera_offset = m_env->getCameraOffset();
+	v3f translation = pos * BS - intToFloat(camera_offset, BS);
 
-	// see #10398
-	// v3s16 camera_offset = m_env->getCameraOffset();
-	// particle position is now handled by step()
-	m_box.reset(v3f());
-
-	for (video::S3DVertex &vertex : m_vertices) {
+	for (u16 i = 0; i < 4; i++) {
+		video::S3DVertex &vertex = vertices[i];
 		if (m_p.vertical) {
 			v3f ppos = m_player->getPosition()/BS;
-			vertex.Pos.rotateXZBy(std::atan2(ppos.Z - m_pos.Z, ppos.X - m_pos.X) /
+			vertex.Pos.rotateXZBy(std::atan2(ppos.Z - pos.Z, ppos.X - pos.X) /
 				core::DEGTORAD + 90);
 		} else {
 			vertex.Pos.rotateYZBy(m_player->getPitch());
 			vertex.Pos.rotateXZBy(m_player->getYaw());
 		}
-		m_box.addInternalPoint(vertex.Pos);
+		vertex.Pos += translation;
 	}
 }
 
@@ -628,12 +845,21 @@ void ParticleSpawner::step(float dtime, ClientEnvironment *env)
 	ParticleManager
 */
 
+// Below this, handing half of the arena to the worker costs more than it saves
+#define PARTICLE_ARENA_THREAD_MIN 4096
+
 ParticleManager::ParticleManager(ClientEnvironment *env) :
 	m_env(env)
-{}
+{
+	m_enable_collision_cache = g_settings->getBool("enable_particle_collision_cache");
+
+	m_arena_thread.start();
+}
 
 ParticleManager::~ParticleManager()
 {
+	m_arena_thread.stop();
+	m_arena_thread.wait();
 	clearAll();
 }
 
@@ -676,24 +902,103 @@ void ParticleManager::stepParticles(float dtime)
 {
 	MutexAutoLock lock(m_particle_list_lock);
 
-	for (size_t i = 0; i < m_particles.size();) {
+	// Simple particles are integrated by the arena, with the upper part of
+	// it handed to the worker thread when there are many. The integration
+	// loop writes every slot of its range, so the other particles of that
+	// range may only be moved once the worker is done.
+	updateCollisionCache(dtime);
+	ParticleCollisionCache *cache = m_collision_cache.get();
+
+	const u32 count = m_arena.size();
+	u32 split = count;
+	if (count >= PARTICLE_ARENA_THREAD_MIN && m_arena_thread.isRunning()) {
+		split = count / 2;
+		m_arena_thread.run([this, dtime, split, count] {
+			m_arena.integrate(dtime, split, count);
+		});
+	}
+	for (u32 i = 0; i < split; i++) {
+		if (!m_arena.isSimple(i))
+			m_particles[i]->stepPhysics(dtime, m_arena, i, cache);
+	}
+	m_arena.integrate(dtime, 0, split);
+	m_arena_thread.sync();
+	for (u32 i = split; i < count; i++) {
+		if (!m_arena.isSimple(i))
+			m_particles[i]->stepPhysics(dtime, m_arena, i, cache);
+	}
+
+	for (u32 i = 0; i < m_particles.size();) {
 		Particle &p = *m_particles[i];
-		if (p.isExpired()) {
+		if (m_arena.isExpired(i)) {
 			ParticleSpawner *parent = p.getParent();
 			if (parent) {
 				assert(parent->hasActive());
 				parent->decrActive();
 			}
-			// remove scene node
-			p.remove();
-			// delete
+			if (p.getParameters().collisiondetection &&
+					p.getParameters().object_collision)
+				m_object_collision_count--;
+			// delete, releasing its quad
 			m_particles[i] = std::move(m_particles.back());
 			m_particles.pop_back();
+			m_arena.swapRemove(i);
 		} else {
-			p.step(dtime);
+			p.stepVisuals(dtime, m_arena, i);
 			++i;
 		}
 	}
+
+	for (size_t i = 0; i < m_particle_buffers.size();) {
+		if (m_particle_buffers[i]->expireIfEmpty(dtime)) {
+			// remove scene node
+			m_particle_buffers[i]->remove();
+			m_particle_buffers[i] = std::move(m_particle_buffers.back());
+			m_particle_buffers.pop_back();
+		} else {
+			++i;
+		}
+	}
+
+	g_profiler->avg("Particles [#]", m_particles.size());
+	g_profiler->avg("Particle buffers [#]", m_particle_buffers.size());
+}
+
+void ParticleManager::updateCollisionCache(float dtime)
+{
+	if (!m_enable_collision_cache)
+		return;
+
+	if (!m_collision_cache) {
+		m_collision_cache = std::make_unique<ParticleCollisionCache>(
+				&m_env->getClientMap(), m_env->getGameDef()->ndef());
+	}
+	m_collision_cache->step(dtime);
+
+	// Objects move, so their boxes are gathered again every step
+	std::vector<aabb3f> boxes;
+	if (m_object_collision_count > 0) {
+		// Particles out of sight don't need to hit objects
+		const f32 radius = m_env->getClientMap().getWantedRange();
+
+		std::vector<DistanceSortedActiveObject> objects;
+		m_env->getActiveObjects(m_env->getLocalPlayer()->getPosition(),
+				radius * BS, objects);
+		for (const DistanceSortedActiveObject &object : objects) {
+			aabb3f box;
+			if (object.obj->collideWithObjects() && object.obj->getCollisionBox(&box))
+				boxes.push_back(box);
+		}
+	}
+	m_collision_cache->setObjectBoxes(boxes);
+}
+
+void ParticleManager::invalidateCollisionBlock(v3s16 blockpos)
+{
+	MutexAutoLock lock(m_particle_list_lock);
+
+	if (m_collision_cache)
+		m_collision_cache->invalidateBlock(blockpos);
 }
 
 void ParticleManager::clearAll()
@@ -706,13 +1011,18 @@ void ParticleManager::clearAll()
 	m_dying_particle_spawners.clear();
 
 	// clear particles
-	for (std::unique_ptr<Particle> &p : m_particles) {
+	m_particles.clear();
+	m_arena.clear();
+	m_object_collision_count = 0;
+
+	// clear buffers
+	for (std::unique_ptr<ParticleBuffer> &buffer : m_particle_buffers) {
 		// remove scene node
-		p->remove();
+		buffer->remove();
 		// delete
-		p.reset();
+		buffer.reset();
 	}
-	m_particles.clear();
+	m_particle_buffers.clear();
 }
 
 void ParticleManager::handleParticleEvent(ClientEvent *event, Client *client,
@@ -900,12 +1210,35 @@ void ParticleManager::reserveParticleSpace(size_t max_estimate)
 	MutexAutoLock lock(m_particle_list_lock);
 
 	m_particles.reserve(m_particles.size() + max_estimate);
+	m_arena.reserve(m_particles.capacity());
 }
 
 void ParticleManager::addParticle(std::unique_ptr<Particle> toadd)
 {
 	MutexAutoLock lock(m_particle_list_lock);
 
+	// Batch with other particles of the same material
+	const video::SMaterial &material = toadd->getMaterial();
+	ParticleBuffer *buffer = nullptr;
+	u16 index = 0;
+	for (auto &b : m_particle_buffers) {
+		if (b->getMaterial(0) == material && b->allocate(&index)) {
+			buffer = b.get();
+			break;
+		}
+	}
+	if (!buffer) {
+		scene::ISceneManager *smgr = m_env->getGameDef()->getSceneManager();
+		m_particle_buffers.push_back(std::make_unique<ParticleBuffer>(smgr, material));
+		buffer = m_particle_buffers.back().get();
+		buffer->allocate(&index);
+	}
+	toadd->attachToBuffer(buffer, index);
+
+	const ParticleParameters &p = toadd->getParameters();
+	if (p.collisiondetection && p.object_collision)
+		m_object_collision_count++;
+	m_arena.add(p, toadd->isSimple());
 	m_particles.push_back(std::move(toadd));
 }
 
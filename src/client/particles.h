@@ -21,11 +21,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <iostream>
 #include "irrlichttypes_extrabloated.h"
+#include "irr_ptr.h"
 #include "localplayer.h"
+#include "util/thread.h"
 #include "../particles.h"
 
 struct ClientEvent;
 class ParticleManager;
+class ParticleCollisionCache;
 class ClientEnvironment;
 struct MapNode;
 struct ContentFeatures;
@@ -60,9 +63,119 @@ struct ClientParticleTexRef
 	explicit ClientParticleTexRef(video::ITexture *tp): ref(tp) {};
 };
 
+/*
+	Kinematic state of all particles as a structure of arrays. Slot i belongs
+	to ParticleManager::m_particles[i]; removal moves the last slot into the
+	hole, like the particle list does.
+
+	Particles without collision detection and jitter are "simple": their
+	motion is integrated here, in one loop over contiguous arrays that the
+	compiler can vectorize. The others are moved by Particle::stepPhysics().
+*/
+class ParticleArena
+{
+public:
+	u32 size() const { return m_time.size(); }
+	void reserve(size_t count);
+	void clear();
+
+	void add(const ParticleParameters &p, bool simple);
+	// Moves the last slot to i and shrinks the arena by one
+	void swapRemove(u32 i);
+
+	// Advances the time of slots [begin, end) and moves the simple ones.
+	// Disjoint ranges may be integrated concurrently.
+	void integrate(f32 dtime, u32 begin, u32 end);
+
+	v3f getPosition(u32 i) const
+	{ return v3f(m_pos_x[i], m_pos_y[i], m_pos_z[i]); }
+	void setPosition(u32 i, v3f pos)
+	{ m_pos_x[i] = pos.X; m_pos_y[i] = pos.Y; m_pos_z[i] = pos.Z; }
+
+	v3f getVelocity(u32 i) const
+	{ return v3f(m_vel_x[i], m_vel_y[i], m_vel_z[i]); }
+	void setVelocity(u32 i, v3f vel)
+	{ m_vel_x[i] = vel.X; m_vel_y[i] = vel.Y; m_vel_z[i] = vel.Z; }
+
+	f32 getTime(u32 i) const { return m_time[i]; }
+	f32 getExpiration(u32 i) const { return m_expiration[i]; }
+	void setExpiration(u32 i, f32 expiration) { m_expiration[i] = expiration; }
+
+	bool isSimple(u32 i) const { return m_simple[i]; }
+	bool isExpired(u32 i) const { return m_expiration[i] < m_time[i]; }
+
+private:
+	std::vector<f32> m_pos_x, m_pos_y, m_pos_z;
+	std::vector<f32> m_vel_x, m_vel_y, m_vel_z;
+	std::vector<f32> m_acc_x, m_acc_y, m_acc_z;
+	std::vector<f32> m_drag_x, m_drag_y, m_drag_z;
+	std::vector<f32> m_time;
+	std::vector<f32> m_expiration;
+	// Not std::vector<bool>, which is bit-packed
+	std::vector<u8> m_simple;
+};
+
+/*
+	Draws all particles sharing a material (texture and blend mode) from one
+	dynamic mesh buffer, with one quad per particle.
+*/
+class ParticleBuffer : public scene::ISceneNode
+{
+public:
+	ParticleBuffer(scene::ISceneManager *smgr, const video::SMaterial &material);
+	DISABLE_CLASS_COPY(ParticleBuffer)
+
+	// Reserves a quad; false if the buffer is full
+	bool allocate(u16 *index);
+	void release(u16 index);
+
+	// The 4 vertices of a quad, in world space relative to the camera offset
+	video::S3DVertex *getVertices(u16 index);
+
+	bool isEmpty() const { return m_free_list.size() == m_count; }
+	// Accumulates the time spent empty; true once the buffer can be deleted
+	bool expireIfEmpty(float dtime);
+
+	virtual const aabb3f &getBoundingBox() const;
+
+	virtual u32 getMaterialCount() const
+	{
+		return 1;
+	}
+
+	virtual video::SMaterial& getMaterial(u32 i)
+	{
+		return m_mesh_buffer->getMaterial();
+	}
+
+	virtual void OnRegisterSceneNode();
+	virtual void render();
+
+	// Quads are addressed with 16-bit indices
+	static constexpr u16 MAX_PARTICLES_PER_BUFFER = 16000;
+
+private:
+	// Orders the quads back to front, as seen from the camera
+	void sortQuads(v3f camera_pos);
+
+	irr_ptr<scene::SMeshBuffer> m_mesh_buffer;
+	// Alpha blended quads must be drawn back to front, see #10398
+	bool m_depth_sort = false;
+	bool m_order_dirty = false;
+	v3f m_sort_camera_pos;
+	// (squared distance, quad) of the last sort
+	std::vector<std::pair<f32, u16>> m_quad_order;
+	// Released quads, for reuse
+	std::vector<u16> m_free_list;
+	u16 m_count = 0;
+	float m_unused_time = 0.0f;
+	bool m_vertices_dirty = false;
+	mutable bool m_box_dirty = true;
+};
+
 class ParticleSpawner;
 
-class Particle : public scene::ISceneNode
+class Particle
 {
 public:
 	Particle(
@@ -77,52 +190,38 @@ class Particle : public scene::ISceneNode
 		ParticleSpawner *parent = nullptr,
 		std::unique_ptr<ClientParticleTexture> owned_texture = nullptr
 	);
+	~Particle();
+	DISABLE_CLASS_COPY(Particle)
 
-	virtual const aabb3f &getBoundingBox() const
-	{
-		return m_box;
-	}
+	const ParticleParameters &getParameters() const { return m_p; }
+	const video::SMaterial &getMaterial() const { return m_material; }
 
-	virtual u32 getMaterialCount() const
-	{
-		return 1;
-	}
+	// True if the particle can be moved by ParticleArena::integrate()
+	bool isSimple() const;
 
-	virtual video::SMaterial& getMaterial(u32 i)
-	{
-		return m_material;
-	}
+	void attachToBuffer(ParticleBuffer *buffer, u16 index);
 
-	virtual void OnRegisterSceneNode();
-	virtual void render();
-
-	void step(float dtime);
-
-	bool isExpired ()
-	{ return m_expiration < m_time; }
+	// Motion of particles that are not simple. Collisions are resolved from
+	// cache when possible, which may be null.
+	void stepPhysics(float dtime, ParticleArena &arena, u32 index,
+			ParticleCollisionCache *cache);
+	// Animation, lighting and vertices, after the arena has been stepped
+	void stepVisuals(float dtime, const ParticleArena &arena, u32 index);
 
 	ParticleSpawner *getParent() { return m_parent; }
 
 private:
-	void updateLight();
-	void updateVertices();
-	void setVertexAlpha(float a);
-
-	video::S3DVertex m_vertices[4];
-	float m_time = 0.0f;
-	float m_expiration;
+	void updateLight(v3f pos);
+	void updateVertices(v3f pos, float time, float expiration);
 
 	ClientEnvironment *m_env;
 	IGameDef *m_gamedef;
-	aabb3f m_box;
-	aabb3f m_collisionbox;
 	ClientParticleTexRef m_texture;
 	video::SMaterial m_material;
+	ParticleBuffer *m_buffer = nullptr;
+	u16 m_buffer_index = 0;
 	v2f m_texpos;
 	v2f m_texsize;
-	v3f m_pos;
-	v3f m_velocity;
-	v3f m_acceleration;
 	const ParticleParameters m_p;
 	LocalPlayer *m_player;
 
@@ -196,6 +295,9 @@ friend class ParticleSpawner;
 
 	void reserveParticleSpace(size_t max_estimate);
 
+	// To be called when nodes of a block changed
+	void invalidateCollisionBlock(v3s16 blockpos);
+
 	/**
 	 * This function is only used by client particle spawners
 	 *
@@ -220,11 +322,21 @@ friend class ParticleSpawner;
 	void deleteParticleSpawner(u64 id);
 
 	void stepParticles(float dtime);
+	void updateCollisionCache(float dtime);
 	void stepSpawners(float dtime);
 
 	void clearAll();
 
+	// Buffers must outlive the particles that draw into them
+	std::vector<std::unique_ptr<ParticleBuffer>> m_particle_buffers;
 	std::vector<std::unique_ptr<Particle>> m_particles;
+	ParticleArena m_arena;
+	// Integrates part of m_arena while step() moves the rest
+	BackgroundTask m_arena_thread{"ParticleArena"};
+	std::unique_ptr<ParticleCollisionCache> m_collision_cache;
+	bool m_enable_collision_cache;
+	// Particles that collide with objects
+	u32 m_object_collision_count = 0;
 	std::unordered_map<u64, std::unique_ptr<ParticleSpawner>> m_particle_spawners;
 	std::vector<std::unique_ptr<ParticleSpawner>> m_dying_particle_spawners;
 	// Start the particle spawner ids generated from here after u32_max. lower values are
@@ -18,7 +18,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "collision.h"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include "mapblock.h"
 #include "map.h"
 #include "nodedef.h"
@@ -28,7 +30,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "client/localplayer.h"
 #endif
 #include "serverenvironment.h"
+#include "server/activeobjectmgr.h"
 #include "server/serveractiveobject.h"
+#include "threading/thread.h"
+#include "util/thread.h"
 #include "util/timetaker.h"
 #include "profiler.h"
 
@@ -222,43 +227,20 @@ static inline void getNeighborConnectingFace(const v3s16 &p,
 		*neighbors |= v;
 }
 
-collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
-		f32 pos_max_d, const aabb3f &box_0,
-		f32 stepheight, f32 dtime,
-		v3f *pos_f, v3f *speed_f,
-		v3f accel_f, ActiveObject *self,
-		bool collideWithObjects)
-{
-	#define PROFILER_NAME(text) (s_env ? ("Server: " text) : ("Client: " text))
-	static bool time_notification_done = false;
-	Map *map = &env->getMap();
-	ServerEnvironment *s_env = dynamic_cast<ServerEnvironment*>(env);
-
-	ScopeProfiler sp(g_profiler, PROFILER_NAME("collisionMoveSimple()"), SPT_AVG);
-
-	collisionMoveResult result;
-
-	/*
-		Calculate new velocity
-	*/
-	if (dtime > DTIME_LIMIT) {
-		if (!time_notification_done) {
-			time_notification_done = true;
-			warningstream << "collisionMoveSimple: maximum step interval exceeded,"
-					" lost movement details!"<<std::endl;
-		}
-		dtime = DTIME_LIMIT;
-	} else {
-		time_notification_done = false;
-	}
+static bool time_notification_done = false;
 
+// Applies the acceleration and limits the speed.
+// Returns false if the object does not move.
+static bool collisionAccelerate(f32 dtime, const v3f &pos_f, v3f *speed_f,
+		v3f accel_f, v3f *newpos_f)
+{
 	v3f dpos_f = (*speed_f + accel_f * 0.5f * dtime) * dtime;
-	v3f newpos_f = *pos_f + dpos_f;
+	*newpos_f = pos_f + dpos_f;
 	*speed_f += accel_f * dtime;
 
 	// If the object is static, there are no collisions
 	if (dpos_f == v3f())
-		return result;
+		return false;
 
 	// Limit speed for avoiding hangs
 	speed_f->Y = rangelim(speed_f->Y, -5000, 5000);
@@ -266,181 +248,110 @@ collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
 	speed_f->Z = rangelim(speed_f->Z, -5000, 5000);
 
 	*speed_f = truncate(*speed_f, 10000.0f);
+	return true;
+}
 
-	/*
-		Collect node boxes in movement range
-	*/
-	std::vector<NearbyCollisionInfo> cinfo;
-	{
-	//TimeTaker tt2("collisionMoveSimple collect boxes");
-	ScopeProfiler sp2(g_profiler, PROFILER_NAME("collision collect boxes"), SPT_AVG);
-
+// Nodes whose boxes are collected for a move from pos_f to newpos_f
+static void getCollisionNodeRange(const v3f &pos_f, const v3f &newpos_f,
+		const aabb3f &box_0, v3s16 *min, v3s16 *max)
+{
 	v3f minpos_f(
-		MYMIN(pos_f->X, newpos_f.X),
-		MYMIN(pos_f->Y, newpos_f.Y) + 0.01f * BS, // bias rounding, player often at +/-n.5
-		MYMIN(pos_f->Z, newpos_f.Z)
+		MYMIN(pos_f.X, newpos_f.X),
+		MYMIN(pos_f.Y, newpos_f.Y) + 0.01f * BS, // bias rounding, player often at +/-n.5
+		MYMIN(pos_f.Z, newpos_f.Z)
 	);
 	v3f maxpos_f(
-		MYMAX(pos_f->X, newpos_f.X),
-		MYMAX(pos_f->Y, newpos_f.Y),
-		MYMAX(pos_f->Z, newpos_f.Z)
+		MYMAX(pos_f.X, newpos_f.X),
+		MYMAX(pos_f.Y, newpos_f.Y),
+		MYMAX(pos_f.Z, newpos_f.Z)
 	);
-	v3s16 min = floatToInt(minpos_f + box_0.MinEdge, BS) - v3s16(1, 1, 1);
-	v3s16 max = floatToInt(maxpos_f + box_0.MaxEdge, BS) + v3s16(1, 1, 1);
-
-	bool any_position_valid = false;
-
-	v3s16 p;
-	for (p.X = min.X; p.X <= max.X; p.X++)
-	for (p.Y = min.Y; p.Y <= max.Y; p.Y++)
-	for (p.Z = min.Z; p.Z <= max.Z; p.Z++) {
-		bool is_position_valid;
-		MapNode n = map->getNode(p, &is_position_valid);
+	*min = floatToInt(minpos_f + box_0.MinEdge, BS) - v3s16(1, 1, 1);
+	*max = floatToInt(maxpos_f + box_0.MaxEdge, BS) + v3s16(1, 1, 1);
+}
 
-		if (is_position_valid && n.getContent() != CONTENT_IGNORE) {
-			// Object collides into walkable nodes
+// Adds the collision boxes of the node at p.
+// Returns false if the node is unloaded or CONTENT_IGNORE.
+static bool collectNodeBoxes(Map *map, IGameDef *gamedef, const v3s16 &p,
+		std::vector<NearbyCollisionInfo> &cinfo)
+{
+	bool is_position_valid;
+	MapNode n = map->getNode(p, &is_position_valid);
+
+	if (!is_position_valid || n.getContent() == CONTENT_IGNORE) {
+		// Collide with unloaded nodes (position invalid) and loaded
+		// CONTENT_IGNORE nodes (position valid)
+		aabb3f box = getNodeBox(p, BS);
+		cinfo.emplace_back(true, 0, p, box);
+		return false;
+	}
 
-			any_position_valid = true;
-			const NodeDefManager *nodedef = gamedef->getNodeDefManager();
-			const ContentFeatures &f = nodedef->get(n);
+	// Object collides into walkable nodes
+	const NodeDefManager *nodedef = gamedef->getNodeDefManager();
+	const ContentFeatures &f = nodedef->get(n);
 
-			if (!f.walkable)
-				continue;
+	if (!f.walkable)
+		return true;
 
-			// Negative bouncy may have a meaning, but we need +value here.
-			int n_bouncy_value = abs(itemgroup_get(f.groups, "bouncy"));
+	// Negative bouncy may have a meaning, but we need +value here.
+	int n_bouncy_value = abs(itemgroup_get(f.groups, "bouncy"));
 
-			int neighbors = 0;
-			if (f.drawtype == NDT_NODEBOX &&
-				f.node_box.type == NODEBOX_CONNECTED) {
-				v3s16 p2 = p;
+	int neighbors = 0;
+	if (f.drawtype == NDT_NODEBOX &&
+		f.node_box.type == NODEBOX_CONNECTED) {
+		v3s16 p2 = p;
 
-				p2.Y++;
-				getNeighborConnectingFace(p2, nodedef, map, n, 1, &neighbors);
+		p2.Y++;
+		getNeighborConnectingFace(p2, nodedef, map, n, 1, &neighbors);
 
-				p2 = p;
-				p2.Y--;
-				getNeighborConnectingFace(p2, nodedef, map, n, 2, &neighbors);
+		p2 = p;
+		p2.Y--;
+		getNeighborConnectingFace(p2, nodedef, map, n, 2, &neighbors);
 
-				p2 = p;
-				p2.Z--;
-				getNeighborConnectingFace(p2, nodedef, map, n, 4, &neighbors);
+		p2 = p;
+		p2.Z--;
+		getNeighborConnectingFace(p2, nodedef, map, n, 4, &neighbors);
 
-				p2 = p;
-				p2.X--;
-				getNeighborConnectingFace(p2, nodedef, map, n, 8, &neighbors);
+		p2 = p;
+		p2.X--;
+		getNeighborConnectingFace(p2, nodedef, map, n, 8, &neighbors);
 
-				p2 = p;
-				p2.Z++;
-				getNeighborConnectingFace(p2, nodedef, map, n, 16, &neighbors);
+		p2 = p;
+		p2.Z++;
+		getNeighborConnectingFace(p2, nodedef, map, n, 16, &neighbors);
 
-				p2 = p;
-				p2.X++;
-				getNeighborConnectingFace(p2, nodedef, map, n, 32, &neighbors);
-			}
-			std::vector<aabb3f> nodeboxes;
-			n.getCollisionBoxes(gamedef->ndef(), &nodeboxes, neighbors);
-
-			// Calculate float position only once
-			v3f posf = intToFloat(p, BS);
-			for (auto box : nodeboxes) {
-				box.MinEdge += posf;
-				box.MaxEdge += posf;
-				cinfo.emplace_back(false, n_bouncy_value, p, box);
-			}
-		} else {
-			// Collide with unloaded nodes (position invalid) and loaded
-			// CONTENT_IGNORE nodes (position valid)
-			aabb3f box = getNodeBox(p, BS);
-			cinfo.emplace_back(true, 0, p, box);
-		}
+		p2 = p;
+		p2.X++;
+		getNeighborConnectingFace(p2, nodedef, map, n, 32, &neighbors);
 	}
-
-	// Do not move if world has not loaded yet, since custom node boxes
-	// are not available for collision detection.
-	// This also intentionally occurs in the case of the object being positioned
-	// solely on loaded CONTENT_IGNORE nodes, no matter where they come from.
-	if (!any_position_valid) {
-		*speed_f = v3f(0, 0, 0);
-		return result;
+	std::vector<aabb3f> nodeboxes;
+	n.getCollisionBoxes(gamedef->ndef(), &nodeboxes, neighbors);
+
+	// Calculate float position only once
+	v3f posf = intToFloat(p, BS);
+	for (auto box : nodeboxes) {
+		box.MinEdge += posf;
+		box.MaxEdge += posf;
+		cinfo.emplace_back(false, n_bouncy_value, p, box);
 	}
+	return true;
+}
 
-	} // tt2
-
-	if(collideWithObjects)
-	{
-		/* add object boxes to cinfo */
-
-		std::vector<ActiveObject*> objects;
-#ifndef SERVER
-		ClientEnvironment *c_env = dynamic_cast<ClientEnvironment*>(env);
-		if (c_env != 0) {
-			// Calculate distance by speed, add own extent and 1.5m of tolerance
-			f32 distance = speed_f->getLength() * dtime +
-				box_0.getExtent().getLength() + 1.5f * BS;
-			std::vector<DistanceSortedActiveObject> clientobjects;
-			c_env->getActiveObjects(*pos_f, distance, clientobjects);
-
-			for (auto &clientobject : clientobjects) {
-				// Do collide with everything but itself and the parent CAO
-				if (!self || (self != clientobject.obj &&
-						self != clientobject.obj->getParent())) {
-					objects.push_back((ActiveObject*) clientobject.obj);
-				}
-			}
-		}
-		else
-#endif
-		{
-			if (s_env != NULL) {
-				// Calculate distance by speed, add own extent and 1.5m of tolerance
-				f32 distance = speed_f->getLength() * dtime +
-					box_0.getExtent().getLength() + 1.5f * BS;
-
-				// search for objects which are not us, or we are not its parent
-				// we directly use the callback to populate the result to prevent
-				// a useless result loop here
-				auto include_obj_cb = [self, &objects] (ServerActiveObject *obj) {
-					if (!obj->isGone() &&
-						(!self || (self != obj && self != obj->getParent()))) {
-						objects.push_back((ActiveObject *)obj);
-					}
-					return false;
-				};
-
-				std::vector<ServerActiveObject *> s_objects;
-				s_env->getObjectsInsideRadius(s_objects, *pos_f, distance, include_obj_cb);
-			}
-		}
-
-		for (std::vector<ActiveObject*>::const_iterator iter = objects.begin();
-				iter != objects.end(); ++iter) {
-			ActiveObject *object = *iter;
-
-			if (object && object->collideWithObjects()) {
-				aabb3f object_collisionbox;
-				if (object->getCollisionBox(&object_collisionbox))
-					cinfo.emplace_back(object, 0, object_collisionbox);
-			}
-		}
-#ifndef SERVER
-		if (self && c_env) {
-			LocalPlayer *lplayer = c_env->getLocalPlayer();
-			if (lplayer->getParent() == nullptr) {
-				aabb3f lplayer_collisionbox = lplayer->getCollisionbox();
-				v3f lplayer_pos = lplayer->getPosition();
-				lplayer_collisionbox.MinEdge += lplayer_pos;
-				lplayer_collisionbox.MaxEdge += lplayer_pos;
-				ActiveObject *obj = (ActiveObject*) lplayer->getCAO();
-				cinfo.emplace_back(obj, 0, lplayer_collisionbox);
-			}
-		}
-#endif
-	} //tt3
+// Distance in which objects are collided with: the distance by speed,
+// the own extent and 1.5m of tolerance
+static inline f32 getObjectCollisionRadius(const v3f &speed_f, f32 dtime,
+		const aabb3f &box_0)
+{
+	return speed_f.getLength() * dtime +
+		box_0.getExtent().getLength() + 1.5f * BS;
+}
 
-	/*
-		Collision detection
-	*/
+// Moves box_0 from pos_f through the collision boxes in cinfo.
+// Returns false if the movement was aborted to avoid an infinite loop.
+static bool collisionSweep(std::vector<NearbyCollisionInfo> &cinfo,
+		const aabb3f &box_0, f32 stepheight, f32 dtime,
+		v3f *pos_f, v3f *speed_f, collisionMoveResult &result)
+{
+	bool completed = true;
 
 	f32 d = 0.0f;
 
@@ -450,7 +361,7 @@ collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
 		// Avoid infinite loop
 		loopcount++;
 		if (loopcount >= 100) {
-			warningstream << "collisionMoveSimple: Loop count exceeded, aborting to avoid infiniite loop" << std::endl;
+			completed = false;
 			break;
 		}
 
@@ -612,5 +523,608 @@ collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
 		}
 	}
 
+	return completed;
+}
+
+static void warnLoopCountExceeded()
+{
+	warningstream << "collisionMoveSimple: Loop count exceeded, aborting to avoid infiniite loop" << std::endl;
+}
+
+// env is only used for client objects, server objects are given by s_objects
+static collisionMoveResult collisionMove(Map *map, IGameDef *gamedef,
+		Environment *env, server::ActiveObjectMgr *s_objects,
+		const aabb3f &box_0, f32 stepheight, f32 dtime,
+		v3f *pos_f, v3f *speed_f,
+		v3f accel_f, ActiveObject *self,
+		bool collideWithObjects)
+{
+	#define PROFILER_NAME(text) (s_objects ? ("Server: " text) : ("Client: " text))
+
+	ScopeProfiler sp(g_profiler, PROFILER_NAME("collisionMoveSimple()"), SPT_AVG);
+
+	collisionMoveResult result;
+
+	/*
+		Calculate new velocity
+	*/
+	if (dtime > DTIME_LIMIT) {
+		if (!time_notification_done) {
+			time_notification_done = true;
+			warningstream << "collisionMoveSimple: maximum step interval exceeded,"
+					" lost movement details!"<<std::endl;
+		}
+		dtime = DTIME_LIMIT;
+	} else {
+		time_notification_done = false;
+	}
+
+	v3f newpos_f;
+	if (!collisionAccelerate(dtime, *pos_f, speed_f, accel_f, &newpos_f))
+		return result;
+
+	/*
+		Collect node boxes in movement range
+	*/
+	std::vector<NearbyCollisionInfo> cinfo;
+	{
+	//TimeTaker tt2("collisionMoveSimple collect boxes");
+	ScopeProfiler sp2(g_profiler, PROFILER_NAME("collision collect boxes"), SPT_AVG);
+
+	v3s16 min, max;
+	getCollisionNodeRange(*pos_f, newpos_f, box_0, &min, &max);
+
+	bool any_position_valid = false;
+
+	v3s16 p;
+	for (p.X = min.X; p.X <= max.X; p.X++)
+	for (p.Y = min.Y; p.Y <= max.Y; p.Y++)
+	for (p.Z = min.Z; p.Z <= max.Z; p.Z++) {
+		if (collectNodeBoxes(map, gamedef, p, cinfo))
+			any_position_valid = true;
+	}
+
+	// Do not move if world has not loaded yet, since custom node boxes
+	// are not available for collision detection.
+	// This also intentionally occurs in the case of the object being positioned
+	// solely on loaded CONTENT_IGNORE nodes, no matter where they come from.
+	if (!any_position_valid) {
+		*speed_f = v3f(0, 0, 0);
+		return result;
+	}
+
+	} // tt2
+
+	if(collideWithObjects)
+	{
+		/* add object boxes to cinfo */
+
+		std::vector<ActiveObject*> objects;
+#ifndef SERVER
+		ClientEnvironment *c_env = dynamic_cast<ClientEnvironment*>(env);
+		if (c_env != 0) {
+			f32 distance = getObjectCollisionRadius(*speed_f, dtime, box_0);
+			std::vector<DistanceSortedActiveObject> clientobjects;
+			c_env->getActiveObjects(*pos_f, distance, clientobjects);
+
+			for (auto &clientobject : clientobjects) {
+				// Do collide with everything but itself and the parent CAO
+				if (!self || (self != clientobject.obj &&
+						self != clientobject.obj->getParent())) {
+					objects.push_back((ActiveObject*) clientobject.obj);
+				}
+			}
+		}
+		else
+#endif
+		{
+			if (s_objects != NULL) {
+				f32 distance = getObjectCollisionRadius(*speed_f, dtime, box_0);
+
+				// search for objects which are not us, or we are not its parent
+				// we directly use the callback to populate the result to prevent
+				// a useless result loop here
+				auto include_obj_cb = [self, &objects] (ServerActiveObject *obj) {
+					if (!obj->isGone() &&
+						(!self || (self != obj && self != obj->getParent()))) {
+						objects.push_back((ActiveObject *)obj);
+					}
+					return false;
+				};
+
+				std::vector<ServerActiveObject *> found;
+				s_objects->getObjectsInsideRadius(*pos_f, distance, found, include_obj_cb);
+			}
+		}
+
+		for (std::vector<ActiveObject*>::const_iterator iter = objects.begin();
+				iter != objects.end(); ++iter) {
+			ActiveObject *object = *iter;
+
+			if (object && object->collideWithObjects()) {
+				aabb3f object_collisionbox;
+				if (object->getCollisionBox(&object_collisionbox))
+					cinfo.emplace_back(object, 0, object_collisionbox);
+			}
+		}
+#ifndef SERVER
+		if (self && c_env) {
+			LocalPlayer *lplayer = c_env->getLocalPlayer();
+			if (lplayer->getParent() == nullptr) {
+				aabb3f lplayer_collisionbox = lplayer->getCollisionbox();
+				v3f lplayer_pos = lplayer->getPosition();
+				lplayer_collisionbox.MinEdge += lplayer_pos;
+				lplayer_collisionbox.MaxEdge += lplayer_pos;
+				ActiveObject *obj = (ActiveObject*) lplayer->getCAO();
+				cinfo.emplace_back(obj, 0, lplayer_collisionbox);
+			}
+		}
+#endif
+	} //tt3
+
+	/*
+		Collision detection
+	*/
+	if (!collisionSweep(cinfo, box_0, stepheight, dtime, pos_f, speed_f, result))
+		warnLoopCountExceeded();
+
+	return result;
+}
+
+collisionMoveResult collisionMoveSimple(Environment *env, IGameDef *gamedef,
+		f32 pos_max_d, const aabb3f &box_0,
+		f32 stepheight, f32 dtime,
+		v3f *pos_f, v3f *speed_f,
+		v3f accel_f, ActiveObject *self,
+		bool collideWithObjects)
+{
+	ServerEnvironment *s_env = dynamic_cast<ServerEnvironment*>(env);
+	if (s_env) {
+		return collisionMoveSimple(&s_env->getMap(), gamedef,
+				&s_env->getActiveObjectMgr(), pos_max_d, box_0, stepheight,
+				dtime, pos_f, speed_f, accel_f, self, collideWithObjects);
+	}
+
+	return collisionMove(&env->getMap(), gamedef, env, nullptr, box_0,
+			stepheight, dtime, pos_f, speed_f, accel_f, self,
+			collideWithObjects);
+}
+
+collisionMoveResult collisionMoveSimple(Map *map, IGameDef *gamedef,
+		server::ActiveObjectMgr *objects,
+		f32 pos_max_d, const aabb3f &box_0,
+		f32 stepheight, f32 dtime,
+		v3f *pos_f, v3f *speed_f,
+		v3f accel_f, ActiveObject *self,
+		bool collideWithObjects)
+{
+	return collisionMove(map, gamedef, nullptr, objects, box_0,
+			stepheight, dtime, pos_f, speed_f, accel_f, self,
+			collideWithObjects);
+}
+
+/*
+	CollisionBatch
+*/
+
+// Cell size of the object lookup grids
+#define COLLISION_GRID_SIZE (8.0f * BS)
+// Larger lookups scan all objects
+#define COLLISION_GRID_MAX_CELLS 8
+// Moves touching more nodes are left to collisionMoveSimple()
+#define COLLISION_BATCH_MAX_NODES 4096
+
+// Returns false for positions that are not on the grid (including NaN)
+static bool getGridCell(const v3f &pos, v3s16 *cell)
+{
+	const f32 limit = MAX_MAP_GENERATION_LIMIT * 2 * BS;
+	if (!(std::fabs(pos.X) < limit && std::fabs(pos.Y) < limit &&
+			std::fabs(pos.Z) < limit))
+		return false;
+	*cell = v3s16(
+		std::floor(pos.X / COLLISION_GRID_SIZE),
+		std::floor(pos.Y / COLLISION_GRID_SIZE),
+		std::floor(pos.Z / COLLISION_GRID_SIZE));
+	return true;
+}
+
+// Cells that may hold positions within radius of pos, with a margin for
+// rounding errors. Returns false if all positions have to be looked at.
+static bool getGridRange(const v3f &pos, f32 radius, v3s16 *min, v3s16 *max)
+{
+	f32 r = radius * 1.001f + 0.01f * BS;
+	v3f extent(r, r, r);
+	if (!getGridCell(pos - extent, min) || !getGridCell(pos + extent, max))
+		return false;
+	v3s16 size = *max - *min;
+	return size.X <= COLLISION_GRID_MAX_CELLS &&
+		size.Y <= COLLISION_GRID_MAX_CELLS &&
+		size.Z <= COLLISION_GRID_MAX_CELLS;
+}
+
+template <typename T>
+static inline bool bitwiseEqual(const T &a, const T &b)
+{
+	return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+// Everything a move reads from another object
+struct CollisionBatch::ObjectState
+{
+	ServerActiveObject *obj;
+	u16 id;
+	v3f pos;
+	ServerActiveObject *parent;
+	bool gone;
+	bool collides;
+	bool has_box;
+	aabb3f box;
+
+	void read(ServerActiveObject *o)
+	{
+		obj = o;
+		id = o->getId();
+		pos = o->getBasePosition();
+		parent = o->getParent();
+		gone = o->isGone();
+		collides = o->collideWithObjects();
+		has_box = o->getCollisionBox(&box);
+	}
+};
+
+struct CollisionBatch::PreparedMove
+{
+	Move in;
+	// false if collisionMoveSimple() has to be used
+	bool batched = false;
+	bool moving = false;
+	// nodes whose boxes are used, in the order they are collected in,
+	// and the blocks they were read from
+	std::vector<u32> nodes;
+	v3s16 block_min, block_max;
+	// the collision boxes of the objects; only valid if any node position
+	// was valid, otherwise the move ends before looking at the objects
+	bool any_position_valid = false;
+	f32 radius = 0.0f;
+	std::vector<NearbyCollisionInfo> object_boxes;
+
+	// speed after the acceleration, the sweep starts with it
+	v3f start_speed;
+	v3f pos;
+	v3f speed;
+	collisionMoveResult result;
+	bool completed = true;
+};
+
+CollisionBatch::CollisionBatch(Map *map, IGameDef *gamedef,
+		server::ActiveObjectMgr *objects, u32 num_threads) :
+	m_map(map),
+	m_gamedef(gamedef),
+	m_objects(objects)
+{
+	if (num_threads == 0)
+		num_threads = MYMAX(1U, MYMIN(4U, Thread::getNumberOfProcessors() / 2));
+	m_runner = std::make_unique<ParallelRunner>("Collision", num_threads);
+}
+
+CollisionBatch::~CollisionBatch() = default;
+
+void CollisionBatch::clear()
+{
+	m_prepared = false;
+	m_snapshot.clear();
+	m_snapshot_positions.clear();
+	m_positions.clear();
+	m_snapshot_index.clear();
+	m_snapshot_grid.clear();
+	m_snapshot_anywhere.clear();
+	m_node_index.clear();
+	m_node_boxes.clear();
+	m_boxes.clear();
+	m_moves.clear();
+	m_move_index.clear();
+	m_blocks.clear();
+	m_modified_blocks.clear();
+	m_moved_grid.clear();
+	m_moved_anywhere.clear();
+}
+
+void CollisionBatch::prepare(f32 dtime, const std::vector<Move> &moves)
+{
+	ScopeProfiler sp(g_profiler, "Server: collision batch", SPT_AVG);
+
+	clear();
+	m_hits = 0;
+	m_misses = 0;
+
+	// Overlong steps are left to collisionMoveSimple(), which warns about them
+	if (moves.empty() || dtime > DTIME_LIMIT)
+		return;
+
+	m_prepared = true;
+	m_dtime = dtime;
+
+	/*
+		Take a snapshot of the objects
+	*/
+	std::vector<ServerActiveObject *> objects;
+	m_objects->getAllObjects(objects);
+	m_snapshot.resize(objects.size());
+	m_snapshot_positions.resize(objects.size());
+	for (u32 i = 0; i < objects.size(); i++) {
+		ObjectState &state = m_snapshot[i];
+		state.read(objects[i]);
+		m_snapshot_positions[i] = state.pos;
+		m_snapshot_index[state.id] = i;
+		v3s16 cell;
+		if (getGridCell(state.pos, &cell))
+			m_snapshot_grid[cell].push_back(i);
+		else
+			m_snapshot_anywhere.push_back(i);
+	}
+	m_positions = m_snapshot_positions;
+
+	/*
+		Accelerate and collect the boxes of all touched nodes
+	*/
+	m_moves.resize(moves.size());
+	for (u32 i = 0; i < moves.size(); i++) {
+		PreparedMove &pm = m_moves[i];
+		pm.in = moves[i];
+		pm.pos = pm.in.pos;
+		pm.speed = pm.in.speed;
+		// An object moving twice is not batched
+		auto inserted = m_move_index.emplace(pm.in.self, i);
+		if (!inserted.second) {
+			m_moves[inserted.first->second].batched = false;
+			m_moves[inserted.first->second].moving = false;
+			continue;
+		}
+
+		v3f newpos;
+		if (!collisionAccelerate(dtime, pm.pos, &pm.speed, pm.in.accel, &newpos)) {
+			pm.batched = true;
+			continue;
+		}
+
+		v3s16 min, max;
+		getCollisionNodeRange(pm.pos, newpos, pm.in.box_0, &min, &max);
+		v3s16 size = max - min + v3s16(1, 1, 1);
+		if ((s64)size.X * size.Y * size.Z > COLLISION_BATCH_MAX_NODES)
+			continue;
+
+		// Connected node boxes look at the neighbours
+		pm.block_min = getNodeBlockPos(min - v3s16(1, 1, 1));
+		pm.block_max = getNodeBlockPos(max + v3s16(1, 1, 1));
+		v3s16 bp;
+		for (bp.X = pm.block_min.X; bp.X <= pm.block_max.X; bp.X++)
+		for (bp.Y = pm.block_min.Y; bp.Y <= pm.block_max.Y; bp.Y++)
+		for (bp.Z = pm.block_min.Z; bp.Z <= pm.block_max.Z; bp.Z++) {
+			if (m_blocks.find(bp) == m_blocks.end())
+				m_blocks[bp] = m_map->getBlockNoCreateNoEx(bp);
+		}
+
+		pm.nodes.reserve((u32)size.X * size.Y * size.Z);
+		v3s16 p;
+		for (p.X = min.X; p.X <= max.X; p.X++)
+		for (p.Y = min.Y; p.Y <= max.Y; p.Y++)
+		for (p.Z = min.Z; p.Z <= max.Z; p.Z++) {
+			auto inserted = m_node_index.emplace(p, m_node_boxes.size());
+			if (inserted.second) {
+				NodeBoxes nb;
+				nb.begin = m_boxes.size();
+				nb.valid = collectNodeBoxes(m_map, m_gamedef, p, m_boxes);
+				nb.end = m_boxes.size();
+				m_node_boxes.push_back(nb);
+			}
+			pm.nodes.push_back(inserted.first->second);
+		}
+
+		pm.start_speed = pm.speed;
+		pm.radius = getObjectCollisionRadius(pm.speed, dtime, pm.in.box_0);
+		pm.batched = true;
+		pm.moving = true;
+	}
+
+	/*
+		Sweep the moves on the workers
+	*/
+	m_runner->run(m_moves.size(), [&] (u32 begin, u32 end) {
+		std::vector<NearbyCollisionInfo> cinfo;
+		for (u32 i = begin; i < end; i++) {
+			PreparedMove &pm = m_moves[i];
+			if (!pm.moving)
+				continue;
+
+			pm.any_position_valid = collectCachedNodeBoxes(pm, cinfo);
+			if (!pm.any_position_valid) {
+				pm.speed = v3f(0, 0, 0);
+				continue;
+			}
+
+			if (pm.in.collide_objects) {
+				collectObjectBoxes(pm, false, pm.object_boxes);
+				cinfo.insert(cinfo.end(), pm.object_boxes.begin(),
+						pm.object_boxes.end());
+			}
+
+			pm.completed = collisionSweep(cinfo, pm.in.box_0, pm.in.stepheight,
+					dtime, &pm.pos, &pm.speed, pm.result);
+		}
+	});
+}
+
+void CollisionBatch::objectMoved(ServerActiveObject *obj)
+{
+	if (!m_prepared)
+		return;
+
+	// Objects added after prepare() are not visible yet
+	auto it = m_snapshot_index.find(obj->getId());
+	if (it == m_snapshot_index.end() || m_snapshot[it->second].obj != obj)
+		return;
+
+	u32 j = it->second;
+	m_positions[j] = obj->getBasePosition();
+	v3s16 cell;
+	if (getGridCell(m_positions[j], &cell))
+		m_moved_grid[cell].push_back(j);
+	else
+		m_moved_anywhere.push_back(j);
+}
+
+void CollisionBatch::onMapEditEvent(const MapEditEvent &event)
+{
+	if (!m_prepared)
+		return;
+
+	for (v3s16 blockpos : event.modified_blocks)
+		m_modified_blocks.insert(blockpos);
+}
+
+bool CollisionBatch::collectCachedNodeBoxes(const PreparedMove &pm,
+		std::vector<NearbyCollisionInfo> &cinfo) const
+{
+	cinfo.clear();
+	bool any_position_valid = false;
+	for (u32 i : pm.nodes) {
+		const NodeBoxes &nb = m_node_boxes[i];
+		cinfo.insert(cinfo.end(), m_boxes.begin() + nb.begin,
+				m_boxes.begin() + nb.end);
+		if (nb.valid)
+			any_position_valid = true;
+	}
+	return any_position_valid;
+}
+
+bool CollisionBatch::nodesUnchanged(const PreparedMove &pm) const
+{
+	v3s16 bp;
+	for (bp.X = pm.block_min.X; bp.X <= pm.block_max.X; bp.X++)
+	for (bp.Y = pm.block_min.Y; bp.Y <= pm.block_max.Y; bp.Y++)
+	for (bp.Z = pm.block_min.Z; bp.Z <= pm.block_max.Z; bp.Z++) {
+		if (m_modified_blocks.count(bp) ||
+				m_map->getBlockNoCreateNoEx(bp) != m_blocks.at(bp))
+			return false;
+	}
+	return true;
+}
+
+void CollisionBatch::collectObjectBoxes(const PreparedMove &pm, bool live,
+		std::vector<NearbyCollisionInfo> &cinfo) const
+{
+	const std::vector<v3f> &positions = live ? m_positions : m_snapshot_positions;
+	float r2 = pm.radius * pm.radius;
+	std::vector<u32> indices;
+	auto add = [&] (const std::vector<u32> &list) {
+		for (u32 j : list) {
+			// Same distance check as in collisionMoveSimple()
+			if (!(positions[j].getDistanceFromSQ(pm.in.pos) > r2))
+				indices.push_back(j);
+		}
+	};
+
+	// Objects can only be in reach from their snapshot position or from
+	// the last position they were moved to
+	v3s16 cmin, cmax;
+	if (getGridRange(pm.in.pos, pm.radius, &cmin, &cmax)) {
+		v3s16 c;
+		for (c.X = cmin.X; c.X <= cmax.X; c.X++)
+		for (c.Y = cmin.Y; c.Y <= cmax.Y; c.Y++)
+		for (c.Z = cmin.Z; c.Z <= cmax.Z; c.Z++) {
+			auto it = m_snapshot_grid.find(c);
+			if (it != m_snapshot_grid.end())
+				add(it->second);
+			if (!live)
+				continue;
+			it = m_moved_grid.find(c);
+			if (it != m_moved_grid.end())
+				add(it->second);
+		}
+		add(m_snapshot_anywhere);
+		if (live)
+			add(m_moved_anywhere);
+		// Same order as the objects are looked up in
+		std::sort(indices.begin(), indices.end());
+		indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+	} else {
+		std::vector<u32> all(m_snapshot.size());
+		for (u32 j = 0; j < all.size(); j++)
+			all[j] = j;
+		add(all);
+	}
+
+	cinfo.clear();
+	ActiveObject *self = pm.in.self;
+	ObjectState live_state;
+	for (u32 j : indices) {
+		const ObjectState *o = &m_snapshot[j];
+		if (live) {
+			// Removed objects are skipped by the lookup too
+			if (m_objects->getActiveObject(o->id) != o->obj)
+				continue;
+			live_state.read(o->obj);
+			o = &live_state;
+		}
+		if (!o->gone && (!self || (self != o->obj && self != o->parent)) &&
+				o->collides && o->has_box)
+			cinfo.emplace_back(o->obj, 0, o->box);
+	}
+}
+
+collisionMoveResult CollisionBatch::move(f32 pos_max_d, const aabb3f &box_0,
+		f32 stepheight, f32 dtime,
+		v3f *pos_f, v3f *speed_f,
+		v3f accel_f, ActiveObject *self,
+		bool collideWithObjects)
+{
+	auto it = m_prepared ? m_move_index.find(self) : m_move_index.end();
+	const PreparedMove *pm = it != m_move_index.end() ?
+			&m_moves[it->second] : nullptr;
+	if (!pm || !pm->batched || !bitwiseEqual(dtime, m_dtime) ||
+			!bitwiseEqual(box_0, pm->in.box_0) ||
+			!bitwiseEqual(stepheight, pm->in.stepheight) ||
+			!bitwiseEqual(*pos_f, pm->in.pos) ||
+			!bitwiseEqual(*speed_f, pm->in.speed) ||
+			!bitwiseEqual(accel_f, pm->in.accel) ||
+			collideWithObjects != pm->in.collide_objects ||
+			(pm->moving && !nodesUnchanged(*pm))) {
+		if (pm)
+			m_misses++;
+		return collisionMoveSimple(m_map, m_gamedef, m_objects, pos_max_d, box_0,
+				stepheight, dtime, pos_f, speed_f, accel_f, self,
+				collideWithObjects);
+	}
+
+	time_notification_done = false;
+
+	// The objects in reach may have changed since the sweep
+	std::vector<NearbyCollisionInfo> object_boxes;
+	if (pm->any_position_valid && collideWithObjects)
+		collectObjectBoxes(*pm, true, object_boxes);
+	bool same_objects = object_boxes.size() == pm->object_boxes.size();
+	for (size_t i = 0; same_objects && i < object_boxes.size(); i++) {
+		same_objects = object_boxes[i].obj == pm->object_boxes[i].obj &&
+			bitwiseEqual(object_boxes[i].box, pm->object_boxes[i].box);
+	}
+
+	if (same_objects) {
+		m_hits++;
+		*pos_f = pm->pos;
+		*speed_f = pm->speed;
+		if (!pm->completed)
+			warnLoopCountExceeded();
+		return pm->result;
+	}
+
+	// Sweep again with the cached node boxes
+	m_misses++;
+	collisionMoveResult result;
+	std::vector<NearbyCollisionInfo> cinfo;
+	collectCachedNodeBoxes(*pm, cinfo);
+	cinfo.insert(cinfo.end(), object_boxes.begin(), object_boxes.end());
+	*speed_f = pm->start_speed;
+	if (!collisionSweep(cinfo, box_0, stepheight, dtime, pos_f, speed_f, result))
+		warnLoopCountExceeded();
 	return result;
 }
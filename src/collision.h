@@ -20,12 +20,21 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes_bloated.h"
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include "map.h"
 
-class Map;
 class IGameDef;
 class Environment;
 class ActiveObject;
+class ServerActiveObject;
+class ParallelRunner;
+struct NearbyCollisionInfo;
+namespace server {
+	class ActiveObjectMgr;
+}
 
 enum CollisionType
 {
@@ -72,6 +81,124 @@ collisionMoveResult collisionMoveSimple(Environment *env,IGameDef *gamedef,
 		v3f accel_f, ActiveObject *self=NULL,
 		bool collideWithObjects=true);
 
+// Same as above for an object of the server environment, with the map and
+// the active objects given directly
+collisionMoveResult collisionMoveSimple(Map *map, IGameDef *gamedef,
+		server::ActiveObjectMgr *objects,
+		f32 pos_max_d, const aabb3f &box_0,
+		f32 stepheight, f32 dtime,
+		v3f *pos_f, v3f *speed_f,
+		v3f accel_f, ActiveObject *self=NULL,
+		bool collideWithObjects=true);
+
+/*
+	Runs the collisions of many server objects in one go.
+
+	prepare() sweeps all given moves on worker threads, using one shared
+	collision box cache for the touched nodes and a snapshot of the objects.
+	move() hands out the prepared result of a move if the move and the
+	collision boxes it ran into are still the same. If objects in reach have
+	changed in between, the move is swept again with the cached node boxes,
+	if the nodes have changed, collisionMoveSimple() is used. Either way the
+	outcome is identical to moving the objects one by one.
+
+	Like in ActiveObjectMgr::step(), objects added after prepare() are not
+	collided with until the batch is cleared.
+*/
+class CollisionBatch : public MapEventReceiver
+{
+public:
+	struct Move
+	{
+		ActiveObject *self;
+		aabb3f box_0;
+		f32 stepheight;
+		v3f pos;
+		v3f speed;
+		v3f accel;
+		bool collide_objects;
+	};
+
+	// num_threads includes the calling thread; 0 picks a default
+	CollisionBatch(Map *map, IGameDef *gamedef,
+			server::ActiveObjectMgr *objects, u32 num_threads);
+	~CollisionBatch();
+
+	DISABLE_CLASS_COPY(CollisionBatch);
+
+	// Sweeps the moves of this step; replaces the previous batch
+	void prepare(f32 dtime, const std::vector<Move> &moves);
+	// Forgets the prepared moves
+	void clear();
+
+	// Must be called whenever an object changes its position
+	void objectMoved(ServerActiveObject *obj);
+
+	// Drop-in replacement for collisionMoveSimple()
+	collisionMoveResult move(f32 pos_max_d, const aabb3f &box_0,
+			f32 stepheight, f32 dtime,
+			v3f *pos_f, v3f *speed_f,
+			v3f accel_f, ActiveObject *self,
+			bool collideWithObjects);
+
+	void onMapEditEvent(const MapEditEvent &event) override;
+
+	// Moves of the last batch served from it, and moves that were redone
+	u32 getHits() const { return m_hits; }
+	u32 getMisses() const { return m_misses; }
+
+private:
+	struct ObjectState;
+	struct PreparedMove;
+	struct NodeBoxes
+	{
+		u32 begin, end;
+		bool valid;
+	};
+
+	// Returns whether any node position was valid
+	bool collectCachedNodeBoxes(const PreparedMove &pm,
+			std::vector<NearbyCollisionInfo> &cinfo) const;
+	bool nodesUnchanged(const PreparedMove &pm) const;
+	// live: look at the objects as they are now instead of the snapshot
+	void collectObjectBoxes(const PreparedMove &pm, bool live,
+			std::vector<NearbyCollisionInfo> &cinfo) const;
+
+	Map *m_map;
+	IGameDef *m_gamedef;
+	server::ActiveObjectMgr *m_objects;
+	std::unique_ptr<ParallelRunner> m_runner;
+
+	bool m_prepared = false;
+	f32 m_dtime = 0.0f;
+	std::vector<ObjectState> m_snapshot;
+	// positions of the snapshot objects, at prepare() and now
+	std::vector<v3f> m_snapshot_positions;
+	std::vector<v3f> m_positions;
+	// snapshot index by object id
+	std::unordered_map<u16, u32> m_snapshot_index;
+	// snapshot indices by grid cell; objects at non-finite positions are
+	// kept in m_snapshot_anywhere
+	std::unordered_map<v3s16, std::vector<u32>> m_snapshot_grid;
+	std::vector<u32> m_snapshot_anywhere;
+	// collision boxes of the touched nodes, as ranges of m_boxes
+	std::unordered_map<v3s16, u32> m_node_index;
+	std::vector<NodeBoxes> m_node_boxes;
+	std::vector<NearbyCollisionInfo> m_boxes;
+	std::vector<PreparedMove> m_moves;
+	std::unordered_map<const ActiveObject *, u32> m_move_index;
+	// map blocks the node boxes were read from
+	std::unordered_map<v3s16, MapBlock *> m_blocks;
+	std::unordered_set<v3s16> m_modified_blocks;
+	// snapshot indices of the objects that moved since prepare(), by the
+	// grid cell they moved to
+	std::unordered_map<v3s16, std::vector<u32>> m_moved_grid;
+	std::vector<u32> m_moved_anywhere;
+
+	u32 m_hits = 0;
+	u32 m_misses = 0;
+};
+
 // Helper function:
 // Checks for collision of a moving aabbox with a static aabbox
 // Returns -1 if no collision, 0 if X collision, 1 if Y collision, 2 if Z collision
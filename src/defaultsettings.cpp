@@ -55,6 +55,7 @@ void set_default_settings()
 	settings->setDefault("mute_sound", "false");
 	settings->setDefault("sound_extensions_blacklist", "");
 	settings->setDefault("enable_mesh_cache", "false");
+	settings->setDefault("enable_greedy_meshing", "true");
 	settings->setDefault("mesh_generation_interval", "0");
 	settings->setDefault("mesh_generation_threads", "0");
 	settings->setDefault("free_move", "false");
@@ -73,12 +74,15 @@ void set_default_settings()
 	settings->setDefault("curl_file_download_timeout", "300000");
 	settings->setDefault("curl_verify_cert", "true");
 	settings->setDefault("enable_remote_media_server", "true");
+	settings->setDefault("media_chunk_requests", "16");
 	settings->setDefault("enable_client_modding", "true");
 	settings->setDefault("max_out_chat_queue_size", "20");
 	settings->setDefault("pause_on_lost_focus", "false");
 	settings->setDefault("enable_split_login_register", "true");
 	settings->setDefault("occlusion_culler", "bfs");
 	settings->setDefault("enable_raytraced_culling", "true");
+	settings->setDefault("enable_occlusion_buffer", "true");
+	settings->setDefault("occlusion_buffer_range", "64");
 	settings->setDefault("chat_weblink_color", "#8888FF");
 
 	// Keymap
@@ -255,6 +259,7 @@ void set_default_settings()
 	settings->setDefault("ambient_occlusion_gamma", "1.8");
 	settings->setDefault("enable_shaders", "true");
 	settings->setDefault("enable_particles", "true");
+	settings->setDefault("enable_particle_collision_cache", "true");
 	settings->setDefault("arm_inertia", "true");
 	settings->setDefault("show_nametag_backgrounds", "true");
 	settings->setDefault("transparency_sorting_distance", "16");
@@ -383,6 +388,9 @@ void set_default_settings()
 	settings->setDefault("ipv6_server", "false");
 	//settings->setDefault("max_packets_per_iteration", "1024");
 	settings->setDefault("max_packets_per_iteration", "10000");
+	settings->setDefault("udp_batch_size", "64");
+	settings->setDefault("connection_send_threads", "1");
+	settings->setDefault("congestion_control", "true");
 	settings->setDefault("port", "30000");
 	settings->setDefault("strict_protocol_version_checking", "false");
 	settings->setDefault("protocol_version_min", "1");
@@ -420,6 +428,8 @@ void set_default_settings()
 	settings->setDefault("chat_message_format", "<@name> @message");
 	settings->setDefault("profiler_print_interval", "0");
 	settings->setDefault("active_object_send_range_blocks", "8");
+	settings->setDefault("active_object_update_tiers", "");
+	settings->setDefault("active_object_update_out_of_view_factor", "2.0");
 	settings->setDefault("active_block_range", "4");
 	//settings->setDefault("max_simultaneous_block_sends_per_client", "1");
 	// This causes frametime jitter on client side, or does it?
@@ -448,6 +458,9 @@ void set_default_settings()
 	settings->setDefault("active_block_mgmt_interval", "2.0");
 	settings->setDefault("abm_interval", "1.0");
 	settings->setDefault("abm_time_budget", "0.2");
+	settings->setDefault("abm_scan_threads", "0");
+	settings->setDefault("pathfinder_threads", "1");
+	settings->setDefault("collision_threads", "0");
 	settings->setDefault("nodetimer_interval", "0.2");
 	settings->setDefault("ignore_world_load_errors", "false");
 	settings->setDefault("remote_media", "");
@@ -457,7 +470,14 @@ void set_default_settings()
 	settings->setDefault("emergequeue_limit_total", "1024");
 	settings->setDefault("emergequeue_limit_diskonly", "128");
 	settings->setDefault("emergequeue_limit_generate", "128");
+	settings->setDefault("emergequeue_cancel_margin", "2");
 	settings->setDefault("num_emerge_threads", "1");
+	settings->setDefault("mapgen_chunk_threads", "0");
+	settings->setDefault("pregen_radius", "0");
+	settings->setDefault("pregen_center", "(0, 0, 0)");
+	settings->setDefault("pregen_y_min", "-64");
+	settings->setDefault("pregen_y_max", "128");
+	settings->setDefault("pregen_max_lag", "0.2");
 	settings->setDefault("secure.enable_security", "true");
 	settings->setDefault("secure.trusted_mods", "");
 	settings->setDefault("secure.http_mods", "");
@@ -480,6 +500,8 @@ void set_default_settings()
 	settings->setDefault("liquid_loop_max", "100000");
 	settings->setDefault("liquid_queue_purge_time", "0");
 	settings->setDefault("liquid_update", "1.0");
+	settings->setDefault("liquid_time_budget", "0.5");
+	settings->setDefault("liquid_threads", "0");
 
 	// Mapgen
 	settings->setDefault("mg_name", "v7");
@@ -41,6 +41,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "scripting_server.h"
 #include "scripting_emerge.h"
 #include "server.h"
+#include "server/emergequeue.h"
 #include "settings.h"
 #include "voxel.h"
 
@@ -61,6 +62,7 @@ EmergeParams::EmergeParams(EmergeManager *parent, const BiomeGen *biomegen,
 	const SchematicManager *schemmgr) :
 	ndef(parent->ndef),
 	enable_mapgen_debug_info(parent->enable_mapgen_debug_info),
+	chunk_threads(parent->chunk_threads),
 	gen_notify_on(parent->gen_notify_on),
 	gen_notify_on_deco_ids(&parent->gen_notify_on_deco_ids),
 	gen_notify_on_custom(&parent->gen_notify_on_custom),
@@ -123,11 +125,22 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 	m_qlimit_total = rangelim(m_qlimit_total, 1, 1000000);
 	m_qlimit_diskonly = rangelim(m_qlimit_diskonly, 1, 1000000);
 	m_qlimit_generate = rangelim(m_qlimit_generate, 1, 1000000);
+	m_cancel_margin = rangelim(g_settings->getS16("emergequeue_cancel_margin"),
+		0, MAX_MAP_GENERATION_LIMIT / MAP_BLOCKSIZE);
+
+	m_queue = std::make_unique<EmergeQueue>(mb);
+
+	chunk_threads = g_settings->getU16("mapgen_chunk_threads");
+	// If automatic, share half of the procs between the emerge threads
+	if (chunk_threads == 0)
+		chunk_threads = MYMAX(1U, MYMIN(4U,
+			Thread::getNumberOfProcessors() / 2 / nthreads));
 
 	for (s16 i = 0; i < nthreads; i++)
 		m_threads.push_back(new EmergeThread(server, i));
 
-	infostream << "EmergeManager: using " << nthreads << " threads" << std::endl;
+	infostream << "EmergeManager: using " << nthreads << " threads, "
+		<< chunk_threads << " per mapchunk" << std::endl;
 }
 
 
@@ -195,6 +208,11 @@ void EmergeManager::initMapgens(MapgenParams *params)
 	v3s16 csize = v3s16(1, 1, 1) * (params->chunksize * MAP_BLOCKSIZE);
 	biomegen = biomemgr->createBiomeGen(BIOMEGEN_ORIGINAL, params->bparams, csize);
 
+	{
+		MutexAutoLock queuelock(m_queue_mutex);
+		m_queue->setChunkSize(params->chunksize);
+	}
+
 	for (u32 i = 0; i != m_threads.size(); i++) {
 		EmergeParams *p = new EmergeParams(this, biomegen,
 			biomemgr, oremgr, decomgr, schemmgr);
@@ -280,7 +298,6 @@ bool EmergeManager::enqueueBlockEmergeEx(
 	EmergeCompletionCallback callback,
 	void *callback_param)
 {
-	EmergeThread *thread = NULL;
 	bool entry_already_exists = false;
 
 	{
@@ -292,12 +309,9 @@ bool EmergeManager::enqueueBlockEmergeEx(
 
 		if (entry_already_exists)
 			return true;
-
-		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
 	}
 
-	thread->signal();
+	signalThreads();
 
 	return true;
 }
@@ -306,7 +320,43 @@ bool EmergeManager::enqueueBlockEmergeEx(
 bool EmergeManager::isBlockInQueue(v3s16 pos)
 {
 	MutexAutoLock queuelock(m_queue_mutex);
-	return m_blocks_enqueued.find(pos) != m_blocks_enqueued.end();
+	return m_queue->contains(pos);
+}
+
+
+size_t EmergeManager::getQueueSize()
+{
+	MutexAutoLock queuelock(m_queue_mutex);
+	return m_queue->size();
+}
+
+
+void EmergeManager::updatePeerPosition(session_t peer_id, v3s16 blockpos,
+	s16 radius)
+{
+	EmergeQueue::BlockList cancelled;
+	{
+		MutexAutoLock queuelock(m_queue_mutex);
+		m_queue->setPeerPosition(peer_id, blockpos, radius + m_cancel_margin,
+			&cancelled);
+	}
+
+	// Requests of players carry no callbacks
+	for (size_t i = 0; i != cancelled.size(); i++)
+		reportCompletedEmerge(EMERGE_CANCELLED);
+}
+
+
+void EmergeManager::removePeer(session_t peer_id)
+{
+	EmergeQueue::BlockList cancelled;
+	{
+		MutexAutoLock queuelock(m_queue_mutex);
+		m_queue->removePeer(peer_id, &cancelled);
+	}
+
+	for (size_t i = 0; i != cancelled.size(); i++)
+		reportCompletedEmerge(EMERGE_CANCELLED);
 }
 
 
@@ -353,10 +403,10 @@ bool EmergeManager::pushBlockEmergeData(
 	void *callback_param,
 	bool *entry_already_exists)
 {
-	u32 &count_peer = m_peer_queue_count[peer_requested];
+	u32 count_peer = m_queue->getPeerCount(peer_requested);
 
 	if ((flags & BLOCK_EMERGE_FORCE_QUEUE) == 0) {
-		if (m_blocks_enqueued.size() >= m_qlimit_total)
+		if (m_queue->size() >= m_qlimit_total)
 			return false;
 
 		if (peer_requested != PEER_ID_INEXISTENT) {
@@ -371,69 +421,33 @@ bool EmergeManager::pushBlockEmergeData(
 		}
 	}
 
-	std::pair<std::map<v3s16, BlockEmergeData>::iterator, bool> findres;
-	findres = m_blocks_enqueued.insert(std::make_pair(pos, BlockEmergeData()));
-
-	BlockEmergeData &bedata = findres.first->second;
-	*entry_already_exists   = !findres.second;
-
-	if (callback)
-		bedata.callbacks.emplace_back(callback, callback_param);
-
-	if (*entry_already_exists) {
-		bedata.flags |= flags;
-	} else {
-		bedata.flags = flags;
-		bedata.peer_requested = peer_requested;
-
-		count_peer++;
-	}
+	m_queue->push(pos, peer_requested, flags, callback, callback_param,
+		entry_already_exists);
 
 	return true;
 }
 
 
-bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
+void EmergeManager::finishBlockEmerge(v3s16 pos)
 {
-	auto it = m_blocks_enqueued.find(pos);
-	if (it == m_blocks_enqueued.end())
-		return false;
-
-	*bedata = it->second;
-
-	auto it2 = m_peer_queue_count.find(bedata->peer_requested);
-	if (it2 == m_peer_queue_count.end())
-		return false;
-
-	u32 &count_peer = it2->second;
-
-	assert(count_peer != 0);
-	count_peer--;
-
-	m_blocks_enqueued.erase(it);
+	bool has_blocks;
+	{
+		MutexAutoLock queuelock(m_queue_mutex);
+		m_queue->finish(pos);
+		has_blocks = m_queue->size() != 0;
+	}
 
-	return true;
+	// Blocks of the mapchunk may have been held back
+	if (has_blocks)
+		signalThreads();
 }
 
 
-EmergeThread *EmergeManager::getOptimalThread()
+void EmergeManager::signalThreads()
 {
-	size_t nthreads = m_threads.size();
-
-	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
-
-	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
-
-	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
-		if (nitems < nitems_lowest) {
-			index = i;
-			nitems_lowest = nitems;
-		}
-	}
-
-	return m_threads[index];
+	// Any idle thread may take the block
+	for (EmergeThread *thread : m_threads)
+		thread->signal();
 }
 
 void EmergeManager::reportCompletedEmerge(EmergeAction action)
@@ -466,28 +480,17 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(const v3s16 &pos)
-{
-	m_block_queue.push(pos);
-	return true;
-}
-
-
 void EmergeThread::cancelPendingItems()
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
-
-	while (!m_block_queue.empty()) {
-		BlockEmergeData bedata;
-		v3s16 pos;
-
-		pos = m_block_queue.front();
-		m_block_queue.pop();
-
-		m_emerge->popBlockEmergeData(pos, &bedata);
-
-		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
+	// The queue is shared, the first thread to stop cancels everything
+	EmergeQueue::BlockList cancelled;
+	{
+		MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+		m_emerge->m_queue->clear(&cancelled);
 	}
+
+	for (const auto &it : cancelled)
+		runCompletionCallbacks(it.first, EMERGE_CANCELLED, it.second.callbacks);
 }
 
 
@@ -512,15 +515,7 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
-		return false;
-
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
-
-	m_emerge->popBlockEmergeData(*pos, bedata);
-
-	return true;
+	return m_emerge->m_queue->pop(pos, bedata);
 }
 
 
@@ -667,8 +662,10 @@ void *EmergeThread::run()
 			continue;
 		}
 
-		if (blockpos_over_max_limit(pos))
+		if (blockpos_over_max_limit(pos)) {
+			m_emerge->finishBlockEmerge(pos);
 			continue;
+		}
 
 		bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
 		EMERGE_DBG_OUT("pos=" << pos << " allow_gen=" << allow_gen);
@@ -705,6 +702,7 @@ void *EmergeThread::run()
 			m_trans_liquid = nullptr;
 		}
 
+		m_emerge->finishBlockEmerge(pos);
 		runCompletionCallbacks(pos, action, bedata.callbacks);
 
 		if (block)
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <map>
+#include <memory>
 #include <mutex>
 #include "network/networkprotocol.h"
 #include "irr_v3d.h"
@@ -36,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 		infostream << "EmergeThread: " x << std::endl; \
 }
 
+class EmergeQueue;
 class EmergeThread;
 class NodeDefManager;
 class Settings;
@@ -104,6 +106,8 @@ class EmergeParams {
 
 	const NodeDefManager *ndef; // shared
 	bool enable_mapgen_debug_info;
+	// Threads a mapgen may use for a single mapchunk, including its own
+	u32 chunk_threads;
 
 	u32 gen_notify_on;
 	const std::set<u32> *gen_notify_on_deco_ids; // shared
@@ -136,6 +140,7 @@ class EmergeManager {
 public:
 	const NodeDefManager *ndef;
 	bool enable_mapgen_debug_info;
+	u32 chunk_threads;
 
 	// Generation Notify
 	u32 gen_notify_on = 0;
@@ -191,6 +196,17 @@ class EmergeManager {
 		void *callback_param);
 
 	bool isBlockInQueue(v3s16 pos);
+	size_t getQueueSize();
+	size_t getThreadCount() const { return m_threads.size(); }
+
+	/*
+		Tells the queue where a peer is, so that its nearest blocks come
+		first. Its requests beyond radius (in blocks) plus a margin are
+		cancelled.
+	*/
+	void updatePeerPosition(session_t peer_id, v3s16 blockpos, s16 radius);
+	// Cancels the requests of a peer that left
+	void removePeer(session_t peer_id);
 
 	Mapgen *getCurrentMapgen();
 
@@ -206,12 +222,12 @@ class EmergeManager {
 	bool m_threads_active = false;
 
 	std::mutex m_queue_mutex;
-	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
-	std::unordered_map<u16, u32> m_peer_queue_count;
+	std::unique_ptr<EmergeQueue> m_queue;
 
 	u32 m_qlimit_total;
 	u32 m_qlimit_diskonly;
 	u32 m_qlimit_generate;
+	s16 m_cancel_margin;
 
 	// Emerge metrics
 	MetricCounterPtr m_completed_emerge_counter[5];
@@ -225,8 +241,6 @@ class EmergeManager {
 	SchematicManager *schemmgr;
 
 	// Requires m_queue_mutex held
-	EmergeThread *getOptimalThread();
-
 	bool pushBlockEmergeData(
 		v3s16 pos,
 		u16 peer_requested,
@@ -235,7 +249,9 @@ class EmergeManager {
 		void *callback_param,
 		bool *entry_already_exists);
 
-	bool popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata);
+	// Called by an emerge thread once it is done with a block
+	void finishBlockEmerge(v3s16 pos);
+	void signalThreads();
 
 	void reportCompletedEmerge(EmergeAction action);
 
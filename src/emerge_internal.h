@@ -25,8 +25,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
-#include <queue>
-
 #include "util/thread.h"
 #include "threading/event.h"
 
@@ -48,9 +46,6 @@ class EmergeThread : public Thread {
 	void *run();
 	void signal();
 
-	// Requires queue mutex held
-	bool pushBlock(const v3s16 &pos);
-
 	void cancelPendingItems();
 
 	EmergeManager *getEmergeManager() { return m_emerge; }
@@ -73,7 +68,6 @@ class EmergeThread : public Thread {
 	UniqueQueue<v3s16> *m_trans_liquid; //< non-null only when generating a mapblock
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
 
 	bool initScripting();
 
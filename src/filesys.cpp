@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <cstring>
 #include <cerrno>
 #include <fstream>
+#include <algorithm>
 #include "log.h"
 #include "config.h"
 #include "porting.h"
@@ -139,6 +140,18 @@ bool IsExecutable(const std::string &path)
 	return GetBinaryType(path.c_str(), &type) != 0;
 }
 
+bool GetFileInfo(const std::string &path, uint64_t &size, uint64_t &mtime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attr) ||
+			(attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+	size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+	mtime = ((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) |
+		attr.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+
 bool IsDirDelimiter(char c)
 {
 	return c == '/' || c == '\\';
@@ -346,6 +359,16 @@ bool IsDir(const std::string &path)
 	return ((statbuf.st_mode & S_IFDIR) == S_IFDIR);
 }
 
+bool GetFileInfo(const std::string &path, uint64_t &size, uint64_t &mtime)
+{
+	struct stat statbuf{};
+	if (stat(path.c_str(), &statbuf) || !S_ISREG(statbuf.st_mode))
+		return false;
+	size = statbuf.st_size;
+	mtime = statbuf.st_mtime;
+	return true;
+}
+
 bool IsExecutable(const std::string &path)
 {
 	return access(path.c_str(), X_OK) == 0;
@@ -970,6 +993,26 @@ bool ReadFile(const std::string &path, std::string &out)
 	return !is.fail();
 }
 
+bool ReadFilePart(const std::string &path, uint64_t offset, uint32_t len,
+		std::string &out, uint64_t &file_size)
+{
+	std::ifstream is(path, std::ios::binary | std::ios::ate);
+	if (!is.good())
+		return false;
+
+	file_size = is.tellg();
+	out.clear();
+	if (offset >= file_size)
+		return true;
+
+	out.resize(std::min<uint64_t>(len, file_size - offset));
+	is.seekg(offset);
+	is.read(&out[0], out.size());
+	// The file may have been truncated in the meantime
+	out.resize(is.gcount());
+	return !is.bad();
+}
+
 bool Rename(const std::string &from, const std::string &to)
 {
 	return rename(from.c_str(), to.c_str()) == 0;
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <cstdint>
 #include <set>
 #include <string>
 #include <string_view>
@@ -67,6 +68,10 @@ inline bool IsFile(const std::string &path)
 	return PathExists(path) && !IsDir(path);
 }
 
+// Size and last modification time of a regular file. The time is only
+// meant to be compared, its unit depends on the platform.
+bool GetFileInfo(const std::string &path, uint64_t &size, uint64_t &mtime);
+
 bool IsDirDelimiter(char c);
 
 // Only pass full paths to this one. True on success.
@@ -150,6 +155,11 @@ bool extractZipFile(irr::io::IFileSystem *fs, const char *filename, const std::s
 
 bool ReadFile(const std::string &path, std::string &out);
 
+// Reads at most `len` bytes starting at `offset`, `out` is empty if the
+// file is shorter. Returns false if the file can't be read.
+bool ReadFilePart(const std::string &path, uint64_t offset, uint32_t len,
+		std::string &out, uint64_t &file_size);
+
 bool Rename(const std::string &from, const std::string &to);
 
 } // namespace fs
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "debug.h"
 #include <algorithm>
 #include <sstream>
+#include <unordered_map>
 #include "log.h"
 #include "util/strfnd.h"
 #include "content_mapnode.h" // For loading legacy MaterialItems
@@ -566,6 +567,9 @@ InventoryList & InventoryList::operator = (const InventoryList &other)
 	m_name = other.m_name;
 	m_itemdef = other.m_itemdef;
 	//setDirty(true);
+	// Slots are not tracked across copies
+	m_dirty_all = m_dirty;
+	m_dirty_slots.assign(m_size, false);
 
 	return *this;
 }
@@ -603,7 +607,7 @@ ItemStack InventoryList::changeItem(u32 i, const ItemStack &newitem)
 	ItemStack olditem = m_items[i];
 	if (olditem != newitem) {
 		m_items[i] = newitem;
-		setModified();
+		setSlotModified(i);
 	}
 	return olditem;
 }
@@ -612,7 +616,7 @@ void InventoryList::deleteItem(u32 i)
 {
 	assert(i < m_items.size()); // Pre-condition
 	m_items[i].clear();
-	setModified();
+	setSlotModified(i);
 }
 
 ItemStack InventoryList::addItem(const ItemStack &newitem_)
@@ -661,7 +665,7 @@ ItemStack InventoryList::addItem(u32 i, const ItemStack &newitem)
 
 	ItemStack leftover = m_items[i].addItem(newitem, m_itemdef);
 	if (leftover != newitem)
-		setModified();
+		setSlotModified(i);
 	return leftover;
 }
 
@@ -716,8 +720,10 @@ ItemStack InventoryList::removeItem(const ItemStack &item)
 	for (auto i = m_items.rbegin(); i != m_items.rend(); ++i) {
 		if (i->name == item.name) {
 			u32 still_to_remove = item.count - removed.count;
-			ItemStack leftover = removed.addItem(i->takeItem(still_to_remove),
-					m_itemdef);
+			ItemStack taken = i->takeItem(still_to_remove);
+			if (!taken.empty())
+				setSlotModified(m_items.rend() - i - 1);
+			ItemStack leftover = removed.addItem(taken, m_itemdef);
 			// Allow oversized stacks
 			removed.count += leftover.count;
 
@@ -725,8 +731,6 @@ ItemStack InventoryList::removeItem(const ItemStack &item)
 				break;
 		}
 	}
-	if (!removed.empty())
-		setModified();
 	return removed;
 }
 
@@ -737,7 +741,7 @@ ItemStack InventoryList::takeItem(u32 i, u32 takecount)
 
 	ItemStack taken = m_items[i].takeItem(takecount);
 	if (!taken.empty())
-		setModified();
+		setSlotModified(i);
 	return taken;
 }
 
@@ -968,6 +972,161 @@ void Inventory::deSerialize(std::istream &is)
 	throw SerializationError(ss.str());
 }
 
+/*
+	Delta format:
+	u16 number of strings
+		std::string32 item name or serialized metadata
+	u16 number of modified lists
+		std::string16 list name
+		u16 list size
+		u8 whole list; all slots that are not sent are empty
+		if whole list:
+			u32 width
+		u16 number of slots
+			u16 slot index
+			u16 item name (index into the strings + 1, 0 for an empty slot)
+			if not empty:
+				u16 count
+				u16 wear
+				u16 metadata (index into the strings + 1, 0 for none)
+*/
+
+bool Inventory::serializeDelta(std::ostream &os) const
+{
+	// Lists were added or removed
+	if (m_dirty)
+		return false;
+
+	// Item names and metadata are mostly the same in many slots
+	std::vector<std::string> strings;
+	std::unordered_map<std::string, u16> string_ids;
+	auto intern = [&] (const std::string &str) -> u16 {
+		auto it = string_ids.find(str);
+		if (it != string_ids.end())
+			return it->second;
+		strings.push_back(str);
+		// Checked below
+		u16 id = static_cast<u16>(strings.size());
+		string_ids.emplace(str, id);
+		return id;
+	};
+
+	std::ostringstream os2(std::ios_base::binary);
+	u16 list_count = 0;
+	for (const InventoryList *list : m_lists) {
+		if (list->checkModified())
+			list_count++;
+	}
+	writeU16(os2, list_count);
+
+	std::vector<u16> slots;
+	for (const InventoryList *list : m_lists) {
+		if (!list->checkModified())
+			continue;
+		if (list->getSize() > U16_MAX)
+			return false;
+
+		const bool all = list->checkAllModified();
+		slots.clear();
+		for (u32 i = 0; i < list->getSize(); i++) {
+			if (all ? !list->getItem(i).empty() : list->checkSlotModified(i))
+				slots.push_back(i);
+		}
+
+		os2 << serializeString16(list->getName());
+		writeU16(os2, list->getSize());
+		writeU8(os2, all);
+		if (all)
+			writeU32(os2, list->getWidth());
+		writeU16(os2, slots.size());
+
+		for (u16 i : slots) {
+			const ItemStack &item = list->getItem(i);
+			writeU16(os2, i);
+			if (item.empty()) {
+				writeU16(os2, 0);
+				continue;
+			}
+			writeU16(os2, intern(item.name));
+			writeU16(os2, item.count);
+			writeU16(os2, item.wear);
+			if (item.metadata.empty()) {
+				writeU16(os2, 0);
+			} else {
+				std::ostringstream meta_os(std::ios_base::binary);
+				item.metadata.serialize(meta_os);
+				writeU16(os2, intern(meta_os.str()));
+			}
+		}
+	}
+
+	if (strings.size() > U16_MAX)
+		return false;
+
+	writeU16(os, strings.size());
+	for (const std::string &str : strings)
+		os << serializeString32(str);
+	os << os2.str();
+	return true;
+}
+
+void Inventory::deSerializeDelta(std::istream &is)
+{
+	std::vector<std::string> strings(readU16(is));
+	for (std::string &str : strings)
+		str = deSerializeString32(is);
+
+	auto get_string = [&] (u16 id) -> const std::string & {
+		if (id == 0 || id > strings.size())
+			throw SerializationError("Inventory delta: invalid string");
+		return strings[id - 1];
+	};
+
+	u16 list_count = readU16(is);
+	for (u16 l = 0; l < list_count; l++) {
+		std::string listname = deSerializeString16(is);
+		u16 size = readU16(is);
+		bool all = readU8(is);
+
+		InventoryList *list = getList(listname);
+		if (!list)
+			throw SerializationError("Inventory delta: unknown list " + listname);
+		if (all) {
+			list->setSize(size);
+			list->setWidth(readU32(is));
+			list->clearItems();
+		} else if (list->getSize() != size) {
+			throw SerializationError("Inventory delta: size mismatch of list "
+				+ listname);
+		}
+
+		u16 slot_count = readU16(is);
+		for (u16 s = 0; s < slot_count; s++) {
+			u16 i = readU16(is);
+			u16 name_id = readU16(is);
+			if (is.fail() || i >= size)
+				throw SerializationError("Inventory delta: invalid slot");
+
+			ItemStack item;
+			if (name_id != 0) {
+				item.name = get_string(name_id);
+				item.count = readU16(is);
+				item.wear = readU16(is);
+				u16 meta_id = readU16(is);
+				if (meta_id != 0) {
+					std::istringstream meta_is(get_string(meta_id),
+						std::ios_base::binary);
+					item.metadata.deSerialize(meta_is);
+				}
+			}
+			list->changeItem(i, item);
+		}
+	}
+
+	if (is.fail())
+		throw SerializationError("Inventory delta: unexpected end");
+}
+
 InventoryList * Inventory::addList(const std::string &name, u32 size)
 {
 	setModified();
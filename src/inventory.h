@@ -295,7 +295,25 @@ class InventoryList
 	void moveItemSomewhere(u32 i, InventoryList *dest, u32 count);
 
 	inline bool checkModified() const { return m_dirty; }
-	inline void setModified(bool dirty = true) { m_dirty = dirty; }
+	// Whether more than single slots were modified (size, width, ...)
+	inline bool checkAllModified() const { return m_dirty_all; }
+	inline bool checkSlotModified(u32 i) const
+	{
+		return m_dirty_all || m_dirty_slots[i];
+	}
+	// Marks the whole list as modified, or nothing at all
+	inline void setModified(bool dirty = true)
+	{
+		m_dirty = dirty;
+		m_dirty_all = dirty;
+		m_dirty_slots.assign(m_items.size(), false);
+	}
+	inline void setSlotModified(u32 i)
+	{
+		m_dirty = true;
+		if (i < m_dirty_slots.size())
+			m_dirty_slots[i] = true;
+	}
 
 	// Problem: C++ keeps references to InventoryList and ItemStack indices
 	// until a better solution is found, this serves as a guard to prevent side-effects
@@ -322,6 +340,9 @@ class InventoryList
 	u32 m_width = 0;
 	IItemDefManager *m_itemdef;
 	bool m_dirty = true;
+	bool m_dirty_all = true;
+	// Slots modified since the last setModified(false)
+	std::vector<bool> m_dirty_slots;
 	int m_resize_locks = 0; // Lua callback sanity
 };
 
@@ -345,6 +366,16 @@ class Inventory
 	void serialize(std::ostream &os, bool incremental = false) const;
 	void deSerialize(std::istream &is);
 
+	/*
+		Binary serialization of the slots modified since the last
+		setModified(false), for the network. Returns false if that is not
+		possible because lists were added or removed; the inventory has to
+		be serialized incrementally then.
+	*/
+	bool serializeDelta(std::ostream &os) const;
+	// Throws SerializationError if the delta doesn't match the lists
+	void deSerializeDelta(std::istream &is);
+
 	// Creates a new list if none exists or truncates existing lists
 	InventoryList * addList(const std::string &name, u32 size);
 	InventoryList * getList(const std::string &name);
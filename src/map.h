@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <algorithm>
 
 #include "irrlichttypes_bloated.h"
 #include "mapblock.h"
@@ -50,6 +51,7 @@ class IRollbackManager;
 class EmergeManager;
 class MetricsBackend;
 class ServerEnvironment;
+class LiquidQueue;
 struct BlockMakeData;
 
 /*
@@ -305,6 +307,82 @@ class Map /*: public NodeContainer*/
 		}
 	}
 
+	// Like forEachNodeInArea, but only visits nodes with a content in filter,
+	// looked up in the content index of each block. Nodes are visited in the
+	// same order as forEachNodeInArea.
+	template<typename F>
+	void forEachNodeInAreaWithContent(v3s16 minp, v3s16 maxp,
+			const std::vector<content_t> &filter, F func)
+	{
+		std::vector<content_t> contents(filter);
+		std::sort(contents.begin(), contents.end());
+		contents.erase(std::unique(contents.begin(), contents.end()), contents.end());
+		const bool want_ignore = std::binary_search(contents.begin(),
+				contents.end(), CONTENT_IGNORE);
+		// Node indices of a block found for all contents
+		std::vector<u16> hits;
+
+		v3s16 bpmin = getNodeBlockPos(minp);
+		v3s16 bpmax = getNodeBlockPos(maxp);
+		for (s16 bz = bpmin.Z; bz <= bpmax.Z; bz++)
+		for (s16 bx = bpmin.X; bx <= bpmax.X; bx++)
+		for (s16 by = bpmin.Y; by <= bpmax.Y; by++) {
+			// y is iterated innermost to make use of the sector cache.
+			v3s16 bp(bx, by, bz);
+			MapBlock *block = getBlockNoCreateNoEx(bp);
+			v3s16 basep = bp * MAP_BLOCKSIZE;
+			v3s16 min_block(
+				rangelim(minp.X - basep.X, 0, MAP_BLOCKSIZE - 1),
+				rangelim(minp.Y - basep.Y, 0, MAP_BLOCKSIZE - 1),
+				rangelim(minp.Z - basep.Z, 0, MAP_BLOCKSIZE - 1));
+			v3s16 max_block(
+				rangelim(maxp.X - basep.X, 0, MAP_BLOCKSIZE - 1),
+				rangelim(maxp.Y - basep.Y, 0, MAP_BLOCKSIZE - 1),
+				rangelim(maxp.Z - basep.Z, 0, MAP_BLOCKSIZE - 1));
+
+			if (!block) {
+				if (!want_ignore)
+					continue;
+				v3s16 p;
+				for (p.Z = min_block.Z; p.Z <= max_block.Z; p.Z++)
+				for (p.Y = min_block.Y; p.Y <= max_block.Y; p.Y++)
+				for (p.X = min_block.X; p.X <= max_block.X; p.X++) {
+					if (!func(basep + p, MapNode(CONTENT_IGNORE)))
+						return;
+				}
+				continue;
+			}
+
+			// The positions of a content are sorted by index, which is the
+			// z, y, x order of forEachNodeInArea
+			const MapBlockContentIndex &index = block->getContentIndex();
+			hits.clear();
+			size_t lists = 0;
+			for (content_t c : contents) {
+				const std::vector<u16> *positions = index.find(c);
+				if (!positions)
+					continue;
+				for (u16 i : *positions) {
+					v3s16 p = MapBlockContentIndex::getPos(i);
+					if (p.X < min_block.X || p.X > max_block.X ||
+							p.Y < min_block.Y || p.Y > max_block.Y ||
+							p.Z < min_block.Z || p.Z > max_block.Z)
+						continue;
+					hits.push_back(i);
+				}
+				lists++;
+			}
+			if (lists > 1)
+				std::sort(hits.begin(), hits.end());
+
+			for (u16 i : hits) {
+				v3s16 p = MapBlockContentIndex::getPos(i);
+				if (!func(basep + p, block->getNodeNoCheck(p)))
+					return;
+			}
+		}
+	}
+
 	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes)
 	{
 		return isBlockOccluded(block->getPosRelative(), cam_pos_nodes, false);
@@ -459,6 +537,14 @@ class ServerMap : public Map
 private:
 	friend class ModApiMapgen; // for m_transforming_liquid
 
+	// Transforms a liquid node on this thread, calling on_flood() and
+	// reporting to rollback as needed. Queues neighbors to m_transforming_liquid.
+	void transformLiquidNode(v3s16 p0, ServerEnvironment *env,
+			std::map<v3s16, MapBlock*> &modified_blocks,
+			std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+			std::vector<v3s16> &must_reflow,
+			std::vector<v3s16> &check_for_falling);
+
 	// Emerge manager
 	EmergeManager *m_emerge;
 
@@ -472,8 +558,10 @@ class ServerMap : public Map
 	// used by deleteBlock() and deleteDetachedBlocks()
 	std::vector<std::unique_ptr<MapBlock>> m_detached_blocks;
 
-	// Queued transforming water nodes
+	// Transforming water nodes queued since the last transformLiquids()
 	UniqueQueue<v3s16> m_transforming_liquid;
+	// Queued transforming water nodes, by mapchunk
+	std::unique_ptr<LiquidQueue> m_liquid_queue;
 	f32 m_transforming_liquid_loop_count_multiplier = 1.0f;
 	u32 m_unprocessed_count = 0;
 	u64 m_inc_trending_up_start_time = 0; // milliseconds
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapblock.h"
 
+#include <algorithm>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -212,6 +213,7 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+	expireContentIndex();
 }
 
 void MapBlock::actuallyUpdateIsAir()
@@ -237,6 +239,71 @@ void MapBlock::expireIsAirCache()
 	m_is_air_expired = true;
 }
 
+/*
+	MapBlockContentIndex
+*/
+
+static bool contentLess(const MapBlockContentIndex::Entry &e, content_t c)
+{
+	return e.content < c;
+}
+
+void MapBlockContentIndex::build(const MapNode *data)
+{
+	m_entries.clear();
+	Entry *entry = nullptr;
+	for (u32 i = 0; i < MapBlock::nodecount; i++) {
+		const content_t c = data[i].getContent();
+		// Runs of the same content are common
+		if (!entry || entry->content != c)
+			entry = &getOrAdd(c);
+		entry->positions.push_back(i);
+	}
+}
+
+MapBlockContentIndex::Entry &MapBlockContentIndex::getOrAdd(content_t c)
+{
+	auto it = std::lower_bound(m_entries.begin(), m_entries.end(), c,
+		contentLess);
+	if (it == m_entries.end() || it->content != c)
+		it = m_entries.insert(it, Entry{c, {}});
+	return *it;
+}
+
+void MapBlockContentIndex::change(u16 i, content_t from, content_t to)
+{
+	auto it = std::lower_bound(m_entries.begin(), m_entries.end(), from,
+		contentLess);
+	if (it != m_entries.end() && it->content == from) {
+		std::vector<u16> &positions = it->positions;
+		auto pos = std::lower_bound(positions.begin(), positions.end(), i);
+		if (pos != positions.end() && *pos == i)
+			positions.erase(pos);
+		if (positions.empty())
+			m_entries.erase(it);
+	}
+
+	std::vector<u16> &positions = getOrAdd(to).positions;
+	positions.insert(std::lower_bound(positions.begin(), positions.end(), i), i);
+}
+
+const std::vector<u16> *MapBlockContentIndex::find(content_t c) const
+{
+	auto it = std::lower_bound(m_entries.begin(), m_entries.end(), c,
+		contentLess);
+	if (it == m_entries.end() || it->content != c)
+		return nullptr;
+	return &it->positions;
+}
+
+size_t MapBlockContentIndex::getMemoryUsage() const
+{
+	size_t size = m_entries.capacity() * sizeof(Entry);
+	for (const Entry &e : m_entries)
+		size += e.positions.capacity() * sizeof(u16);
+	return size;
+}
+
 /*
 	Serialization
 */
@@ -477,6 +544,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()<<std::endl);
 
 	m_is_air_expired = true;
+	expireContentIndex();
 
 	if(version <= 21)
 	{
@@ -65,6 +65,49 @@ enum ModReason : u32 {
 	MOD_REASON_UNKNOWN                    = 1 << 18,
 };
 
+////
+//// Node positions by content
+////
+
+/*
+	Positions of the nodes of a mapblock, grouped by content.
+	Positions are node indices (z * zstride + y * ystride + x) in ascending
+	order, the entries are sorted by content.
+*/
+class MapBlockContentIndex
+{
+public:
+	struct Entry {
+		content_t content;
+		std::vector<u16> positions;
+	};
+
+	void build(const MapNode *data);
+	void clear() { m_entries.clear(); }
+
+	// Moves position i from the list of content 'from' to that of 'to'
+	void change(u16 i, content_t from, content_t to);
+
+	// nullptr if there is no such content
+	const std::vector<u16> *find(content_t c) const;
+	const std::vector<Entry> &getEntries() const { return m_entries; }
+
+	// Heap memory used, in bytes
+	size_t getMemoryUsage() const;
+
+	// Position within the block of node index i
+	static inline v3s16 getPos(u16 i)
+	{
+		return v3s16(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+			i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+	}
+
+private:
+	Entry &getOrAdd(content_t c);
+
+	std::vector<Entry> m_entries;
+};
+
 ////
 //// MapBlock itself
 ////
@@ -92,6 +135,7 @@ class MapBlock
 	{
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
+		expireContentIndex();
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
 
@@ -268,8 +312,7 @@ class MapBlock
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
-		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
+		setNodeNoCheck(x, y, z, n);
 	}
 
 	inline void setNode(v3s16 p, MapNode n)
@@ -293,7 +336,10 @@ class MapBlock
 
 	inline void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode n)
 	{
-		data[z * zstride + y * ystride + x] = n;
+		const u32 i = z * zstride + y * ystride + x;
+		if (m_content_index_valid && data[i].getContent() != n.getContent())
+			m_content_index.change(i, data[i].getContent(), n.getContent());
+		data[i] = n;
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -323,6 +369,29 @@ class MapBlock
 		return m_is_air;
 	}
 
+	// Node positions by content. Built on first use, then kept up to date
+	// by setNode() until the data is replaced in bulk.
+	const MapBlockContentIndex &getContentIndex()
+	{
+		if (!m_content_index_valid) {
+			m_content_index.build(data);
+			m_content_index_valid = true;
+		}
+		return m_content_index;
+	}
+
+	bool hasContentIndex() const
+	{
+		return m_content_index_valid;
+	}
+
+	// Call after changing the node data other than through setNode()
+	void expireContentIndex()
+	{
+		m_content_index.clear();
+		m_content_index_valid = false;
+	}
+
 	bool onObjectsActivation();
 	bool saveStaticObject(u16 id, const StaticObject &obj, u32 reason);
 
@@ -517,6 +586,9 @@ class MapBlock
 	bool m_is_air = false;
 	bool m_is_air_expired = true;
 
+	MapBlockContentIndex m_content_index;
+	bool m_content_index_valid = false;
+
 	/*
 		- On the server, this is used for telling whether the
 		  block has been modified from the one on disk.
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "util/numeric.h"
+#include <algorithm>
 #include <cmath>
 #include "map.h"
 #include "mapgen.h"
@@ -28,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen_v7.h"
 #include "mg_biome.h"
 #include "cavegen.h"
+#include "util/thread.h"
 
 // TODO Remove this. Cave liquids are now defined and located using biome definitions
 static NoiseParams nparams_caveliquids(0, 1, v3f(150.0, 150.0, 150.0), 776, 3, 0.6, 2.0);
@@ -71,125 +73,136 @@ CavesNoiseIntersection::~CavesNoiseIntersection()
 
 
 void CavesNoiseIntersection::generateCaves(MMVManip *vm,
-	v3s16 nmin, v3s16 nmax, biome_t *biomemap)
+	v3s16 nmin, v3s16 nmax, biome_t *biomemap, ParallelRunner *runner)
 {
 	assert(vm);
 	assert(biomemap);
 
+	noise_cave1->setParallelRunner(runner);
+	noise_cave2->setParallelRunner(runner);
 	noise_cave1->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
 	noise_cave2->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
 
 	const v3s16 &em = vm->m_area.getExtent();
-	u32 index2d = 0;  // Biomemap index
 
 	s16 *biome_transitions = m_bmgn->getBiomeTransitions();
 
-	for (s16 z = nmin.Z; z <= nmax.Z; z++)
-	for (s16 x = nmin.X; x <= nmax.X; x++, index2d++) {
-		bool column_is_open = false;  // Is column open to overground
-		bool is_under_river = false;  // Is column under river water
-		bool is_under_tunnel = false;  // Is tunnel or is under tunnel
-		bool is_top_filler_above = false;  // Is top or filler above node
-		// Indexes at column top
-		u32 vi = vm->m_area.index(x, nmax.Y, z);
-		u32 index3d = (z - nmin.Z) * m_zstride_1d + m_csize.Y * m_ystride +
-			(x - nmin.X);  // 3D noise index
-		// Biome of column
-		Biome *biome = (Biome *)m_bmgr->getRaw(biomemap[index2d]);
-		u16 depth_top = biome->depth_top;
-		u16 base_filler = depth_top + biome->depth_filler;
-		u16 depth_riverbed = biome->depth_riverbed;
-		u16 nplaced = 0;
-
-		int cur_biome_depth = 0;
-		s16 biome_y_min = biome_transitions[cur_biome_depth];
-
-		// Don't excavate the overgenerated stone at nmax.Y + 1,
-		// this creates a 'roof' over the tunnel, preventing light in
-		// tunnels at mapchunk borders when generating mapchunks upwards.
-		// This 'roof' is removed when the mapchunk above is generated.
-		for (s16 y = nmax.Y; y >= nmin.Y - 1; y--,
-				index3d -= m_ystride,
-				VoxelArea::add_y(em, vi, -1)) {
-			// We need this check to make sure that biomes don't generate too far down
-			if (y < biome_y_min) {
-				biome = m_bmgn->getBiomeAtIndex(index2d, v3s16(x, y, z));
-
-				// Finding the height of the next biome
-				// On first iteration this may loop a couple times after than it should just run once
-				while (y < biome_y_min) {
-					biome_y_min = biome_transitions[++cur_biome_depth];
+	// Columns are independent, so slices along Z can be carved in parallel
+	auto carve = [&] (u32 z_begin, u32 z_end) {
+		u32 index2d = z_begin * m_csize.X;  // Biomemap index
+
+		for (s16 z = nmin.Z + (s16)z_begin; z < nmin.Z + (s16)z_end; z++)
+		for (s16 x = nmin.X; x <= nmax.X; x++, index2d++) {
+			bool column_is_open = false;  // Is column open to overground
+			bool is_under_river = false;  // Is column under river water
+			bool is_under_tunnel = false;  // Is tunnel or is under tunnel
+			bool is_top_filler_above = false;  // Is top or filler above node
+			// Indexes at column top
+			u32 vi = vm->m_area.index(x, nmax.Y, z);
+			u32 index3d = (z - nmin.Z) * m_zstride_1d + m_csize.Y * m_ystride +
+				(x - nmin.X);  // 3D noise index
+			// Biome of column
+			Biome *biome = (Biome *)m_bmgr->getRaw(biomemap[index2d]);
+			u16 depth_top = biome->depth_top;
+			u16 base_filler = depth_top + biome->depth_filler;
+			u16 depth_riverbed = biome->depth_riverbed;
+			u16 nplaced = 0;
+
+			int cur_biome_depth = 0;
+			s16 biome_y_min = biome_transitions[cur_biome_depth];
+
+			// Don't excavate the overgenerated stone at nmax.Y + 1,
+			// this creates a 'roof' over the tunnel, preventing light in
+			// tunnels at mapchunk borders when generating mapchunks upwards.
+			// This 'roof' is removed when the mapchunk above is generated.
+			for (s16 y = nmax.Y; y >= nmin.Y - 1; y--,
+					index3d -= m_ystride,
+					VoxelArea::add_y(em, vi, -1)) {
+				// We need this check to make sure that biomes don't generate too far down
+				if (y < biome_y_min) {
+					biome = m_bmgn->getBiomeAtIndex(index2d, v3s16(x, y, z));
+
+					// Finding the height of the next biome
+					// On first iteration this may loop a couple times after than it should just run once
+					while (y < biome_y_min) {
+						biome_y_min = biome_transitions[++cur_biome_depth];
+					}
+
+					/*if (x == nmin.X && z == nmin.Z)
+						printf("Cave: check @ %i -> %s -> again at %i\n", y, biome->name.c_str(), biome_y_min);*/
 				}
 
-				/*if (x == nmin.X && z == nmin.Z)
-					printf("Cave: check @ %i -> %s -> again at %i\n", y, biome->name.c_str(), biome_y_min);*/
-			}
+				content_t c = vm->m_data[vi].getContent();
 
-			content_t c = vm->m_data[vi].getContent();
+				if (c == CONTENT_AIR || c == biome->c_water_top ||
+						c == biome->c_water) {
+					column_is_open = true;
+					is_top_filler_above = false;
+					continue;
+				}
 
-			if (c == CONTENT_AIR || c == biome->c_water_top ||
-					c == biome->c_water) {
-				column_is_open = true;
-				is_top_filler_above = false;
-				continue;
-			}
+				if (c == biome->c_river_water) {
+					column_is_open = true;
+					is_under_river = true;
+					is_top_filler_above = false;
+					continue;
+				}
 
-			if (c == biome->c_river_water) {
-				column_is_open = true;
-				is_under_river = true;
-				is_top_filler_above = false;
-				continue;
-			}
+				// Ground
+				float d1 = contour(noise_cave1->result[index3d]);
+				float d2 = contour(noise_cave2->result[index3d]);
 
-			// Ground
-			float d1 = contour(noise_cave1->result[index3d]);
-			float d2 = contour(noise_cave2->result[index3d]);
-
-			if (d1 * d2 > m_cave_width && m_ndef->get(c).is_ground_content) {
-				// In tunnel and ground content, excavate
-				vm->m_data[vi] = MapNode(CONTENT_AIR);
-				is_under_tunnel = true;
-				// If tunnel roof is top or filler, replace with stone
-				if (is_top_filler_above)
-					vm->m_data[vi + em.X] = MapNode(biome->c_stone);
-				is_top_filler_above = false;
-			} else if (column_is_open && is_under_tunnel &&
-					(c == biome->c_stone || c == biome->c_filler)) {
-				// Tunnel entrance floor, place biome surface nodes
-				if (is_under_river) {
-					if (nplaced < depth_riverbed) {
-						vm->m_data[vi] = MapNode(biome->c_riverbed);
+				if (d1 * d2 > m_cave_width && m_ndef->get(c).is_ground_content) {
+					// In tunnel and ground content, excavate
+					vm->m_data[vi] = MapNode(CONTENT_AIR);
+					is_under_tunnel = true;
+					// If tunnel roof is top or filler, replace with stone
+					if (is_top_filler_above)
+						vm->m_data[vi + em.X] = MapNode(biome->c_stone);
+					is_top_filler_above = false;
+				} else if (column_is_open && is_under_tunnel &&
+						(c == biome->c_stone || c == biome->c_filler)) {
+					// Tunnel entrance floor, place biome surface nodes
+					if (is_under_river) {
+						if (nplaced < depth_riverbed) {
+							vm->m_data[vi] = MapNode(biome->c_riverbed);
+							is_top_filler_above = true;
+							nplaced++;
+						} else {
+							// Disable top/filler placement
+							column_is_open = false;
+							is_under_river = false;
+							is_under_tunnel = false;
+						}
+					} else if (nplaced < depth_top) {
+						vm->m_data[vi] = MapNode(biome->c_top);
+						is_top_filler_above = true;
+						nplaced++;
+					} else if (nplaced < base_filler) {
+						vm->m_data[vi] = MapNode(biome->c_filler);
 						is_top_filler_above = true;
 						nplaced++;
 					} else {
 						// Disable top/filler placement
 						column_is_open = false;
-						is_under_river = false;
 						is_under_tunnel = false;
 					}
-				} else if (nplaced < depth_top) {
-					vm->m_data[vi] = MapNode(biome->c_top);
-					is_top_filler_above = true;
-					nplaced++;
-				} else if (nplaced < base_filler) {
-					vm->m_data[vi] = MapNode(biome->c_filler);
-					is_top_filler_above = true;
-					nplaced++;
 				} else {
-					// Disable top/filler placement
+					// Not tunnel or tunnel entrance floor
+					// Check node for possible replacing with stone for tunnel roof
+					if (c == biome->c_top || c == biome->c_filler)
+						is_top_filler_above = true;
+
 					column_is_open = false;
-					is_under_tunnel = false;
 				}
-			} else {
-				// Not tunnel or tunnel entrance floor
-				// Check node for possible replacing with stone for tunnel roof
-				if (c == biome->c_top || c == biome->c_filler)
-					is_top_filler_above = true;
-
-				column_is_open = false;
 			}
 		}
-	}
+	};
+
+	if (runner)
+		runner->run(m_csize.Z, carve);
+	else
+		carve(0, m_csize.Z);
 }
 
 
@@ -234,11 +247,13 @@ CavernsNoise::~CavernsNoise()
 }
 
 
-bool CavernsNoise::generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax)
+bool CavernsNoise::generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax,
+	ParallelRunner *runner)
 {
 	assert(vm);
 
 	// Calculate noise
+	noise_cavern->setParallelRunner(runner);
 	noise_cavern->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
 
 	// Cache cavern_amp values
@@ -250,44 +265,53 @@ bool CavernsNoise::generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax)
 	}
 
 	//// Place nodes
-	bool near_cavern = false;
 	const v3s16 &em = vm->m_area.getExtent();
-	u32 index2d = 0;
-
-	for (s16 z = nmin.Z; z <= nmax.Z; z++)
-	for (s16 x = nmin.X; x <= nmax.X; x++, index2d++) {
-		// Reset cave_amp index to column top
-		cavern_amp_index = 0;
-		// Initial voxelmanip index at column top
-		u32 vi = vm->m_area.index(x, nmax.Y, z);
-		// Initial 3D noise index at column top
-		u32 index3d = (z - nmin.Z) * m_zstride_1d + m_csize.Y * m_ystride +
-			(x - nmin.X);
-		// Don't excavate the overgenerated stone at node_max.Y + 1,
-		// this creates a 'roof' over the cavern, preventing light in
-		// caverns at mapchunk borders when generating mapchunks upwards.
-		// This 'roof' is excavated when the mapchunk above is generated.
-		for (s16 y = nmax.Y; y >= nmin.Y - 1; y--,
-				index3d -= m_ystride,
-				VoxelArea::add_y(em, vi, -1),
-				cavern_amp_index++) {
-			content_t c = vm->m_data[vi].getContent();
-			float n_absamp_cavern = std::fabs(noise_cavern->result[index3d]) *
-				cavern_amp[cavern_amp_index];
-			// Disable CavesRandomWalk at a safe distance from caverns
-			// to avoid excessively spreading liquids in caverns.
-			if (n_absamp_cavern > m_cavern_threshold - 0.1f) {
-				near_cavern = true;
-				if (n_absamp_cavern > m_cavern_threshold &&
-						m_ndef->get(c).is_ground_content)
-					vm->m_data[vi] = MapNode(CONTENT_AIR);
+	// Columns are independent, so slices along Z can be dug in parallel.
+	// Every slice tells whether it is near a cavern.
+	std::vector<u8> near_cavern_z(m_csize.Z, 0);
+
+	auto dig = [&] (u32 z_begin, u32 z_end) {
+		for (s16 z = nmin.Z + (s16)z_begin; z < nmin.Z + (s16)z_end; z++)
+		for (s16 x = nmin.X; x <= nmax.X; x++) {
+			// Cave_amp index at column top
+			u8 amp_index = 0;
+			// Initial voxelmanip index at column top
+			u32 vi = vm->m_area.index(x, nmax.Y, z);
+			// Initial 3D noise index at column top
+			u32 index3d = (z - nmin.Z) * m_zstride_1d + m_csize.Y * m_ystride +
+				(x - nmin.X);
+			// Don't excavate the overgenerated stone at node_max.Y + 1,
+			// this creates a 'roof' over the cavern, preventing light in
+			// caverns at mapchunk borders when generating mapchunks upwards.
+			// This 'roof' is excavated when the mapchunk above is generated.
+			for (s16 y = nmax.Y; y >= nmin.Y - 1; y--,
+					index3d -= m_ystride,
+					VoxelArea::add_y(em, vi, -1),
+					amp_index++) {
+				content_t c = vm->m_data[vi].getContent();
+				float n_absamp_cavern = std::fabs(noise_cavern->result[index3d]) *
+					cavern_amp[amp_index];
+				// Disable CavesRandomWalk at a safe distance from caverns
+				// to avoid excessively spreading liquids in caverns.
+				if (n_absamp_cavern > m_cavern_threshold - 0.1f) {
+					near_cavern_z[z - nmin.Z] = 1;
+					if (n_absamp_cavern > m_cavern_threshold &&
+							m_ndef->get(c).is_ground_content)
+						vm->m_data[vi] = MapNode(CONTENT_AIR);
+				}
 			}
 		}
-	}
+	};
+
+	if (runner)
+		runner->run(m_csize.Z, dig);
+	else
+		dig(0, m_csize.Z);
 
 	delete[] cavern_amp;
 
-	return near_cavern;
+	return std::find(near_cavern_z.begin(), near_cavern_z.end(), 1) !=
+		near_cavern_z.end();
 }
 
 
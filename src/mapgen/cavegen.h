@@ -27,6 +27,7 @@ typedef u16 biome_t;  // copy from mg_biome.h to avoid an unnecessary include
 class GenerateNotifier;
 
 class BiomeGen;
+class ParallelRunner;
 
 /*
 	CavesNoiseIntersection is a cave digging algorithm that carves smooth,
@@ -48,7 +49,9 @@ class CavesNoiseIntersection
 		NoiseParams *np_cave2, s32 seed, float cave_width);
 	~CavesNoiseIntersection();
 
-	void generateCaves(MMVManip *vm, v3s16 nmin, v3s16 nmax, biome_t *biomemap);
+	// Uses the threads of runner, if not nullptr
+	void generateCaves(MMVManip *vm, v3s16 nmin, v3s16 nmax, biome_t *biomemap,
+		ParallelRunner *runner = nullptr);
 
 private:
 	const NodeDefManager *m_ndef;
@@ -79,7 +82,9 @@ class CavernsNoise
 		float cavern_taper, float cavern_threshold);
 	~CavernsNoise();
 
-	bool generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax);
+	// Uses the threads of runner, if not nullptr
+	bool generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax,
+		ParallelRunner *runner = nullptr);
 
 private:
 	const NodeDefManager *m_ndef;
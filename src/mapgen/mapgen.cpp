@@ -39,6 +39,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 #include "util/numeric.h"
 #include "util/directiontables.h"
+#include "util/thread.h"
 #include "filesys.h"
 #include "log.h"
 #include "mapgen_carpathian.h"
@@ -635,6 +636,7 @@ MapgenBasic::MapgenBasic(int mapgenid, MapgenParams *params, EmergeParams *emerg
 MapgenBasic::~MapgenBasic()
 {
 	delete []heightmap;
+	delete runner;
 }
 
 
@@ -863,7 +865,7 @@ void MapgenBasic::generateCavesNoiseIntersection(s16 max_stone_y)
 	CavesNoiseIntersection caves_noise(ndef, m_bmgr, biomegen, csize,
 		&np_cave1, &np_cave2, seed, cave_width);
 
-	caves_noise.generateCaves(vm, node_min, node_max, biomemap);
+	caves_noise.generateCaves(vm, node_min, node_max, biomemap, runner);
 }
 
 
@@ -906,7 +908,7 @@ bool MapgenBasic::generateCavernsNoise(s16 max_stone_y)
 	CavernsNoise caverns_noise(ndef, csize, &np_cavern,
 		seed, cavern_limit, cavern_taper, cavern_threshold);
 
-	return caverns_noise.generateCaverns(vm, node_min, node_max);
+	return caverns_noise.generateCaverns(vm, node_min, node_max, runner);
 }
 
 
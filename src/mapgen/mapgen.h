@@ -58,6 +58,7 @@ class VoxelManipulator;
 struct BlockMakeData;
 class VoxelArea;
 class Map;
+class ParallelRunner;
 
 enum MapgenObject {
 	MGOBJ_VMANIP,
@@ -306,6 +307,10 @@ class MapgenBasic : public Mapgen {
 protected:
 	BiomeManager *m_bmgr;
 
+	// Threads for generating a single mapchunk, created by mapgens that
+	// split their work. Caves use it too if set.
+	ParallelRunner *runner = nullptr;
+
 	Noise *noise_filler_depth;
 
 	v3s16 node_min;
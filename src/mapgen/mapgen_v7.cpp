@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 
 #include "mapgen.h"
+#include <algorithm>
 #include <cmath>
 #include "voxel.h"
 #include "noise.h"
@@ -37,6 +38,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mg_ore.h"
 #include "mg_decoration.h"
 #include "mapgen_v7.h"
+#include "util/thread.h"
 
 
 FlagDesc flagdesc_mapgen_v7[] = {
@@ -121,6 +123,14 @@ MapgenV7::MapgenV7(MapgenV7Params *params, EmergeParams *emerge)
 	MapgenBasic::np_cavern   = params->np_cavern;
 	// 3D noise
 	MapgenBasic::np_dungeons = params->np_dungeons;
+
+	runner = new ParallelRunner("Mapgen", emerge->chunk_threads);
+	if (spflags & MGV7_MOUNTAINS)
+		noise_mountain->setParallelRunner(runner);
+	if (spflags & MGV7_RIDGES)
+		noise_ridge->setParallelRunner(runner);
+	if (spflags & MGV7_FLOATLANDS)
+		noise_floatland->setParallelRunner(runner);
 }
 
 
@@ -490,20 +500,27 @@ int MapgenV7::generateTerrain()
 	noise_terrain_persist->perlinMap2D(node_min.X, node_min.Z);
 	float *persistmap = noise_terrain_persist->result;
 
-	noise_terrain_base->perlinMap2D(node_min.X, node_min.Z, persistmap);
-	noise_terrain_alt->perlinMap2D(node_min.X, node_min.Z, persistmap);
-	noise_height_select->perlinMap2D(node_min.X, node_min.Z);
-
-	if (spflags & MGV7_MOUNTAINS) {
-		noise_mount_height->perlinMap2D(node_min.X, node_min.Z);
+	// The other 2D noises are independent, calculate them in parallel
+	std::vector<std::pair<Noise *, float *>> noises_2d = {
+		{noise_terrain_base, persistmap},
+		{noise_terrain_alt, persistmap},
+		{noise_height_select, nullptr},
+	};
+	if (spflags & MGV7_MOUNTAINS)
+		noises_2d.emplace_back(noise_mount_height, nullptr);
+	runner->run(noises_2d.size(), [&] (u32 begin, u32 end) {
+		for (u32 i = begin; i < end; i++)
+			noises_2d[i].first->perlinMap2D(node_min.X, node_min.Z,
+				noises_2d[i].second);
+	});
+
+	if (spflags & MGV7_MOUNTAINS)
 		noise_mountain->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
-	}
 
 	//// Floatlands
 	// 'Generate floatlands in this mapchunk' bool for
 	// simplification of condition checks in y-loop.
 	bool gen_floatlands = false;
-	u8 cache_index = 0;
 	// Y values where floatland tapering starts
 	s16 float_taper_ymax = floatland_ymax - floatland_taper;
 	s16 float_taper_ymin = floatland_ymin + floatland_taper;
@@ -515,6 +532,7 @@ int MapgenV7::generateTerrain()
 		noise_floatland->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
 
 		// Cache floatland noise offset values, for floatland tapering
+		u8 cache_index = 0;
 		for (s16 y = node_min.Y - 1; y <= node_max.Y + 1; y++, cache_index++) {
 			float float_offset = 0.0f;
 			if (y > float_taper_ymax) {
@@ -538,53 +556,61 @@ int MapgenV7::generateTerrain()
 	}
 
 	//// Place nodes
+	// Columns are independent, so slices along Z are placed in parallel.
 	const v3s16 &em = vm->m_area.getExtent();
-	s16 stone_surface_max_y = -MAX_MAP_GENERATION_LIMIT;
-	u32 index2d = 0;
-
-	for (s16 z = node_min.Z; z <= node_max.Z; z++)
-	for (s16 x = node_min.X; x <= node_max.X; x++, index2d++) {
-		s16 surface_y = baseTerrainLevelFromMap(index2d);
-		if (surface_y > stone_surface_max_y)
-			stone_surface_max_y = surface_y;
-
-		cache_index = 0;
-		u32 vi = vm->m_area.index(x, node_min.Y - 1, z);
-		u32 index3d = (z - node_min.Z) * zstride_1u1d + (x - node_min.X);
-
-		for (s16 y = node_min.Y - 1; y <= node_max.Y + 1;
-				y++,
-				index3d += ystride,
-				VoxelArea::add_y(em, vi, 1),
-				cache_index++) {
-			if (vm->m_data[vi].getContent() != CONTENT_IGNORE)
-				continue;
-
-			bool is_river_channel = gen_rivers &&
-				getRiverChannelFromMap(index3d, index2d, y);
-			if (y <= surface_y && !is_river_channel) {
-				vm->m_data[vi] = n_stone; // Base terrain
-			} else if ((spflags & MGV7_MOUNTAINS) &&
-					getMountainTerrainFromMap(index3d, index2d, y) &&
-					!is_river_channel) {
-				vm->m_data[vi] = n_stone; // Mountain terrain
-				if (y > stone_surface_max_y)
-					stone_surface_max_y = y;
-			} else if (gen_floatlands &&
-					getFloatlandTerrainFromMap(index3d,
-					float_offset_cache[cache_index])) {
-				vm->m_data[vi] = n_stone; // Floatland terrain
-				if (y > stone_surface_max_y)
-					stone_surface_max_y = y;
-			} else if (y <= water_level) { // Surface water
-				vm->m_data[vi] = n_water;
-			} else if (gen_floatlands && y >= float_taper_ymax && y <= floatland_ywater) {
-				vm->m_data[vi] = n_water; // Water for solid floatland layer only
-			} else {
-				vm->m_data[vi] = n_air; // Air
+	std::vector<s16> surface_max_y_z(csize.Z, -MAX_MAP_GENERATION_LIMIT);
+
+	runner->run(csize.Z, [&] (u32 z_begin, u32 z_end) {
+		s16 surface_max_y = -MAX_MAP_GENERATION_LIMIT;
+		u32 index2d = z_begin * csize.X;
+
+		for (s16 z = node_min.Z + (s16)z_begin; z < node_min.Z + (s16)z_end; z++)
+		for (s16 x = node_min.X; x <= node_max.X; x++, index2d++) {
+			s16 surface_y = baseTerrainLevelFromMap(index2d);
+			if (surface_y > surface_max_y)
+				surface_max_y = surface_y;
+
+			u8 cache_index = 0;
+			u32 vi = vm->m_area.index(x, node_min.Y - 1, z);
+			u32 index3d = (z - node_min.Z) * zstride_1u1d + (x - node_min.X);
+
+			for (s16 y = node_min.Y - 1; y <= node_max.Y + 1;
+					y++,
+					index3d += ystride,
+					VoxelArea::add_y(em, vi, 1),
+					cache_index++) {
+				if (vm->m_data[vi].getContent() != CONTENT_IGNORE)
+					continue;
+
+				bool is_river_channel = gen_rivers &&
+					getRiverChannelFromMap(index3d, index2d, y);
+				if (y <= surface_y && !is_river_channel) {
+					vm->m_data[vi] = n_stone; // Base terrain
+				} else if ((spflags & MGV7_MOUNTAINS) &&
+						getMountainTerrainFromMap(index3d, index2d, y) &&
+						!is_river_channel) {
+					vm->m_data[vi] = n_stone; // Mountain terrain
+					if (y > surface_max_y)
+						surface_max_y = y;
+				} else if (gen_floatlands &&
+						getFloatlandTerrainFromMap(index3d,
+						float_offset_cache[cache_index])) {
+					vm->m_data[vi] = n_stone; // Floatland terrain
+					if (y > surface_max_y)
+						surface_max_y = y;
+				} else if (y <= water_level) { // Surface water
+					vm->m_data[vi] = n_water;
+				} else if (gen_floatlands && y >= float_taper_ymax && y <= floatland_ywater) {
+					vm->m_data[vi] = n_water; // Water for solid floatland layer only
+				} else {
+					vm->m_data[vi] = n_air; // Air
+				}
 			}
 		}
-	}
 
-	return stone_surface_max_y;
+		for (u32 z = z_begin; z < z_end; z++)
+			surface_max_y_z[z] = surface_max_y;
+	});
+
+	return *std::max_element(surface_max_y_z.begin(), surface_max_y_z.end());
 }
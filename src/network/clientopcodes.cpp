@@ -127,9 +127,9 @@ const ToClientCommandHandler toClientCommandTable[TOCLIENT_NUM_MSG_TYPES] =
 	{ "TOCLIENT_MINIMAP_MODES",            TOCLIENT_STATE_CONNECTED, &Client::handleCommand_MinimapModes }, // 0x62,
 	{ "TOCLIENT_SET_LIGHTING",             TOCLIENT_STATE_CONNECTED, &Client::handleCommand_SetLighting }, // 0x63,
 
-	null_command_handler, // 0x64
-	null_command_handler, // 0x65
-	null_command_handler, // 0x66
+	{ "TOCLIENT_OBJECT_SNAPSHOT",          TOCLIENT_STATE_CONNECTED, &Client::handleCommand_ObjectSnapshot }, // 0x64
+	{ "TOCLIENT_INVENTORY_DELTA",          TOCLIENT_STATE_CONNECTED, &Client::handleCommand_InventoryDelta }, // 0x65
+	{ "TOCLIENT_MEDIA_CHUNK",              TOCLIENT_STATE_CONNECTED, &Client::handleCommand_MediaChunk }, // 0x66
 	null_command_handler, // 0x67
 	{ "TOCLIENT_LUA_PACKET",			   TOCLIENT_STATE_CONNECTED, &Client::handleCommand_Lua_Packet }, // 0x68,
 	{ "TOCLIENT_LUA_PACKET_STREAM",        TOCLIENT_STATE_CONNECTED, &Client::handleCommand_Lua_Packet_Stream }, // 0x69,
@@ -145,6 +145,10 @@ const static ServerCommandFactory null_command_factory = { nullptr, 0, false };
 
 	Packet order is only guaranteed inside a channel, so packets that operate on
 	the same objects are *required* to be in the same channel.
+
+	Reliable packets of a channel are further split into streams (see
+	NetworkStream), order is only kept inside a stream. Anything that
+	changes the game state must stay in the default stream.
 */
 
 const ServerCommandFactory serverCommandFactoryTable[TOSERVER_NUM_MSG_TYPES] =
@@ -185,8 +189,8 @@ const ServerCommandFactory serverCommandFactoryTable[TOSERVER_NUM_MSG_TYPES] =
 	null_command_factory, // 0x21
 	null_command_factory, // 0x22
 	{ "TOSERVER_PLAYERPOS",          0, false }, // 0x23
-	{ "TOSERVER_GOTBLOCKS",          2, true }, // 0x24
-	{ "TOSERVER_DELETEDBLOCKS",      2, true }, // 0x25
+	{ "TOSERVER_GOTBLOCKS",          2, true, NETSTREAM_BLOCKS }, // 0x24
+	{ "TOSERVER_DELETEDBLOCKS",      2, true, NETSTREAM_BLOCKS }, // 0x25
 	null_command_factory, // 0x26
 	null_command_factory, // 0x27
 	null_command_factory, // 0x28
@@ -199,7 +203,7 @@ const ServerCommandFactory serverCommandFactoryTable[TOSERVER_NUM_MSG_TYPES] =
 	null_command_factory, // 0x2f
 	null_command_factory, // 0x30
 	{ "TOSERVER_INVENTORY_ACTION",   0, true }, // 0x31
-	{ "TOSERVER_CHAT_MESSAGE",       0, true }, // 0x32
+	{ "TOSERVER_CHAT_MESSAGE",       0, true, NETSTREAM_CHAT }, // 0x32
 	null_command_factory, // 0x33
 	null_command_factory, // 0x34
 	{ "TOSERVER_DAMAGE",             0, true }, // 0x35
@@ -235,9 +239,9 @@ const ServerCommandFactory serverCommandFactoryTable[TOSERVER_NUM_MSG_TYPES] =
 	{ "TOSERVER_SRP_BYTES_M",        1, true }, // 0x53
 	{ "TOSERVER_UPDATE_CLIENT_INFO", 2, true }, // 0x54
 
-	null_command_factory, // 0x55
-	null_command_factory, // 0x56
-	null_command_factory, // 0x57
-	{ "TOSERVER_LUA_PACKET",		0, true }, // 0x58,
-	{ "TOSERVER_LUA_PACKET_STREAM", 0, true }, // 0x59,
+	{ "TOSERVER_OBJECT_SNAPSHOT_ACK", 2, false }, // 0x55
+	{ "TOSERVER_INVENTORY_RESYNC",   0, true }, // 0x56
+	{ "TOSERVER_MEDIA_CHUNK_REQUEST", 1, true }, // 0x57
+	{ "TOSERVER_LUA_PACKET",		0, true, NETSTREAM_LUA }, // 0x58,
+	{ "TOSERVER_LUA_PACKET_STREAM", 0, true, NETSTREAM_LUA }, // 0x59,
 };
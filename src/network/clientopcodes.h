@@ -44,6 +44,8 @@ struct ServerCommandFactory
 	const char* name;
 	u8 channel;
 	bool reliable;
+	// NetworkStream of reliable packets
+	u8 stream = NETSTREAM_DEFAULT;
 };
 
 extern const ToClientCommandHandler toClientCommandTable[TOCLIENT_NUM_MSG_TYPES];
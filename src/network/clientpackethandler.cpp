@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "map.h"
 #include "mapsector.h"
 #include "client/minimap.h"
+#include "client/particles.h"
 #include "modchannels.h"
 #include "nodedef.h"
 #include "serialization.h"
@@ -40,6 +41,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "network/networkpacket.h"
 #include "script/scripting_client.h"
 #include "util/serialize.h"
+#include "util/hex.h"
 #include "util/srp.h"
 #include "util/sha1.h"
 #include "tileanimation.h"
@@ -358,6 +360,9 @@ void Client::handleBlockDataPacket(NetworkPacket* pkt, bool is_urgent) {
 		ServerMap::saveBlock(block, m_localdb);
 	}
 
+	if (m_particle_manager)
+		m_particle_manager->invalidateCollisionBlock(p);
+
 	/*
 		Add it to mesh update queue and set it to be acknowledged after update.
 	*/
@@ -417,6 +422,51 @@ void Client::handleCommand_Inventory(NetworkPacket* pkt)
 	m_inventory_from_server_age = 0.0;
 }
 
+void Client::handleCommand_InventoryDelta(NetworkPacket* pkt)
+{
+	std::string location;
+	*pkt >> location;
+
+	InventoryLocation loc;
+	try {
+		loc.deSerialize(location);
+	} catch (SerializationError &) {
+		errorstream << "Client: Inventory delta for invalid location \""
+			<< location << "\"" << std::endl;
+		return;
+	}
+	if (loc.type != InventoryLocation::CURRENT_PLAYER &&
+			loc.type != InventoryLocation::DETACHED)
+		return;
+
+	// Detached inventories not known yet are sent in full later
+	Inventory *inv = getInventory(loc);
+	if (!inv)
+		return;
+
+	std::string delta(pkt->getRemainingString(), pkt->getRemainingBytes());
+	std::istringstream is(delta, std::ios_base::binary);
+	try {
+		inv->deSerializeDelta(is);
+	} catch (SerializationError &e) {
+		infostream << "Client: Inventory " << location << " out of sync ("
+			<< e.what() << "), requesting it again" << std::endl;
+
+		NetworkPacket resp(TOSERVER_INVENTORY_RESYNC, 2 + location.size());
+		resp << location;
+		Send(&resp);
+		return;
+	}
+
+	if (loc.type == InventoryLocation::CURRENT_PLAYER) {
+		m_update_wielded_item = true;
+
+		delete m_inventory_from_server;
+		m_inventory_from_server = new Inventory(*inv);
+		m_inventory_from_server_age = 0.0;
+	}
+}
+
 void Client::handleCommand_TimeOfDay(NetworkPacket* pkt)
 {
 	if (pkt->getSize() < 2)
@@ -533,6 +583,7 @@ void Client::handleCommand_ActiveObjectRemoveAdd(NetworkPacket* pkt)
 		for (u16 i = 0; i < removed_count; i++) {
 			*pkt >> id;
 			m_env.removeActiveObject(id);
+			m_object_snapshots.removeObject(id);
 		}
 
 		// Read added objects
@@ -582,6 +633,30 @@ void Client::handleCommand_ActiveObjectMessages(NetworkPacket* pkt)
 	}
 }
 
+void Client::handleCommand_ObjectSnapshot(NetworkPacket* pkt)
+{
+	std::vector<std::pair<u16, ObjectState>> updates;
+	u16 seq;
+	try {
+		seq = m_object_snapshots.read((const u8 *)pkt->getString(0),
+			pkt->getSize(), updates);
+	} catch (SerializationError &e) {
+		errorstream << "Client::handleCommand_ObjectSnapshot: "
+			<< "caught SerializationError: " << e.what() << std::endl;
+		return;
+	}
+
+	// Later snapshots are encoded against this one now
+	NetworkPacket resp(TOSERVER_OBJECT_SNAPSHOT_ACK, 2);
+	resp << seq;
+	Send(&resp);
+
+	// The objects interpolate to the new states over their update interval,
+	// the same as for AO_CMD_UPDATE_POSITION
+	for (const auto &it : updates)
+		m_env.processActiveObjectMessage(it.first, it.second.toPositionCommand());
+}
+
 void Client::handleCommand_Movement(NetworkPacket* pkt)
 {
 	LocalPlayer *player = m_env.getLocalPlayer();
@@ -1705,6 +1780,29 @@ void Client::handleCommand_PlayerSpeed(NetworkPacket *pkt)
 	player->addVelocity(added_vel);
 }
 
+void Client::handleCommand_MediaChunk(NetworkPacket *pkt)
+{
+	std::string sha1;
+	u32 file_size, offset;
+
+	*pkt >> sha1 >> file_size >> offset;
+	std::string data = pkt->readLongString();
+
+	bool init_phase = m_media_downloader && m_media_downloader->isStarted();
+
+	if (init_phase && m_mesh_update_manager) {
+		// Mesh update thread must be stopped while
+		// updating content definitions
+		sanity_check(!m_mesh_update_manager->isRunning());
+	}
+
+	if (!init_phase ||
+			!m_media_downloader->chunkReceived(sha1, file_size, offset, data, this)) {
+		errorstream << "Client: Received media chunk " << hex_encode(sha1)
+			<< " but no downloads pending" << std::endl;
+	}
+}
+
 void Client::handleCommand_MediaPush(NetworkPacket *pkt)
 {
 	std::string raw_hash, filename, filedata;
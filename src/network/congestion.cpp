@@ -0,0 +1,393 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "congestion.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/basic_macros.h"
+
+namespace con
+{
+
+// 2/ln(2), the smallest gain that doubles the delivery rate every round
+#define HIGH_GAIN 2.885f
+// Reliable packets are mostly split at the default max_packet_size
+#define CC_PACKET_SIZE 512
+#define MIN_CWND (4 * CC_PACKET_SIZE)
+#define INITIAL_CWND (32 * CC_PACKET_SIZE)
+// Round trip time assumed before the first ack
+#define INITIAL_RTT 100000
+// The minimum round trip time is measured again after this time
+#define MIN_RTT_EXPIRY 10000000
+#define PROBE_RTT_DURATION 200000
+// Share of lost bytes in a round that counts as congestion, a few lost
+// packets are expected on any link
+#define LOSS_THRESHOLD 0.02f
+#define LOSS_MIN_BYTES (4 * CC_PACKET_SIZE)
+// Window reduction on congestion
+#define LOSS_BETA 0.7f
+// Data that may be sent in a burst
+#define PACING_BURST_TIME 4000
+#define PACING_MIN_BURST (4 * CC_PACKET_SIZE)
+
+static const float PACING_GAIN_CYCLE[] = {
+	1.25f, 0.75f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f
+};
+#define CYCLE_LENGTH ARRLEN(PACING_GAIN_CYCLE)
+
+CongestionControl::CongestionControl() :
+	m_pacing_gain(HIGH_GAIN),
+	m_cwnd_gain(HIGH_GAIN),
+	m_cwnd(INITIAL_CWND),
+	m_pacing_rate(HIGH_GAIN * INITIAL_CWND * 1e6f / INITIAL_RTT),
+	m_budget(PACING_MIN_BURST)
+{
+}
+
+bool CongestionControl::canSend(u32 size, u64 now)
+{
+	MutexAutoLock lock(m_mutex);
+	refillBudget(now);
+
+	if (m_bytes_in_flight > 0 && m_bytes_in_flight + size > m_cwnd) {
+		m_cwnd_limited = true;
+		return false;
+	}
+	return m_budget >= 0.0f;
+}
+
+u64 CongestionControl::getPacingDelay(u64 now)
+{
+	MutexAutoLock lock(m_mutex);
+	refillBudget(now);
+
+	if (m_budget >= 0.0f)
+		return 0;
+	return (u64)(-m_budget * 1e6f / m_pacing_rate) + 1;
+}
+
+void CongestionControl::onSend(DeliveryState &state, u32 size, u64 now,
+		bool app_limited)
+{
+	MutexAutoLock lock(m_mutex);
+
+	if (m_bytes_in_flight == 0)
+		m_delivered_time = m_first_sent_time = now;
+
+	if (app_limited)
+		m_app_limited_until = MYMAX(1, m_delivered + m_bytes_in_flight + size);
+
+	state.send_time = now;
+	state.delivered = m_delivered;
+	state.delivered_time = m_delivered_time;
+	state.first_sent_time = m_first_sent_time;
+	state.app_limited = m_app_limited_until != 0;
+
+	m_bytes_in_flight += size;
+
+	refillBudget(now);
+	m_budget -= size;
+}
+
+void CongestionControl::onResend(u32 size, u64 now)
+{
+	MutexAutoLock lock(m_mutex);
+	refillBudget(now);
+	m_budget -= size;
+}
+
+bool CongestionControl::onAck(const DeliveryState &state, u32 size, bool resent,
+		u64 now)
+{
+	MutexAutoLock lock(m_mutex);
+
+	m_bytes_in_flight -= MYMIN(m_bytes_in_flight, size);
+	m_delivered += size;
+	m_delivered_time = now;
+	m_delivered_in_round += size;
+	if (m_app_limited_until != 0 && m_delivered > m_app_limited_until)
+		m_app_limited_until = 0;
+
+	updateRound(state);
+	updateBandwidth(state, now);
+	updateMinRTT(state, resent, now);
+	updateState(now);
+	updateControls(size);
+
+	bool was_limited = m_cwnd_limited;
+	m_cwnd_limited = false;
+	return was_limited;
+}
+
+void CongestionControl::onLoss(u32 bytes)
+{
+	MutexAutoLock lock(m_mutex);
+	m_lost_in_round += bytes;
+}
+
+float CongestionControl::getBandwidth() const
+{
+	MutexAutoLock lock(m_mutex);
+	return getMaxBandwidth();
+}
+
+float CongestionControl::getPacingRate() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_pacing_rate;
+}
+
+u32 CongestionControl::getCongestionWindow() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_cwnd;
+}
+
+u32 CongestionControl::getBytesInFlight() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_bytes_in_flight;
+}
+
+float CongestionControl::getMinRTT() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_min_rtt == U64_MAX ? -1.0f : m_min_rtt / 1e6f;
+}
+
+CongestionControl::State CongestionControl::getState() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_state;
+}
+
+float CongestionControl::getBDP() const
+{
+	float bw = getMaxBandwidth();
+	if (bw <= 0.0f || m_min_rtt == U64_MAX)
+		return INITIAL_CWND;
+	return bw * m_min_rtt / 1e6f;
+}
+
+float CongestionControl::getMaxBandwidth() const
+{
+	float bw = 0.0f;
+	for (float sample : m_bw_rounds)
+		bw = MYMAX(bw, sample);
+	return bw;
+}
+
+void CongestionControl::refillBudget(u64 now)
+{
+	// The threads may pass slightly different times
+	if (now <= m_budget_time)
+		return;
+
+	if (m_budget_time != 0) {
+		float burst = MYMAX(PACING_MIN_BURST,
+			m_pacing_rate * PACING_BURST_TIME / 1e6f);
+		m_budget = MYMIN(burst,
+			m_budget + m_pacing_rate * (now - m_budget_time) / 1e6f);
+	}
+	m_budget_time = now;
+}
+
+void CongestionControl::updateRound(const DeliveryState &state)
+{
+	m_round_start = false;
+	if (state.delivered < m_next_round_delivered)
+		return;
+
+	m_next_round_delivered = m_delivered;
+	m_round_count++;
+	m_round_start = true;
+	m_bw_rounds[m_round_count % BW_FILTER_ROUNDS] = 0.0f;
+
+	u32 total = m_delivered_in_round + m_lost_in_round;
+	m_high_loss = m_lost_in_round >= LOSS_MIN_BYTES &&
+		m_lost_in_round > LOSS_THRESHOLD * total;
+	if (m_high_loss) {
+		m_inflight_hi = MYMAX(MIN_CWND,
+			(u32)(LOSS_BETA * MYMIN(m_cwnd, m_inflight_hi)));
+		// Stop growing, the link is full
+		m_filled_pipe = true;
+	} else if (m_inflight_hi != U32_MAX) {
+		if (m_inflight_hi > U32_MAX / 2)
+			m_inflight_hi = U32_MAX;
+		else
+			m_inflight_hi += m_inflight_hi / 8;
+	}
+
+	m_delivered_in_round = 0;
+	m_lost_in_round = 0;
+}
+
+void CongestionControl::updateBandwidth(const DeliveryState &state, u64 now)
+{
+	u64 send_elapsed = state.send_time - MYMIN(state.send_time, state.first_sent_time);
+	u64 ack_elapsed = now - MYMIN(now, state.delivered_time);
+	u64 interval = MYMAX(send_elapsed, ack_elapsed);
+	m_first_sent_time = state.send_time;
+
+	// Acks that arrive in a burst would overestimate the rate
+	if (interval == 0 || (m_min_rtt != U64_MAX && interval < m_min_rtt))
+		return;
+
+	float rate = (m_delivered - state.delivered) * 1e6f / interval;
+	// Sending less than possible says nothing about the link, unless it
+	// was even faster than that
+	if (state.app_limited && rate < getMaxBandwidth())
+		return;
+
+	float &slot = m_bw_rounds[m_round_count % BW_FILTER_ROUNDS];
+	slot = MYMAX(slot, rate);
+}
+
+void CongestionControl::updateMinRTT(const DeliveryState &state, bool resent,
+		u64 now)
+{
+	m_min_rtt_expired = m_min_rtt_stamp != 0 &&
+		now > m_min_rtt_stamp + MIN_RTT_EXPIRY;
+
+	// The ack of a resent packet may belong to any of its copies
+	if (resent || now < state.send_time)
+		return;
+
+	u64 rtt = MYMAX(1, now - state.send_time);
+	if (rtt < m_min_rtt || m_min_rtt_expired) {
+		m_min_rtt = rtt;
+		m_min_rtt_stamp = now;
+	}
+}
+
+void CongestionControl::updateState(u64 now)
+{
+	switch (m_state) {
+	case STARTUP:
+		if (m_round_start && !m_filled_pipe && m_app_limited_until == 0) {
+			float bw = getMaxBandwidth();
+			if (bw >= m_full_bw * 1.25f) {
+				m_full_bw = bw;
+				m_full_bw_count = 0;
+			} else if (++m_full_bw_count >= 3) {
+				m_filled_pipe = true;
+			}
+		}
+		if (m_filled_pipe) {
+			m_state = DRAIN;
+			m_pacing_gain = 1.0f / HIGH_GAIN;
+			m_cwnd_gain = HIGH_GAIN;
+		}
+		break;
+	case DRAIN:
+		if (m_bytes_in_flight <= getBDP())
+			enterProbeBW(now);
+		break;
+	case PROBE_BW: {
+		bool full_length = m_min_rtt == U64_MAX ||
+			now > m_cycle_stamp + m_min_rtt;
+		bool advance;
+		if (m_pacing_gain > 1.0f) {
+			advance = (m_round_start && m_high_loss) || (full_length &&
+				m_bytes_in_flight >= m_pacing_gain * getBDP());
+		} else if (m_pacing_gain < 1.0f) {
+			advance = full_length || m_bytes_in_flight <= getBDP();
+		} else {
+			advance = full_length;
+		}
+		if (advance) {
+			m_cycle_index = (m_cycle_index + 1) % CYCLE_LENGTH;
+			m_cycle_stamp = now;
+			m_pacing_gain = PACING_GAIN_CYCLE[m_cycle_index];
+		}
+		break;
+	}
+	case PROBE_RTT:
+		break;
+	}
+
+	if (m_state != PROBE_RTT && m_min_rtt_expired) {
+		m_state = PROBE_RTT;
+		m_pacing_gain = 1.0f;
+		m_cwnd_gain = 1.0f;
+		m_prior_cwnd = m_cwnd;
+		m_probe_rtt_done_stamp = 0;
+	}
+
+	if (m_state != PROBE_RTT)
+		return;
+
+	if (m_probe_rtt_done_stamp == 0) {
+		// Hold the window low for a while once the queue is drained
+		if (m_bytes_in_flight <= MIN_CWND) {
+			m_probe_rtt_done_stamp = now + PROBE_RTT_DURATION;
+			m_probe_rtt_round_done = false;
+			m_next_round_delivered = m_delivered;
+		}
+		return;
+	}
+
+	if (m_round_start)
+		m_probe_rtt_round_done = true;
+	if (m_probe_rtt_round_done && now > m_probe_rtt_done_stamp) {
+		m_min_rtt_stamp = now;
+		m_cwnd = MYMAX(m_cwnd, m_prior_cwnd);
+		if (m_filled_pipe) {
+			enterProbeBW(now);
+		} else {
+			m_state = STARTUP;
+			m_pacing_gain = HIGH_GAIN;
+			m_cwnd_gain = HIGH_GAIN;
+		}
+	}
+}
+
+void CongestionControl::updateControls(u32 acked)
+{
+	float bw = getMaxBandwidth();
+	if (bw > 0.0f) {
+		float rate = m_pacing_gain * bw;
+		// While starting up the estimate is still too low
+		if (m_filled_pipe || rate > m_pacing_rate)
+			m_pacing_rate = rate;
+
+		u32 target = MYMAX(MIN_CWND,
+			(u32)(m_cwnd_gain * getBDP()) + 2 * CC_PACKET_SIZE);
+		if (m_filled_pipe)
+			m_cwnd = MYMIN(m_cwnd + acked, target);
+		else if (m_cwnd < target || m_delivered < INITIAL_CWND)
+			m_cwnd += acked;
+	}
+
+	m_cwnd = MYMAX(MIN_CWND, MYMIN(m_cwnd, m_inflight_hi));
+	if (m_state == PROBE_RTT)
+		m_cwnd = MYMIN(m_cwnd, MIN_CWND);
+}
+
+void CongestionControl::enterProbeBW(u64 now)
+{
+	m_state = PROBE_BW;
+	m_cwnd_gain = 2.0f;
+	// Start cruising, probing right away would not give the queue built
+	// up during startup time to drain
+	m_cycle_index = 2;
+	m_cycle_stamp = now;
+	m_pacing_gain = PACING_GAIN_CYCLE[m_cycle_index];
+}
+
+} // namespace
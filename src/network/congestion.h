@@ -0,0 +1,169 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include <mutex>
+
+namespace con
+{
+
+/*
+	State of the connection when a packet was (re-)sent, needed to
+	calculate the delivery rate once it is acknowledged.
+	Times are in microseconds.
+*/
+struct DeliveryState
+{
+	u64 send_time = 0;
+	// Bytes acknowledged before the packet was sent
+	u64 delivered = 0;
+	// Time of the last ack before the packet was sent
+	u64 delivered_time = 0;
+	// Send time of the packet acknowledged last when it was sent
+	u64 first_sent_time = 0;
+	// Sent while there was not enough data to fill the window
+	bool app_limited = false;
+};
+
+/*
+	Congestion controller for the reliable packets of a peer, modelled
+	after BBR.
+
+	The bottleneck bandwidth is estimated from the rate at which packets
+	are acknowledged, the propagation delay from the smallest recent
+	round trip time. Data in flight is limited to a multiple of their
+	product and packets are paced at a multiple of the bandwidth. The
+	pacing gain cycles to probe for more bandwidth and to drain the queue
+	built up while probing. Rounds with heavy loss cap the window at a
+	fraction of what was in flight, the cap is raised again as long as
+	there is no loss.
+
+	Sizes are in bytes, times in microseconds. All methods are safe to
+	call from the send and the receive thread.
+*/
+class CongestionControl
+{
+public:
+	enum State : u8 {
+		STARTUP,
+		DRAIN,
+		PROBE_BW,
+		PROBE_RTT,
+	};
+
+	CongestionControl();
+
+	// Whether a new packet of `size` bytes fits into the congestion window
+	// and the pacing budget. Remembers that the sender was held back.
+	bool canSend(u32 size, u64 now);
+	// Time until the pacing budget allows sending, 0 if it already does
+	u64 getPacingDelay(u64 now);
+
+	// A new reliable packet goes on the wire, `app_limited` tells that
+	// there is nothing queued behind it
+	void onSend(DeliveryState &state, u32 size, u64 now, bool app_limited);
+	// A reliable packet is sent again, it is still in flight
+	void onResend(u32 size, u64 now);
+	// A reliable packet was acknowledged, `resent` packets give no
+	// reliable round trip time.
+	// Returns true if the sender was held back by the window before.
+	bool onAck(const DeliveryState &state, u32 size, bool resent, u64 now);
+	// Reliable packets of `bytes` total size timed out
+	void onLoss(u32 bytes);
+
+	// Estimated bottleneck bandwidth in bytes per second
+	float getBandwidth() const;
+	// Bytes per second the packets are paced at
+	float getPacingRate() const;
+	u32 getCongestionWindow() const;
+	u32 getBytesInFlight() const;
+	// Smallest round trip time seen recently in seconds, -1 if unknown
+	float getMinRTT() const;
+	State getState() const;
+
+private:
+	float getBDP() const;
+	float getMaxBandwidth() const;
+	void refillBudget(u64 now);
+	void updateRound(const DeliveryState &state);
+	void updateBandwidth(const DeliveryState &state, u64 now);
+	void updateMinRTT(const DeliveryState &state, bool resent, u64 now);
+	void updateState(u64 now);
+	void updateControls(u32 acked);
+	void enterProbeBW(u64 now);
+
+	// Number of rounds the bandwidth maximum is taken over
+	static constexpr u32 BW_FILTER_ROUNDS = 10;
+
+	mutable std::mutex m_mutex;
+
+	State m_state = STARTUP;
+	float m_pacing_gain;
+	float m_cwnd_gain;
+
+	// Delivery rate
+	u64 m_delivered = 0;
+	u64 m_delivered_time = 0;
+	u64 m_first_sent_time = 0;
+	u64 m_app_limited_until = 0;
+	u32 m_bytes_in_flight = 0;
+
+	// Round trips, a round ends when a packet sent after its start is acked
+	u64 m_round_count = 0;
+	u64 m_next_round_delivered = 0;
+	bool m_round_start = false;
+	u32 m_lost_in_round = 0;
+	u32 m_delivered_in_round = 0;
+	// The last round lost more than the threshold
+	bool m_high_loss = false;
+
+	// Maximum delivery rate of the last rounds
+	float m_bw_rounds[BW_FILTER_ROUNDS] = {};
+
+	// Minimum round trip time and when it was measured
+	u64 m_min_rtt = U64_MAX;
+	u64 m_min_rtt_stamp = 0;
+	bool m_min_rtt_expired = false;
+
+	// Startup ends when the bandwidth stops growing
+	bool m_filled_pipe = false;
+	float m_full_bw = 0.0f;
+	u32 m_full_bw_count = 0;
+
+	u8 m_cycle_index = 0;
+	u64 m_cycle_stamp = 0;
+
+	u64 m_probe_rtt_done_stamp = 0;
+	bool m_probe_rtt_round_done = false;
+	u32 m_prior_cwnd = 0;
+
+	u32 m_cwnd;
+	u32 m_inflight_hi = U32_MAX;
+	float m_pacing_rate;
+
+	// Pacing budget in bytes, may become negative by one packet
+	float m_budget = 0.0f;
+	u64 m_budget_time = 0;
+
+	bool m_cwnd_limited = false;
+};
+
+} // namespace
@@ -167,86 +167,121 @@ SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
 	return b;
 }
 
+BufferedPacketPtr makeOriginalReliablePacket(Address &address, PacketBuffer &&data,
+		u16 seqnum, u32 protocol_id, session_t sender_peer_id, u8 channel)
+{
+	u8 *header = data.prepend(ORIGINAL_HEADER_SIZE);
+	writeU8(header, PACKET_TYPE_ORIGINAL);
+
+	header = data.prepend(RELIABLE_HEADER_SIZE);
+	writeU8(&header[0], PACKET_TYPE_RELIABLE);
+	writeU16(&header[1], seqnum);
+
+	header = data.prepend(BASE_HEADER_SIZE);
+	writeU32(&header[0], protocol_id);
+	writeU16(&header[4], sender_peer_id);
+	writeU8(&header[6], channel);
+
+	auto p = std::make_shared<BufferedPacket>(std::move(data));
+	p->address = address;
+	return p;
+}
+
 /*
 	ReliablePacketBuffer
 */
 
+template <typename F>
+void ReliablePacketBuffer::forEachNoLock(F &&f)
+{
+	if (m_packets.size() == 0)
+		return;
+
+	u32 found = 0;
+	for (u16 seqnum = m_first; found < m_packets.size(); seqnum++) {
+		BufferedPacketPtr *packet = m_packets.get(seqnum);
+		if (!packet)
+			continue;
+		found++;
+		if (!f(*packet))
+			break;
+	}
+}
+
+void ReliablePacketBuffer::removeNoLock(u16 seqnum)
+{
+	m_packets.remove(seqnum);
+	if (m_packets.size() == 0)
+		return;
+
+	// The last packet is still there, so these loops end
+	if (seqnum == m_first) {
+		do {
+			m_first++;
+		} while (!m_packets.get(m_first));
+	} else if (seqnum == m_last) {
+		do {
+			m_last--;
+		} while (!m_packets.get(m_last));
+	}
+}
+
 void ReliablePacketBuffer::print()
 {
 	MutexAutoLock listlock(m_list_mutex);
 	LOG(dout_con<<"Dump of ReliablePacketBuffer:" << std::endl);
 	unsigned int index = 0;
-	for (BufferedPacketPtr &packet : m_list) {
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		LOG(dout_con<<index<< ":" << packet->getSeqnum() << std::endl);
 		index++;
-	}
+		return true;
+	});
 }
 
 bool ReliablePacketBuffer::empty()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.empty();
+	return m_packets.size() == 0;
 }
 
 u32 ReliablePacketBuffer::size()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.size();
-}
-
-ReliablePacketBuffer::FindResult ReliablePacketBuffer::findPacketNoLock(u16 seqnum)
-{
-	for (auto it = m_list.begin(); it != m_list.end(); ++it) {
-		if ((*it)->getSeqnum() == seqnum)
-			return it;
-	}
-	return m_list.end();
+	return m_packets.size();
 }
 
 bool ReliablePacketBuffer::getFirstSeqnum(u16& result)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_packets.size() == 0)
 		return false;
-	result = m_list.front()->getSeqnum();
+	result = m_first;
 	return true;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popFirst()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_packets.size() == 0)
 		throw NotFoundException("Buffer is empty");
 
-	BufferedPacketPtr p(m_list.front());
-	m_list.pop_front();
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
+	BufferedPacketPtr p(*m_packets.get(m_first));
+	removeNoLock(m_first);
 	return p;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popSeqnum(u16 seqnum)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	auto r = findPacketNoLock(seqnum);
-	if (r == m_list.end()) {
+	BufferedPacketPtr *r = m_packets.get(seqnum);
+	if (!r) {
 		LOG(dout_con<<"Sequence number: " << seqnum
 				<< " not found in reliable buffer"<<std::endl);
 		throw NotFoundException("seqnum not found in buffer");
 	}
 
 	BufferedPacketPtr p(*r);
-	m_list.erase(r);
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
+	removeNoLock(seqnum);
 	return p;
 }
 
@@ -279,45 +314,11 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 		return;
 	}
 
-	sanity_check(m_list.size() <= SEQNUM_MAX); // FIXME: Handle the error?
-
-	// Find the right place for the packet and insert it there
-	// If list is empty, just add it
-	if (m_list.empty()) {
-		m_list.push_back(p_ptr);
-		m_oldest_non_answered_ack = seqnum;
-		// Done.
-		return;
-	}
-
-	// Otherwise find the right place
-	auto it = m_list.begin();
-	// Find the first packet in the list which has a higher seqnum
-	u16 s = (*it)->getSeqnum();
-
-	/* case seqnum is smaller then next_expected seqnum */
-	/* this is true e.g. on wrap around */
-	if (seqnum < next_expected) {
-		while(((s < seqnum) || (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-	/* non wrap around case (at least for incoming and next_expected */
-	else
-	{
-		while(((s < seqnum) && (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-
-	if (s == seqnum) {
+	BufferedPacketPtr *existing = m_packets.get(seqnum);
+	if (existing) {
 		/* nothing to do this seems to be a resent packet */
 		/* for paranoia reason data should be compared */
-		auto &i = *it;
+		auto &i = *existing;
 		if (
 			(i->getSeqnum() != seqnum) ||
 			(i->size() != p.size()) ||
@@ -342,35 +343,41 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 			warningstream << buf << std::flush;
 			throw IncomingDataCorruption("duplicated packet isn't same as original one");
 		}
+		return;
 	}
-	/* insert or push back */
-	else if (it != m_list.end()) {
-		m_list.insert(it, p_ptr);
+
+	if (m_packets.size() == 0) {
+		m_first = m_last = seqnum;
 	} else {
-		m_list.push_back(p_ptr);
+		// Window order is the distance from the next expected seqnum
+		const u16 pos = seqnum - next_expected;
+		if (pos < (u16)(m_first - next_expected))
+			m_first = seqnum;
+		if (pos > (u16)(m_last - next_expected))
+			m_last = seqnum;
 	}
-
-	/* update last packet number */
-	m_oldest_non_answered_ack = m_list.front()->getSeqnum();
+	m_packets.add(seqnum) = p_ptr;
 }
 
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	for (auto &packet : m_list) {
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		packet->time += dtime;
 		packet->totaltime += dtime;
-	}
+		return true;
+	});
 }
 
 u32 ReliablePacketBuffer::getTimedOuts(float timeout)
 {
 	MutexAutoLock listlock(m_list_mutex);
 	u32 count = 0;
-	for (auto &packet : m_list) {
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		if (packet->totaltime >= timeout)
 			count++;
-	}
+		return true;
+	});
 	return count;
 }
 
@@ -379,12 +386,12 @@ std::vector<ConstSharedPtr<BufferedPacket>>
 {
 	MutexAutoLock listlock(m_list_mutex);
 	std::vector<ConstSharedPtr<BufferedPacket>> timed_outs;
-	for (auto &packet : m_list) {
+	forEachNoLock([&] (BufferedPacketPtr &packet) {
 		// resend time scales exponentially with each cycle
 		const float pkt_timeout = timeout * powf(RESEND_SCALE_BASE, packet->resend_count);
 
 		if (packet->time < pkt_timeout)
-			continue;
+			return true;
 
 		// caller will resend packet so reset time and increase counter
 		packet->time = 0.0f;
@@ -392,9 +399,8 @@ std::vector<ConstSharedPtr<BufferedPacket>>
 
 		timed_outs.emplace_back(packet);
 
-		if (timed_outs.size() >= max_packets)
-			break;
-	}
+		return timed_outs.size() < max_packets;
+	});
 	return timed_outs;
 }
 
@@ -406,14 +412,25 @@ bool IncomingSplitPacket::insert(u32 chunk_num, SharedBuffer<u8> &chunkdata)
 {
 	sanity_check(chunk_num < chunk_count);
 
+	// Append in the usual case of chunks arriving in order
+	if (chunks.empty() || chunks.back().first < chunk_num) {
+		chunks.emplace_back(chunk_num, chunkdata);
+		return true;
+	}
+
+	auto it = std::lower_bound(chunks.begin(), chunks.end(), chunk_num,
+		[] (const std::pair<u16, SharedBuffer<u8>> &chunk, u32 num) {
+			return chunk.first < num;
+		});
+
 	// If chunk already exists, ignore it.
 	// Sometimes two identical packets may arrive when there is network
 	// lag and the server re-sends stuff.
-	if (chunks.find(chunk_num) != chunks.end())
+	if (it != chunks.end() && it->first == chunk_num)
 		return false;
 
 	// Set chunk data in buffer
-	chunks[chunk_num] = chunkdata;
+	chunks.emplace(it, chunk_num, chunkdata);
 
 	return true;
 }
@@ -429,10 +446,10 @@ SharedBuffer<u8> IncomingSplitPacket::reassemble()
 
 	SharedBuffer<u8> fulldata(totalsize);
 
-	// Copy chunks to data buffer
+	// Copy chunks to data buffer, they are sorted by chunk number
 	u32 start = 0;
-	for (u32 chunk_i = 0; chunk_i < chunk_count; chunk_i++) {
-		const SharedBuffer<u8> &buf = chunks[chunk_i];
+	for (const auto &chunk : chunks) {
+		const SharedBuffer<u8> &buf = chunk.second;
 		memcpy(&fulldata[start], *buf, buf.getSize());
 		start += buf.getSize();
 	}
@@ -444,14 +461,6 @@ SharedBuffer<u8> IncomingSplitPacket::reassemble()
 	IncomingSplitBuffer
 */
 
-IncomingSplitBuffer::~IncomingSplitBuffer()
-{
-	MutexAutoLock listlock(m_map_mutex);
-	for (auto &i : m_buf) {
-		delete i.second;
-	}
-}
-
 SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reliable)
 {
 	MutexAutoLock listlock(m_map_mutex);
@@ -479,13 +488,10 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 	}
 
 	// Add if doesn't exist
-	IncomingSplitPacket *sp;
-	if (m_buf.find(seqnum) == m_buf.end()) {
-		sp = new IncomingSplitPacket(chunk_count, reliable);
-		m_buf[seqnum] = sp;
-	} else {
-		sp = m_buf[seqnum];
-	}
+	std::unique_ptr<IncomingSplitPacket> &slot = m_buf.add(seqnum);
+	if (!slot)
+		slot.reset(new IncomingSplitPacket(chunk_count, reliable));
+	IncomingSplitPacket *sp = slot.get();
 
 	if (chunk_count != sp->chunk_count) {
 		errorstream << "IncomingSplitBuffer::insert(): chunk_count="
@@ -513,8 +519,7 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 	SharedBuffer<u8> fulldata = sp->reassemble();
 
 	// Remove sp from buffer
-	m_buf.erase(seqnum);
-	delete sp;
+	m_buf.remove(seqnum);
 
 	return fulldata;
 }
@@ -522,23 +527,21 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 void IncomingSplitBuffer::removeUnreliableTimedOuts(float dtime, float timeout)
 {
 	MutexAutoLock listlock(m_map_mutex);
+	if (m_buf.size() == 0)
+		return;
+
 	std::vector<u16> remove_queue;
-	{
-		for (const auto &i : m_buf) {
-			IncomingSplitPacket *p = i.second;
-			// Reliable ones are not removed by timeout
-			if (p->reliable)
-				continue;
-			p->time += dtime;
-			if (p->time >= timeout)
-				remove_queue.push_back(i.first);
-		}
-	}
+	m_buf.forEach([&] (u16 seqnum, std::unique_ptr<IncomingSplitPacket> &p) {
+		// Reliable ones are not removed by timeout
+		if (p->reliable)
+			return;
+		p->time += dtime;
+		if (p->time >= timeout)
+			remove_queue.push_back(seqnum);
+	});
 	for (u16 j : remove_queue) {
 		LOG(dout_con<<"NOTE: Removing timed out unreliable split packet"<<std::endl);
-		auto it = m_buf.find(j);
-		delete it->second;
-		m_buf.erase(it);
+		m_buf.remove(j);
 	}
 }
 
@@ -587,13 +590,14 @@ ConnectionCommandPtr ConnectionCommand::resend_one(session_t peer_id)
 }
 
 ConnectionCommandPtr ConnectionCommand::send(session_t peer_id, u8 channelnum,
-	NetworkPacket *pkt, bool reliable)
+	NetworkPacket *pkt, bool reliable, u8 stream)
 {
 	auto c = create(CONNCMD_SEND);
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
+	c->stream = stream;
 	c->reliable = reliable;
-	c->data = pkt->oldForgePacket();
+	c->data = pkt->forgePacket(SEND_HEADROOM);
 	return c;
 }
 
@@ -603,7 +607,7 @@ ConnectionCommandPtr ConnectionCommand::ack(session_t peer_id, u8 channelnum, co
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = false;
-	data.copyTo(c->data);
+	c->data = PacketBuffer(*data, data.getSize());
 	return c;
 }
 
@@ -614,7 +618,7 @@ ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const Buff
 	c->channelnum = 0;
 	c->reliable = true;
 	c->raw = true;
-	data.copyTo(c->data);
+	c->data = PacketBuffer(*data, data.getSize());
 	return c;
 }
 
@@ -733,7 +737,7 @@ void Channel::UpdatePacketTooLateCounter()
 	current_packet_too_late++;
 }
 
-void Channel::UpdateTimers(float dtime)
+void Channel::UpdateTimers(float dtime, bool dynamic_window)
 {
 	bpm_counter += dtime;
 	packet_loss_counter += dtime;
@@ -763,9 +767,11 @@ void Channel::UpdateTimers(float dtime)
 
 		/* dynamic window size */
 		float successful_to_lost_ratio = 0.0f;
-		bool done = false;
+		bool done = !dynamic_window;
 
-		if (packets_successful > 0) {
+		if (done) {
+			// keep the window, the congestion control limits the sending
+		} else if (packets_successful > 0) {
 			successful_to_lost_ratio = packet_loss/packets_successful;
 		} else if (packet_loss > 0) {
 			setWindowSize(m_window_size - 10);
@@ -1014,6 +1020,20 @@ bool UDPPeer::isTimedOut(float timeout, std::string &reason)
 	return false;
 }
 
+float UDPPeer::getStat(rtt_stat_type type) const
+{
+	switch (type) {
+		case BANDWIDTH:
+			return congestion.getBandwidth();
+		case PACING_RATE:
+			return congestion.getPacingRate();
+		case CONGESTION_WINDOW:
+			return congestion.getCongestionWindow();
+		default:
+			return Peer::getStat(type);
+	}
+}
+
 bool UDPPeer::getAddress(MTProtocols type,Address& toset)
 {
 	if ((type == MTP_UDP) || (type == MTP_MINETEST_RELIABLE_UDP) || (type == MTP_PRIMARY))
@@ -1062,29 +1082,16 @@ void UDPPeer::PutReliableSendCommand(ConnectionCommandPtr &c,
 	if (m_pending_disconnect)
 		return;
 
-	Channel &chan = channels[c->channelnum];
+	/*
+		The send thread turns the command into packets when the channel
+		can take more, see processQueuedCommand
+	*/
+	LOG(dout_con<<m_connection->getDesc()
+			<<" Queueing reliable command for peer id: " << c->peer_id
+			<<" stream: " << (int)c->stream
+			<<" data size: " << c->data.getSize() <<std::endl);
 
-	if (chan.queued_commands.empty() &&
-			/* don't queue more packets then window size */
-			(chan.queued_reliables.size() + 1 < chan.getWindowSize() / 2)) {
-		LOG(dout_con<<m_connection->getDesc()
-				<<" processing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() << std::endl);
-		if (processReliableSendCommand(c, max_packet_size))
-			return;
-	} else {
-		LOG(dout_con<<m_connection->getDesc()
-				<<" Queueing reliable command for peer id: " << c->peer_id
-				<<" data size: " << c->data.getSize() <<std::endl);
-
-		if (chan.queued_commands.size() + 1 >= chan.getWindowSize() / 2) {
-			LOG(derr_con << m_connection->getDesc()
-					<< "Possible packet stall to peer id: " << c->peer_id
-					<< " queued_commands=" << chan.queued_commands.size()
-					<< std::endl);
-		}
-	}
-	chan.queued_commands.push_back(c);
+	channels[c->channelnum].queued_commands.push_back(c);
 }
 
 bool UDPPeer::processReliableSendCommand(
@@ -1103,13 +1110,35 @@ bool UDPPeer::processReliableSendCommand(
 
 	sanity_check(c.data.getSize() < MAX_RELIABLE_WINDOW_SIZE*512);
 
+	/*
+		A SEND command that fits into one packet is owned by this peer,
+		its buffer becomes the packet without copying the data again
+	*/
+	if (c.type == CONNCMD_SEND && !c.raw &&
+			c.data.getHeadroom() >= SEND_HEADROOM &&
+			c.data.getSize() + ORIGINAL_HEADER_SIZE <= chunksize_max) {
+		bool have_sequence_number = false;
+		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
+		if (!have_sequence_number) {
+			LOG(derr_con << m_connection->getDesc() << "Ran out of sequence numbers!" << std::endl);
+			return false;
+		}
+
+		chan.queued_reliables.push(makeOriginalReliablePacket(address,
+				std::move(c_ptr->data), seqnum, m_connection->GetProtocolID(),
+				m_connection->GetPeerID(), c.channelnum));
+		sanity_check(chan.queued_reliables.size() < 0xFFFF);
+		return true;
+	}
+
 	std::list<SharedBuffer<u8>> originals;
 	u16 split_sequence_number = chan.readNextSplitSeqNum();
+	const SharedBuffer<u8> data(*c.data, c.data.getSize());
 
 	if (c.raw) {
-		originals.emplace_back(c.data);
+		originals.emplace_back(data);
 	} else {
-		makeAutoSplitPacket(c.data, chunksize_max,split_sequence_number, &originals);
+		makeAutoSplitPacket(data, chunksize_max,split_sequence_number, &originals);
 		chan.setNextSplitSeqNum(split_sequence_number);
 	}
 
@@ -1190,36 +1219,26 @@ bool UDPPeer::processReliableSendCommand(
 	return false;
 }
 
-void UDPPeer::RunCommandQueues(
-							unsigned int max_packet_size,
-							unsigned int maxtransfer)
+bool UDPPeer::processQueuedCommand(Channel &chan, unsigned int max_packet_size)
 {
+	ConnectionCommandPtr c = chan.queued_commands.front();
+	if (!c)
+		return false;
 
-	for (Channel &channel : channels) {
-
-		if ((!channel.queued_commands.empty()) &&
-				(channel.queued_reliables.size() < maxtransfer)) {
-			try {
-				ConnectionCommandPtr c = channel.queued_commands.front();
-
-				LOG(dout_con << m_connection->getDesc()
-						<< " processing queued reliable command " << std::endl);
+	LOG(dout_con << m_connection->getDesc()
+			<< " processing queued reliable command " << std::endl);
 
-				// Packet is processed, remove it from queue
-				if (processReliableSendCommand(c, max_packet_size)) {
-					channel.queued_commands.pop_front();
-				} else {
-					LOG(dout_con << m_connection->getDesc()
-							<< " Failed to queue packets for peer_id: " << c->peer_id
-							<< ", delaying sending of " << c->data.getSize()
-							<< " bytes" << std::endl);
-				}
-			}
-			catch (ItemNotFoundException &e) {
-				// intentionally empty
-			}
-		}
+	if (!processReliableSendCommand(c, max_packet_size)) {
+		LOG(dout_con << m_connection->getDesc()
+				<< " Failed to queue packets for peer_id: " << c->peer_id
+				<< ", delaying sending of " << c->data.getSize()
+				<< " bytes" << std::endl);
+		return false;
 	}
+
+	// Packet is processed, remove it from queue
+	chan.queued_commands.pop_front();
+	return true;
 }
 
 u16 UDPPeer::getNextSplitSequenceNumber(u8 channel)
@@ -1303,10 +1322,9 @@ ConnectionEventPtr ConnectionEvent::bindFailed()
 */
 
 Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout,
-		bool ipv6, PeerHandler *peerhandler) :
+		bool ipv6, PeerHandler *peerhandler, u32 send_threads) :
 	m_udpSocket(ipv6),
 	m_protocol_id(protocol_id),
-	m_sendThread(new ConnectionSendThread(max_packet_size, timeout)),
 	m_receiveThread(new ConnectionReceiveThread(max_packet_size)),
 	m_bc_peerhandler(peerhandler)
 
@@ -1315,10 +1333,18 @@ Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout,
 	 * from the connection timeout */
 	m_udpSocket.setTimeoutMs(500);
 
-	m_sendThread->setParent(this);
+	if (send_threads == 0)
+		send_threads = MYMAX(1U, MYMIN(4U, Thread::getNumberOfProcessors() / 2));
+
+	for (u32 i = 0; i < send_threads; i++) {
+		m_sendThreads.emplace_back(new ConnectionSendThread(max_packet_size,
+				timeout, i));
+		m_sendThreads.back()->setParent(this);
+	}
 	m_receiveThread->setParent(this);
 
-	m_sendThread->start();
+	for (auto &thread : m_sendThreads)
+		thread->start();
 	m_receiveThread->start();
 }
 
@@ -1327,16 +1353,19 @@ Connection::~Connection()
 {
 	m_shutting_down = true;
 	// request threads to stop
-	m_sendThread->stop();
+	for (auto &thread : m_sendThreads)
+		thread->stop();
 	m_receiveThread->stop();
 
 	//TODO for some unkonwn reason send/receive threads do not exit as they're
 	// supposed to be but wait on peer timeout. To speed up shutdown we reduce
 	// timeout to half a second.
-	m_sendThread->setPeerTimeout(0.5);
+	for (auto &thread : m_sendThreads)
+		thread->setPeerTimeout(0.5);
 
 	// wait for threads to finish
-	m_sendThread->wait();
+	for (auto &thread : m_sendThreads)
+		thread->wait();
 	m_receiveThread->wait();
 
 	// Delete peers
@@ -1353,9 +1382,9 @@ void Connection::putEvent(ConnectionEventPtr e)
 	m_event_queue.push_back(e);
 }
 
-void Connection::TriggerSend()
+void Connection::TriggerSend(session_t peer_id)
 {
-	m_sendThread->Trigger();
+	m_sendThreads[getSendShard(peer_id)]->Trigger();
 }
 
 PeerHelper Connection::getPeerNoEx(session_t peer_id)
@@ -1397,12 +1426,14 @@ session_t Connection::lookupPeer(const Address& sender)
 	return PEER_ID_INEXISTENT;
 }
 
-u32 Connection::getActiveCount()
+u32 Connection::getActiveCount(u32 shard)
 {
 	MutexAutoLock peerlock(m_peers_mutex);
 	u32 count = 0;
 	for (auto &it : m_peers) {
 		Peer *peer = it.second;
+		if (getSendShard(peer->id) != shard)
+			continue;
 		if (peer->isPendingDeletion())
 			continue;
 		if (peer->isHalfOpen())
@@ -1463,9 +1494,26 @@ bool Connection::ReceivePackets(std::vector<ConnectionEventPtr>& pkts)
 
 void Connection::putCommand(ConnectionCommandPtr c)
 {
-	if (!m_shutting_down) {
-		m_command_queue.push_back(c);
-		m_sendThread->Trigger();
+	if (m_shutting_down)
+		return;
+
+	c->time_queued = porting::getTimeUs();
+
+	switch (c->type) {
+	case CONNCMD_SERVE:
+	case CONNCMD_CONNECT:
+		// The socket is shared, any thread can set it up
+		m_sendThreads[0]->putCommand(c);
+		break;
+	case CONNCMD_DISCONNECT:
+	case CONNCMD_SEND_TO_ALL:
+		// Every thread handles its own peers, the command is only read
+		for (auto &thread : m_sendThreads)
+			thread->putCommand(c);
+		break;
+	default:
+		m_sendThreads[getSendShard(c->peer_id)]->putCommand(c);
+		break;
 	}
 }
 
@@ -1561,11 +1609,12 @@ bool Connection::TryReceive(NetworkPacket *pkt)
 }
 
 void Connection::Send(session_t peer_id, u8 channelnum,
-		NetworkPacket *pkt, bool reliable)
+		NetworkPacket *pkt, bool reliable, u8 stream)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
+	assert(stream < NETSTREAM_COUNT); // Pre-condition
 
-	putCommand(ConnectionCommand::send(peer_id, channelnum, pkt, reliable));
+	putCommand(ConnectionCommand::send(peer_id, channelnum, pkt, reliable, stream));
 }
 
 Address Connection::GetPeerAddress(session_t peer_id)
@@ -1621,7 +1670,7 @@ float Connection::getLocalStat(rate_stat_type type)
 	return retval;
 }
 
-session_t Connection::createPeer(Address& sender, MTProtocols protocol, int fd)
+session_t Connection::createPeer(const Address &sender, MTProtocols protocol, int fd)
 {
 	// Somebody wants to make a new connection
 
@@ -1703,7 +1752,6 @@ void Connection::sendAck(session_t peer_id, u8 channelnum, u16 seqnum)
 	writeU16(&ack[2], seqnum);
 
 	putCommand(ConnectionCommand::ack(peer_id, channelnum, ack));
-	m_sendThread->Trigger();
 }
 
 UDPPeer* Connection::createServerPeer(Address& address)
@@ -28,6 +28,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/thread.h"
 #include "util/numeric.h"
 #include "networkprotocol.h"
+#include "packetbuffer.h"
+#include "congestion.h"
+#include "streamqueue.h"
+#include <cassert>
 #include <iostream>
 #include <vector>
 #include <map>
@@ -118,6 +122,11 @@ with a buffer in the receiving and transmitting end.
 */
 //#define TYPE_RELIABLE 3
 #define RELIABLE_HEADER_SIZE 3
+/*
+Room reserved in front of the data of a send command, so that a packet
+which is not split gets all its headers prepended in place.
+*/
+#define SEND_HEADROOM (BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE + ORIGINAL_HEADER_SIZE)
 #define SEQNUM_INITIAL 65500
 #define SEQNUM_MAX 65535
 
@@ -184,17 +193,24 @@ static inline float CALC_DTIME(u64 lasttime, u64 curtime)
 		u8[] packet data (usually copied from SharedBuffer<u8>)
 */
 struct BufferedPacket {
-	BufferedPacket(u32 a_size)
+	BufferedPacket(u32 a_size) :
+		m_data(a_size)
 	{
-		m_data.resize(a_size);
-		data = &m_data[0];
+		data = *m_data;
+	}
+
+	// Takes over a buffer that already contains all headers
+	BufferedPacket(PacketBuffer &&a_data) :
+		m_data(std::move(a_data))
+	{
+		data = *m_data;
 	}
 
 	DISABLE_CLASS_COPY(BufferedPacket)
 
 	u16 getSeqnum() const;
 
-	inline size_t size() const { return m_data.size(); }
+	inline size_t size() const { return m_data.getSize(); }
 
 	u8 *data; // Direct memory access
 	float time = 0.0f; // Seconds from buffering the packet or re-sending
@@ -202,9 +218,10 @@ struct BufferedPacket {
 	u64 absolute_send_time = -1;
 	Address address; // Sender or destination
 	unsigned int resend_count = 0;
+	DeliveryState delivery; // For the congestion control of reliables
 
 private:
-	std::vector<u8> m_data; // Data of the packet, including headers
+	PacketBuffer m_data; // Data of the packet, including headers
 };
 
 typedef std::shared_ptr<BufferedPacket> BufferedPacketPtr;
@@ -222,6 +239,11 @@ void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 // Add the TYPE_RELIABLE header to the data
 SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
 
+// Prepends the TYPE_ORIGINAL, TYPE_RELIABLE and base headers to the data in
+// place and makes a packet out of it. data needs SEND_HEADROOM bytes headroom.
+BufferedPacketPtr makeOriginalReliablePacket(Address &address, PacketBuffer &&data,
+		u16 seqnum, u32 protocol_id, session_t sender_peer_id, u8 channel);
+
 struct IncomingSplitPacket
 {
 	IncomingSplitPacket(u32 cc, bool r):
@@ -241,13 +263,104 @@ struct IncomingSplitPacket
 	SharedBuffer<u8> reassemble();
 
 private:
-	// Key is chunk number, value is data without headers
-	std::map<u16, SharedBuffer<u8>> chunks;
+	// Chunk numbers and data without headers, sorted by chunk number.
+	// Chunks usually arrive in order, which makes inserting O(1).
+	std::vector<std::pair<u16, SharedBuffer<u8>>> chunks;
+};
+
+/*
+	Slots for values keyed by sequence number, indexed by seqnum % capacity.
+	The capacity is a power of two that grows when two sequence numbers in
+	use would share a slot, so it follows the span of the sequence numbers
+	in flight. Not thread-safe.
+*/
+template <typename T>
+class SeqnumRing
+{
+public:
+	SeqnumRing(u32 initial_capacity = 64) : m_slots(initial_capacity)
+	{
+		assert(initial_capacity > 0 && initial_capacity <= 0x10000 &&
+			(initial_capacity & (initial_capacity - 1)) == 0);
+	}
+
+	u32 size() const { return m_count; }
+	u32 capacity() const { return m_slots.size(); }
+
+	// Returns nullptr if seqnum is not in use
+	T *get(u16 seqnum)
+	{
+		Slot &slot = m_slots[seqnum & (m_slots.size() - 1)];
+		return slot.used && slot.seqnum == seqnum ? &slot.value : nullptr;
+	}
+
+	// Returns the value of seqnum, adding a default one if it is not in use
+	T &add(u16 seqnum)
+	{
+		Slot *slot = &m_slots[seqnum & (m_slots.size() - 1)];
+		while (slot->used && slot->seqnum != seqnum) {
+			grow();
+			slot = &m_slots[seqnum & (m_slots.size() - 1)];
+		}
+		if (!slot->used) {
+			slot->used = true;
+			slot->seqnum = seqnum;
+			m_count++;
+		}
+		return slot->value;
+	}
+
+	bool remove(u16 seqnum)
+	{
+		Slot &slot = m_slots[seqnum & (m_slots.size() - 1)];
+		if (!slot.used || slot.seqnum != seqnum)
+			return false;
+		slot.used = false;
+		slot.value = T();
+		m_count--;
+		return true;
+	}
+
+	// Calls f(seqnum, value) for each value, in slot order
+	template <typename F>
+	void forEach(F &&f)
+	{
+		u32 found = 0;
+		for (u32 i = 0; i < m_slots.size() && found < m_count; i++) {
+			Slot &slot = m_slots[i];
+			if (slot.used) {
+				found++;
+				f(slot.seqnum, slot.value);
+			}
+		}
+	}
+
+private:
+	struct Slot {
+		u16 seqnum = 0;
+		bool used = false;
+		T value = T();
+	};
+
+	void grow()
+	{
+		// With a slot for each sequence number there are no collisions
+		assert(m_slots.size() < 0x10000);
+		std::vector<Slot> slots(m_slots.size() * 2);
+		for (Slot &slot : m_slots) {
+			if (slot.used)
+				slots[slot.seqnum & (slots.size() - 1)] = std::move(slot);
+		}
+		m_slots = std::move(slots);
+	}
+
+	std::vector<Slot> m_slots;
+	u32 m_count = 0;
 };
 
 /*
-	A buffer which stores reliable packets and sorts them internally
-	for fast access to the smallest one.
+	A buffer which stores reliable packets by their sequence number
+	and keeps track of the first one in window order.
 */
 
 class ReliablePacketBuffer
@@ -272,13 +385,16 @@ class ReliablePacketBuffer
 
 
 private:
-	typedef std::list<BufferedPacketPtr>::iterator FindResult;
-
-	FindResult findPacketNoLock(u16 seqnum);
+	// Calls f(packet) in window order until it returns false
+	template <typename F>
+	void forEachNoLock(F &&f);
+	void removeNoLock(u16 seqnum);
 
-	std::list<BufferedPacketPtr> m_list;
+	SeqnumRing<BufferedPacketPtr> m_packets;
 
-	u16 m_oldest_non_answered_ack;
+	// Sequence numbers of the first and last packet in window order
+	u16 m_first = 0;
+	u16 m_last = 0;
 
 	std::mutex m_list_mutex;
 };
@@ -290,7 +406,6 @@ class ReliablePacketBuffer
 class IncomingSplitBuffer
 {
 public:
-	~IncomingSplitBuffer();
 	/*
 		Returns a reference counted buffer of length != 0 when a full split
 		packet is constructed. If not, returns one of length 0.
@@ -301,7 +416,7 @@ class IncomingSplitBuffer
 
 private:
 	// Key is seqnum
-	std::map<u16, IncomingSplitPacket*> m_buf;
+	SeqnumRing<std::unique_ptr<IncomingSplitPacket>> m_buf{16};
 
 	std::mutex m_map_mutex;
 };
@@ -329,9 +444,14 @@ struct ConnectionCommand
 	Address address;
 	session_t peer_id = PEER_ID_INEXISTENT;
 	u8 channelnum = 0;
-	Buffer<u8> data;
+	// NetworkStream of reliable SEND commands
+	u8 stream = NETSTREAM_DEFAULT;
+	// Command and data of SEND commands, which have SEND_HEADROOM headroom
+	PacketBuffer data;
 	bool reliable = false;
 	bool raw = false;
+	// Time in microseconds when the command was queued, for latency statistics
+	u64 time_queued = 0;
 
 	DISABLE_CLASS_COPY(ConnectionCommand);
 
@@ -340,7 +460,8 @@ struct ConnectionCommand
 	static ConnectionCommandPtr disconnect();
 	static ConnectionCommandPtr disconnect_peer(session_t peer_id);
 	static ConnectionCommandPtr resend_one(session_t peer_id);
-	static ConnectionCommandPtr send(session_t peer_id, u8 channelnum, NetworkPacket *pkt, bool reliable);
+	static ConnectionCommandPtr send(session_t peer_id, u8 channelnum, NetworkPacket *pkt,
+			bool reliable, u8 stream = NETSTREAM_DEFAULT);
 	static ConnectionCommandPtr ack(session_t peer_id, u8 channelnum, const Buffer<u8> &data);
 	static ConnectionCommandPtr createPeer(session_t peer_id, const Buffer<u8> &data);
 
@@ -385,8 +506,8 @@ class Channel
 	//queued reliable packets
 	std::queue<BufferedPacketPtr> queued_reliables;
 
-	//queue commands prior splitting to packets
-	std::deque<ConnectionCommandPtr> queued_commands;
+	//queue commands prior splitting to packets, per stream
+	StreamQueue queued_commands;
 
 	IncomingSplitBuffer incoming_splits;
 
@@ -399,7 +520,9 @@ class Channel
 	void UpdateBytesLost(unsigned int bytes);
 	void UpdateBytesReceived(unsigned int bytes);
 
-	void UpdateTimers(float dtime);
+	// dynamic_window adapts the window size to the packet loss, not
+	// needed if the peer has a congestion control
+	void UpdateTimers(float dtime, bool dynamic_window = true);
 
 	float getCurrentDownloadRateKB()
 		{ MutexAutoLock lock(m_internal_mutex); return cur_kbps; };
@@ -557,6 +680,8 @@ class Peer {
 					return m_rtt.jitter_max;
 				case AVG_JITTER:
 					return m_rtt.jitter_avg;
+				default:
+					break;
 			}
 			return -1;
 		}
@@ -640,6 +765,8 @@ class UDPPeer final : public Peer
 
 	bool isTimedOut(float timeout, std::string &reason) override;
 
+	float getStat(rtt_stat_type type) const override;
+
 protected:
 	/*
 		Calculates avg_rtt and resend_timeout.
@@ -647,9 +774,11 @@ class UDPPeer final : public Peer
 	*/
 	void reportRTT(float rtt) override;
 
-	void RunCommandQueues(
-					unsigned int max_packet_size,
-					unsigned int maxtransfer);
+	/*
+		Turns the next queued command of the channel into packets.
+		Returns false if there is none or the sequence numbers ran out.
+	*/
+	bool processQueuedCommand(Channel &chan, unsigned int max_packet_size);
 
 	float getResendTimeout()
 		{ MutexAutoLock lock(m_exclusive_access_mutex); return resend_timeout; }
@@ -660,6 +789,7 @@ class UDPPeer final : public Peer
 	bool Ping(float dtime, SharedBuffer<u8>& data) override;
 
 	Channel channels[CHANNEL_COUNT];
+	CongestionControl congestion;
 	bool m_pending_disconnect = false;
 private:
 	// This is changed dynamically
@@ -718,8 +848,12 @@ class Connection
 	friend class ConnectionSendThread;
 	friend class ConnectionReceiveThread;
 
+	/*
+		send_threads: number of threads the peers are distributed over for
+		sending, 0 picks a number based on the available processors
+	*/
 	Connection(u32 protocol_id, u32 max_packet_size, float timeout, bool ipv6,
-			PeerHandler *peerhandler);
+			PeerHandler *peerhandler, u32 send_threads = 1);
 	~Connection();
 
 	/* Interface */
@@ -736,7 +870,8 @@ class Connection
 	bool ReceivePackets(std::vector<ConnectionEventPtr>& pkts);
 	void Receive(NetworkPacket *pkt);
 	bool TryReceive(NetworkPacket *pkt);
-	void Send(session_t peer_id, u8 channelnum, NetworkPacket *pkt, bool reliable);
+	void Send(session_t peer_id, u8 channelnum, NetworkPacket *pkt, bool reliable,
+			u8 stream = NETSTREAM_DEFAULT);
 	session_t GetPeerID() const { return m_peer_id; }
 	Address GetPeerAddress(session_t peer_id);
 	float getPeerStat(session_t peer_id, rtt_stat_type type);
@@ -753,7 +888,7 @@ class Connection
 	PeerHelper getPeerNoEx(session_t peer_id);
 	session_t   lookupPeer(const Address& sender);
 
-	session_t createPeer(Address& sender, MTProtocols protocol, int fd);
+	session_t createPeer(const Address &sender, MTProtocols protocol, int fd);
 	UDPPeer*  createServerPeer(Address& sender);
 	bool deletePeer(session_t peer_id, bool timeout);
 
@@ -769,15 +904,20 @@ class Connection
 		return m_peer_ids;
 	}
 
-	u32 getActiveCount();
+	// Counts the active peers handled by the given send thread
+	u32 getActiveCount(u32 shard);
+
+	// Index of the send thread that owns the peer
+	u32 getSendShard(session_t peer_id) const
+	{
+		return peer_id % m_sendThreads.size();
+	}
 
 	UDPSocket m_udpSocket;
-	// Command queue: user -> SendThread
-	MutexedQueue<ConnectionCommandPtr> m_command_queue;
 
 	void putEvent(ConnectionEventPtr e);
 
-	void TriggerSend();
+	void TriggerSend(session_t peer_id);
 
 	bool ConnectedToServer()
 	{
@@ -795,7 +935,9 @@ class Connection
 	std::vector<session_t> m_peer_ids;
 	std::mutex m_peers_mutex;
 
-	std::unique_ptr<ConnectionSendThread> m_sendThread;
+	// Each send thread owns the channels and timers of its share of the peers
+	// and has its own command queue (user -> SendThread)
+	std::vector<std::unique_ptr<ConnectionSendThread>> m_sendThreads;
 	std::unique_ptr<ConnectionReceiveThread> m_receiveThread;
 
 	mutable std::mutex m_info_mutex;
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
 #include "connectionthreads.h"
 #include "log.h"
 #include "profiler.h"
@@ -60,11 +61,14 @@ static inline u8 readChannel(const u8 *packetdata)
 /******************************************************************************/
 
 ConnectionSendThread::ConnectionSendThread(unsigned int max_packet_size,
-	float timeout) :
+	float timeout, u32 shard) :
 	Thread("ConnectionSend"),
+	m_shard(shard),
 	m_max_packet_size(max_packet_size),
 	m_timeout(timeout),
-	m_max_data_packets_per_iteration(g_settings->getU16("max_packets_per_iteration"))
+	m_max_data_packets_per_iteration(g_settings->getU16("max_packets_per_iteration")),
+	m_congestion_control(g_settings->getBool("congestion_control")),
+	m_send_batch(g_settings->getU16("udp_batch_size"))
 {
 	SANITY_CHECK(m_max_data_packets_per_iteration > 1);
 }
@@ -80,7 +84,8 @@ void *ConnectionSendThread::run()
 	u64 lasttime = curtime;
 
 	PROFILE(std::stringstream ThreadIdentifier);
-	PROFILE(ThreadIdentifier << "ConnectionSend: [" << m_connection->getDesc() << "]");
+	PROFILE(ThreadIdentifier << "ConnectionSend: [" << m_connection->getDesc()
+		<< ";" << m_shard << "]");
 
 	/* if stop is requested don't stop immediately but try to send all        */
 	/* packets first */
@@ -88,8 +93,12 @@ void *ConnectionSendThread::run()
 		BEGIN_DEBUG_EXCEPTION_HANDLER
 		PROFILE(ScopeProfiler sp(g_profiler, ThreadIdentifier.str(), SPT_AVG));
 
-		/* wait for trigger or timeout */
-		m_send_sleep_semaphore.wait(50);
+		/* wait for trigger, timeout or the pacing of a peer */
+		u32 wait_ms = 50;
+		if (m_pacing_delay > 0)
+			wait_ms = MYMIN(wait_ms, m_pacing_delay / 1000 + 1);
+		m_pacing_delay = 0;
+		m_send_sleep_semaphore.wait(wait_ms);
 
 		/* remove all triggers */
 		while (m_send_sleep_semaphore.wait(0)) {
@@ -101,7 +110,7 @@ void *ConnectionSendThread::run()
 
 		m_iteration_packets_avaialble = m_max_data_packets_per_iteration;
 		const auto &calculate_quota = [&] () -> u32 {
-			u32 numpeers = m_connection->getActiveCount();
+			u32 numpeers = m_connection->getActiveCount(m_shard);
 			if (numpeers > 0)
 				return MYMAX(1, m_iteration_packets_avaialble / numpeers);
 			return m_iteration_packets_avaialble;
@@ -116,19 +125,26 @@ void *ConnectionSendThread::run()
 		}
 
 		/* translate commands to packets */
-		auto c = m_connection->m_command_queue.pop_frontNoEx(0);
-		while (c && c->type != CONNCMD_NONE) {
+		ConnectionCommandPtr c;
+		u64 now_us = porting::getTimeUs();
+		while (m_command_queue.pop_front(c) && c->type != CONNCMD_NONE) {
+			m_stats_commands++;
+			m_stats_latency_us += now_us - MYMIN(now_us, c->time_queued);
+
 			if (c->reliable)
 				processReliableCommand(c);
 			else
 				processNonReliableCommand(c);
-
-			c = m_connection->m_command_queue.pop_frontNoEx(0);
 		}
 
 		/* send queued packets */
 		sendPackets(dtime, calculate_quota());
 
+		/* hand everything sent in this iteration to the socket */
+		flushSendBatch();
+
+		updateStats(dtime);
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
@@ -141,9 +157,65 @@ void ConnectionSendThread::Trigger()
 	m_send_sleep_semaphore.post();
 }
 
-bool ConnectionSendThread::packetsQueued()
+void ConnectionSendThread::putCommand(ConnectionCommandPtr c)
+{
+	m_command_queue.push_back(std::move(c));
+	Trigger();
+}
+
+std::vector<session_t> ConnectionSendThread::getPeerIDs()
 {
 	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	peerIds.erase(std::remove_if(peerIds.begin(), peerIds.end(),
+		[this] (session_t id) { return m_connection->getSendShard(id) != m_shard; }),
+		peerIds.end());
+	return peerIds;
+}
+
+void ConnectionSendThread::updateStats(float dtime)
+{
+	m_stats_timer += dtime;
+	if (m_stats_timer < 1.0f)
+		return;
+
+	std::string prefix = "ConnectionSend[" + std::to_string(m_shard) + "]: ";
+	g_profiler->avg(prefix + "packets/s", m_stats_packets / m_stats_timer);
+	if (m_stats_commands > 0) {
+		g_profiler->avg(prefix + "command latency [ms]",
+			m_stats_latency_us / 1000.0f / m_stats_commands);
+	}
+
+	// The packet buffer pool is shared by the whole process
+	if (m_shard == 0) {
+		std::vector<PacketBufferStats> pool_stats;
+		PacketBufferPool::get()->getStats(pool_stats);
+		m_pool_stats.resize(pool_stats.size());
+		for (size_t i = 0; i < pool_stats.size(); i++) {
+			const PacketBufferStats &cur = pool_stats[i];
+			const PacketBufferStats &last = m_pool_stats[i];
+			if (cur.allocations + cur.reuses == 0)
+				continue;
+
+			std::string name = "PacketBuffer[" + (cur.size > 0 ?
+				std::to_string(cur.size) : std::string("large")) + "]: ";
+			g_profiler->avg(name + "allocations/s",
+				(cur.allocations - last.allocations) / m_stats_timer);
+			g_profiler->avg(name + "reuses/s",
+				(cur.reuses - last.reuses) / m_stats_timer);
+			g_profiler->avg(name + "in use", cur.in_use);
+		}
+		m_pool_stats = std::move(pool_stats);
+	}
+
+	m_stats_timer = 0.0f;
+	m_stats_packets = 0;
+	m_stats_commands = 0;
+	m_stats_latency_us = 0;
+}
+
+bool ConnectionSendThread::packetsQueued()
+{
+	std::vector<session_t> peerIds = getPeerIDs();
 
 	if (!m_outgoing_queue.empty() && !peerIds.empty())
 		return true;
@@ -171,7 +243,7 @@ bool ConnectionSendThread::packetsQueued()
 void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 {
 	std::vector<session_t> timeouted_peers;
-	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	std::vector<session_t> peerIds = getPeerIDs();
 
 	for (const session_t peerId : peerIds) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerId);
@@ -211,6 +283,7 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 		}
 
 		float resend_timeout = udpPeer->getResendTimeout();
+		u64 now = porting::getTimeUs();
 		for (Channel &channel : udpPeer->channels) {
 
 			// Remove timed out incomplete unreliable split packets
@@ -243,10 +316,15 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 			else
 				m_iteration_packets_avaialble = 0;
 
-			for (const auto &k : timed_outs)
-				resendReliable(channel, k.get(), resend_timeout);
+			u32 lost_bytes = 0;
+			for (const auto &k : timed_outs) {
+				lost_bytes += k->size();
+				udpPeer->congestion.onResend(k->size(), now);
+				resendReliable(channel, k, resend_timeout);
+			}
+			udpPeer->congestion.onLoss(lost_bytes);
 
-			channel.UpdateTimers(dtime);
+			channel.UpdateTimers(dtime, !m_congestion_control);
 		}
 
 		/* send ping if necessary */
@@ -255,8 +333,6 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 				<< "Sending ping for peer_id: " << udpPeer->id << std::endl);
 			rawSendAsPacket(udpPeer->id, 0, data, true);
 		}
-
-		udpPeer->RunCommandQueues(m_max_packet_size, m_max_packets_requeued);
 	}
 
 	// Remove timed out peers
@@ -267,9 +343,10 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 	}
 }
 
-void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout)
+void ConnectionSendThread::resendReliable(Channel &channel,
+	const ConstSharedPtr<BufferedPacket> &k, float resend_timeout)
 {
-	assert(k);
+	assert(k.get());
 	u8 channelnum = readChannel(k->data);
 	u16 seqnum = k->getSeqnum();
 
@@ -294,22 +371,58 @@ void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket
 	// lost or really takes more time to transmit
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(const ConstSharedPtr<BufferedPacket> &p)
 {
-	assert(p);
-	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
-		LOG(dout_con << m_connection->getDesc()
-			<< " rawSend: " << p->size()
-			<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
-		LOG(derr_con << m_connection->getDesc()
-			<< "Connection::rawSend(): SendFailedException: "
-			<< p->address.serializeString() << std::endl);
+	assert(p.get());
+	m_send_batch.add(p->address, p->data, p->size());
+	m_send_batch_packets.push_back(p);
+
+	if (m_send_batch.full())
+		flushSendBatch();
+}
+
+void ConnectionSendThread::flushSendBatch()
+{
+	if (m_send_batch.size() == 0)
+		return;
+
+	m_connection->m_udpSocket.SendBatch(m_send_batch);
+	m_stats_packets += m_send_batch.size();
+
+	for (u32 i = 0; i < m_send_batch.size(); i++) {
+		const BufferedPacket *p = m_send_batch_packets[i].get();
+		if (m_send_batch.wasSent(i)) {
+			LOG(dout_con << m_connection->getDesc()
+				<< " rawSend: " << p->size()
+				<< " bytes sent" << std::endl);
+		} else {
+			LOG(derr_con << m_connection->getDesc()
+				<< "Connection::rawSend(): SendFailedException: "
+				<< p->address.serializeString() << std::endl);
+		}
 	}
+
+	m_send_batch.clear();
+	m_send_batch_packets.clear();
+}
+
+bool ConnectionSendThread::canSendReliable(UDPPeer *peer, Channel *channel,
+	u32 size, u64 now)
+{
+	if (channel->outgoing_reliables_sent.size() >= channel->getWindowSize())
+		return false;
+	if (!m_congestion_control || peer->congestion.canSend(size, now))
+		return true;
+
+	// Wake up in time when the pacing holds the peer back
+	u64 delay = peer->congestion.getPacingDelay(now);
+	if (delay > 0 && (m_pacing_delay == 0 || delay < m_pacing_delay))
+		m_pacing_delay = delay;
+	return false;
 }
 
-void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel)
+void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel,
+	UDPPeer *peer)
 {
 	try {
 		p->absolute_send_time = porting::getTimeMs();
@@ -317,6 +430,15 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 		channel->outgoing_reliables_sent.insert(p,
 			(channel->readOutgoingSequenceNumber() - MAX_RELIABLE_WINDOW_SIZE)
 				% (MAX_RELIABLE_WINDOW_SIZE + 1));
+
+		// Nothing queued behind it means the window can't be filled
+		bool app_limited = true;
+		for (const Channel &c : peer->channels) {
+			if (!c.queued_reliables.empty() || !c.queued_commands.empty())
+				app_limited = false;
+		}
+		peer->congestion.onSend(p->delivery, p->size(), porting::getTimeUs(),
+			app_limited);
 	}
 	catch (AlreadyExistsException &e) {
 		LOG(derr_con << m_connection->getDesc()
@@ -325,7 +447,7 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
@@ -338,7 +460,8 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 			<< "packet for non existent peer_id: " << peer_id << std::endl);
 		return false;
 	}
-	Channel *channel = &(dynamic_cast<UDPPeer *>(&peer)->channels[channelnum]);
+	UDPPeer *udpPeer = dynamic_cast<UDPPeer *>(&peer);
+	Channel *channel = &(udpPeer->channels[channelnum]);
 
 	if (reliable) {
 		bool have_seqnum = false;
@@ -357,12 +480,12 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 			channelnum);
 
 		// first check if our send window is already maxed out
-		if (channel->outgoing_reliables_sent.size() < channel->getWindowSize()) {
+		if (canSendReliable(udpPeer, channel, p->size(), porting::getTimeUs())) {
 			LOG(dout_con << m_connection->getDesc()
 				<< " INFO: sending a reliable packet to peer_id " << peer_id
 				<< " channel: " << (u32)channelnum
 				<< " seqnum: " << seqnum << std::endl);
-			sendAsPacketReliable(p, channel);
+			sendAsPacketReliable(p, channel, udpPeer);
 			return true;
 		}
 
@@ -382,7 +505,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 			channelnum);
 
 		// Send the packet
-		rawSend(p.get());
+		rawSend(p);
 		return true;
 	}
 
@@ -417,7 +540,8 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 		case CONCMD_CREATE_PEER:
 			LOG(dout_con << m_connection->getDesc()
 				<< "UDP processing reliable CONCMD_CREATE_PEER" << std::endl);
-			if (!rawSendAsPacket(c->peer_id, c->channelnum, c->data, c->reliable)) {
+			if (!rawSendAsPacket(c->peer_id, c->channelnum,
+					SharedBuffer<u8>(*c->data, c->data.getSize()), c->reliable)) {
 				/* put to queue if we couldn't send it immediately */
 				sendReliable(c);
 			}
@@ -435,7 +559,7 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 			auto list = channel.outgoing_reliables_sent.getResend(0, 1);
 
 			if (!list.empty())
-				resendReliable(channel, list.front().get(), -1);
+				resendReliable(channel, list.front(), -1);
 
 			return;
 		}
@@ -486,17 +610,18 @@ void ConnectionSendThread::processNonReliableCommand(ConnectionCommandPtr &c_ptr
 		case CONNCMD_SEND:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONNCMD_SEND" << std::endl);
-			send(c.peer_id, c.channelnum, c.data);
+			send(c.peer_id, c.channelnum, SharedBuffer<u8>(*c.data, c.data.getSize()));
 			return;
 		case CONNCMD_SEND_TO_ALL:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONNCMD_SEND_TO_ALL" << std::endl);
-			sendToAll(c.channelnum, c.data);
+			sendToAll(c.channelnum, SharedBuffer<u8>(*c.data, c.data.getSize()));
 			return;
 		case CONCMD_ACK:
 			LOG(dout_con << m_connection->getDesc()
 				<< " UDP processing CONCMD_ACK" << std::endl);
-			sendAsPacket(c.peer_id, c.channelnum, c.data, true);
+			sendAsPacket(c.peer_id, c.channelnum,
+				SharedBuffer<u8>(*c.data, c.data.getSize()), true);
 			return;
 		case CONCMD_CREATE_PEER:
 		case CONNCMD_RESEND_ONE:
@@ -557,7 +682,7 @@ void ConnectionSendThread::disconnect()
 
 
 	// Send to all
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		sendAsPacket(peerid, 0, data, false);
@@ -629,7 +754,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommandPtr &c)
 
 void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
 {
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		send(peerid, channelnum, data);
@@ -638,7 +763,7 @@ void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data
 
 void ConnectionSendThread::sendToAllReliable(ConnectionCommandPtr &c)
 {
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerid);
@@ -652,9 +777,10 @@ void ConnectionSendThread::sendToAllReliable(ConnectionCommandPtr &c)
 
 void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 {
-	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	std::vector<session_t> peerIds = getPeerIDs();
 	std::vector<session_t> pendingDisconnect;
 	std::map<session_t, bool> pending_unreliable;
+	const u64 now = porting::getTimeUs();
 
 	for (session_t peerId : peerIds) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerId);
@@ -694,7 +820,7 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 			Channel &channel = udpPeer->channels[i];
 
 			// Reduces logging verbosity
-			if (channel.queued_reliables.empty())
+			if (channel.queued_reliables.empty() && channel.queued_commands.empty())
 				continue;
 
 			u16 next_to_ack = 0;
@@ -723,10 +849,19 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 				<< channel.queued_commands.size()
 				<< std::endl);
 
-			while (!channel.queued_reliables.empty() &&
-					channel.outgoing_reliables_sent.size()
-					< channel.getWindowSize() &&
-					peer->m_increment_packets_remaining > 0) {
+			while (peer->m_increment_packets_remaining > 0) {
+				/*
+					Commands are turned into packets only when the channel
+					can send, so the packets queued here never hold back
+					more than one command and the streams keep their share
+				*/
+				if (channel.queued_reliables.empty() &&
+						!udpPeer->processQueuedCommand(channel, m_max_packet_size))
+					break;
+				if (!canSendReliable(udpPeer, &channel,
+						channel.queued_reliables.front()->size(), now))
+					break;
+
 				BufferedPacketPtr p = channel.queued_reliables.front();
 				channel.queued_reliables.pop();
 
@@ -736,7 +871,7 @@ void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 					<< ", seqnum: " << p->getSeqnum()
 					<< std::endl);
 
-				sendAsPacketReliable(p, &channel);
+				sendAsPacketReliable(p, &channel, udpPeer);
 				peer->m_increment_packets_remaining--;
 			}
 		}
@@ -807,7 +942,8 @@ void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
 }
 
 ConnectionReceiveThread::ConnectionReceiveThread(unsigned int max_packet_size) :
-	Thread("ConnectionReceive")
+	Thread("ConnectionReceive"),
+	m_batch_size(MYMAX(1, g_settings->getU16("udp_batch_size")))
 {
 }
 
@@ -826,7 +962,7 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	UDPReceiveBatch batch(m_batch_size, packet_maxsize);
 
 	bool packet_queued = true;
 
@@ -848,7 +984,7 @@ void *ConnectionReceiveThread::run()
 #endif
 
 		/* receive packets */
-		receive(packetdata, packet_queued);
+		receive(batch, packet_queued);
 
 #ifdef DEBUG_CONNECTION_KBPS
 		debug_print_timer += dtime;
@@ -908,35 +1044,55 @@ void *ConnectionReceiveThread::run()
 }
 
 // Receive packets from the network and buffers and create ConnectionEvents
-void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
+void ConnectionReceiveThread::receive(UDPReceiveBatch &batch,
 		bool &packet_queued)
 {
-	try {
-		// First, see if there any buffered packets we can process now
+	// First, see if there any buffered packets we can process now
+	if (packet_queued) {
+		processBuffers();
+		packet_queued = false;
+	}
+
+	// Wait for incoming data and read all datagrams available
+	u32 count = m_connection->m_udpSocket.ReceiveBatch(batch);
+
+	for (u32 i = 0; i < count; i++) {
+		// Keep the order of a datagram-by-datagram receive
 		if (packet_queued) {
-			session_t peer_id;
-			SharedBuffer<u8> resultdata;
-			while (true) {
-				try {
-					if (!getFromBuffers(peer_id, resultdata))
-						break;
-
-					m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-				}
-				catch (ProcessedSilentlyException &e) {
-					/* try reading again */
-				}
-			}
+			processBuffers();
 			packet_queued = false;
 		}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
+		processDatagram(batch.getSender(i), batch.getData(i),
+				batch.getSize(i), packet_queued);
+	}
+}
 
+void ConnectionReceiveThread::processBuffers()
+{
+	try {
+		session_t peer_id;
+		SharedBuffer<u8> resultdata;
+		while (true) {
+			try {
+				if (!getFromBuffers(peer_id, resultdata))
+					break;
+
+				m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
+			}
+			catch (ProcessedSilentlyException &e) {
+				/* try reading again */
+			}
+		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+}
+
+void ConnectionReceiveThread::processDatagram(const Address &sender,
+		const u8 *packetdata, s32 received_size, bool &packet_queued)
+{
+	try {
 		if ((received_size < BASE_HEADER_SIZE) ||
 				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
 			LOG(derr_con << m_connection->getDesc()
@@ -948,8 +1104,8 @@ void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
 			return;
 		}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+		session_t peer_id = readPeerId(packetdata);
+		u8 channelnum = readChannel(packetdata);
 
 		if (channelnum >= CHANNEL_COUNT) {
 			LOG(derr_con << m_connection->getDesc()
@@ -1214,8 +1370,10 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 
 			// put bytes for max bandwidth calculation
 			channel->UpdateBytesSent(p->size(), 1);
-			if (channel->outgoing_reliables_sent.size() == 0)
-				m_connection->TriggerSend();
+			bool was_limited = dynamic_cast<UDPPeer *>(peer)->congestion.onAck(
+				p->delivery, p->size(), p->resend_count > 0, porting::getTimeUs());
+			if (was_limited || channel->outgoing_reliables_sent.size() == 0)
+				m_connection->TriggerSend(peer->id);
 		} catch (NotFoundException &e) {
 			LOG(derr_con << m_connection->getDesc()
 				<< "WARNING: ACKed packet not in outgoing queue"
@@ -54,12 +54,16 @@ class ConnectionSendThread : public Thread
 public:
 	friend class UDPPeer;
 
-	ConnectionSendThread(unsigned int max_packet_size, float timeout);
+	ConnectionSendThread(unsigned int max_packet_size, float timeout,
+			u32 shard = 0);
 
 	void *run();
 
 	void Trigger();
 
+	// May be called from any thread
+	void putCommand(ConnectionCommandPtr c);
+
 	void setParent(Connection *parent)
 	{
 		assert(parent != NULL); // Pre-condition
@@ -70,8 +74,11 @@ class ConnectionSendThread : public Thread
 
 private:
 	void runTimeouts(float dtime, u32 peer_packet_quota);
-	void resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout);
-	void rawSend(const BufferedPacket *p);
+	void resendReliable(Channel &channel, const ConstSharedPtr<BufferedPacket> &k,
+			float resend_timeout);
+	// Adds the packet to the send batch, which is flushed once per iteration
+	void rawSend(const ConstSharedPtr<BufferedPacket> &p);
+	void flushSendBatch();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
 			const SharedBuffer<u8> &data, bool reliable);
 
@@ -91,19 +98,45 @@ class ConnectionSendThread : public Thread
 	void sendAsPacket(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data,
 			bool ack = false);
 
-	void sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel);
+	// Whether the window and the congestion control of the peer allow
+	// sending a new reliable packet
+	bool canSendReliable(UDPPeer *peer, Channel *channel, u32 size, u64 now);
+	void sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel,
+			UDPPeer *peer);
 
 	bool packetsQueued();
 
+	// Peers handled by this thread
+	std::vector<session_t> getPeerIDs();
+
+	void updateStats(float dtime);
+
 	Connection *m_connection = nullptr;
+	// Index of this thread in Connection::m_sendThreads
+	u32 m_shard;
 	unsigned int m_max_packet_size;
 	float m_timeout;
+	MPSCQueue<ConnectionCommandPtr> m_command_queue;
 	std::queue<OutgoingPacket> m_outgoing_queue;
 	Semaphore m_send_sleep_semaphore;
 
 	unsigned int m_iteration_packets_avaialble;
 	unsigned int m_max_data_packets_per_iteration;
-	unsigned int m_max_packets_requeued = 256;
+	bool m_congestion_control;
+	// Time until the first paced peer may send again, 0 if none waits
+	u64 m_pacing_delay = 0;
+
+	UDPSendBatch m_send_batch;
+	// Keeps the packets of m_send_batch alive until they are sent
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch_packets;
+
+	// Statistics, reported to the profiler once per second
+	float m_stats_timer = 0.0f;
+	u32 m_stats_packets = 0;
+	u32 m_stats_commands = 0;
+	u64 m_stats_latency_us = 0;
+	// Pool statistics of the last report
+	std::vector<PacketBufferStats> m_pool_stats;
 };
 
 class ConnectionReceiveThread : public Thread
@@ -120,7 +153,12 @@ class ConnectionReceiveThread : public Thread
 	}
 
 private:
-	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	void receive(UDPReceiveBatch &batch, bool &packet_queued);
+
+	// Creates events for the buffered packets that can be processed now
+	void processBuffers();
+	void processDatagram(const Address &sender, const u8 *packetdata,
+			s32 received_size, bool &packet_queued);
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
@@ -181,6 +219,9 @@ class ConnectionReceiveThread : public Thread
 
 	Connection *m_connection = nullptr;
 
+	// Maximum number of datagrams read with one system call
+	u32 m_batch_size;
+
 	RateLimitHelper m_new_peer_ratelimit;
 };
 }
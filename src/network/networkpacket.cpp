@@ -33,6 +33,24 @@ void NetworkPacket::checkReadOffset(u32 from_offset, u32 field_size) const
 	}
 }
 
+NetworkPacket::NetworkPacket(const NetworkPacket &other)
+{
+	*this = other;
+}
+
+NetworkPacket &NetworkPacket::operator=(const NetworkPacket &other)
+{
+	if (this == &other)
+		return *this;
+
+	m_data = PacketBuffer(*other.m_data, other.m_datasize);
+	m_datasize = other.m_datasize;
+	m_read_offset = other.m_read_offset;
+	m_command = other.m_command;
+	m_peer_id = other.m_peer_id;
+	return *this;
+}
+
 void NetworkPacket::putRawPacket(const u8 *data, u32 datasize, session_t peer_id)
 {
 	// If a m_command is already set, we are rewriting on same packet
@@ -48,7 +66,7 @@ void NetworkPacket::putRawPacket(const u8 *data, u32 datasize, session_t peer_id
 	// split command and datas
 	m_command = readU16(&data[0]);
 	if (m_datasize > 0)
-		memcpy(m_data.data(), &data[2], m_datasize);
+		memcpy(*m_data, &data[2], m_datasize);
 }
 
 void NetworkPacket::clear()
@@ -63,9 +81,9 @@ void NetworkPacket::clear()
 std::string NetworkPacket::substring(int length) {
 	checkReadOffset(0, length);
 	std::string str(getString(0), length);
-	m_data.erase(m_data.begin(), m_data.begin() + length);
+	m_data.consume(length);
 	m_read_offset -= length;
-	m_datasize = m_data.size();
+	m_datasize = m_data.getSize();
 	return str;
 }
 
@@ -551,7 +569,23 @@ Buffer<u8> NetworkPacket::oldForgePacket()
 	Buffer<u8> sb(m_datasize + 2);
 	writeU16(&sb[0], m_command);
 	if (m_datasize > 0)
-		memcpy(&sb[2], m_data.data(), m_datasize);
+		memcpy(&sb[2], *m_data, m_datasize);
 
 	return sb;
 }
+
+PacketBuffer NetworkPacket::forgePacket(u32 headroom) const
+{
+	// this is the dummy packet used to first contact the server
+	if (m_command == 0) {
+		assert(m_datasize == 0);
+		return PacketBuffer(m_datasize, headroom);
+	}
+
+	PacketBuffer buf(m_datasize + 2, headroom);
+	writeU16(*buf, m_command);
+	if (m_datasize > 0)
+		memcpy(*buf + 2, *m_data, m_datasize);
+
+	return buf;
+}
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "util/pointer.h"
 #include "networkprotocol.h"
+#include "packetbuffer.h"
 #include <SColor.h>
 
 class NetworkPacket
@@ -37,9 +38,14 @@ class NetworkPacket
 		m_data.reserve(preallocate);
 	}
 	NetworkPacket() = default;
+	NetworkPacket(const NetworkPacket &other);
+	NetworkPacket(NetworkPacket &&other) = default;
 
 	~NetworkPacket() = default;
 
+	NetworkPacket &operator=(const NetworkPacket &other);
+	NetworkPacket &operator=(NetworkPacket &&other) = default;
+
 	void putRawPacket(const u8 *data, u32 datasize, session_t peer_id);
 	void clear();
 
@@ -126,6 +132,10 @@ class NetworkPacket
 	// ^ this comment has been here for 7 years
 	Buffer<u8> oldForgePacket();
 
+	// Returns the command and the data in a pooled buffer, with `headroom`
+	// bytes in front of it for the headers of the connection
+	PacketBuffer forgePacket(u32 headroom) const;
+
 	inline u32 get_read_offset() {
 		return m_read_offset;
 	}
@@ -145,7 +155,7 @@ class NetworkPacket
 		}
 	}
 
-	std::vector<u8> m_data;
+	PacketBuffer m_data;
 	u32 m_datasize = 0;
 	u32 m_read_offset = 0;
 	u16 m_command = 0;
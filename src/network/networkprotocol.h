@@ -224,9 +224,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 		Add TOCLIENT_MOVE_PLAYER_REL
 		Move default minimap from client-side C++ to server-side builtin Lua
 		[scheduled bump for 5.9.0]
+	PROTOCOL VERSION 51:
+		Add TOCLIENT_OBJECT_SNAPSHOT and TOSERVER_OBJECT_SNAPSHOT_ACK,
+			replacing AO_CMD_UPDATE_POSITION
+	PROTOCOL VERSION 52:
+		Add TOCLIENT_INVENTORY_DELTA and TOSERVER_INVENTORY_RESYNC
+	PROTOCOL VERSION 53:
+		Add TOSERVER_MEDIA_CHUNK_REQUEST and TOCLIENT_MEDIA_CHUNK
 */
 
-#define LATEST_PROTOCOL_VERSION 50
+#define LATEST_PROTOCOL_VERSION 53
 #define LATEST_PROTOCOL_VERSION_STRING TOSTRING(LATEST_PROTOCOL_VERSION)
 
 // Server's supported network protocol range
@@ -246,6 +253,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // See also formspec [Version History] in doc/lua_api.md
 #define FORMSPEC_API_VERSION 7
 
+// Maximum amount of file data in one TOCLIENT_MEDIA_CHUNK
+#define MEDIA_CHUNK_SIZE (32 * 1024)
+
 #define TEXTURENAME_ALLOWED_CHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.-/\\"
 
 typedef u16 session_t;
@@ -850,6 +860,38 @@ enum ToClientCommand : u16
 			f32 center_weight_power
 	*/
 
+	TOCLIENT_OBJECT_SNAPSHOT = 0x64,
+	/*
+		Positions of active objects, replaces AO_CMD_UPDATE_POSITION.
+		Acknowledged with TOSERVER_OBJECT_SNAPSHOT_ACK.
+		See network/objectsnapshot.h for the format.
+	*/
+
+	TOCLIENT_INVENTORY_DELTA = 0x65,
+	/*
+		Slots of an inventory that changed since the last update.
+		std::string serialized inventory location
+		binary delta, see Inventory::serializeDelta
+
+		The client answers with TOSERVER_INVENTORY_RESYNC if the delta
+		does not fit its copy of the inventory.
+	*/
+
+	TOCLIENT_MEDIA_CHUNK = 0x66,
+	/*
+		Answer to one file of TOSERVER_MEDIA_CHUNK_REQUEST.
+		std::string raw SHA1 of the file (20 bytes)
+		u32 total file size
+		u32 offset of this chunk
+		u32 len
+		u8[len] data, at most MEDIA_CHUNK_SIZE bytes
+
+		len is 0 if offset is not below the file size. The total file size
+		is 0 if the server can't send the file, e.g. because it is unknown,
+		unreadable or was requested too often. Clients tell this apart from
+		an empty file by its SHA1.
+	*/
+
 	TOCLIENT_LUA_PACKET = 0x68,
 	TOCLIENT_LUA_PACKET_STREAM = 0x69,
 
@@ -1065,6 +1107,28 @@ enum ToServerCommand : u16
 		v2f32 max_fs_info
 	*/
 
+	TOSERVER_OBJECT_SNAPSHOT_ACK = 0x55,
+	/*
+		u16 sequence number of a TOCLIENT_OBJECT_SNAPSHOT
+	*/
+
+	TOSERVER_INVENTORY_RESYNC = 0x56,
+	/*
+		Requests the whole inventory after a TOCLIENT_INVENTORY_DELTA
+		that could not be applied.
+		std::string serialized inventory location
+	*/
+
+	TOSERVER_MEDIA_CHUNK_REQUEST = 0x57,
+	/*
+		Requests parts of announced media files by content.
+		u16 count
+		for each chunk {
+			std::string raw SHA1 of the file (20 bytes)
+			u32 offset
+		}
+	*/
+
 	TOSERVER_LUA_PACKET = 0x58,
 	TOSERVER_LUA_PACKET_STREAM = 0x59,
 
@@ -1156,3 +1220,26 @@ enum InteractAction : u8
 	INTERACT_USE,               // 4: use item
 	INTERACT_ACTIVATE           // 5: rightclick air ("activate")
 };
+
+/*
+	Logical streams on top of the channels. Reliable packets of a channel
+	are queued per stream and the streams take turns by weight, so a burst
+	on one of them doesn't hold back the others. Streams are not sent over
+	the wire, the opcode tables assign them.
+
+	Packet order is only guaranteed inside a stream. Objects, inventories,
+	formspecs, nodes, media pushes and so on refer to each other, e.g. a
+	formspec may show a node's inventory right after it was set, so all
+	packets changing the game state are in the default stream and keep
+	their order. Chat messages, Lua packets, map blocks and media files
+	may overtake them or fall behind.
+*/
+enum NetworkStream : u8
+{
+	NETSTREAM_DEFAULT, // game state, everything else
+	NETSTREAM_CHAT,    // chat messages
+	NETSTREAM_LUA,     // Lua packets and packet streams (voice, data)
+	NETSTREAM_BLOCKS,  // map blocks
+	NETSTREAM_MEDIA,   // media files
+	NETSTREAM_COUNT
+};
@@ -0,0 +1,415 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "objectsnapshot.h"
+#include "activeobject.h"
+#include "exceptions.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include <cmath>
+#include <sstream>
+
+// Baselines and histories older than this are dropped, so that they are
+// never mistaken for new ones once the sequence numbers wrap around
+static constexpr u16 SNAPSHOT_SWEEP_INTERVAL = 4096;
+
+// Bits of the field mask
+enum : u8 {
+	FIELD_POSITION = 0x01,
+	FIELD_VELOCITY = 0x02,
+	FIELD_ACCELERATION = 0x04,
+	FIELD_ROTATION = 0x08,
+	FIELD_UPDATE_INTERVAL = 0x10,
+	// ObjectState::Flags
+	FIELD_FLAGS_SHIFT = 5,
+};
+
+static const ObjectState s_zero_state;
+
+static inline bool seq_newer(u16 seq, u16 than)
+{
+	return (s16)(seq - than) > 0;
+}
+
+static s32 quantize(f32 v, f32 step)
+{
+	if (!std::isfinite(v))
+		return 0;
+	return myround(rangelim(v / step, -1.0e9f, 1.0e9f));
+}
+
+static s32 quantizeAngle(f32 degrees)
+{
+	if (!std::isfinite(degrees))
+		return 0;
+	return myround(wrapDegrees_0_360(degrees) * (65536.0f / 360.0f)) & 0xFFFF;
+}
+
+static inline u32 zigzag(s32 v)
+{
+	return ((u32)v << 1) ^ (u32)(v >> 31);
+}
+
+static inline s32 unzigzag(u32 v)
+{
+	return (s32)(v >> 1) ^ -(s32)(v & 1);
+}
+
+static void writeVarint(std::string &os, u32 v)
+{
+	while (v >= 0x80) {
+		os.push_back((char)((v & 0x7F) | 0x80));
+		v >>= 7;
+	}
+	os.push_back((char)v);
+}
+
+namespace {
+
+struct SnapshotReader
+{
+	const u8 *data;
+	const u8 *end;
+
+	u8 readU8()
+	{
+		if (data >= end)
+			throw SerializationError("Object snapshot: truncated");
+		return *data++;
+	}
+
+	u16 readU16()
+	{
+		u16 v = (u16)readU8() << 8;
+		return v | readU8();
+	}
+
+	u32 readVarint()
+	{
+		u32 v = 0;
+		for (u32 shift = 0; shift < 35; shift += 7) {
+			u8 b = readU8();
+			v |= (u32)(b & 0x7F) << shift;
+			if (!(b & 0x80))
+				return v;
+		}
+		throw SerializationError("Object snapshot: bad varint");
+	}
+};
+
+}
+
+/*
+	ObjectState
+*/
+
+bool ObjectState::operator==(const ObjectState &other) const
+{
+	return position == other.position && velocity == other.velocity &&
+		acceleration == other.acceleration && rotation == other.rotation &&
+		update_interval == other.update_interval && flags == other.flags;
+}
+
+bool ObjectState::fromPositionCommand(const std::string &data)
+{
+	// See UnitSAO::generateUpdatePositionCommand
+	if (data.size() < 1 + 4 * 12 + 2 + 4 || (u8)data[0] != AO_CMD_UPDATE_POSITION)
+		return false;
+
+	const u8 *p = (const u8 *)data.data() + 1;
+	const v3f values[4] = {
+		readV3F32(p), readV3F32(p + 12), readV3F32(p + 24), readV3F32(p + 36)
+	};
+	p += 48;
+	v3s32 *fields[3] = { &position, &velocity, &acceleration };
+	for (int i = 0; i < 3; i++) {
+		fields[i]->X = quantize(values[i].X, OBJECT_STATE_POS_STEP);
+		fields[i]->Y = quantize(values[i].Y, OBJECT_STATE_POS_STEP);
+		fields[i]->Z = quantize(values[i].Z, OBJECT_STATE_POS_STEP);
+	}
+	rotation.X = quantizeAngle(values[3].X);
+	rotation.Y = quantizeAngle(values[3].Y);
+	rotation.Z = quantizeAngle(values[3].Z);
+
+	flags = 0;
+	if (p[0])
+		flags |= DO_INTERPOLATE;
+	if (p[1])
+		flags |= IS_MOVEMENT_END;
+	update_interval = rangelim(quantize(readF32(p + 2), 0.001f), 0, 0xFFFF);
+	return true;
+}
+
+std::string ObjectState::toPositionCommand() const
+{
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, AO_CMD_UPDATE_POSITION);
+	writeV3F32(os, v3f(position.X, position.Y, position.Z) * OBJECT_STATE_POS_STEP);
+	writeV3F32(os, v3f(velocity.X, velocity.Y, velocity.Z) * OBJECT_STATE_POS_STEP);
+	writeV3F32(os, v3f(acceleration.X, acceleration.Y, acceleration.Z) *
+		OBJECT_STATE_POS_STEP);
+	writeV3F32(os, v3f(rotation.X, rotation.Y, rotation.Z) * (360.0f / 65536.0f));
+	writeU8(os, (flags & DO_INTERPOLATE) != 0);
+	writeU8(os, (flags & IS_MOVEMENT_END) != 0);
+	writeF32(os, update_interval * 0.001f);
+	return os.str();
+}
+
+/*
+	Field deltas
+*/
+
+static void writeDelta(std::string &os, const ObjectState &state,
+		const ObjectState &base)
+{
+	// Angles wrap around
+	v3s32 rotation = state.rotation - base.rotation;
+	rotation.X = (s16)rotation.X;
+	rotation.Y = (s16)rotation.Y;
+	rotation.Z = (s16)rotation.Z;
+
+	const v3s32 deltas[4] = {
+		state.position - base.position,
+		state.velocity - base.velocity,
+		state.acceleration - base.acceleration,
+		rotation,
+	};
+	const s32 interval = state.update_interval - base.update_interval;
+
+	u8 mask = state.flags << FIELD_FLAGS_SHIFT;
+	for (int i = 0; i < 4; i++) {
+		if (deltas[i] != v3s32())
+			mask |= 1 << i;
+	}
+	if (interval != 0)
+		mask |= FIELD_UPDATE_INTERVAL;
+
+	os.push_back((char)mask);
+	for (int i = 0; i < 4; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		writeVarint(os, zigzag(deltas[i].X));
+		writeVarint(os, zigzag(deltas[i].Y));
+		writeVarint(os, zigzag(deltas[i].Z));
+	}
+	if (mask & FIELD_UPDATE_INTERVAL)
+		writeVarint(os, zigzag(interval));
+}
+
+static void readDelta(SnapshotReader &is, const ObjectState &base,
+		ObjectState &state)
+{
+	u8 mask = is.readU8();
+	v3s32 *fields[4] = {
+		&state.position, &state.velocity, &state.acceleration, &state.rotation
+	};
+
+	state = base;
+	for (int i = 0; i < 4; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		fields[i]->X += unzigzag(is.readVarint());
+		fields[i]->Y += unzigzag(is.readVarint());
+		fields[i]->Z += unzigzag(is.readVarint());
+	}
+	state.rotation.X &= 0xFFFF;
+	state.rotation.Y &= 0xFFFF;
+	state.rotation.Z &= 0xFFFF;
+	if (mask & FIELD_UPDATE_INTERVAL)
+		state.update_interval += unzigzag(is.readVarint());
+	state.flags = mask >> FIELD_FLAGS_SHIFT;
+}
+
+/*
+	ObjectSnapshotEncoder
+*/
+
+void ObjectSnapshotEncoder::write(std::string &os)
+{
+	const u16 seq = m_next_seq++;
+	const size_t start = os.size();
+
+	if ((u16)(seq - m_sweep_seq) >= SNAPSHOT_SWEEP_INTERVAL) {
+		m_sweep_seq = seq;
+		for (auto it = m_baselines.begin(); it != m_baselines.end();) {
+			if ((u16)(seq - it->second.seq) >= OBJECT_SNAPSHOT_HISTORY)
+				it = m_baselines.erase(it);
+			else
+				++it;
+		}
+	}
+
+	char buf[2];
+	writeU16((u8 *)buf, seq);
+	os.append(buf, 2);
+	writeU16((u8 *)buf, m_pending.size());
+	os.append(buf, 2);
+
+	SentSnapshot sent;
+	sent.seq = seq;
+	sent.objects.reserve(m_pending.size());
+
+	u16 prev_id = 0;
+	for (const auto &it : m_pending) {
+		const u16 id = it.first;
+		writeVarint(os, id - prev_id);
+		prev_id = id;
+
+		const ObjectState *base = &s_zero_state;
+		u16 age = 0;
+		auto baseline = m_baselines.find(id);
+		if (baseline != m_baselines.end()) {
+			u16 baseline_age = seq - baseline->second.seq;
+			if (baseline_age < OBJECT_SNAPSHOT_HISTORY) {
+				base = &baseline->second.state;
+				age = baseline_age;
+			}
+		}
+		os.push_back((char)age);
+		writeDelta(os, it.second, *base);
+
+		sent.objects.emplace_back(id, it.second);
+	}
+
+	m_states_written += m_pending.size();
+	m_bytes_written += os.size() - start;
+	m_pending.clear();
+
+	m_sent.push_back(std::move(sent));
+	if (m_sent.size() > OBJECT_SNAPSHOT_HISTORY)
+		m_sent.pop_front();
+}
+
+void ObjectSnapshotEncoder::acknowledge(u16 seq)
+{
+	for (const SentSnapshot &sent : m_sent) {
+		if (sent.seq != seq)
+			continue;
+
+		for (const auto &it : sent.objects) {
+			auto baseline = m_baselines.find(it.first);
+			if (baseline == m_baselines.end())
+				m_baselines.emplace(it.first, Baseline{it.second, seq});
+			else if (seq_newer(seq, baseline->second.seq))
+				baseline->second = Baseline{it.second, seq};
+		}
+		return;
+	}
+}
+
+void ObjectSnapshotEncoder::removeObject(u16 id)
+{
+	m_pending.erase(id);
+	m_baselines.erase(id);
+	// A late acknowledgement must not bring back the baseline,
+	// the id may be reused for another object
+	for (SentSnapshot &sent : m_sent) {
+		for (auto it = sent.objects.begin(); it != sent.objects.end(); ++it) {
+			if (it->first == id) {
+				sent.objects.erase(it);
+				break;
+			}
+		}
+	}
+}
+
+/*
+	ObjectSnapshotDecoder
+*/
+
+const ObjectState *ObjectSnapshotDecoder::History::find(u16 seq) const
+{
+	for (u8 i = 0; i < count; i++) {
+		if (seqs[i] == seq)
+			return &states[i];
+	}
+	return nullptr;
+}
+
+void ObjectSnapshotDecoder::History::insert(u16 seq, const ObjectState &state)
+{
+	if (find(seq))
+		return;
+
+	if (count == 0 || seq_newer(seq, newest_seq))
+		newest_seq = seq;
+
+	u8 i = count;
+	if (count < OBJECT_SNAPSHOT_HISTORY) {
+		count++;
+	} else {
+		// Replace the oldest state, unless the new one is older still
+		u8 oldest = 0;
+		for (u8 j = 1; j < count; j++) {
+			if (seq_newer(seqs[oldest], seqs[j]))
+				oldest = j;
+		}
+		if (seq_newer(seqs[oldest], seq))
+			return;
+		i = oldest;
+	}
+	seqs[i] = seq;
+	states[i] = state;
+}
+
+u16 ObjectSnapshotDecoder::read(const u8 *data, size_t size,
+		std::vector<std::pair<u16, ObjectState>> &updates)
+{
+	SnapshotReader is{data, data + size};
+	const u16 seq = is.readU16();
+	const u16 count = is.readU16();
+
+	if ((u16)(seq - m_sweep_seq) >= SNAPSHOT_SWEEP_INTERVAL &&
+			seq_newer(seq, m_sweep_seq)) {
+		m_sweep_seq = seq;
+		for (auto it = m_objects.begin(); it != m_objects.end();) {
+			if ((u16)(seq - it->second.newest_seq) >= SNAPSHOT_SWEEP_INTERVAL)
+				it = m_objects.erase(it);
+			else
+				++it;
+		}
+	}
+
+	u32 id = 0;
+	for (u16 i = 0; i < count; i++) {
+		id += is.readVarint();
+		if (id > U16_MAX)
+			throw SerializationError("Object snapshot: bad object id");
+		const u8 age = is.readU8();
+
+		auto history = m_objects.find(id);
+		const ObjectState *base = &s_zero_state;
+		if (age != 0) {
+			base = history != m_objects.end() ?
+				history->second.find(seq - age) : nullptr;
+		}
+
+		ObjectState state;
+		readDelta(is, base ? *base : s_zero_state, state);
+		if (!base)
+			continue;
+
+		History &h = history != m_objects.end() ? history->second : m_objects[id];
+		const bool is_newest = h.count == 0 || seq_newer(seq, h.newest_seq);
+		h.insert(seq, state);
+		if (is_newest)
+			updates.emplace_back(id, state);
+	}
+	return seq;
+}
@@ -0,0 +1,159 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes_bloated.h"
+#include "constants.h"
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Movement state of an active object, as sent in AO_CMD_UPDATE_POSITION,
+	quantized for TOCLIENT_OBJECT_SNAPSHOT.
+	Position, velocity and acceleration are in steps of OBJECT_STATE_POS_STEP,
+	the rotation in 1/65536 of a turn and the update interval in milliseconds.
+*/
+constexpr float OBJECT_STATE_POS_STEP = BS / 64.0f;
+
+struct ObjectState
+{
+	enum Flags : u8 {
+		DO_INTERPOLATE = 0x01,
+		IS_MOVEMENT_END = 0x02,
+	};
+
+	v3s32 position;
+	v3s32 velocity;
+	v3s32 acceleration;
+	v3s32 rotation;
+	s32 update_interval = 0;
+	u8 flags = 0;
+
+	bool operator==(const ObjectState &other) const;
+	bool operator!=(const ObjectState &other) const { return !(*this == other); }
+
+	// Reads an AO_CMD_UPDATE_POSITION message, false if it is not one
+	bool fromPositionCommand(const std::string &data);
+	// Writes the state back as AO_CMD_UPDATE_POSITION message
+	std::string toPositionCommand() const;
+};
+
+/*
+	Snapshots are sent unreliably. Every object in a snapshot is encoded
+	against the newest state of it that the client acknowledged, or in full
+	if there is none within the last OBJECT_SNAPSHOT_HISTORY snapshots.
+
+	u16 sequence number
+	u16 object count
+	for all objects, ordered by id {
+		varint id - id of the previous object
+		u8 age of the base state in snapshots, 0 = no base state
+		u8 bitmask of the fields that differ from the base state,
+			and the flags
+		zigzag varint differences of the changed fields
+	}
+*/
+constexpr u16 OBJECT_SNAPSHOT_HISTORY = 16;
+
+/*
+	Server side of the snapshots sent to one client.
+	The owner makes sure the methods are not called concurrently.
+*/
+class ObjectSnapshotEncoder
+{
+public:
+	// Queues the state of an object for the next snapshot,
+	// replacing one queued before
+	void add(u16 id, const ObjectState &state) { m_pending[id] = state; }
+	bool empty() const { return m_pending.empty(); }
+
+	// Writes the queued states as the next snapshot and clears them
+	void write(std::string &os);
+
+	// The client received snapshot `seq`
+	void acknowledge(u16 seq);
+
+	// The object is no longer known by the client
+	void removeObject(u16 id);
+
+	// Total bytes written and number of object states in them
+	u64 getBytesWritten() const { return m_bytes_written; }
+	u64 getStatesWritten() const { return m_states_written; }
+
+private:
+	struct Baseline {
+		ObjectState state;
+		u16 seq;
+	};
+
+	struct SentSnapshot {
+		u16 seq;
+		std::vector<std::pair<u16, ObjectState>> objects;
+	};
+
+	std::map<u16, ObjectState> m_pending;
+	std::unordered_map<u16, Baseline> m_baselines;
+	// Newest last
+	std::deque<SentSnapshot> m_sent;
+	u16 m_next_seq = 0;
+	u16 m_sweep_seq = 0;
+	u64 m_bytes_written = 0;
+	u64 m_states_written = 0;
+};
+
+/*
+	Client side of the snapshots, keeps the last states received for every
+	object to decode later snapshots against them.
+*/
+class ObjectSnapshotDecoder
+{
+public:
+	/*
+		Decodes a snapshot. Objects whose base state is unknown are
+		skipped, and so are states older than one already returned for the
+		object, the rest goes to `updates`.
+		Throws SerializationError on malformed data.
+	*/
+	u16 read(const u8 *data, size_t size,
+		std::vector<std::pair<u16, ObjectState>> &updates);
+
+	// The object was removed on the client
+	void removeObject(u16 id) { m_objects.erase(id); }
+
+private:
+	struct History {
+		// Received states, unordered
+		u16 seqs[OBJECT_SNAPSHOT_HISTORY];
+		ObjectState states[OBJECT_SNAPSHOT_HISTORY];
+		u8 count = 0;
+		// Newest state received, also the newest one returned
+		u16 newest_seq = 0;
+
+		const ObjectState *find(u16 seq) const;
+		// Keeps the OBJECT_SNAPSHOT_HISTORY newest states
+		void insert(u16 seq, const ObjectState &state);
+	};
+
+	std::unordered_map<u16, History> m_objects;
+	u16 m_sweep_seq = 0;
+};
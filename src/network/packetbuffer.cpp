@@ -0,0 +1,189 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "packetbuffer.h"
+#include "threading/mutex_auto_lock.h"
+#include <cassert>
+#include <cstring>
+
+// Upper bound for the memory kept in the free list of one size class
+#define POOL_CLASS_MAX_CACHED_BYTES (4 * 1024 * 1024)
+#define POOL_CLASS_MAX_CACHED_SLABS 4096
+
+/*
+	PacketBufferPool
+*/
+
+PacketBufferPool *PacketBufferPool::get()
+{
+	// Never destroyed, buffers may still be released during shutdown
+	static PacketBufferPool *pool = new PacketBufferPool();
+	return pool;
+}
+
+u8 *PacketBufferPool::allocate(u32 size, u32 &capacity, u8 &size_class)
+{
+	size_class = 0;
+	while (size_class < SIZE_CLASS_COUNT && getClassSize(size_class) < size)
+		size_class++;
+
+	SizeClass &sc = m_classes[size_class];
+	capacity = size_class == OVERSIZED ? size : getClassSize(size_class);
+	{
+		MutexAutoLock lock(sc.mutex);
+		sc.stats.in_use++;
+		if (!sc.free.empty()) {
+			u8 *slab = sc.free.back();
+			sc.free.pop_back();
+			sc.stats.reuses++;
+			return slab;
+		}
+		sc.stats.allocations++;
+	}
+	return new u8[capacity];
+}
+
+void PacketBufferPool::release(u8 *slab, u8 size_class)
+{
+	assert(size_class <= OVERSIZED); // Pre-condition
+
+	SizeClass &sc = m_classes[size_class];
+	{
+		MutexAutoLock lock(sc.mutex);
+		sc.stats.in_use--;
+		if (size_class != OVERSIZED) {
+			const size_t max_cached = MYMIN(POOL_CLASS_MAX_CACHED_SLABS,
+				POOL_CLASS_MAX_CACHED_BYTES / getClassSize(size_class));
+			if (sc.free.size() < max_cached) {
+				sc.free.push_back(slab);
+				return;
+			}
+		}
+		sc.stats.frees++;
+	}
+	delete[] slab;
+}
+
+void PacketBufferPool::getStats(std::vector<PacketBufferStats> &stats)
+{
+	for (SizeClass &sc : m_classes) {
+		MutexAutoLock lock(sc.mutex);
+		stats.push_back(sc.stats);
+		stats.back().size = getClassSize(&sc - m_classes);
+		stats.back().cached = sc.free.size();
+	}
+}
+
+/*
+	PacketBuffer
+*/
+
+PacketBuffer::PacketBuffer(u32 size, u32 headroom)
+{
+	if (size + headroom == 0)
+		return;
+
+	m_slab = PacketBufferPool::get()->allocate(headroom + size, m_capacity,
+		m_size_class);
+	m_begin = headroom;
+	m_end = headroom + size;
+}
+
+PacketBuffer::PacketBuffer(const u8 *data, u32 size, u32 headroom) :
+	PacketBuffer(size, headroom)
+{
+	if (size > 0)
+		memcpy(m_slab + m_begin, data, size);
+}
+
+PacketBuffer::PacketBuffer(PacketBuffer &&other) noexcept
+{
+	*this = std::move(other);
+}
+
+PacketBuffer &PacketBuffer::operator=(PacketBuffer &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	release();
+	m_slab = other.m_slab;
+	m_capacity = other.m_capacity;
+	m_begin = other.m_begin;
+	m_end = other.m_end;
+	m_size_class = other.m_size_class;
+
+	other.m_slab = nullptr;
+	other.m_capacity = other.m_begin = other.m_end = 0;
+	return *this;
+}
+
+void PacketBuffer::resize(u32 size)
+{
+	// Grow geometrically, packets are usually built field by field
+	if (m_begin + size > m_capacity)
+		reserve(MYMAX(size, 2 * getSize()));
+
+	m_end = m_begin + size;
+}
+
+void PacketBuffer::reserve(u32 size)
+{
+	if (m_begin + size <= m_capacity)
+		return;
+
+	u32 capacity;
+	u8 size_class;
+	u8 *slab = PacketBufferPool::get()->allocate(m_begin + size, capacity,
+		size_class);
+	if (getSize() > 0)
+		memcpy(slab + m_begin, m_slab + m_begin, getSize());
+
+	const u32 begin = m_begin, end = m_end;
+	release();
+	m_slab = slab;
+	m_capacity = capacity;
+	m_begin = begin;
+	m_end = end;
+	m_size_class = size_class;
+}
+
+u8 *PacketBuffer::prepend(u32 size)
+{
+	assert(size <= m_begin); // Pre-condition
+
+	m_begin -= size;
+	return m_slab + m_begin;
+}
+
+void PacketBuffer::consume(u32 size)
+{
+	assert(size <= getSize()); // Pre-condition
+
+	m_begin += size;
+}
+
+void PacketBuffer::release()
+{
+	if (m_slab)
+		PacketBufferPool::get()->release(m_slab, m_size_class);
+
+	m_slab = nullptr;
+	m_capacity = m_begin = m_end = 0;
+}
@@ -0,0 +1,133 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "util/basic_macros.h"
+#include <mutex>
+#include <vector>
+
+/*
+	Pool of reusable memory slabs for packet data.
+
+	Slabs are sorted into size classes (powers of four from 64 bytes to
+	64 KiB), every class keeps a bounded free list. Larger requests are
+	served from the heap directly and are counted in an extra class of
+	size 0. The pool is shared by all threads.
+*/
+
+struct PacketBufferStats
+{
+	// Size of the slabs of this class, 0 for oversized buffers
+	u32 size = 0;
+	// Slabs taken from the heap
+	u64 allocations = 0;
+	// Slabs taken from the free list
+	u64 reuses = 0;
+	// Slabs given back to the heap because the free list was full
+	u64 frees = 0;
+	// Slabs currently in the free list
+	u32 cached = 0;
+	// Slabs currently handed out
+	u32 in_use = 0;
+};
+
+class PacketBufferPool
+{
+public:
+	static constexpr u8 SIZE_CLASS_COUNT = 6;
+	// Index of the class of the slabs that are not pooled
+	static constexpr u8 OVERSIZED = SIZE_CLASS_COUNT;
+
+	static PacketBufferPool *get();
+
+	// Returns a slab of at least `size` bytes, `capacity` and `size_class`
+	// are set to describe it
+	u8 *allocate(u32 size, u32 &capacity, u8 &size_class);
+	void release(u8 *slab, u8 size_class);
+
+	// Appends the statistics of every size class to `stats`
+	void getStats(std::vector<PacketBufferStats> &stats);
+
+	static u32 getClassSize(u8 size_class)
+	{
+		return size_class < SIZE_CLASS_COUNT ? 64U << (2 * size_class) : 0;
+	}
+
+private:
+	PacketBufferPool() = default;
+
+	struct SizeClass
+	{
+		std::mutex mutex;
+		std::vector<u8 *> free;
+		PacketBufferStats stats;
+	};
+
+	SizeClass m_classes[SIZE_CLASS_COUNT + 1];
+};
+
+/*
+	Owning handle of a slab from the PacketBufferPool.
+
+	The data may be preceded by unused headroom, so that headers can be
+	prepended without moving the data. The interface follows Buffer<u8>.
+*/
+class PacketBuffer
+{
+public:
+	PacketBuffer() = default;
+	PacketBuffer(u32 size, u32 headroom = 0);
+	// Copies the data
+	PacketBuffer(const u8 *data, u32 size, u32 headroom = 0);
+	PacketBuffer(PacketBuffer &&other) noexcept;
+	PacketBuffer &operator=(PacketBuffer &&other) noexcept;
+	~PacketBuffer() { release(); }
+
+	DISABLE_CLASS_COPY(PacketBuffer)
+
+	u8 *operator*() const { return m_slab + m_begin; }
+	u8 &operator[](u32 i) const { return m_slab[m_begin + i]; }
+
+	u32 getSize() const { return m_end - m_begin; }
+	u32 getHeadroom() const { return m_begin; }
+
+	// Changes the size, keeps the data and the headroom.
+	// Newly added bytes are not initialized.
+	void resize(u32 size);
+	// Makes sure that the data can grow to `size` bytes without reallocation
+	void reserve(u32 size);
+	void clear() { m_end = m_begin; }
+
+	// Grows the data to the front, only possible within the headroom.
+	// Returns the start of the data.
+	u8 *prepend(u32 size);
+	// Removes `size` bytes from the front, they become headroom
+	void consume(u32 size);
+
+private:
+	void release();
+
+	u8 *m_slab = nullptr;
+	u32 m_capacity = 0;
+	u32 m_begin = 0;
+	u32 m_end = 0;
+	u8 m_size_class = 0;
+};
@@ -31,7 +31,11 @@ typedef enum
 	AVG_RTT,
 	MIN_JITTER,
 	MAX_JITTER,
-	AVG_JITTER
+	AVG_JITTER,
+	// Estimates of the congestion control
+	BANDWIDTH,
+	PACING_RATE,
+	CONGESTION_WINDOW,
 } rtt_stat_type;
 
 class Peer;
@@ -112,9 +112,9 @@ const ToServerCommandHandler toServerCommandTable[TOSERVER_NUM_MSG_TYPES] =
 	{ "TOSERVER_SRP_BYTES_M",              TOSERVER_STATE_NOT_CONNECTED, &Server::handleCommand_SrpBytesM }, // 0x53
 	{ "TOSERVER_UPDATE_CLIENT_INFO",       TOSERVER_STATE_INGAME, &Server::handleCommand_UpdateClientInfo }, // 0x54,
 
-	null_command_handler, // 0x55
-	null_command_handler, // 0x56
-	null_command_handler, // 0x57
+	{ "TOSERVER_OBJECT_SNAPSHOT_ACK",      TOSERVER_STATE_INGAME, &Server::handleCommand_ObjectSnapshotAck }, // 0x55
+	{ "TOSERVER_INVENTORY_RESYNC",         TOSERVER_STATE_INGAME, &Server::handleCommand_InventoryResync }, // 0x56
+	{ "TOSERVER_MEDIA_CHUNK_REQUEST",      TOSERVER_STATE_STARTUP, &Server::handleCommand_MediaChunkRequest }, // 0x57
 	{ "TOSERVER_LUA_PACKET",			   TOSERVER_STATE_INGAME, &Server::handleCommand_Lua_Packet }, // 0x58,
 	{ "TOSERVER_LUA_PACKET_STREAM",        TOSERVER_STATE_INGAME, &Server::handleCommand_Lua_Packet_Stream }, // 0x59,
 };
@@ -129,6 +129,10 @@ const static ClientCommandFactory null_command_factory = { nullptr, 0, false };
 
 	Packet order is only guaranteed inside a channel, so packets that operate on
 	the same objects are *required* to be in the same channel.
+
+	Reliable packets of a channel are further split into streams (see
+	NetworkStream), order is only kept inside a stream. Anything that
+	changes the game state must stay in the default stream.
 */
 
 const ClientCommandFactory clientCommandFactoryTable[TOCLIENT_NUM_MSG_TYPES] =
@@ -165,10 +169,10 @@ const ClientCommandFactory clientCommandFactoryTable[TOCLIENT_NUM_MSG_TYPES] =
 	null_command_factory, // 0x1D
 	null_command_factory, // 0x1E
 	null_command_factory, // 0x1F
-	{ "TOCLIENT_BLOCKDATA",                2, true }, // 0x20
+	{ "TOCLIENT_BLOCKDATA",                2, true, NETSTREAM_BLOCKS }, // 0x20
 	{ "TOCLIENT_ADDNODE",                  0, true }, // 0x21
 	{ "TOCLIENT_REMOVENODE",               0, true }, // 0x22
-	{ "TOCLIENT_RESETBLOCK",               2, true }, // 0x23
+	{ "TOCLIENT_RESETBLOCK",               2, true, NETSTREAM_BLOCKS }, // 0x23
 	null_command_factory, // 0x24
 	null_command_factory, // 0x25
 	null_command_factory, // 0x26
@@ -180,7 +184,7 @@ const ClientCommandFactory clientCommandFactoryTable[TOCLIENT_NUM_MSG_TYPES] =
 	{ "TOCLIENT_MEDIA_PUSH",               0, true }, // 0x2C (sent over channel 1 too if legacy)
 	null_command_factory, // 0x2D
 	null_command_factory, // 0x2E
-	{ "TOCLIENT_CHAT_MESSAGE",             0, true }, // 0x2F
+	{ "TOCLIENT_CHAT_MESSAGE",             0, true, NETSTREAM_CHAT }, // 0x2F
 	null_command_factory, // 0x30
 	{ "TOCLIENT_ACTIVE_OBJECT_REMOVE_ADD", 0, true }, // 0x31
 	{ "TOCLIENT_ACTIVE_OBJECT_MESSAGES",   0, true }, // 0x32 (may be sent as unrel over channel 1 too)
@@ -189,7 +193,7 @@ const ClientCommandFactory clientCommandFactoryTable[TOCLIENT_NUM_MSG_TYPES] =
 	null_command_factory, // 0x35
 	{ "TOCLIENT_FOV",                      0, true }, // 0x36
 	{ "TOCLIENT_DEATHSCREEN",              0, true }, // 0x37
-	{ "TOCLIENT_MEDIA",                    2, true }, // 0x38
+	{ "TOCLIENT_MEDIA",                    2, true, NETSTREAM_MEDIA }, // 0x38
 	null_command_factory, // 0x39
 	{ "TOCLIENT_NODEDEF",                  0, true }, // 0x3A
 	null_command_factory, // 0x3B
@@ -234,10 +238,10 @@ const ClientCommandFactory clientCommandFactoryTable[TOCLIENT_NUM_MSG_TYPES] =
 	{ "TOCLIENT_MINIMAP_MODES",            0, true }, // 0x62
 	{ "TOCLIENT_SET_LIGHTING",             0, true }, // 0x63
 
-	null_command_factory, // 0x64
-	null_command_factory, // 0x65
-	null_command_factory, // 0x66
+	{ "TOCLIENT_OBJECT_SNAPSHOT",          1, false }, // 0x64
+	{ "TOCLIENT_INVENTORY_DELTA",          0, true }, // 0x65
+	{ "TOCLIENT_MEDIA_CHUNK",              2, true, NETSTREAM_MEDIA }, // 0x66
 	null_command_factory, // 0x67
-	{ "TOCLIENT_LUA_PACKET",             0, true }, // 0x68,
-	{ "TOCLIENT_LUA_PACKET_STREAM",      0, true }, // 0x69,
+	{ "TOCLIENT_LUA_PACKET",             0, true, NETSTREAM_LUA }, // 0x68,
+	{ "TOCLIENT_LUA_PACKET_STREAM",      0, true, NETSTREAM_LUA }, // 0x69,
 };
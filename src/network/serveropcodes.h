@@ -44,6 +44,8 @@ struct ClientCommandFactory
 	const char* name;
 	u8 channel;
 	bool reliable;
+	// NetworkStream of reliable packets
+	u8 stream = NETSTREAM_DEFAULT;
 };
 
 extern const ToServerCommandHandler toServerCommandTable[TOSERVER_NUM_MSG_TYPES];
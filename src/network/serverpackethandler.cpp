@@ -406,6 +406,41 @@ void Server::handleCommand_RequestMedia(NetworkPacket* pkt)
 	sendRequestedMedia(peer_id, tosend);
 }
 
+void Server::handleCommand_MediaChunkRequest(NetworkPacket *pkt)
+{
+	// Clients keep only a few chunk requests in flight
+	const u16 max_requests = 256;
+
+	session_t peer_id = pkt->getPeerId();
+	RemoteClient *client = getClientNoEx(peer_id, CS_DefinitionsSent);
+	if (!client) {
+		warningstream << "Client " << getPlayerName(peer_id)
+			<< " requested media chunks before the announcement" << std::endl;
+		return;
+	}
+
+	u16 count;
+	*pkt >> count;
+	if (count > max_requests) {
+		warningstream << "Client " << getPlayerName(peer_id)
+			<< " requested too many media chunks (" << count << ")" << std::endl;
+		count = max_requests;
+	}
+
+	std::vector<std::pair<std::string, u32>> requests;
+	requests.reserve(count);
+	for (u16 i = 0; i < count; i++) {
+		std::string sha1;
+		u32 offset;
+		*pkt >> sha1 >> offset;
+		if (sha1.size() != 20)
+			continue;
+		requests.emplace_back(std::move(sha1), offset);
+	}
+
+	sendMediaChunks(peer_id, requests);
+}
+
 void Server::handleCommand_ClientReady(NetworkPacket* pkt)
 {
 	session_t peer_id = pkt->getPeerId();
@@ -2085,6 +2120,51 @@ void Server::handleCommand_UpdateClientInfo(NetworkPacket *pkt)
 	client->setDynamicInfo(info);
 }
 
+void Server::handleCommand_ObjectSnapshotAck(NetworkPacket *pkt)
+{
+	u16 seq;
+	*pkt >> seq;
+
+	RemoteClient *client = getClientNoEx(pkt->getPeerId(), CS_Active);
+	if (client)
+		client->m_object_snapshots.acknowledge(seq);
+}
+
+void Server::handleCommand_InventoryResync(NetworkPacket *pkt)
+{
+	RemotePlayer *player = m_env->getPlayer(pkt->getPeerId());
+	if (!player)
+		return;
+
+	std::string location;
+	*pkt >> location;
+
+	InventoryLocation loc;
+	try {
+		loc.deSerialize(location);
+	} catch (SerializationError &) {
+		warningstream << "Server: " << player->getName()
+			<< " requested invalid inventory \"" << location << "\"" << std::endl;
+		return;
+	}
+
+	infostream << "Server: " << player->getName() << " lost track of inventory "
+		<< loc.dump() << ", sending it again" << std::endl;
+
+	switch (loc.type) {
+	case InventoryLocation::CURRENT_PLAYER:
+		SendInventory(player, false);
+		break;
+	case InventoryLocation::DETACHED:
+		if (m_inventory_mgr->checkDetachedInventoryAccess(loc, player->getName()))
+			sendDetachedInventory(m_inventory_mgr->getInventory(loc), loc.name,
+				pkt->getPeerId());
+		break;
+	default:
+		break;
+	}
+}
+
 void Server::handleCommand_Lua_Packet(NetworkPacket* pkt) {
 	NetworkPacket* clone = new NetworkPacket(*pkt);
 
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <cstdlib>
 #include <cstring>
 #include <iomanip>
+#include <atomic>
 #include "util/string.h"
 #include "util/numeric.h"
 #include "constants.h"
@@ -46,6 +47,9 @@ typedef int socklen_t;
 #include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#ifdef __linux__
+#define HAVE_MMSG 1
+#endif
 #define LAST_SOCKET_ERR() (errno)
 #define SOCKET_ERR_STR(e) strerror(e)
 #endif
@@ -195,7 +199,14 @@ void UDPSocket::Bind(Address addr)
 	}
 }
 
-void UDPSocket::Send(const Address &destination, const void *data, int size)
+/*
+	Helpers
+*/
+
+// Prints the packet if debug output is enabled. Returns false if the
+// INTERNET_SIMULATOR decided to drop it.
+static bool simulate_send(int handle, const Address &destination,
+		const void *data, int size)
 {
 	bool dumping_packet = false; // for INTERNET_SIMULATOR
 
@@ -204,7 +215,7 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 
 	if (socket_enable_debug_output) {
 		// Print packet destination and size
-		tracestream << (int)m_handle << " -> ";
+		tracestream << handle << " -> ";
 		destination.print(tracestream);
 		tracestream << ", size=" << size;
 
@@ -230,30 +241,85 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 		// Lol let's forget it
 		tracestream << "UDPSocket::Send(): INTERNET_SIMULATOR: dumping packet."
 			<< std::endl;
-		return;
+		return false;
+	}
+
+	return true;
+}
+
+static void print_received(int handle, const Address &sender,
+		const void *data, int received)
+{
+	// Print packet sender and size
+	tracestream << handle << " <- ";
+	sender.print(tracestream);
+	tracestream << ", size=" << received;
+
+	// Print packet contents
+	tracestream << ", data=";
+	for (int i = 0; i < received && i < 20; i++) {
+		if (i % 2 == 0)
+			tracestream << " ";
+		unsigned int a = ((const unsigned char *)data)[i];
+		tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
+	}
+	if (received > 20)
+		tracestream << "...";
+
+	tracestream << std::endl;
+}
+
+static socklen_t to_sockaddr(const Address &address,
+		struct sockaddr_storage *storage)
+{
+	memset(storage, 0, sizeof(*storage));
+	if (address.getFamily() == AF_INET6) {
+		auto *addr6 = reinterpret_cast<struct sockaddr_in6 *>(storage);
+		addr6->sin6_family = AF_INET6;
+		addr6->sin6_addr = address.getAddress6();
+		addr6->sin6_port = htons(address.getPort());
+		return sizeof(struct sockaddr_in6);
 	}
 
+	auto *addr4 = reinterpret_cast<struct sockaddr_in *>(storage);
+	addr4->sin_family = AF_INET;
+	addr4->sin_addr = address.getAddress();
+	addr4->sin_port = htons(address.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address from_sockaddr(unsigned short family,
+		const struct sockaddr_storage *storage)
+{
+	if (family == AF_INET6) {
+		auto *addr6 = reinterpret_cast<const struct sockaddr_in6 *>(storage);
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes *>
+			(addr6->sin6_addr.s6_addr);
+		return Address(bytes, ntohs(addr6->sin6_port));
+	}
+
+	auto *addr4 = reinterpret_cast<const struct sockaddr_in *>(storage);
+	return Address(ntohl(addr4->sin_addr.s_addr), ntohs(addr4->sin_port));
+}
+
+void UDPSocket::Send(const Address &destination, const void *data, int size)
+{
+	if (!simulate_send(m_handle, destination, data, size))
+		return;
+
 	if (destination.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = {};
-		address.sin6_family = AF_INET6;
-		address.sin6_addr = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
+	sendOne(destination, data, size);
+}
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in6));
-	} else {
-		struct sockaddr_in address = {};
-		address.sin_family = AF_INET;
-		address.sin_addr = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
+void UDPSocket::sendOne(const Address &destination, const void *data, int size)
+{
+	struct sockaddr_storage address;
+	socklen_t address_len = to_sockaddr(destination, &address);
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in));
-	}
+	int sent = sendto(m_handle, (const char *)data, size, 0,
+			(struct sockaddr *)&address, address_len);
 
 	if (sent != size)
 		throw SendFailedException("Failed to send packet");
@@ -266,63 +332,223 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 	if (!WaitData(m_timeout_ms))
 		return -1;
 
-	size = MYMAX(size, 0);
+	return receiveOne(sender, data, MYMAX(size, 0));
+}
 
-	int received;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address;
-		memset(&address, 0, sizeof(address));
-		socklen_t address_len = sizeof(address);
+int UDPSocket::receiveOne(Address &sender, void *data, int size)
+{
+	struct sockaddr_storage address;
+	memset(&address, 0, sizeof(address));
+	socklen_t address_len = sizeof(address);
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	int received = recvfrom(m_handle, (char *)data, size, 0,
+			(struct sockaddr *)&address, &address_len);
 
-		if (received < 0)
-			return -1;
+	if (received < 0)
+		return -1;
 
-		u16 address_port = ntohs(address.sin6_port);
-		const auto *bytes = reinterpret_cast<IPv6AddressBytes*>
-			(address.sin6_addr.s6_addr);
-		sender = Address(bytes, address_port);
-	} else {
-		struct sockaddr_in address;
-		memset(&address, 0, sizeof(address));
+	sender = from_sockaddr(m_addr_family, &address);
+
+	if (socket_enable_debug_output)
+		print_received(m_handle, sender, data, received);
+
+	return received;
+}
 
-		socklen_t address_len = sizeof(address);
+/*
+	Batched I/O
+*/
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+#ifdef HAVE_MMSG
+// Set once the kernel turned out to lack sendmmsg() or recvmmsg()
+static std::atomic<bool> g_mmsg_unsupported(false);
+#endif
 
-		if (received < 0)
-			return -1;
+struct UDPBatchHeaders
+{
+#ifdef HAVE_MMSG
+	UDPBatchHeaders(u32 capacity) :
+		msgs(capacity), iovecs(capacity), addresses(capacity),
+		indices(capacity)
+	{
+		for (u32 i = 0; i < capacity; i++) {
+			msgs[i].msg_hdr.msg_name = &addresses[i];
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+
+	std::vector<struct mmsghdr> msgs;
+	std::vector<struct iovec> iovecs;
+	std::vector<struct sockaddr_storage> addresses;
+	// Index of the datagram in the batch, for each message
+	std::vector<u32> indices;
+#else
+	UDPBatchHeaders(u32) {}
+#endif
+};
+
+UDPSendBatch::UDPSendBatch(u32 capacity) :
+	m_capacity(MYMAX(capacity, 1U)),
+	m_destinations(m_capacity),
+	m_data(m_capacity),
+	m_sizes(m_capacity),
+	m_sent(m_capacity),
+	m_headers(new UDPBatchHeaders(m_capacity))
+{
+}
+
+UDPSendBatch::~UDPSendBatch() = default;
 
-		u32 address_ip = ntohl(address.sin_addr.s_addr);
-		u16 address_port = ntohs(address.sin_port);
+void UDPSendBatch::add(const Address &destination, const void *data, int size)
+{
+	assert(!full());
+	m_destinations[m_count] = destination;
+	m_data[m_count] = data;
+	m_sizes[m_count] = size;
+	m_sent[m_count] = false;
+	m_count++;
+}
 
-		sender = Address(address_ip, address_port);
+UDPReceiveBatch::UDPReceiveBatch(u32 capacity, u32 packet_size) :
+	m_capacity(MYMAX(capacity, 1U)),
+	m_packet_size(packet_size),
+	m_buffer(m_capacity * packet_size),
+	m_senders(m_capacity),
+	m_sizes(m_capacity),
+	m_headers(new UDPBatchHeaders(m_capacity))
+{
+#ifdef HAVE_MMSG
+	for (u32 i = 0; i < m_capacity; i++) {
+		m_headers->iovecs[i].iov_base = getData(i);
+		m_headers->iovecs[i].iov_len = m_packet_size;
 	}
+#endif
+}
 
-	if (socket_enable_debug_output) {
-		// Print packet sender and size
-		tracestream << (int)m_handle << " <- ";
-		sender.print(tracestream);
-		tracestream << ", size=" << received;
+UDPReceiveBatch::~UDPReceiveBatch() = default;
 
-		// Print packet contents
-		tracestream << ", data=";
-		for (int i = 0; i < received && i < 20; i++) {
-			if (i % 2 == 0)
-				tracestream << " ";
-			unsigned int a = ((const unsigned char *)data)[i];
-			tracestream << std::hex << std::setw(2) << std::setfill('0') << a;
+u32 UDPSocket::SendBatch(UDPSendBatch &batch)
+{
+	u32 failed = 0;
+
+#ifdef HAVE_MMSG
+	if (!g_mmsg_unsupported) {
+		UDPBatchHeaders &h = *batch.m_headers;
+		u32 count = 0;
+		for (u32 i = 0; i < batch.m_count; i++) {
+			if (!simulate_send(m_handle, batch.m_destinations[i],
+					batch.m_data[i], batch.m_sizes[i])) {
+				batch.m_sent[i] = true;
+				continue;
+			}
+			if (batch.m_destinations[i].getFamily() != m_addr_family) {
+				failed++;
+				continue;
+			}
+
+			struct msghdr &hdr = h.msgs[count].msg_hdr;
+			hdr.msg_namelen = to_sockaddr(batch.m_destinations[i],
+					&h.addresses[count]);
+			h.iovecs[count].iov_base = const_cast<void *>(batch.m_data[i]);
+			h.iovecs[count].iov_len = batch.m_sizes[i];
+			h.indices[count] = i;
+			count++;
 		}
-		if (received > 20)
-			tracestream << "...";
 
-		tracestream << std::endl;
+		u32 done = 0;
+		while (done < count) {
+			int sent = sendmmsg(m_handle, &h.msgs[done], count - done, 0);
+			if (sent < 0) {
+				int e = LAST_SOCKET_ERR();
+				if (e == EINTR)
+					continue;
+				if (e == ENOSYS) {
+					g_mmsg_unsupported = true;
+					// Send the rest one by one
+					for (; done < count; done++) {
+						u32 i = h.indices[done];
+						try {
+							sendOne(batch.m_destinations[i], batch.m_data[i],
+									batch.m_sizes[i]);
+							batch.m_sent[i] = true;
+						} catch (SendFailedException &) {
+							failed++;
+						}
+					}
+					break;
+				}
+				// The first message failed, the others may still succeed
+				failed++;
+				done++;
+				continue;
+			}
+
+			for (int k = 0; k < sent; k++, done++) {
+				u32 i = h.indices[done];
+				batch.m_sent[i] = h.msgs[done].msg_len == (unsigned int)batch.m_sizes[i];
+				if (!batch.m_sent[i])
+					failed++;
+			}
+		}
+		return failed;
 	}
+#endif
 
-	return received;
+	for (u32 i = 0; i < batch.m_count; i++) {
+		try {
+			Send(batch.m_destinations[i], batch.m_data[i], batch.m_sizes[i]);
+			batch.m_sent[i] = true;
+		} catch (SendFailedException &) {
+			failed++;
+		}
+	}
+	return failed;
+}
+
+u32 UDPSocket::ReceiveBatch(UDPReceiveBatch &batch)
+{
+	batch.m_count = 0;
+
+	// Return on timeout
+	assert(m_timeout_ms >= 0);
+	if (!WaitData(m_timeout_ms))
+		return 0;
+
+#ifdef HAVE_MMSG
+	if (!g_mmsg_unsupported) {
+		UDPBatchHeaders &h = *batch.m_headers;
+		for (u32 i = 0; i < batch.m_capacity; i++)
+			h.msgs[i].msg_hdr.msg_namelen = sizeof(h.addresses[i]);
+
+		int received = recvmmsg(m_handle, h.msgs.data(), batch.m_capacity,
+				MSG_DONTWAIT, nullptr);
+		if (received >= 0 || LAST_SOCKET_ERR() != ENOSYS) {
+			for (int i = 0; i < received; i++) {
+				batch.m_senders[i] = from_sockaddr(m_addr_family, &h.addresses[i]);
+				batch.m_sizes[i] = h.msgs[i].msg_len;
+				if (socket_enable_debug_output)
+					print_received(m_handle, batch.m_senders[i],
+							batch.getData(i), batch.m_sizes[i]);
+			}
+			batch.m_count = MYMAX(received, 0);
+			return batch.m_count;
+		}
+		g_mmsg_unsupported = true;
+	}
+#endif
+
+	do {
+		u32 i = batch.m_count;
+		int received = receiveOne(batch.m_senders[i], batch.getData(i),
+				batch.m_packet_size);
+		if (received < 0)
+			break;
+		batch.m_sizes[i] = received;
+		batch.m_count++;
+	} while (batch.m_count < batch.m_capacity && WaitData(0));
+
+	return batch.m_count;
 }
 
 void UDPSocket::setTimeoutMs(int timeout_ms)
@@ -21,15 +21,82 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <ostream>
 #include <cstring>
+#include <memory>
+#include <vector>
 #include "address.h"
 #include "irrlichttypes.h"
 #include "networkexceptions.h"
+#include "util/basic_macros.h"
 
 extern bool socket_enable_debug_output;
 
 void sockets_init();
 void sockets_cleanup();
 
+struct UDPBatchHeaders;
+
+/*
+	Datagrams for UDPSocket::SendBatch(). The data is not copied and has to
+	stay valid until the batch was sent.
+*/
+class UDPSendBatch
+{
+public:
+	UDPSendBatch(u32 capacity);
+	~UDPSendBatch();
+	DISABLE_CLASS_COPY(UDPSendBatch)
+
+	void add(const Address &destination, const void *data, int size);
+	void clear() { m_count = 0; }
+
+	u32 size() const { return m_count; }
+	u32 capacity() const { return m_capacity; }
+	bool full() const { return m_count == m_capacity; }
+
+	const Address &getDestination(u32 i) const { return m_destinations[i]; }
+	// Whether the datagram was handed to the system by the last SendBatch()
+	bool wasSent(u32 i) const { return m_sent[i]; }
+
+private:
+	friend class UDPSocket;
+
+	u32 m_capacity;
+	u32 m_count = 0;
+	std::vector<Address> m_destinations;
+	std::vector<const void *> m_data;
+	std::vector<int> m_sizes;
+	std::vector<bool> m_sent;
+	std::unique_ptr<UDPBatchHeaders> m_headers;
+};
+
+// Preallocated buffers for UDPSocket::ReceiveBatch()
+class UDPReceiveBatch
+{
+public:
+	UDPReceiveBatch(u32 capacity, u32 packet_size);
+	~UDPReceiveBatch();
+	DISABLE_CLASS_COPY(UDPReceiveBatch)
+
+	// Number of datagrams received by the last ReceiveBatch()
+	u32 size() const { return m_count; }
+	u32 capacity() const { return m_capacity; }
+
+	const Address &getSender(u32 i) const { return m_senders[i]; }
+	u8 *getData(u32 i) { return &m_buffer[i * m_packet_size]; }
+	int getSize(u32 i) const { return m_sizes[i]; }
+
+private:
+	friend class UDPSocket;
+
+	u32 m_capacity;
+	u32 m_packet_size;
+	u32 m_count = 0;
+	std::vector<u8> m_buffer;
+	std::vector<Address> m_senders;
+	std::vector<int> m_sizes;
+	std::unique_ptr<UDPBatchHeaders> m_headers;
+};
+
 class UDPSocket
 {
 public:
@@ -43,6 +110,17 @@ class UDPSocket
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+
+	/*
+		Batched I/O: On Linux these use a single sendmmsg() or recvmmsg()
+		system call for the whole batch, elsewhere one call per datagram.
+	*/
+	// Returns the number of datagrams that could not be sent
+	u32 SendBatch(UDPSendBatch &batch);
+	// Waits like Receive(), then reads as many datagrams as are available
+	// and fit into the batch. Returns the number of datagrams read.
+	u32 ReceiveBatch(UDPReceiveBatch &batch);
+
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
 	bool WaitData(int timeout_ms);
@@ -51,6 +129,9 @@ class UDPSocket
 	int GetHandle() const { return m_handle; };
 
 private:
+	void sendOne(const Address &destination, const void *data, int size);
+	int receiveOne(Address &sender, void *data, int size);
+
 	int m_handle = -1;
 	int m_timeout_ms = -1;
 	unsigned short m_addr_family = 0;
@@ -0,0 +1,89 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "streamqueue.h"
+#include "connection.h"
+#include "debug.h"
+#include "util/basic_macros.h"
+
+namespace con
+{
+
+/*
+	Interactive streams get a larger share than bulk data. A stream that
+	is alone in its channel gets all of the bandwidth regardless.
+*/
+static const u32 stream_weights[NETSTREAM_COUNT] = {
+	4, // NETSTREAM_DEFAULT
+	8, // NETSTREAM_CHAT
+	4, // NETSTREAM_LUA
+	2, // NETSTREAM_BLOCKS
+	1, // NETSTREAM_MEDIA
+};
+
+u32 StreamQueue::getWeight(u8 stream)
+{
+	return stream_weights[stream];
+}
+
+void StreamQueue::push_back(const ConnectionCommandPtr &c)
+{
+	sanity_check(c->stream < NETSTREAM_COUNT);
+	m_streams[c->stream].commands.push_back(c);
+	m_size++;
+}
+
+const ConnectionCommandPtr &StreamQueue::front()
+{
+	static const ConnectionCommandPtr none;
+	if (m_size == 0)
+		return none;
+
+	for (;;) {
+		Stream &stream = m_streams[m_current];
+		if (!stream.commands.empty()) {
+			u32 size = stream.commands.front()->data.getSize();
+			if (size <= stream.deficit) {
+				m_front_size = size;
+				return stream.commands.front();
+			}
+		}
+
+		// The turn is over, the next stream with commands gets its credit
+		m_current = (m_current + 1) % NETSTREAM_COUNT;
+		Stream &next = m_streams[m_current];
+		if (!next.commands.empty())
+			next.deficit += stream_weights[m_current] * STREAM_QUANTUM;
+	}
+}
+
+void StreamQueue::pop_front()
+{
+	Stream &stream = m_streams[m_current];
+	sanity_check(!stream.commands.empty());
+	stream.commands.pop_front();
+	m_size--;
+
+	stream.deficit -= MYMIN(stream.deficit, m_front_size);
+	if (stream.commands.empty())
+		stream.deficit = 0;
+	m_front_size = 0;
+}
+
+}
@@ -0,0 +1,77 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "networkprotocol.h"
+#include <deque>
+#include <memory>
+
+namespace con
+{
+
+struct ConnectionCommand;
+typedef std::shared_ptr<ConnectionCommand> ConnectionCommandPtr;
+
+// Bytes a stream of weight 1 may send per turn
+#define STREAM_QUANTUM 512
+
+/*
+	Reliable send commands of a channel that are not yet turned into
+	packets, queued per NetworkStream.
+
+	The streams take turns by deficit round robin: each turn a stream gets
+	its weight times STREAM_QUANTUM bytes of credit and sends commands as
+	long as the credit covers them. Credit that is left over is kept for
+	the next turn while the stream has commands queued, so large commands
+	get through as well.
+*/
+class StreamQueue
+{
+public:
+	bool empty() const { return m_size == 0; }
+	size_t size() const { return m_size; }
+	size_t size(u8 stream) const { return m_streams[stream].commands.size(); }
+
+	void push_back(const ConnectionCommandPtr &c);
+	// Command to send next, nullptr if the queue is empty. Doesn't change
+	// until it is popped.
+	const ConnectionCommandPtr &front();
+	// Removes the command returned by front()
+	void pop_front();
+
+	static u32 getWeight(u8 stream);
+
+private:
+	struct Stream
+	{
+		std::deque<ConnectionCommandPtr> commands;
+		u32 deficit = 0;
+	};
+
+	Stream m_streams[NETSTREAM_COUNT];
+	u8 m_current = 0;
+	size_t m_size = 0;
+	// Size of the command returned by front(), its data may be gone
+	// when it is popped
+	u32 m_front_size = 0;
+};
+
+}
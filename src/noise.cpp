@@ -31,6 +31,8 @@
 #include "util/numeric.h"
 #include "util/string.h"
 #include "exceptions.h"
+#include "util/thread.h"
+#include "noise_kernels.h"
 
 #define NOISE_MAGIC_X    1619
 #define NOISE_MAGIC_Y    31337
@@ -366,6 +368,7 @@ Noise::Noise(const NoiseParams *np_, s32 seed, u32 sx, u32 sy, u32 sz)
 	this->sx   = sx;
 	this->sy   = sy;
 	this->sz   = sz;
+	m_kernels = getNoiseKernels();
 
 	allocBuffers();
 }
@@ -476,6 +479,26 @@ void Noise::resizeNoiseBuf(bool is3d)
 }
 
 
+void Noise::calcSteps(float orig_u, float step_x, bool eased)
+{
+	m_step_ix.resize(sx);
+	m_step_tx.resize(sx);
+
+	float u = orig_u;
+	u32 noisex = 0;
+	for (u32 i = 0; i != sx; i++) {
+		m_step_ix[i] = noisex;
+		m_step_tx[i] = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+}
+
+
 /*
  * NB:  This algorithm is not optimal in terms of space complexity.  The entire
  * integer lattice of noise points could be done as 2 lines instead, and for 3D,
@@ -487,14 +510,13 @@ void Noise::resizeNoiseBuf(bool is3d)
  * values from the previous noise lattice as midpoints in the new lattice for the
  * next octave.
  */
-#define idx(x, y) ((y) * nlx + (x))
 void Noise::gradientMap2D(
 		float x, float y,
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
+	float u, v;
+	u32 j, noisey;
 	u32 nlx, nly;
 	s32 x0, y0;
 
@@ -503,41 +525,21 @@ void Noise::gradientMap2D(
 	y0 = std::floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		m_kernels->lattice2D(&noise_buf[j * nlx], nlx, x0, y0 + j, seed);
 
-	//calculate interpolations
-	index  = 0;
+	//calculate interpolations, one row at a time
+	calcSteps(u, step_x, eased);
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] =
-				biLinearInterpolation(v00, v10, v01, v11, u, v, eased);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
-		}
+		m_kernels->interpolate2D(&gradient_buf[j * sx], sx,
+			&noise_buf[noisey * nlx], &noise_buf[(noisey + 1) * nlx],
+			m_step_ix.data(), m_step_tx.data(),
+			eased ? easeCurve(v) : v);
 
 		v += step_y;
 		if (v >= 1.0) {
@@ -546,96 +548,94 @@ void Noise::gradientMap2D(
 		}
 	}
 }
-#undef idx
 
 
-#define idx(x, y, z) ((z) * nly * nlx + (y) * nlx + (x))
+#define idx(y, z) (((z) * nly + (y)) * nlx)
 void Noise::gradientMap3D(
 		float x, float y, float z,
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
+	float orig_u, orig_v, orig_w;
 
 	bool eased = np.flags & NOISE_FLAG_EASED;
 
 	x0 = std::floor(x);
 	y0 = std::floor(y);
 	z0 = std::floor(z);
-	u = x - (float)x0;
-	v = y - (float)y0;
-	w = z - (float)z0;
-	orig_u = u;
-	orig_v = v;
+	orig_u = x - (float)x0;
+	orig_v = y - (float)y0;
+	orig_w = z - (float)z0;
 
 	//calculate noise point lattice
-	nlx = (u32)(u + sx * step_x) + 2;
-	nly = (u32)(v + sy * step_y) + 2;
-	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
-	for (k = 0; k != nlz; k++)
-		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
-
-	//calculate interpolations
-	index  = 0;
-	noisey = 0;
-	noisez = 0;
-	for (k = 0; k != sz; k++) {
-		v = orig_v;
-		noisey = 0;
-		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = triLinearInterpolation(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w,
-					eased);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
+	nlx = (u32)(orig_u + sx * step_x) + 2;
+	nly = (u32)(orig_v + sy * step_y) + 2;
+	nlz = (u32)(orig_w + sz * step_z) + 2;
+
+	auto calc_lattice = [&] (u32 k_begin, u32 k_end) {
+		for (u32 k = k_begin; k != k_end; k++)
+			for (u32 j = 0; j != nly; j++)
+				m_kernels->lattice3D(&noise_buf[idx(j, k)], nlx,
+					x0, y0 + j, z0 + k, seed);
+	};
+
+	// Same for every row
+	calcSteps(orig_u, step_x, eased);
+
+	//calculate interpolations, one row at a time
+	auto calc_interpolations = [&] (u32 k_begin, u32 k_end) {
+		float v, w = orig_w;
+		u32 index, j, k, noisey, noisez = 0;
+
+		// Step w exactly like the layers below k_begin do, so that every
+		// range gives the same values as a single pass.
+		for (k = 0; k != k_begin; k++) {
+			w += step_z;
+			if (w >= 1.0) {
+				w -= 1.0;
+				noisez++;
+			}
+		}
+
+		index = k_begin * sy * sx;
+		for (k = k_begin; k != k_end; k++) {
+			const float tz = eased ? easeCurve(w) : w;
+			v = orig_v;
+			noisey = 0;
+			for (j = 0; j != sy; j++) {
+				m_kernels->interpolate3D(&gradient_buf[index], sx,
+					&noise_buf[idx(noisey,     noisez)],
+					&noise_buf[idx(noisey + 1, noisez)],
+					&noise_buf[idx(noisey,     noisez + 1)],
+					&noise_buf[idx(noisey + 1, noisez + 1)],
+					m_step_ix.data(), m_step_tx.data(),
+					eased ? easeCurve(v) : v, tz);
+				index += sx;
+
+				v += step_y;
+				if (v >= 1.0) {
+					v -= 1.0;
+					noisey++;
 				}
 			}
 
-			v += step_y;
-			if (v >= 1.0) {
-				v -= 1.0;
-				noisey++;
+			w += step_z;
+			if (w >= 1.0) {
+				w -= 1.0;
+				noisez++;
 			}
 		}
+	};
 
-		w += step_z;
-		if (w >= 1.0) {
-			w -= 1.0;
-			noisez++;
-		}
+	if (m_runner && m_runner->getThreadCount() > 1) {
+		// Both steps are split into slabs along z
+		m_runner->run(nlz, calc_lattice);
+		m_runner->run(sz, calc_interpolations);
+	} else {
+		calc_lattice(0, nlz);
+		calc_interpolations(0, sz);
 	}
 }
 #undef idx
@@ -663,7 +663,7 @@ float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 			f / np.spread.X, f / np.spread.Y,
 			seed + np.seed + oct);
 
-		updateResults(g, persist_buf, persistence_map, bufsize);
+		updateResults(g, persist_buf, persistence_map, 0, bufsize);
 
 		f *= np.lacunarity;
 		g *= np.persist;
@@ -696,12 +696,21 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 			persist_buf[i] = 1.0;
 	}
 
+	const bool parallel = m_runner && m_runner->getThreadCount() > 1;
+
 	for (size_t oct = 0; oct < np.octaves; oct++) {
 		gradientMap3D(x * f, y * f, z * f,
 			f / np.spread.X, f / np.spread.Y, f / np.spread.Z,
 			seed + np.seed + oct);
 
-		updateResults(g, persist_buf, persistence_map, bufsize);
+		if (parallel) {
+			m_runner->run(sz, [&] (u32 k_begin, u32 k_end) {
+				updateResults(g, persist_buf, persistence_map,
+					(size_t)k_begin * sx * sy, (size_t)k_end * sx * sy);
+			});
+		} else {
+			updateResults(g, persist_buf, persistence_map, 0, bufsize);
+		}
 
 		f *= np.lacunarity;
 		g *= np.persist;
@@ -717,29 +726,14 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 
 
 void Noise::updateResults(float g, float *gmap,
-	const float *persistence_map, size_t bufsize)
-{
-	// This looks very ugly, but it is 50-70% faster than having
-	// conditional statements inside the loop
-	if (np.flags & NOISE_FLAG_ABSVALUE) {
-		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * std::fabs(gradient_buf[i]);
-				gmap[i] *= persistence_map[i];
-			}
-		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * std::fabs(gradient_buf[i]);
-		}
+	const float *persistence_map, size_t begin, size_t end)
+{
+	const bool absvalue = np.flags & NOISE_FLAG_ABSVALUE;
+	if (persistence_map) {
+		m_kernels->accumulatePersist(&result[begin], &gmap[begin],
+			&gradient_buf[begin], &persistence_map[begin], end - begin, absvalue);
 	} else {
-		if (persistence_map) {
-			for (size_t i = 0; i != bufsize; i++) {
-				result[i] += gmap[i] * gradient_buf[i];
-				gmap[i] *= persistence_map[i];
-			}
-		} else {
-			for (size_t i = 0; i != bufsize; i++)
-				result[i] += g * gradient_buf[i];
-		}
+		m_kernels->accumulate(&result[begin], &gradient_buf[begin],
+			end - begin, g, absvalue);
 	}
 }
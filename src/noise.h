@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include <vector>
 #include "irr_v3d.h"
 #include "exceptions.h"
 #include "util/string.h"
@@ -36,6 +37,9 @@
 #undef RANDOM_MAX
 #endif
 
+class ParallelRunner;
+struct NoiseKernels;
+
 extern FlagDesc flagdesc_noiseparams[];
 
 // Note: this class is not polymorphic so that its high level of
@@ -161,6 +165,12 @@ class Noise {
 	void setSize(u32 sx, u32 sy, u32 sz=1);
 	void setSpreadFactor(v3f spread);
 	void setOctaves(int octaves);
+	// Computes 3D maps on the threads of runner, with the same result.
+	// nullptr computes them on the calling thread only.
+	void setParallelRunner(ParallelRunner *runner) { m_runner = runner; }
+	// Kernels computing the maps, the fastest supported ones by default.
+	// Every choice gives the same result.
+	void setKernels(const NoiseKernels *kernels) { m_kernels = kernels; }
 
 	void gradientMap2D(
 		float x, float y,
@@ -197,8 +207,14 @@ class Noise {
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
 	void updateResults(float g, float *gmap, const float *persistence_map,
-			size_t bufsize);
-
+			size_t begin, size_t end);
+	// Lattice cell and (eased) position in it for every x of a row
+	void calcSteps(float orig_u, float step_x, bool eased);
+
+	ParallelRunner *m_runner = nullptr;
+	const NoiseKernels *m_kernels = nullptr;
+	std::vector<u32> m_step_ix;
+	std::vector<float> m_step_tx;
 };
 
 float NoisePerlin2D(const NoiseParams *np, float x, float y, s32 seed);
@@ -0,0 +1,485 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "noise_kernels.h"
+#include <cmath>
+#include "noise.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+		(defined(__x86_64__) || defined(__i386__))
+	#define NOISE_KERNELS_X86
+	#define TARGET_SSE2 __attribute__((target("sse2")))
+	// Not "fma": fused multiply-add would change the results
+	#define TARGET_AVX2 __attribute__((target("avx2")))
+	#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#define NOISE_KERNELS_X86
+	#define TARGET_SSE2
+	#define TARGET_AVX2
+	#include <intrin.h>
+	#include <immintrin.h>
+#endif
+
+// Must match noise2d() and noise3d()
+#define NOISE_MAGIC_X    1619U
+#define NOISE_MAGIC_Y    31337U
+#define NOISE_MAGIC_Z    52591U
+#define NOISE_MAGIC_SEED 1013U
+
+/*
+	Plain C++
+*/
+
+static inline float lerp(float v0, float v1, float t)
+{
+	return v0 + (v1 - v0) * t;
+}
+
+// The hash of noise2d() and noise3d(), n being its input
+static inline float hashToNoise(u32 n)
+{
+	n &= 0x7fffffff;
+	n = (n >> 13) ^ n;
+	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
+	return 1.f - (float)(int)n / 0x40000000;
+}
+
+static inline u32 hashRowBase(s32 y, s32 z, s32 seed)
+{
+	return NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_Z * (u32)z +
+		NOISE_MAGIC_SEED * (u32)seed;
+}
+
+static void lattice2D_plain(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = noise2d(x0 + i, y, seed);
+}
+
+static void lattice3D_plain(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = noise3d(x0 + i, y, z, seed);
+}
+
+// Tail of the SIMD lattice rows
+static void latticeRow_plain(float *out, u32 count, s32 x0, u32 base)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = hashToNoise(NOISE_MAGIC_X * (u32)(x0 + i) + base);
+}
+
+static void interpolate2D_plain(float *out, u32 count, const float *r0,
+	const float *r1, const u32 *ix, const float *tx, float ty)
+{
+	for (u32 i = 0; i != count; i++) {
+		const u32 x = ix[i];
+		out[i] = lerp(
+			lerp(r0[x], r0[x + 1], tx[i]),
+			lerp(r1[x], r1[x + 1], tx[i]),
+			ty);
+	}
+}
+
+static void interpolate3D_plain(float *out, u32 count, const float *r00,
+	const float *r10, const float *r01, const float *r11,
+	const u32 *ix, const float *tx, float ty, float tz)
+{
+	for (u32 i = 0; i != count; i++) {
+		const u32 x = ix[i];
+		const float t = tx[i];
+		float u = lerp(lerp(r00[x], r00[x + 1], t), lerp(r10[x], r10[x + 1], t), ty);
+		float v = lerp(lerp(r01[x], r01[x + 1], t), lerp(r11[x], r11[x + 1], t), ty);
+		out[i] = lerp(u, v, tz);
+	}
+}
+
+static void accumulate_plain(float *result, const float *gradient, size_t count,
+	float g, bool absvalue)
+{
+	if (absvalue) {
+		for (size_t i = 0; i != count; i++)
+			result[i] += g * std::fabs(gradient[i]);
+	} else {
+		for (size_t i = 0; i != count; i++)
+			result[i] += g * gradient[i];
+	}
+}
+
+static void accumulatePersist_plain(float *result, float *gmap,
+	const float *gradient, const float *persistence, size_t count, bool absvalue)
+{
+	if (absvalue) {
+		for (size_t i = 0; i != count; i++) {
+			result[i] += gmap[i] * std::fabs(gradient[i]);
+			gmap[i] *= persistence[i];
+		}
+	} else {
+		for (size_t i = 0; i != count; i++) {
+			result[i] += gmap[i] * gradient[i];
+			gmap[i] *= persistence[i];
+		}
+	}
+}
+
+static const NoiseKernels kernels_plain = {
+	"plain",
+	lattice2D_plain,
+	lattice3D_plain,
+	interpolate2D_plain,
+	interpolate3D_plain,
+	accumulate_plain,
+	accumulatePersist_plain,
+};
+
+#ifdef NOISE_KERNELS_X86
+
+/*
+	SSE2, 4 points at a time
+*/
+
+// Low 32 bits of the products, SSE2 has no _mm_mullo_epi32
+TARGET_SSE2 static inline __m128i mullo_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+TARGET_SSE2 static inline __m128 hashToNoise_sse2(__m128i n)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	n = _mm_and_si128(n, mask);
+	n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+	__m128i t = mullo_sse2(mullo_sse2(n, n), _mm_set1_epi32(60493));
+	t = _mm_add_epi32(t, _mm_set1_epi32(19990303));
+	t = _mm_add_epi32(mullo_sse2(n, t), _mm_set1_epi32(1376312589));
+	n = _mm_and_si128(t, mask);
+	// Dividing by a power of two and multiplying by its inverse are exact
+	__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(n), _mm_set1_ps(1.f / 0x40000000));
+	return _mm_sub_ps(_mm_set1_ps(1.f), f);
+}
+
+TARGET_SSE2 static void latticeRow_sse2(float *out, u32 count, s32 x0, u32 base)
+{
+	__m128i n = _mm_add_epi32(
+		_mm_set1_epi32(NOISE_MAGIC_X * (u32)x0 + base),
+		_mm_setr_epi32(0, NOISE_MAGIC_X, 2 * NOISE_MAGIC_X, 3 * NOISE_MAGIC_X));
+	const __m128i step = _mm_set1_epi32(4 * NOISE_MAGIC_X);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_ps(out + i, hashToNoise_sse2(n));
+		n = _mm_add_epi32(n, step);
+	}
+	latticeRow_plain(out + i, count - i, x0 + i, base);
+}
+
+TARGET_SSE2 static void lattice2D_sse2(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	latticeRow_sse2(out, count, x0, hashRowBase(y, 0, seed));
+}
+
+TARGET_SSE2 static void lattice3D_sse2(float *out, u32 count, s32 x0, s32 y, s32 z,
+	s32 seed)
+{
+	latticeRow_sse2(out, count, x0, hashRowBase(y, z, seed));
+}
+
+TARGET_SSE2 static inline __m128 lerp_sse2(__m128 v0, __m128 v1, __m128 t)
+{
+	return _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t));
+}
+
+// Bilinear interpolation of 4 points in the rows r0 and r1
+TARGET_SSE2 static inline __m128 bilerp_sse2(const float *r0, const float *r1,
+	const u32 *ix, __m128 tx, __m128 ty)
+{
+	__m128 a0 = _mm_setr_ps(r0[ix[0]], r0[ix[1]], r0[ix[2]], r0[ix[3]]);
+	__m128 b0 = _mm_setr_ps(r0[ix[0] + 1], r0[ix[1] + 1], r0[ix[2] + 1], r0[ix[3] + 1]);
+	__m128 a1 = _mm_setr_ps(r1[ix[0]], r1[ix[1]], r1[ix[2]], r1[ix[3]]);
+	__m128 b1 = _mm_setr_ps(r1[ix[0] + 1], r1[ix[1] + 1], r1[ix[2] + 1], r1[ix[3] + 1]);
+	return lerp_sse2(lerp_sse2(a0, b0, tx), lerp_sse2(a1, b1, tx), ty);
+}
+
+TARGET_SSE2 static void interpolate2D_sse2(float *out, u32 count, const float *r0,
+	const float *r1, const u32 *ix, const float *tx, float ty)
+{
+	const __m128 vty = _mm_set1_ps(ty);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(out + i, bilerp_sse2(r0, r1, ix + i, _mm_loadu_ps(tx + i), vty));
+	interpolate2D_plain(out + i, count - i, r0, r1, ix + i, tx + i, ty);
+}
+
+TARGET_SSE2 static void interpolate3D_sse2(float *out, u32 count, const float *r00,
+	const float *r10, const float *r01, const float *r11,
+	const u32 *ix, const float *tx, float ty, float tz)
+{
+	const __m128 vty = _mm_set1_ps(ty);
+	const __m128 vtz = _mm_set1_ps(tz);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 t = _mm_loadu_ps(tx + i);
+		__m128 u = bilerp_sse2(r00, r10, ix + i, t, vty);
+		__m128 v = bilerp_sse2(r01, r11, ix + i, t, vty);
+		_mm_storeu_ps(out + i, lerp_sse2(u, v, vtz));
+	}
+	interpolate3D_plain(out + i, count - i, r00, r10, r01, r11,
+		ix + i, tx + i, ty, tz);
+}
+
+TARGET_SSE2 static inline __m128 absMask_sse2(bool absvalue)
+{
+	return _mm_castsi128_ps(_mm_set1_epi32(absvalue ? 0x7fffffff : -1));
+}
+
+TARGET_SSE2 static void accumulate_sse2(float *result, const float *gradient,
+	size_t count, float g, bool absvalue)
+{
+	const __m128 vg = _mm_set1_ps(g);
+	const __m128 mask = absMask_sse2(absvalue);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 grad = _mm_and_ps(_mm_loadu_ps(gradient + i), mask);
+		_mm_storeu_ps(result + i,
+			_mm_add_ps(_mm_loadu_ps(result + i), _mm_mul_ps(vg, grad)));
+	}
+	accumulate_plain(result + i, gradient + i, count - i, g, absvalue);
+}
+
+TARGET_SSE2 static void accumulatePersist_sse2(float *result, float *gmap,
+	const float *gradient, const float *persistence, size_t count, bool absvalue)
+{
+	const __m128 mask = absMask_sse2(absvalue);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 grad = _mm_and_ps(_mm_loadu_ps(gradient + i), mask);
+		__m128 g = _mm_loadu_ps(gmap + i);
+		_mm_storeu_ps(result + i,
+			_mm_add_ps(_mm_loadu_ps(result + i), _mm_mul_ps(g, grad)));
+		_mm_storeu_ps(gmap + i, _mm_mul_ps(g, _mm_loadu_ps(persistence + i)));
+	}
+	accumulatePersist_plain(result + i, gmap + i, gradient + i, persistence + i,
+		count - i, absvalue);
+}
+
+static const NoiseKernels kernels_sse2 = {
+	"sse2",
+	lattice2D_sse2,
+	lattice3D_sse2,
+	interpolate2D_sse2,
+	interpolate3D_sse2,
+	accumulate_sse2,
+	accumulatePersist_sse2,
+};
+
+/*
+	AVX2, 8 points at a time
+*/
+
+TARGET_AVX2 static inline __m256 hashToNoise_avx2(__m256i n)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	n = _mm256_and_si256(n, mask);
+	n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+	__m256i t = _mm256_mullo_epi32(_mm256_mullo_epi32(n, n),
+		_mm256_set1_epi32(60493));
+	t = _mm256_add_epi32(t, _mm256_set1_epi32(19990303));
+	t = _mm256_add_epi32(_mm256_mullo_epi32(n, t), _mm256_set1_epi32(1376312589));
+	n = _mm256_and_si256(t, mask);
+	__m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(n), _mm256_set1_ps(1.f / 0x40000000));
+	return _mm256_sub_ps(_mm256_set1_ps(1.f), f);
+}
+
+TARGET_AVX2 static void latticeRow_avx2(float *out, u32 count, s32 x0, u32 base)
+{
+	const u32 mx = NOISE_MAGIC_X;
+	__m256i n = _mm256_add_epi32(
+		_mm256_set1_epi32(mx * (u32)x0 + base),
+		_mm256_setr_epi32(0, mx, 2 * mx, 3 * mx, 4 * mx, 5 * mx, 6 * mx, 7 * mx));
+	const __m256i step = _mm256_set1_epi32(8 * mx);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm256_storeu_ps(out + i, hashToNoise_avx2(n));
+		n = _mm256_add_epi32(n, step);
+	}
+	latticeRow_plain(out + i, count - i, x0 + i, base);
+}
+
+TARGET_AVX2 static void lattice2D_avx2(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	latticeRow_avx2(out, count, x0, hashRowBase(y, 0, seed));
+}
+
+TARGET_AVX2 static void lattice3D_avx2(float *out, u32 count, s32 x0, s32 y, s32 z,
+	s32 seed)
+{
+	latticeRow_avx2(out, count, x0, hashRowBase(y, z, seed));
+}
+
+TARGET_AVX2 static inline __m256 lerp_avx2(__m256 v0, __m256 v1, __m256 t)
+{
+	return _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), t));
+}
+
+TARGET_AVX2 static inline __m256 bilerp_avx2(const float *r0, const float *r1,
+	__m256i ix, __m256 tx, __m256 ty)
+{
+	__m256 a0 = _mm256_i32gather_ps(r0, ix, 4);
+	__m256 b0 = _mm256_i32gather_ps(r0 + 1, ix, 4);
+	__m256 a1 = _mm256_i32gather_ps(r1, ix, 4);
+	__m256 b1 = _mm256_i32gather_ps(r1 + 1, ix, 4);
+	return lerp_avx2(lerp_avx2(a0, b0, tx), lerp_avx2(a1, b1, tx), ty);
+}
+
+TARGET_AVX2 static void interpolate2D_avx2(float *out, u32 count, const float *r0,
+	const float *r1, const u32 *ix, const float *tx, float ty)
+{
+	const __m256 vty = _mm256_set1_ps(ty);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(ix + i));
+		_mm256_storeu_ps(out + i,
+			bilerp_avx2(r0, r1, x, _mm256_loadu_ps(tx + i), vty));
+	}
+	interpolate2D_plain(out + i, count - i, r0, r1, ix + i, tx + i, ty);
+}
+
+TARGET_AVX2 static void interpolate3D_avx2(float *out, u32 count, const float *r00,
+	const float *r10, const float *r01, const float *r11,
+	const u32 *ix, const float *tx, float ty, float tz)
+{
+	const __m256 vty = _mm256_set1_ps(ty);
+	const __m256 vtz = _mm256_set1_ps(tz);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(ix + i));
+		__m256 t = _mm256_loadu_ps(tx + i);
+		__m256 u = bilerp_avx2(r00, r10, x, t, vty);
+		__m256 v = bilerp_avx2(r01, r11, x, t, vty);
+		_mm256_storeu_ps(out + i, lerp_avx2(u, v, vtz));
+	}
+	interpolate3D_plain(out + i, count - i, r00, r10, r01, r11,
+		ix + i, tx + i, ty, tz);
+}
+
+TARGET_AVX2 static inline __m256 absMask_avx2(bool absvalue)
+{
+	return _mm256_castsi256_ps(_mm256_set1_epi32(absvalue ? 0x7fffffff : -1));
+}
+
+TARGET_AVX2 static void accumulate_avx2(float *result, const float *gradient,
+	size_t count, float g, bool absvalue)
+{
+	const __m256 vg = _mm256_set1_ps(g);
+	const __m256 mask = absMask_avx2(absvalue);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 grad = _mm256_and_ps(_mm256_loadu_ps(gradient + i), mask);
+		_mm256_storeu_ps(result + i,
+			_mm256_add_ps(_mm256_loadu_ps(result + i), _mm256_mul_ps(vg, grad)));
+	}
+	accumulate_plain(result + i, gradient + i, count - i, g, absvalue);
+}
+
+TARGET_AVX2 static void accumulatePersist_avx2(float *result, float *gmap,
+	const float *gradient, const float *persistence, size_t count, bool absvalue)
+{
+	const __m256 mask = absMask_avx2(absvalue);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 grad = _mm256_and_ps(_mm256_loadu_ps(gradient + i), mask);
+		__m256 g = _mm256_loadu_ps(gmap + i);
+		_mm256_storeu_ps(result + i,
+			_mm256_add_ps(_mm256_loadu_ps(result + i), _mm256_mul_ps(g, grad)));
+		_mm256_storeu_ps(gmap + i, _mm256_mul_ps(g, _mm256_loadu_ps(persistence + i)));
+	}
+	accumulatePersist_plain(result + i, gmap + i, gradient + i, persistence + i,
+		count - i, absvalue);
+}
+
+static const NoiseKernels kernels_avx2 = {
+	"avx2",
+	lattice2D_avx2,
+	lattice3D_avx2,
+	interpolate2D_avx2,
+	interpolate3D_avx2,
+	accumulate_avx2,
+	accumulatePersist_avx2,
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+
+static bool cpuSupportsSSE2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool cpuSupportsAVX2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+static bool cpuSupportsSSE2()
+{
+	int info[4];
+	__cpuid(info, 1);
+	return info[3] & (1 << 26);
+}
+
+static bool cpuSupportsAVX2()
+{
+	int info[4];
+	__cpuid(info, 1);
+	// The OS must save the AVX registers
+	if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return info[1] & (1 << 5);
+}
+
+#endif
+
+#endif // NOISE_KERNELS_X86
+
+const std::vector<const NoiseKernels *> &getSupportedNoiseKernels()
+{
+	static const std::vector<const NoiseKernels *> supported = [] {
+		std::vector<const NoiseKernels *> list = {&kernels_plain};
+#ifdef NOISE_KERNELS_X86
+		if (cpuSupportsSSE2())
+			list.push_back(&kernels_sse2);
+		if (cpuSupportsAVX2())
+			list.push_back(&kernels_avx2);
+#endif
+		return list;
+	}();
+	return supported;
+}
+
+const NoiseKernels *getNoiseKernels()
+{
+	return getSupportedNoiseKernels().back();
+}
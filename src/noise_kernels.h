@@ -0,0 +1,71 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <vector>
+#include "irrlichttypes.h"
+
+/*
+	Inner loops of the noise maps of Noise.
+
+	Every implementation gives bit-identical results: the SIMD versions do the
+	same float operations in the same order as the plain one, without fused
+	multiply-add. The fastest one the CPU supports is picked at runtime.
+*/
+struct NoiseKernels
+{
+	const char *name;
+
+	// out[i] = noise2d(x0 + i, y, seed)
+	void (*lattice2D)(float *out, u32 count, s32 x0, s32 y, s32 seed);
+	// out[i] = noise3d(x0 + i, y, z, seed)
+	void (*lattice3D)(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed);
+
+	/*
+		Interpolates a row of a noise map. For every point i, ix[i] is the
+		lattice column to its left and tx[i] the position between it and the
+		next one. The lattice rows are r0 at y and r1 at y + 1, ty is the
+		position between them:
+		out[i] = lerp(lerp(r0[ix[i]], r0[ix[i] + 1], tx[i]),
+		              lerp(r1[ix[i]], r1[ix[i] + 1], tx[i]), ty)
+	*/
+	void (*interpolate2D)(float *out, u32 count, const float *r0,
+		const float *r1, const u32 *ix, const float *tx, float ty);
+	// Like interpolate2D, between the bilinear interpolations of the rows
+	// r00 (y, z) and r10 (y + 1, z), and of r01 (y, z + 1) and r11 (y + 1, z + 1)
+	void (*interpolate3D)(float *out, u32 count, const float *r00,
+		const float *r10, const float *r01, const float *r11,
+		const u32 *ix, const float *tx, float ty, float tz);
+
+	// result[i] += g * gradient[i], using |gradient[i]| if absvalue
+	void (*accumulate)(float *result, const float *gradient, size_t count,
+		float g, bool absvalue);
+	// result[i] += gmap[i] * gradient[i] (or |gradient[i]|),
+	// then gmap[i] *= persistence[i]
+	void (*accumulatePersist)(float *result, float *gmap, const float *gradient,
+		const float *persistence, size_t count, bool absvalue);
+};
+
+// The implementations this CPU supports, from the plain C++ one to the
+// fastest one
+const std::vector<const NoiseKernels *> &getSupportedNoiseKernels();
+
+// The fastest implementation this CPU supports
+const NoiseKernels *getNoiseKernels();
@@ -0,0 +1,899 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "pathfinder_hpa.h"
+#include <algorithm>
+#include <queue>
+#include <unordered_set>
+#include "debug.h"
+#include "log.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "threading/mutex_auto_lock.h"
+#include "threading/thread.h"
+
+// Seconds after which unused blocks and graphs are dropped
+#define CACHE_UNUSED_TIMEOUT 60.0f
+// Longer paths are not returned, like by the plain pathfinder
+#define PATH_MAX_WAYPOINTS 700
+// Times an async search may ask for more blocks before it gives up
+#define REQUEST_MAX_ROUNDS 32
+// Blocks between the ends of an async search that are added up front, at most
+#define REQUEST_MAX_PREFETCH 512
+
+namespace {
+
+enum NavNode : u8
+{
+	NAV_FREE,
+	NAV_WALKABLE,
+	NAV_IGNORE,
+};
+
+const v3s16 s_dirs[4] = {
+	v3s16(1, 0, 0),
+	v3s16(-1, 0, 0),
+	v3s16(0, 0, 1),
+	v3s16(0, 0, -1),
+};
+
+const PathNavBlock &getUnloadedBlock()
+{
+	static const PathNavBlock block = [] {
+		PathNavBlock b;
+		b.ignore.set();
+		return b;
+	}();
+	return block;
+}
+
+inline core::aabbox3d<s16> getBlockArea(v3s16 blockpos)
+{
+	v3s16 pmin = blockpos * MAP_BLOCKSIZE;
+	return core::aabbox3d<s16>(pmin,
+		pmin + v3s16(1, 1, 1) * (MAP_BLOCKSIZE - 1));
+}
+
+inline int getXZDistance(v3s16 a, v3s16 b)
+{
+	return std::abs(a.X - b.X) + std::abs(a.Z - b.Z);
+}
+
+struct OpenEntry
+{
+	int estimate;
+	u32 seq;
+	int cost;
+	v3s16 pos;
+
+	bool operator>(const OpenEntry &other) const
+	{
+		return estimate != other.estimate ? estimate > other.estimate :
+			seq > other.seq;
+	}
+};
+
+typedef std::priority_queue<OpenEntry, std::vector<OpenEntry>,
+	std::greater<OpenEntry>> OpenList;
+
+// A move across the face of a mapblock, see findCrossings()
+struct Crossing
+{
+	v3s16 from;
+	v3s16 to;
+	int cost;
+};
+
+class HierarchicalSearch
+{
+public:
+	HierarchicalSearch(PathNavSource *source, PathNavClusterCache *clusters,
+			int max_jump, int max_drop) :
+		m_source(source),
+		m_clusters(clusters),
+		m_max_jump(max_jump),
+		m_max_drop(max_drop),
+		m_range_up(std::max(1, (max_jump + MAP_BLOCKSIZE) / MAP_BLOCKSIZE)),
+		m_range_down(std::max(1, (max_drop + MAP_BLOCKSIZE) / MAP_BLOCKSIZE))
+	{}
+
+	NavNode getNode(v3s16 p);
+
+	bool isStandable(v3s16 p)
+	{
+		return getNode(p) == NAV_FREE && getNode(p - v3s16(0, 1, 0)) == NAV_WALKABLE;
+	}
+
+	// Same as Pathfinder::walkDownwards()
+	v3s16 walkDownwards(v3s16 pos, int max_down, s16 min_y);
+
+	bool find(v3s16 source, v3s16 destination,
+		const core::aabbox3d<s16> &block_limits, std::vector<v3s16> &path);
+
+	const std::vector<v3s16> &getMissing() const { return m_missing; }
+
+private:
+	struct LocalNode
+	{
+		int cost;
+		v3s16 parent;
+		bool closed;
+	};
+
+	struct AbstractNode
+	{
+		int cost;
+		v3s16 parent;
+		bool closed;
+	};
+
+	const PathNavBlock *getSourceBlock(v3s16 blockpos);
+
+	// Same as Pathfinder::calcCost(), without the search area limits.
+	// to is where the move ends.
+	bool move(v3s16 pos, v3s16 dir, v3s16 *to, int *cost);
+
+	// Searches the nodes in area reachable from `from` without leaving it,
+	// all of them or until goal is reached. If corridor is given, the
+	// mapblocks in it are the area instead.
+	bool searchLocal(v3s16 from, const core::aabbox3d<s16> &area,
+		const v3s16 *goal, const std::unordered_set<v3s16> *corridor = nullptr);
+	// Appends the path found by searchLocal() to goal, without `from`
+	void appendLocalPath(v3s16 from, v3s16 goal, std::vector<v3s16> &path);
+
+	// The moves out of a mapblock through the face towards s_dirs[dir], or
+	// through the top and bottom if dir is -1. One per group of neighbouring
+	// moves that land next to each other.
+	void findCrossings(v3s16 blockpos, int dir, std::vector<Crossing> &crossings);
+	// The blocks the graph of a mapblock is built from
+	void getClusterDeps(v3s16 blockpos, std::vector<v3s16> &deps);
+	std::shared_ptr<const PathNavCluster> getCluster(v3s16 blockpos);
+	std::shared_ptr<PathNavCluster> buildCluster(v3s16 blockpos);
+
+	PathNavSource *m_source;
+	PathNavClusterCache *m_clusters;
+	const int m_max_jump;
+	const int m_max_drop;
+	// Mapblocks a move may reach up and down
+	const s16 m_range_up;
+	const s16 m_range_down;
+
+	v3s16 m_last_blockpos;
+	const PathNavBlock *m_last_block = nullptr;
+	std::unordered_set<v3s16> m_missing_set;
+	std::vector<v3s16> m_missing;
+
+	// Graphs checked or built by this search
+	std::unordered_map<v3s16, std::shared_ptr<const PathNavCluster>> m_search_clusters;
+	std::unordered_map<v3s16, LocalNode> m_local;
+};
+
+const PathNavBlock *HierarchicalSearch::getSourceBlock(v3s16 blockpos)
+{
+	if (blockpos_over_max_limit(blockpos))
+		return &getUnloadedBlock();
+	const PathNavBlock *block = m_source->getBlock(blockpos);
+	if (block)
+		return block;
+	if (m_missing_set.insert(blockpos).second)
+		m_missing.push_back(blockpos);
+	return &getUnloadedBlock();
+}
+
+NavNode HierarchicalSearch::getNode(v3s16 p)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	if (!m_last_block || blockpos != m_last_blockpos) {
+		m_last_block = getSourceBlock(blockpos);
+		m_last_blockpos = blockpos;
+	}
+	v3s16 rel = p - blockpos * MAP_BLOCKSIZE;
+	u32 i = (rel.Z * MAP_BLOCKSIZE + rel.Y) * MAP_BLOCKSIZE + rel.X;
+	if (m_last_block->ignore[i])
+		return NAV_IGNORE;
+	return m_last_block->walkable[i] ? NAV_WALKABLE : NAV_FREE;
+}
+
+bool HierarchicalSearch::move(v3s16 pos, v3s16 dir, v3s16 *to, int *cost)
+{
+	const v3s16 pos2 = pos + dir;
+	const NavNode node2 = getNode(pos2);
+	if (node2 == NAV_IGNORE)
+		return false;
+
+	if (node2 == NAV_FREE) {
+		// Same height, or fall down to m_max_drop nodes
+		v3s16 testpos = pos2 - v3s16(0, 1, 0);
+		NavNode node = getNode(testpos);
+		while (node == NAV_FREE && pos2.Y - testpos.Y <= m_max_drop) {
+			testpos.Y--;
+			node = getNode(testpos);
+		}
+		if (node != NAV_WALKABLE)
+			return false;
+		*to = testpos + v3s16(0, 1, 0);
+		*cost = *to == pos2 ? 1 : 2;
+		return true;
+	}
+
+	// Jump up to m_max_jump nodes, with nothing above our head
+	v3s16 targetpos = pos2;
+	v3s16 jumppos = pos;
+	NavNode node_target = node2;
+	while (node_target == NAV_WALKABLE) {
+		if (getNode(jumppos) != NAV_FREE || targetpos.Y - pos2.Y >= m_max_jump)
+			return false;
+		targetpos.Y++;
+		jumppos.Y++;
+		node_target = getNode(targetpos);
+	}
+	if (node_target != NAV_FREE || getNode(jumppos) != NAV_FREE)
+		return false;
+	*to = targetpos;
+	*cost = 2;
+	return true;
+}
+
+v3s16 HierarchicalSearch::walkDownwards(v3s16 pos, int max_down, s16 min_y)
+{
+	if (max_down == 0)
+		return pos;
+	v3s16 testpos = pos;
+	NavNode node = getNode(testpos);
+	int down = 0;
+	while (node == NAV_FREE && testpos.Y > min_y && down <= max_down) {
+		testpos.Y--;
+		down++;
+		node = getNode(testpos);
+	}
+	if (testpos.Y >= min_y && node == NAV_WALKABLE) {
+		if (down == 0)
+			pos = testpos;
+		else if (down - 1 <= max_down)
+			pos = testpos + v3s16(0, 1, 0);
+	}
+	return pos;
+}
+
+bool HierarchicalSearch::searchLocal(v3s16 from,
+	const core::aabbox3d<s16> &area, const v3s16 *goal,
+	const std::unordered_set<v3s16> *corridor)
+{
+	m_local.clear();
+	OpenList open;
+	u32 seq = 0;
+	m_local[from] = {0, from, false};
+	open.push({goal ? getXZDistance(from, *goal) : 0, seq++, 0, from});
+
+	while (!open.empty()) {
+		const OpenEntry entry = open.top();
+		open.pop();
+		LocalNode &node = m_local[entry.pos];
+		if (node.closed || entry.cost != node.cost)
+			continue;
+		node.closed = true;
+		if (goal && entry.pos == *goal)
+			return true;
+
+		for (const v3s16 &dir : s_dirs) {
+			const v3s16 pos2 = entry.pos + dir;
+			if (!corridor && (pos2.X < area.MinEdge.X || pos2.X > area.MaxEdge.X ||
+					pos2.Z < area.MinEdge.Z || pos2.Z > area.MaxEdge.Z))
+				continue;
+			v3s16 to;
+			int cost;
+			if (!move(entry.pos, dir, &to, &cost))
+				continue;
+			if (corridor ? !corridor->count(getNodeBlockPos(to)) :
+					!area.isPointInside(to))
+				continue;
+			cost += node.cost;
+			auto it = m_local.find(to);
+			if (it != m_local.end() && (it->second.closed || it->second.cost <= cost))
+				continue;
+			m_local[to] = {cost, entry.pos, false};
+			open.push({cost + (goal ? getXZDistance(to, *goal) : 0), seq++, cost, to});
+		}
+	}
+	return !goal;
+}
+
+void HierarchicalSearch::appendLocalPath(v3s16 from, v3s16 goal,
+	std::vector<v3s16> &path)
+{
+	const size_t start = path.size();
+	for (v3s16 pos = goal; pos != from; pos = m_local[pos].parent)
+		path.push_back(pos);
+	std::reverse(path.begin() + start, path.end());
+}
+
+void HierarchicalSearch::findCrossings(v3s16 blockpos, int dir_index,
+	std::vector<Crossing> &crossings)
+{
+	const v3s16 base = blockpos * MAP_BLOCKSIZE;
+	const s16 last = MAP_BLOCKSIZE - 1;
+	std::vector<Crossing> found;
+
+	auto add = [&] (v3s16 from, v3s16 dir) {
+		Crossing c;
+		c.from = from;
+		if (isStandable(from) && move(from, dir, &c.to, &c.cost))
+			found.push_back(c);
+	};
+
+	if (dir_index >= 0) {
+		const v3s16 dir = s_dirs[dir_index];
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+		for (s16 t = 0; t < MAP_BLOCKSIZE; t++) {
+			if (dir.X != 0)
+				add(base + v3s16(dir.X > 0 ? last : 0, y, t), dir);
+			else
+				add(base + v3s16(t, y, dir.Z > 0 ? last : 0), dir);
+		}
+	} else {
+		// Only moves near the top and the bottom may leave through them
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+			if (y + m_max_jump < MAP_BLOCKSIZE && y - m_max_drop >= 0)
+				continue;
+			for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+			for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+			for (const v3s16 &dir : s_dirs) {
+				const v3s16 rel2 = v3s16(x, y, z) + dir;
+				if (rel2.X < 0 || rel2.X > last || rel2.Z < 0 || rel2.Z > last)
+					continue;
+				const size_t count = found.size();
+				add(base + v3s16(x, y, z), dir);
+				if (found.size() > count &&
+						getNodeBlockPos(found.back().to) == blockpos)
+					found.pop_back();
+			}
+		}
+	}
+
+	// Crossings next to each other on both sides lead from and to the same
+	// places, so one of each such group is enough
+	auto touches = [] (v3s16 a, v3s16 b) {
+		return a.Y == b.Y && getXZDistance(a, b) <= 1;
+	};
+	std::unordered_map<v3s16, std::vector<u32>> by_from;
+	std::vector<u32> group(found.size());
+	auto root = [&] (u32 i) {
+		while (group[i] != i)
+			i = group[i] = group[group[i]];
+		return i;
+	};
+	for (u32 i = 0; i < found.size(); i++) {
+		group[i] = i;
+		const Crossing &c = found[i];
+		for (const v3s16 &d : {v3s16(0, 0, 0), s_dirs[0], s_dirs[1], s_dirs[2], s_dirs[3]}) {
+			auto it = by_from.find(c.from + d);
+			if (it == by_from.end())
+				continue;
+			for (u32 j : it->second) {
+				if (touches(c.to, found[j].to) &&
+						getNodeBlockPos(c.to) == getNodeBlockPos(found[j].to))
+					group[root(i)] = root(j);
+			}
+		}
+		by_from[c.from].push_back(i);
+	}
+
+	// Keep the middle one
+	std::unordered_map<u32, std::vector<u32>> members;
+	for (u32 i = 0; i < found.size(); i++)
+		members[root(i)].push_back(i);
+	std::vector<u32> chosen;
+	for (auto &it : members)
+		chosen.push_back(it.second[it.second.size() / 2]);
+	std::sort(chosen.begin(), chosen.end());
+	for (u32 i : chosen)
+		crossings.push_back(found[i]);
+}
+
+void HierarchicalSearch::getClusterDeps(v3s16 blockpos, std::vector<v3s16> &deps)
+{
+	// Crossings into this mapblock start up to m_range_down above or
+	// m_range_up below, and look that far themselves
+	const s16 ymin = blockpos.Y - m_range_up - m_range_down - 1;
+	const s16 ymax = blockpos.Y + m_range_up + m_range_down;
+	deps.clear();
+	for (const v3s16 &column : {v3s16(0, 0, 0), s_dirs[0], s_dirs[1],
+			s_dirs[2], s_dirs[3]}) {
+		for (s16 y = ymin; y <= ymax; y++)
+			deps.emplace_back(blockpos.X + column.X, y, blockpos.Z + column.Z);
+	}
+}
+
+std::shared_ptr<PathNavCluster> HierarchicalSearch::buildCluster(v3s16 blockpos)
+{
+	auto cluster = std::make_shared<PathNavCluster>();
+	std::vector<v3s16> deps;
+	getClusterDeps(blockpos, deps);
+	cluster->deps.reserve(deps.size());
+	for (v3s16 dep : deps)
+		cluster->deps.push_back(getSourceBlock(dep)->id);
+
+	// Ways out
+	std::vector<Crossing> crossings;
+	for (int dir = -1; dir < 4; dir++)
+		findCrossings(blockpos, dir, crossings);
+	for (const Crossing &c : crossings)
+		cluster->edges[c.from].push_back({c.to, c.cost});
+
+	// Ways in, as seen by the neighbours
+	for (int dir = -1; dir < 4; dir++) {
+		const v3s16 column = dir >= 0 ? blockpos - s_dirs[dir] : blockpos;
+		for (s16 dy = -m_range_up; dy <= m_range_down; dy++) {
+			if (dir < 0 && dy == 0)
+				continue;
+			crossings.clear();
+			findCrossings(column + v3s16(0, dy, 0), dir, crossings);
+			for (const Crossing &c : crossings) {
+				if (getNodeBlockPos(c.to) == blockpos)
+					cluster->edges[c.to];
+			}
+		}
+	}
+
+	// Ways between them
+	const core::aabbox3d<s16> area = getBlockArea(blockpos);
+	for (auto &it : cluster->edges) {
+		searchLocal(it.first, area, nullptr);
+		for (auto &it2 : cluster->edges) {
+			if (it2.first == it.first)
+				continue;
+			auto reached = m_local.find(it2.first);
+			if (reached != m_local.end())
+				it.second.push_back({it2.first, reached->second.cost});
+		}
+	}
+	return cluster;
+}
+
+std::shared_ptr<const PathNavCluster> HierarchicalSearch::getCluster(v3s16 blockpos)
+{
+	auto it = m_search_clusters.find(blockpos);
+	if (it != m_search_clusters.end())
+		return it->second;
+
+	std::shared_ptr<const PathNavCluster> cluster =
+		m_clusters->get(blockpos, m_max_jump, m_max_drop);
+	if (cluster) {
+		std::vector<v3s16> deps;
+		getClusterDeps(blockpos, deps);
+		for (size_t i = 0; i < deps.size(); i++) {
+			if (getSourceBlock(deps[i])->id != cluster->deps[i]) {
+				cluster = nullptr;
+				break;
+			}
+		}
+	}
+
+	if (!cluster) {
+		const size_t missing = m_missing.size();
+		std::shared_ptr<PathNavCluster> built = buildCluster(blockpos);
+		// Not cached if built without some blocks
+		if (m_missing.size() == missing)
+			m_clusters->set(blockpos, m_max_jump, m_max_drop, built);
+		cluster = built;
+	}
+	m_search_clusters[blockpos] = cluster;
+	return cluster;
+}
+
+bool HierarchicalSearch::find(v3s16 source, v3s16 destination,
+	const core::aabbox3d<s16> &block_limits, std::vector<v3s16> &path)
+{
+	const v3s16 dest_blockpos = getNodeBlockPos(destination);
+	std::unordered_map<v3s16, AbstractNode> nodes;
+	OpenList open;
+	u32 seq = 0;
+	std::vector<PathNavCluster::Edge> edges;
+
+	nodes[source] = {0, source, false};
+	open.push({getXZDistance(source, destination), seq++, 0, source});
+
+	while (!open.empty()) {
+		const OpenEntry entry = open.top();
+		open.pop();
+		AbstractNode &node = nodes[entry.pos];
+		if (node.closed || entry.cost != node.cost)
+			continue;
+		node.closed = true;
+		if (entry.pos == destination)
+			break;
+
+		const v3s16 blockpos = getNodeBlockPos(entry.pos);
+		std::shared_ptr<const PathNavCluster> cluster = getCluster(blockpos);
+		auto portal = cluster->edges.find(entry.pos);
+		if (portal != cluster->edges.end()) {
+			edges = portal->second;
+		} else {
+			// The source, not a portal: find the portals it can reach
+			edges.clear();
+			searchLocal(entry.pos, getBlockArea(blockpos), nullptr);
+			for (auto &it : cluster->edges) {
+				auto reached = m_local.find(it.first);
+				if (reached != m_local.end())
+					edges.push_back({it.first, reached->second.cost});
+			}
+		}
+		if (blockpos == dest_blockpos &&
+				searchLocal(entry.pos, getBlockArea(blockpos), &destination))
+			edges.push_back({destination, m_local[destination].cost});
+
+		for (const PathNavCluster::Edge &edge : edges) {
+			if (!block_limits.isPointInside(getNodeBlockPos(edge.to)))
+				continue;
+			const int cost = node.cost + edge.cost;
+			auto it = nodes.find(edge.to);
+			if (it != nodes.end() && (it->second.closed || it->second.cost <= cost))
+				continue;
+			nodes[edge.to] = {cost, entry.pos, false};
+			open.push({cost + getXZDistance(edge.to, destination), seq++, cost,
+				edge.to});
+		}
+	}
+
+	auto found = nodes.find(destination);
+	if (found == nodes.end() || !found->second.closed)
+		return false;
+
+	// The abstract path goes through the portals, so it zigzags. The path
+	// is searched again within the mapblocks it goes through instead.
+	std::unordered_set<v3s16> corridor;
+	for (v3s16 pos = destination; pos != source; pos = nodes[pos].parent)
+		corridor.insert(getNodeBlockPos(pos));
+	corridor.insert(getNodeBlockPos(source));
+	if (!searchLocal(source, core::aabbox3d<s16>(), &destination, &corridor))
+		return false;
+
+	path.clear();
+	path.push_back(source);
+	appendLocalPath(source, destination, path);
+	if (path.size() > PATH_MAX_WAYPOINTS) {
+		warningstream << "Pathfinder: path is too long (too many waypoints), "
+			"aborting" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Gives a search the blocks of its request only
+class RequestSource : public PathNavSource
+{
+public:
+	RequestSource(const PathNavRequest &request) : m_request(request) {}
+
+	const PathNavBlock *getBlock(v3s16 blockpos) override
+	{
+		auto it = m_request.blocks.find(blockpos);
+		return it != m_request.blocks.end() ? it->second.get() : nullptr;
+	}
+
+private:
+	const PathNavRequest &m_request;
+};
+
+}
+
+std::vector<v3s16> get_path_hierarchical(PathNavSource *source,
+		PathNavClusterCache *clusters,
+		v3s16 pos1, v3s16 pos2,
+		unsigned int searchdistance,
+		unsigned int max_jump,
+		unsigned int max_drop,
+		std::vector<v3s16> *missing)
+{
+	HierarchicalSearch search(source, clusters, max_jump, max_drop);
+	std::vector<v3s16> path;
+
+	const s16 limit = MAX_MAP_GENERATION_LIMIT;
+	const s32 dist = std::min<u32>(searchdistance, limit);
+	auto clamp = [&] (s32 v) -> s16 { return rangelim(v, -limit, limit); };
+	const v3s16 pmin(clamp(std::min(pos1.X, pos2.X) - dist),
+		clamp(std::min(pos1.Y, pos2.Y) - dist),
+		clamp(std::min(pos1.Z, pos2.Z) - dist));
+	const v3s16 pmax(clamp(std::max(pos1.X, pos2.X) + dist),
+		clamp(std::max(pos1.Y, pos2.Y) + dist),
+		clamp(std::max(pos1.Z, pos2.Z) + dist));
+	const core::aabbox3d<s16> block_limits(getNodeBlockPos(pmin),
+		getNodeBlockPos(pmax));
+
+	// Like Pathfinder::getPath()
+	if (search.getNode(pos1) == NAV_WALKABLE || search.getNode(pos2) == NAV_WALKABLE)
+		return path;
+	const v3s16 source_pos = search.walkDownwards(pos1, max_drop, pmin.Y);
+	const v3s16 dest_pos = search.walkDownwards(pos2, max_jump, pmin.Y);
+
+	if (search.isStandable(source_pos) && search.isStandable(dest_pos) &&
+			search.find(source_pos, dest_pos, block_limits, path)) {
+		if (source_pos != pos1)
+			path.insert(path.begin(), pos1);
+		if (dest_pos != pos2)
+			path.push_back(pos2);
+	} else {
+		path.clear();
+	}
+
+	if (missing) {
+		const std::vector<v3s16> &lacked = search.getMissing();
+		missing->insert(missing->end(), lacked.begin(), lacked.end());
+	}
+	return path;
+}
+
+/*
+	PathNavClusterCache
+*/
+
+std::shared_ptr<const PathNavCluster> PathNavClusterCache::get(v3s16 blockpos,
+	u32 max_jump, u32 max_drop)
+{
+	MutexAutoLock lock(m_mutex);
+	auto it = m_clusters.find(std::min(max_jump, 0xffffU) << 16 |
+		std::min(max_drop, 0xffffU));
+	if (it == m_clusters.end())
+		return nullptr;
+	auto it2 = it->second.find(blockpos);
+	if (it2 == it->second.end())
+		return nullptr;
+	it2->second->unused_time = 0.0f;
+	return it2->second;
+}
+
+void PathNavClusterCache::set(v3s16 blockpos, u32 max_jump, u32 max_drop,
+	std::shared_ptr<PathNavCluster> cluster)
+{
+	MutexAutoLock lock(m_mutex);
+	m_clusters[std::min(max_jump, 0xffffU) << 16 |
+		std::min(max_drop, 0xffffU)][blockpos] = std::move(cluster);
+}
+
+void PathNavClusterCache::step(float dtime, float timeout)
+{
+	MutexAutoLock lock(m_mutex);
+	for (auto it = m_clusters.begin(); it != m_clusters.end();) {
+		auto &clusters = it->second;
+		for (auto it2 = clusters.begin(); it2 != clusters.end();) {
+			it2->second->unused_time += dtime;
+			if (it2->second->unused_time > timeout)
+				it2 = clusters.erase(it2);
+			else
+				++it2;
+		}
+		if (clusters.empty())
+			it = m_clusters.erase(it);
+		else
+			++it;
+	}
+}
+
+void PathNavClusterCache::clear()
+{
+	MutexAutoLock lock(m_mutex);
+	m_clusters.clear();
+}
+
+size_t PathNavClusterCache::size()
+{
+	MutexAutoLock lock(m_mutex);
+	size_t count = 0;
+	for (auto &it : m_clusters)
+		count += it.second.size();
+	return count;
+}
+
+/*
+	PathNavThread
+*/
+
+class PathNavThread : public Thread
+{
+public:
+	PathNavThread(PathNavCache *cache) : Thread("Pathfinder"), m_cache(cache) {}
+
+	void *run() override
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			std::unique_ptr<PathNavRequest> request =
+				m_cache->m_requests.pop_frontNoEx(100);
+			if (!request)
+				continue;
+
+			RequestSource source(*request);
+			request->missing.clear();
+			request->path = get_path_hierarchical(&source, &m_cache->m_clusters,
+				request->pos1, request->pos2, request->searchdistance,
+				request->max_jump, request->max_drop, &request->missing);
+			m_cache->m_results.push_back(std::move(request));
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return nullptr;
+	}
+
+private:
+	PathNavCache *m_cache;
+};
+
+/*
+	PathNavCache
+*/
+
+PathNavCache::PathNavCache(Map *map, const NodeDefManager *ndef, u32 num_threads) :
+	m_map(map),
+	m_ndef(ndef)
+{
+	auto unloaded = std::make_shared<PathNavBlock>(getUnloadedBlock());
+	m_unloaded = unloaded;
+
+	for (u32 i = 0; i < std::max(num_threads, 1U); i++) {
+		m_threads.emplace_back(new PathNavThread(this));
+		m_threads.back()->start();
+	}
+}
+
+PathNavCache::~PathNavCache()
+{
+	for (auto &thread : m_threads)
+		thread->stop();
+	for (auto &thread : m_threads)
+		thread->wait();
+
+	// The threads hand back every request they took, so these are all
+	// the pending ones
+	for (auto *queue : {&m_requests, &m_results}) {
+		while (std::unique_ptr<PathNavRequest> request = queue->pop_frontNoEx(0)) {
+			m_pending--;
+			request->callback({}, true, request->callback_param);
+		}
+	}
+	assert(m_pending == 0);
+}
+
+void PathNavCache::onMapEditEvent(const MapEditEvent &event)
+{
+	for (v3s16 blockpos : event.modified_blocks)
+		m_blocks.erase(blockpos);
+}
+
+PathNavBlockPtr PathNavCache::getBlockPtr(v3s16 blockpos)
+{
+	auto it = m_blocks.find(blockpos);
+	if (it != m_blocks.end()) {
+		it->second.unused_time = 0.0f;
+		return it->second.block;
+	}
+
+	MapBlock *block = blockpos_over_max_limit(blockpos) ? nullptr :
+		m_map->getBlockNoCreateNoEx(blockpos);
+	// Not kept, the block may be loaded later
+	if (!block)
+		return m_unloaded;
+
+	auto nav = std::make_shared<PathNavBlock>();
+	nav->id = m_next_id++;
+	u32 i = 0;
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++, i++) {
+		const content_t c = block->getNodeNoCheck(x, y, z).getContent();
+		if (c == CONTENT_IGNORE)
+			nav->ignore.set(i);
+		else if (m_ndef->get(c).walkable)
+			nav->walkable.set(i);
+	}
+	m_blocks[blockpos].block = nav;
+	return nav;
+}
+
+const PathNavBlock *PathNavCache::getBlock(v3s16 blockpos)
+{
+	return getBlockPtr(blockpos).get();
+}
+
+std::vector<v3s16> PathNavCache::findPath(v3s16 pos1, v3s16 pos2,
+	unsigned int searchdistance, unsigned int max_jump, unsigned int max_drop)
+{
+	return get_path_hierarchical(this, &m_clusters, pos1, pos2,
+		searchdistance, max_jump, max_drop, nullptr);
+}
+
+void PathNavCache::addBlocks(PathNavRequest &request,
+	const std::vector<v3s16> &blockposes)
+{
+	for (v3s16 blockpos : blockposes) {
+		PathNavBlockPtr &block = request.blocks[blockpos];
+		if (!block)
+			block = getBlockPtr(blockpos);
+	}
+}
+
+void PathNavCache::findPathAsync(v3s16 pos1, v3s16 pos2,
+	unsigned int searchdistance, unsigned int max_jump, unsigned int max_drop,
+	PathFoundCallback callback, void *callback_param)
+{
+	auto request = std::make_unique<PathNavRequest>();
+	request->pos1 = pos1;
+	request->pos2 = pos2;
+	request->searchdistance = searchdistance;
+	request->max_jump = max_jump;
+	request->max_drop = max_drop;
+	request->callback = callback;
+	request->callback_param = callback_param;
+
+	// The blocks between the ends, or only those around them if too many.
+	// The search asks for any others it needs.
+	v3s16 bpmin = getNodeBlockPos(pos1), bpmax = bpmin;
+	const v3s16 bp2 = getNodeBlockPos(pos2);
+	bpmin.set(std::min(bpmin.X, bp2.X), std::min(bpmin.Y, bp2.Y),
+		std::min(bpmin.Z, bp2.Z));
+	bpmax.set(std::max(bpmax.X, bp2.X), std::max(bpmax.Y, bp2.Y),
+		std::max(bpmax.Z, bp2.Z));
+	bpmin -= v3s16(1, 1, 1);
+	bpmax += v3s16(1, 1, 1);
+	const v3s16 extent = bpmax - bpmin + v3s16(1, 1, 1);
+	std::vector<v3s16> blockposes;
+	if ((s32)extent.X * extent.Y * extent.Z <= REQUEST_MAX_PREFETCH) {
+		v3s16 bp;
+		for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+		for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+		for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++)
+			blockposes.push_back(bp);
+	} else {
+		for (v3s16 center : {getNodeBlockPos(pos1), bp2}) {
+			v3s16 d;
+			for (d.Z = -1; d.Z <= 1; d.Z++)
+			for (d.Y = -1; d.Y <= 1; d.Y++)
+			for (d.X = -1; d.X <= 1; d.X++)
+				blockposes.push_back(center + d);
+		}
+	}
+	addBlocks(*request, blockposes);
+
+	m_requests.push_back(std::move(request));
+	m_pending++;
+}
+
+void PathNavCache::step(float dtime)
+{
+	while (std::unique_ptr<PathNavRequest> request = m_results.pop_frontNoEx(0)) {
+		if (request->path.empty() && !request->missing.empty() &&
+				++request->rounds < REQUEST_MAX_ROUNDS) {
+			addBlocks(*request, request->missing);
+			m_requests.push_back(std::move(request));
+			continue;
+		}
+		m_pending--;
+		request->callback(request->path, false, request->callback_param);
+	}
+
+	for (auto it = m_blocks.begin(); it != m_blocks.end();) {
+		it->second.unused_time += dtime;
+		if (it->second.unused_time > CACHE_UNUSED_TIMEOUT)
+			it = m_blocks.erase(it);
+		else
+			++it;
+	}
+	m_clusters.step(dtime, CACHE_UNUSED_TIMEOUT);
+}
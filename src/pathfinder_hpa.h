@@ -0,0 +1,202 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <bitset>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+#include "constants.h"
+#include "map.h"
+#include "util/container.h"
+
+class NodeDefManager;
+class PathNavThread;
+
+// Walkability of the nodes of a mapblock. Never changed once built: a block
+// that changes gets a new PathNavBlock.
+struct PathNavBlock
+{
+	// Index (z * MAP_BLOCKSIZE + y) * MAP_BLOCKSIZE + x
+	std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> walkable;
+	std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> ignore;
+	// Unique for every block built, 0 for blocks that are not loaded
+	u64 id = 0;
+};
+
+typedef std::shared_ptr<const PathNavBlock> PathNavBlockPtr;
+
+// Where a search takes its blocks from
+class PathNavSource
+{
+public:
+	virtual ~PathNavSource() = default;
+
+	// nullptr if the block is not available (yet)
+	virtual const PathNavBlock *getBlock(v3s16 blockpos) = 0;
+};
+
+// Abstract graph of a mapblock, for one max_jump and max_drop
+struct PathNavCluster
+{
+	struct Edge
+	{
+		v3s16 to;
+		int cost;
+	};
+
+	// Outgoing edges of the portals of the mapblock: the nodes paths enter
+	// or leave it through
+	std::unordered_map<v3s16, std::vector<Edge>> edges;
+	// Ids of the blocks it depends on, in the order of getClusterDeps()
+	std::vector<u64> deps;
+	float unused_time = 0.0f;
+};
+
+// Abstract graphs shared by all searches, see PathNavCache
+class PathNavClusterCache
+{
+public:
+	std::shared_ptr<const PathNavCluster> get(v3s16 blockpos, u32 max_jump,
+		u32 max_drop);
+	void set(v3s16 blockpos, u32 max_jump, u32 max_drop,
+		std::shared_ptr<PathNavCluster> cluster);
+
+	// Drops the graphs not used for timeout seconds
+	void step(float dtime, float timeout);
+	void clear();
+	size_t size();
+
+private:
+	std::mutex m_mutex;
+	// By max_jump << 16 | max_drop, then blockpos
+	std::unordered_map<u32, std::unordered_map<v3s16,
+		std::shared_ptr<PathNavCluster>>> m_clusters;
+};
+
+/*
+	HPA* search over the mapblocks of source.
+
+	Mapblocks are clusters, and the nodes that paths enter or leave them
+	through are portals: one per group of neighbouring moves out of the
+	mapblock that land next to each other. The paths between the portals
+	of a mapblock are searched once, when its graph is built, and cached in
+	clusters; the graph stays valid until one of the blocks it was built from
+	changes. A search walks the graph of portals, then searches the path
+	again within the mapblocks the portals it took are in.
+
+	Moves are those of the plain A* pathfinder. searchdistance is honoured at
+	mapblock granularity.
+
+	Returns an empty path if none was found. Blocks source could not provide
+	are added to missing; the result is not valid then.
+*/
+std::vector<v3s16> get_path_hierarchical(PathNavSource *source,
+		PathNavClusterCache *clusters,
+		v3s16 pos1, v3s16 pos2,
+		unsigned int searchdistance,
+		unsigned int max_jump,
+		unsigned int max_drop,
+		std::vector<v3s16> *missing);
+
+// cancelled is set for searches dropped when the cache is deleted
+typedef void (*PathFoundCallback)(const std::vector<v3s16> &path,
+		bool cancelled, void *param);
+
+// A search run by find_path_async()
+struct PathNavRequest
+{
+	v3s16 pos1;
+	v3s16 pos2;
+	unsigned int searchdistance;
+	unsigned int max_jump;
+	unsigned int max_drop;
+	PathFoundCallback callback;
+	void *callback_param;
+
+	// The blocks the search may use
+	std::unordered_map<v3s16, PathNavBlockPtr> blocks;
+	// Blocks the search lacked, to be added before it runs again
+	std::vector<v3s16> missing;
+	u32 rounds = 0;
+	std::vector<v3s16> path;
+};
+
+/*
+	Walkability of the blocks of the server map, built when searches need them
+	and dropped when the map changes, and the pathfinder threads.
+
+	Everything but the cluster cache is only used from the server thread. The
+	threads get their own set of blocks with every request: whatever a search
+	lacks is added by step() and the search runs again.
+*/
+class PathNavCache : public MapEventReceiver, public PathNavSource
+{
+public:
+	PathNavCache(Map *map, const NodeDefManager *ndef, u32 num_threads);
+	~PathNavCache();
+
+	void onMapEditEvent(const MapEditEvent &event) override;
+	const PathNavBlock *getBlock(v3s16 blockpos) override;
+
+	// Runs the search right away
+	std::vector<v3s16> findPath(v3s16 pos1, v3s16 pos2,
+		unsigned int searchdistance, unsigned int max_jump,
+		unsigned int max_drop);
+
+	// Runs the search on a pathfinder thread. callback is called from step(),
+	// or from the destructor if the search is still pending then.
+	void findPathAsync(v3s16 pos1, v3s16 pos2, unsigned int searchdistance,
+		unsigned int max_jump, unsigned int max_drop,
+		PathFoundCallback callback, void *callback_param);
+
+	// Calls the callbacks of finished searches and drops unused blocks
+	void step(float dtime);
+
+	size_t getBlockCount() const { return m_blocks.size(); }
+	size_t getPendingCount() const { return m_pending; }
+
+private:
+	friend class PathNavThread;
+
+	struct CachedBlock
+	{
+		PathNavBlockPtr block;
+		float unused_time = 0.0f;
+	};
+
+	PathNavBlockPtr getBlockPtr(v3s16 blockpos);
+	// Adds those of the blocks the request does not have yet
+	void addBlocks(PathNavRequest &request, const std::vector<v3s16> &blockposes);
+
+	Map *m_map;
+	const NodeDefManager *m_ndef;
+	u64 m_next_id = 1;
+	std::unordered_map<v3s16, CachedBlock> m_blocks;
+	PathNavBlockPtr m_unloaded;
+	PathNavClusterCache m_clusters;
+
+	std::vector<std::unique_ptr<PathNavThread>> m_threads;
+	MutexedQueue<std::unique_ptr<PathNavRequest>> m_requests;
+	MutexedQueue<std::unique_ptr<PathNavRequest>> m_results;
+	size_t m_pending = 0;
+};
@@ -257,6 +257,56 @@ void ScriptApiEnv::on_emerge_area_completion(
 	}
 }
 
+void ScriptApiEnv::on_path_found(const std::vector<v3s16> &path,
+	ScriptCallbackState *state)
+{
+	Server *server = getServer();
+
+	// Like on_emerge_area_completion(), this runs with envlock held
+
+	SCRIPTAPI_PRECHECKHEADER
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, state->callback_ref);
+	luaL_checktype(L, -1, LUA_TFUNCTION);
+
+	if (path.empty()) {
+		lua_pushnil(L);
+	} else {
+		lua_createtable(L, path.size(), 0);
+		for (size_t i = 0; i < path.size(); i++) {
+			push_v3s16(L, path[i]);
+			lua_rawseti(L, -2, i + 1);
+		}
+	}
+	lua_rawgeti(L, LUA_REGISTRYINDEX, state->args_ref);
+
+	setOriginDirect(state->origin.c_str());
+
+	try {
+		PCALL_RES(lua_pcall(L, 2, 0, error_handler));
+	} catch (LuaError &e) {
+		// Note: don't throw here, we still need to run the cleanup code below
+		server->setAsyncFatalError(e);
+	}
+
+	lua_pop(L, 1); // Pop error handler
+
+	luaL_unref(L, LUA_REGISTRYINDEX, state->callback_ref);
+	luaL_unref(L, LUA_REGISTRYINDEX, state->args_ref);
+}
+
+void ScriptApiEnv::on_path_cancelled(ScriptCallbackState *state)
+{
+	// The environment is being deleted, so don't call back into it
+
+	SCRIPTAPI_PRECHECKHEADER
+
+	luaL_unref(L, LUA_REGISTRYINDEX, state->callback_ref);
+	luaL_unref(L, LUA_REGISTRYINDEX, state->args_ref);
+}
+
 void ScriptApiEnv::check_for_falling(v3s16 p)
 {
 	SCRIPTAPI_PRECHECKHEADER
@@ -44,6 +44,12 @@ class ScriptApiEnv : virtual public ScriptApiBase
 	void on_emerge_area_completion(v3s16 blockpos, int action,
 		ScriptCallbackState *state);
 
+	// Called when a search queued from core.find_path_async() is done
+	void on_path_found(const std::vector<v3s16> &path,
+		ScriptCallbackState *state);
+	// Called instead if the server shuts down before the search is done
+	void on_path_cancelled(ScriptCallbackState *state);
+
 	void check_for_falling(v3s16 p);
 
 	// Called after liquid transform changes
@@ -36,6 +36,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen/treegen.h"
 #include "emerge_internal.h"
 #include "pathfinder.h"
+#include "pathfinder_hpa.h"
 #include "face_position_cache.h"
 #include "remoteplayer.h"
 #include "server/luaentity_sao.h"
@@ -245,6 +246,23 @@ void LuaEmergeAreaCallback(v3s16 blockpos, EmergeAction action, void *param)
 		delete state;
 }
 
+void LuaPathFoundCallback(const std::vector<v3s16> &path, bool cancelled,
+	void *param)
+{
+	ScriptCallbackState *state = (ScriptCallbackState *)param;
+	assert(state != NULL);
+	assert(state->script != NULL);
+
+	// Called from ServerEnvironment::step(), with envlock held, or when the
+	// environment is deleted
+	state->refcount--;
+	if (cancelled)
+		state->script->on_path_cancelled(state);
+	else
+		state->script->on_path_found(path, state);
+	delete state;
+}
+
 /* Exported functions */
 
 // set_node(pos, node)
@@ -1016,7 +1034,7 @@ int ModApiEnv::l_find_nodes_in_area(lua_State *L)
 	bool grouped = lua_isboolean(L, 4) && readParam<bool>(L, 4);
 
 	auto iterate = [&] (auto &&callback) {
-		map.forEachNodeInArea(minp, maxp, callback);
+		map.forEachNodeInAreaWithContent(minp, maxp, filter, callback);
 	};
 	return findNodesInArea(L, ndef, filter, grouped, iterate);
 }
@@ -1319,6 +1337,7 @@ int ModApiEnv::l_find_path(lua_State *L)
 	unsigned int max_jump       = luaL_checkint(L, 4);
 	unsigned int max_drop       = luaL_checkint(L, 5);
 	PathAlgorithm algo          = PA_PLAIN_NP;
+	bool hierarchical           = false;
 	if (!lua_isnoneornil(L, 6)) {
 		std::string algorithm = luaL_checkstring(L,6);
 
@@ -1327,10 +1346,18 @@ int ModApiEnv::l_find_path(lua_State *L)
 
 		if (algorithm == "Dijkstra")
 			algo = PA_DIJKSTRA;
+
+		if (algorithm == "HPA*")
+			hierarchical = true;
 	}
 
-	std::vector<v3s16> path = get_path(&env->getServerMap(), env->getGameDef()->ndef(), pos1, pos2,
-		searchdistance, max_jump, max_drop, algo);
+	std::vector<v3s16> path;
+	if (hierarchical)
+		path = env->getPathNavCache()->findPath(pos1, pos2, searchdistance,
+			max_jump, max_drop);
+	else
+		path = get_path(&env->getServerMap(), env->getGameDef()->ndef(), pos1, pos2,
+			searchdistance, max_jump, max_drop, algo);
 
 	if (!path.empty()) {
 		lua_createtable(L, path.size(), 0);
@@ -1348,6 +1375,39 @@ int ModApiEnv::l_find_path(lua_State *L)
 	return 0;
 }
 
+// find_path_async(pos1, pos2, searchdistance,
+//     max_jump, max_drop, callback, [param])
+// searches like find_path with "HPA*" on a pathfinder thread,
+// then calls callback(path, param)
+int ModApiEnv::l_find_path_async(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	v3s16 pos1                  = read_v3s16(L, 1);
+	v3s16 pos2                  = read_v3s16(L, 2);
+	unsigned int searchdistance = luaL_checkint(L, 3);
+	unsigned int max_jump       = luaL_checkint(L, 4);
+	unsigned int max_drop       = luaL_checkint(L, 5);
+	luaL_checktype(L, 6, LUA_TFUNCTION);
+
+	lua_pushvalue(L, 6);
+	int callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	lua_pushvalue(L, 7);
+	int args_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	ScriptCallbackState *state = new ScriptCallbackState;
+	state->script       = getServer(L)->getScriptIface();
+	state->callback_ref = callback_ref;
+	state->args_ref     = args_ref;
+	state->refcount     = 1;
+	state->origin       = getScriptApiBase(L)->getOrigin();
+
+	env->getPathNavCache()->findPathAsync(pos1, pos2, searchdistance,
+		max_jump, max_drop, LuaPathFoundCallback, state);
+	return 0;
+}
+
 // spawn_tree(pos, treedef)
 int ModApiEnv::l_spawn_tree(lua_State *L)
 {
@@ -1483,6 +1543,7 @@ void ModApiEnv::Initialize(lua_State *L, int top)
 	API_FCT(clear_objects);
 	API_FCT(spawn_tree);
 	API_FCT(find_path);
+	API_FCT(find_path_async);
 	API_FCT(line_of_sight);
 	API_FCT(raycast);
 	API_FCT(transforming_liquid_add);
@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "cpp_api/s_security.h"
 #include "scripting_server.h"
 #include "server.h"
+#include "server/pregenerator.h"
 #include "environment.h"
 #include "remoteplayer.h"
 #include "log.h"
@@ -70,6 +71,33 @@ int ModApiServer::l_get_server_max_lag(lua_State *L)
 	return 1;
 }
 
+// get_pregen_progress()
+int ModApiServer::l_get_pregen_progress(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	MapPregenerator *pregen = getServer(L)->getMapPregenerator();
+	if (!pregen || !pregen->isEnabled())
+		return 0;
+
+	MapPregenerator::Progress progress = pregen->getProgress();
+	lua_createtable(L, 0, 4);
+	setintfield(L, -1, "done", progress.done);
+	setintfield(L, -1, "total", progress.total);
+	setboolfield(L, -1, "paused", progress.paused);
+	setboolfield(L, -1, "throttled", progress.throttled);
+	return 1;
+}
+
+// set_pregen_paused(paused)
+int ModApiServer::l_set_pregen_paused(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	MapPregenerator *pregen = getServer(L)->getMapPregenerator();
+	if (pregen)
+		pregen->setPaused(readParam<bool>(L, 1));
+	return 0;
+}
+
 // print(text)
 int ModApiServer::l_print(lua_State *L)
 {
@@ -240,6 +268,26 @@ int ModApiServer::l_get_player_information(lua_State *L)
 		lua_settable(L, table);
 	}
 
+	float bandwidth, pacing_rate, congestion_window;
+	bool have_congestion_info =
+		getConInfo(con::BANDWIDTH, &bandwidth) &&
+		getConInfo(con::PACING_RATE, &pacing_rate) &&
+		getConInfo(con::CONGESTION_WINDOW, &congestion_window);
+
+	if (have_congestion_info) {
+		lua_pushstring(L, "bandwidth");
+		lua_pushnumber(L, bandwidth);
+		lua_settable(L, table);
+
+		lua_pushstring(L, "pacing_rate");
+		lua_pushnumber(L, pacing_rate);
+		lua_settable(L, table);
+
+		lua_pushstring(L, "congestion_window");
+		lua_pushnumber(L, congestion_window);
+		lua_settable(L, table);
+	}
+
 	lua_pushstring(L,"connection_uptime");
 	lua_pushnumber(L, info.uptime);
 	lua_settable(L, table);
@@ -256,6 +304,18 @@ int ModApiServer::l_get_player_information(lua_State *L)
 	lua_pushstring(L, info.lang_code.c_str());
 	lua_settable(L, table);
 
+	lua_pushstring(L, "object_bytes");
+	lua_pushnumber(L, info.object_bytes);
+	lua_settable(L, table);
+
+	lua_pushstring(L, "object_bandwidth");
+	lua_pushnumber(L, info.object_bandwidth);
+	lua_settable(L, table);
+
+	lua_pushstring(L, "object_updates_coalesced");
+	lua_pushnumber(L, info.object_updates_coalesced);
+	lua_settable(L, table);
+
 #ifndef NDEBUG
 	lua_pushstring(L,"serialization_version");
 	lua_pushnumber(L, info.ser_vers);
@@ -889,6 +949,8 @@ void ModApiServer::Initialize(lua_State *L, int top)
 	API_FCT(get_server_status);
 	API_FCT(get_server_uptime);
 	API_FCT(get_server_max_lag);
+	API_FCT(get_pregen_progress);
+	API_FCT(set_pregen_paused);
 	API_FCT(get_worldpath);
 	API_FCT(is_singleplayer);
 
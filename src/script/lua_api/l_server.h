@@ -38,6 +38,12 @@ class ModApiServer : public ModApiBase
 	// get_server_max_lag()
 	static int l_get_server_max_lag(lua_State *L);
 
+	// get_pregen_progress()
+	static int l_get_pregen_progress(lua_State *L);
+
+	// set_pregen_paused(paused)
+	static int l_set_pregen_paused(lua_State *L);
+
 	// get_worldpath()
 	static int l_get_worldpath(lua_State *L);
 
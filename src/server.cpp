@@ -64,6 +64,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "chat_interface.h"
 #include "remoteplayer.h"
 #include "server/player_sao.h"
+#include "server/pregenerator.h"
 #include "server/serverinventorymgr.h"
 #include "translation.h"
 #include "database/database-sqlite3.h"
@@ -264,7 +265,8 @@ Server::Server(
 			512,
 			CONNECTION_TIMEOUT,
 			m_bind_addr.isIPv6(),
-			this)),
+			this,
+			g_settings->getU32("connection_send_threads"))),
 	m_itemdef(createItemDefManager()),
 	m_nodedef(createNodeDefManager()),
 	m_craftdef(createCraftDefManager()),
@@ -360,8 +362,12 @@ Server::~Server()
 	// server-controlled resources (like ModStorages). Also do them before
 	// shutdown callbacks since they may modify state that is finalized in a
 	// callback.
+	if (m_pregen)
+		m_pregen->stop();
 	if (m_emerge)
 		m_emerge->stopThreads();
+	if (m_pregen)
+		m_pregen->save();
 
 	if (m_env) {
 		MutexAutoLock envlock(m_env_mutex);
@@ -396,6 +402,7 @@ Server::~Server()
 	}
 
 	// Delete things in the reverse order of creation
+	m_pregen.reset();
 	delete m_emerge;
 	delete m_env;
 	delete m_rollback;
@@ -522,6 +529,10 @@ void Server::init()
 	// Initialize mapgens
 	m_emerge->initMapgens(servermap->getMapgenParams());
 
+	m_pregen = std::make_unique<MapPregenerator>(m_emerge, m_path_world,
+		m_metrics_backend.get());
+	m_pregen->load(servermap->getMapgenParams()->chunksize);
+
 	if (g_settings->getBool("enable_rollback_recording")) {
 		// Create rollback manager
 		m_rollback = new RollbackManager(m_path_world, this);
@@ -892,11 +903,46 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 			const RemoteClientMap &clients = m_clients.getClientList();
 			// Route data to every client
 			std::string reliable_data, unreliable_data;
+			std::vector<ObjectInterest::DueUpdate> due_updates;
 			for (const auto &client_it : clients) {
 				reliable_data.clear();
 				unreliable_data.clear();
 				RemoteClient *client = client_it.second;
 				PlayerSAO *player = getPlayerSAO(client->peer_id);
+				ObjectInterest &interest = client->m_object_interest;
+				const bool use_snapshots = client->net_proto_version >= 51;
+
+				if (player) {
+					v3f camera_dir(0, 0, 1);
+					camera_dir.rotateYZBy(player->getLookPitch());
+					camera_dir.rotateXZBy(player->getRotation().Y);
+					if (player->getCameraInverted())
+						camera_dir = -camera_dir;
+					interest.step(dtime, player->getEyePosition(), camera_dir,
+						player->getFov());
+				}
+
+				auto append_message = [] (std::string &buffer, u16 id,
+						const std::string &data) {
+					char idbuf[2];
+					writeU16((u8*) idbuf, id);
+					// u16 id
+					// std::string data
+					buffer.append(idbuf, sizeof(idbuf));
+					buffer.append(serializeString16(data));
+				};
+
+				// Only the latest position goes into the snapshot
+				auto send_position = [&] (u16 id, const std::string &data, f32 interval) {
+					std::string message = data;
+					ObjectInterest::setUpdateInterval(message, interval);
+					ObjectState state;
+					if (use_snapshots && state.fromPositionCommand(message))
+						client->m_object_snapshots.add(id, state);
+					else
+						append_message(unreliable_data, id, message);
+				};
+
 				// Go through all objects in message buffer
 				for (const auto &buffered_message : buffered_messages) {
 					// If object does not exist or is not known by client, skip it
@@ -920,29 +966,43 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 							if (parent && client->m_known_objects.find(parent->getId()) !=
 									client->m_known_objects.end())
 								continue;
+
+							// Far and unseen objects are updated less often
+							f32 interval;
+							if (interest.update(id, sao->getBasePosition(),
+									aom.datastring, interval))
+								send_position(id, aom.datastring, interval);
+							continue;
 						}
 
 						// Add full new data to appropriate buffer
-						std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
-						char idbuf[2];
-						writeU16((u8*) idbuf, aom.id);
-						// u16 id
-						// std::string data
-						buffer.append(idbuf, sizeof(idbuf));
-						buffer.append(serializeString16(aom.datastring));
+						append_message(aom.reliable ? reliable_data : unreliable_data,
+							aom.id, aom.datastring);
 					}
 				}
+
+				// Position updates that were held back and are due now
+				due_updates.clear();
+				interest.release(due_updates);
+				for (const ObjectInterest::DueUpdate &update : due_updates)
+					send_position(update.id, update.data, update.interval);
+
 				/*
 					reliable_data and unreliable_data are now ready.
 					Send them.
 				*/
 				if (!reliable_data.empty()) {
 					SendActiveObjectMessages(client->peer_id, reliable_data);
+					interest.countSent(2 + reliable_data.size());
 				}
 
 				if (!unreliable_data.empty()) {
 					SendActiveObjectMessages(client->peer_id, unreliable_data, false);
+					interest.countSent(2 + unreliable_data.size());
 				}
+
+				if (!client->m_object_snapshots.empty())
+					SendObjectSnapshot(client);
 			}
 		}
 
@@ -1058,6 +1118,9 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 		}
 	}
 
+	// Pre-generate the map while there is time to spare
+	m_pregen->step(dtime);
+
 	// Save map, players and auth stuff
 	{
 		float &counter = m_savemap_timer;
@@ -1083,6 +1146,9 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 
 			// Save environment metadata
 			m_env->saveMeta();
+
+			// Save pre-generation progress
+			m_pregen->save();
 		}
 	}
 
@@ -1391,6 +1457,10 @@ bool Server::getClientInfo(session_t peer_id, ClientInfo &ret)
 
 	ret.lang_code = client->getLangCode();
 
+	ret.object_bytes = client->m_object_interest.getBytesSent();
+	ret.object_bandwidth = client->m_object_interest.getBandwidth();
+	ret.object_updates_coalesced = client->m_object_interest.getUpdatesCoalesced();
+
 	return true;
 }
 
@@ -1591,6 +1661,24 @@ void Server::SendInventory(RemotePlayer *player, bool incremental)
 
 	UpdateCrafting(player);
 
+	// Only the modified slots if the lists are the same
+	if (incremental && player->protocol_version >= 52) {
+		std::ostringstream os(std::ios::binary);
+		if (player->inventory.serializeDelta(os)) {
+			InventoryLocation loc;
+			loc.setCurrentPlayer();
+
+			NetworkPacket pkt(TOCLIENT_INVENTORY_DELTA, 0, player->getPeerId());
+			pkt << loc.dump();
+			pkt.putRawString(os.str());
+			Send(&pkt);
+
+			player->inventory.setModified(false);
+			player->setModified(true);
+			return;
+		}
+	}
+
 	/*
 		Serialize it
 	*/
@@ -2185,6 +2273,8 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 
 		// Remove from known objects
 		client->m_known_objects.erase(id);
+		client->m_object_snapshots.removeObject(id);
+		client->m_object_interest.removeObject(id);
 
 		if (obj && obj->m_known_by_count > 0)
 			obj->m_known_by_count--;
@@ -2228,12 +2318,26 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 	NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_REMOVE_ADD, data.size(), client->peer_id);
 	pkt.putRawString(data.c_str(), data.size());
 	Send(&pkt);
+	client->m_object_interest.countSent(2 + pkt.getSize());
 
 	verbosestream << "Server::SendActiveObjectRemoveAdd: "
 		<< removed_count << " removed, " << added_count << " added, "
 		<< "packet size is " << pkt.getSize() << std::endl;
 }
 
+void Server::SendObjectSnapshot(RemoteClient *client)
+{
+	std::string data;
+	client->m_object_snapshots.write(data);
+
+	NetworkPacket pkt(TOCLIENT_OBJECT_SNAPSHOT, data.size(), client->peer_id);
+	pkt.putRawString(data.c_str(), data.size());
+
+	auto &ccf = clientCommandFactoryTable[pkt.getCommand()];
+	m_clients.sendCustom(pkt.getPeerId(), ccf.channel, &pkt, ccf.reliable);
+	client->m_object_interest.countSent(2 + pkt.getSize());
+}
+
 void Server::SendActiveObjectMessages(session_t peer_id, const std::string &datas,
 		bool reliable)
 {
@@ -2777,7 +2881,10 @@ bool Server::addMediaFile(std::string filename,
 		*digest_to = digest;
 
 	// Put in list
+	if (m_media.count(filename))
+		unindexMedia(filename);
 	m_media[filename] = MediaInfo(filepath, sha1_base64);
+	m_media_by_sha1[digest] = filename;
 	verbosestream << "Server: " << sha1_hex << " is " << filename
 			<< std::endl;
 
@@ -2820,6 +2927,27 @@ void Server::fillMediaCache()
 	infostream << "Server: " << m_media.size() << " media files collected" << std::endl;
 }
 
+void Server::unindexMedia(const std::string &filename)
+{
+	auto it = m_media.find(filename);
+	if (it == m_media.end())
+		return;
+	const std::string &sha1_base64 = it->second.sha1_digest;
+	auto index_it = m_media_by_sha1.find(base64_decode(sha1_base64));
+	if (index_it == m_media_by_sha1.end() || index_it->second != filename)
+		return;
+
+	// Another announced file may have the same content
+	for (const auto &other : m_media) {
+		if (other.first != filename && !other.second.no_announce &&
+				other.second.sha1_digest == sha1_base64) {
+			index_it->second = other.first;
+			return;
+		}
+	}
+	m_media_by_sha1.erase(index_it);
+}
+
 void Server::sendMediaAnnouncement(session_t peer_id, const std::string &lang_code)
 {
 	std::string lang_suffix = ".";
@@ -2971,6 +3099,62 @@ void Server::sendRequestedMedia(session_t peer_id,
 	}
 }
 
+void Server::sendMediaChunks(session_t peer_id,
+		const std::vector<std::pair<std::string, u32>> &requests)
+{
+	auto *client = getClient(peer_id, CS_DefinitionsSent);
+	assert(client);
+
+	u32 unknown = 0, refused = 0;
+	for (const auto &request : requests) {
+		const std::string &sha1 = request.first;
+		const u32 offset = request.second;
+
+		// Only announced media can be fetched by content
+		const MediaInfo *info = nullptr;
+		auto name_it = m_media_by_sha1.find(sha1);
+		if (name_it != m_media_by_sha1.end()) {
+			auto it = m_media.find(name_it->second);
+			if (it != m_media.end() && !it->second.no_announce)
+				info = &it->second;
+		}
+
+		std::string data;
+		u64 file_size = 0;
+		if (!info) {
+			unknown++;
+		} else if (!fs::ReadFilePart(info->path, offset, MEDIA_CHUNK_SIZE,
+				data, file_size) || file_size > U32_MAX) {
+			errorstream << "Server::sendMediaChunks(): Failed to read \""
+					<< info->path << "\"" << std::endl;
+			data.clear();
+			file_size = 0;
+		} else if (!client->markMediaChunkSent(sha1, file_size, data.size())) {
+			refused++;
+			data.clear();
+			file_size = 0;
+		}
+
+		// A file size of 0 tells the client that the file can't be sent,
+		// unless it is empty
+		NetworkPacket pkt(TOCLIENT_MEDIA_CHUNK, 2 + 20 + 4 + 4 + 4 + data.size(),
+				peer_id);
+		pkt << sha1 << (u32)file_size << offset;
+		pkt.putLongString(data);
+		Send(&pkt);
+	}
+
+	if (unknown > 0) {
+		infostream << "Server::sendMediaChunks(): " << client->getName()
+			<< " asked for " << unknown << " unknown files" << std::endl;
+	}
+	if (refused > 0) {
+		warningstream << "Server::sendMediaChunks(): " << client->getName()
+			<< " asked for " << refused << " media chunks again, "
+			"not sending them" << std::endl;
+	}
+}
+
 void Server::stepPendingDynMediaCallbacks(float dtime)
 {
 	MutexAutoLock lock(m_env_mutex);
@@ -2991,6 +3175,7 @@ void Server::stepPendingDynMediaCallbacks(float dtime)
 			sanity_check(m_media[name].no_announce);
 
 			fs::DeleteSingleFileOrEmptyDirectory(m_media[name].path);
+			unindexMedia(name);
 			m_media.erase(name);
 		}
 		getScriptIface()->freeDynamicMediaCallback(it->first);
@@ -3014,11 +3199,24 @@ void Server::SendMinimapModes(session_t peer_id,
 	Send(&pkt);
 }
 
-void Server::sendDetachedInventory(Inventory *inventory, const std::string &name, session_t peer_id)
+void Server::sendDetachedInventory(Inventory *inventory, const std::string &name,
+		session_t peer_id, bool incremental)
 {
 	NetworkPacket pkt(TOCLIENT_DETACHED_INVENTORY, 0, peer_id);
 	pkt << name;
 
+	// Only the modified slots if the lists are the same
+	std::ostringstream delta_os(std::ios_base::binary);
+	bool send_delta = incremental && inventory &&
+		inventory->serializeDelta(delta_os);
+	NetworkPacket delta_pkt(TOCLIENT_INVENTORY_DELTA, 0, peer_id);
+	if (send_delta) {
+		InventoryLocation loc;
+		loc.setDetached(name);
+		delta_pkt << loc.dump();
+		delta_pkt.putRawString(delta_os.str());
+	}
+
 	if (!inventory) {
 		pkt << false; // Remove inventory
 	} else {
@@ -3027,17 +3225,28 @@ void Server::sendDetachedInventory(Inventory *inventory, const std::string &name
 		// Serialization & NetworkPacket isn't a love story
 		std::ostringstream os(std::ios_base::binary);
 		inventory->serialize(os);
-		inventory->setModified(false);
 
 		const std::string &os_str = os.str();
 		pkt << static_cast<u16>(os_str.size()); // HACK: to keep compatibility with 5.0.0 clients
 		pkt.putRawString(os_str);
 	}
 
-	if (peer_id == PEER_ID_INEXISTENT)
-		m_clients.sendToAll(&pkt);
-	else
-		Send(&pkt);
+	if (peer_id == PEER_ID_INEXISTENT) {
+		if (send_delta)
+			m_clients.sendToAllCompat(&delta_pkt, &pkt, 52);
+		else
+			m_clients.sendToAll(&pkt);
+	} else {
+		RemoteClient *client = getClientNoEx(peer_id, CS_Created);
+		if (send_delta && client && client->net_proto_version >= 52)
+			Send(&delta_pkt);
+		else
+			Send(&pkt);
+	}
+
+	// The others don't have the changes yet
+	if (inventory && peer_id == PEER_ID_INEXISTENT)
+		inventory->setModified(false);
 }
 
 void Server::sendDetachedInventories(session_t peer_id, bool incremental)
@@ -3048,8 +3257,8 @@ void Server::sendDetachedInventories(session_t peer_id, bool incremental)
 		peer_name = getClient(peer_id, CS_Created)->getName();
 	}
 
-	auto send_cb = [this, peer_id](const std::string &name, Inventory *inv) {
-		sendDetachedInventory(inv, name, peer_id);
+	auto send_cb = [this, peer_id, incremental](const std::string &name, Inventory *inv) {
+		sendDetachedInventory(inv, name, peer_id, incremental);
 	};
 
 	m_inventory_mgr->sendDetachedInventories(peer_name, incremental, send_cb);
@@ -3222,6 +3431,7 @@ void Server::DeleteClient(session_t peer_id, ClientDeletionReason reason)
 			MutexAutoLock env_lock(m_env_mutex);
 			m_clients.DeleteClient(peer_id);
 		}
+		m_emerge->removePeer(peer_id);
 	}
 
 	// Send leave chat message to all remaining clients
@@ -3899,6 +4109,7 @@ bool Server::dynamicAddMedia(const DynamicMediaArgs &a)
 			if (filepath.empty()) {
 				errorstream << "Server: failed creating a copy of media file \""
 					<< filename << "\"" << std::endl;
+				unindexMedia(filename);
 				m_media.erase(filename);
 				return false;
 			}
@@ -3907,6 +4118,7 @@ bool Server::dynamicAddMedia(const DynamicMediaArgs &a)
 			media_it->second.path = filepath;
 		}
 
+		unindexMedia(filename);
 		media_it->second.no_announce = true;
 		// stepPendingDynMediaCallbacks will clean the file up later
 	} else if (a.data) {
@@ -3916,6 +4128,7 @@ bool Server::dynamicAddMedia(const DynamicMediaArgs &a)
 	}
 	if (!a.to_player.empty()) {
 		// only sent to one player (who must be online), so shouldn't announce.
+		unindexMedia(filename);
 		media_it->second.no_announce = true;
 	}
 
@@ -62,6 +62,7 @@ struct PlayerHPChangeReason;
 class IRollbackManager;
 struct RollbackAction;
 class EmergeManager;
+class MapPregenerator;
 class ServerScripting;
 class ServerEnvironment;
 struct SoundSpec;
@@ -144,6 +145,8 @@ struct ClientInfo {
 	u16 prot_vers;
 	u8 major, minor, patch;
 	std::string vers_string, lang_code;
+	u64 object_bytes, object_updates_coalesced;
+	f32 object_bandwidth;
 };
 
 class Server : public con::PeerHandler, public MapEventReceiver,
@@ -209,6 +212,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void handleCommand_SrpBytesM(NetworkPacket* pkt);
 	void handleCommand_HaveMedia(NetworkPacket *pkt);
 	void handleCommand_UpdateClientInfo(NetworkPacket *pkt);
+	void handleCommand_ObjectSnapshotAck(NetworkPacket *pkt);
+	void handleCommand_InventoryResync(NetworkPacket *pkt);
+	void handleCommand_MediaChunkRequest(NetworkPacket *pkt);
 	void handleCommand_Lua_Packet(NetworkPacket *pkt);
 	void handleCommand_Lua_Packet_Stream(NetworkPacket *pkt);
 
@@ -284,7 +290,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	bool dynamicAddMedia(const DynamicMediaArgs &args);
 
 	ServerInventoryManager *getInventoryMgr() const { return m_inventory_mgr.get(); }
-	void sendDetachedInventory(Inventory *inventory, const std::string &name, session_t peer_id);
+	void sendDetachedInventory(Inventory *inventory, const std::string &name,
+		session_t peer_id, bool incremental = false);
 
 	// Envlock and conlock should be locked when using scriptapi
 	ServerScripting *getScriptIface(){ return m_script; }
@@ -302,6 +309,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	virtual u16 allocateUnknownNodeId(const std::string &name);
 	IRollbackManager *getRollbackManager() { return m_rollback; }
 	virtual EmergeManager *getEmergeManager() { return m_emerge; }
+	MapPregenerator *getMapPregenerator() { return m_pregen.get(); }
 	virtual ModStorageDatabase *getModStorageDatabase() { return m_mod_storage_database; }
 
 	IWritableItemDefManager* getWritableItemDefManager();
@@ -556,9 +564,14 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	bool addMediaFile(std::string filename, const std::string &filepath,
 			std::string *filedata = nullptr, std::string *digest = nullptr);
 	void fillMediaCache();
+	// Call before a media file is removed or stops being announced
+	void unindexMedia(const std::string &filename);
 	void sendMediaAnnouncement(session_t peer_id, const std::string &lang_code);
 	void sendRequestedMedia(session_t peer_id,
 			const std::unordered_set<std::string> &tosend);
+	// `requests` are pairs of raw SHA1 and offset
+	void sendMediaChunks(session_t peer_id,
+			const std::vector<std::pair<std::string, u32>> &requests);
 	void stepPendingDynMediaCallbacks(float dtime);
 
 	// Adds a ParticleSpawner on peer with peer_id (PEER_ID_INEXISTENT == all)
@@ -572,6 +585,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		const ParticleParameters &p);
 
 	void SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersao);
+	void SendObjectSnapshot(RemoteClient *client);
 	void SendActiveObjectMessages(session_t peer_id, const std::string &datas,
 		bool reliable = true);
 	void SendCSMRestrictionFlags(session_t peer_id);
@@ -663,6 +677,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Emerge manager
 	EmergeManager *m_emerge = nullptr;
 
+	// Background map generation
+	std::unique_ptr<MapPregenerator> m_pregen;
+
 	// Scripting
 	// Envlock and conlock should be locked when using Lua
 	ServerScripting *m_script = nullptr;
@@ -749,6 +766,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	// media files known to server
 	std::unordered_map<std::string, MediaInfo> m_media;
+	// raw SHA1 -> name of an announced media file with that content
+	std::unordered_map<std::string, std::string> m_media_by_sha1;
 
 	// pending dynamic media callbacks, clients inform the server when they have a file fetched
 	std::unordered_map<u32, PendingDynamicMediaCallback> m_pending_dyn_media;
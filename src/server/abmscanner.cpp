@@ -0,0 +1,196 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "abmscanner.h"
+#include "map.h"
+#include "mapblock.h"
+#include "util/basic_macros.h"
+#include "util/numeric.h"
+
+// Blocks per thread below which the scan is not split further
+#define ABM_SCAN_MIN_BLOCKS_PER_THREAD 8
+
+/*
+	ABMScanner
+*/
+
+ABMScanner::ABMScanner(u32 num_threads) :
+	m_runner("ABMScan", num_threads ? num_threads :
+			MYMAX(1U, MYMIN(4U, Thread::getNumberOfProcessors() / 2)))
+{
+	m_tasks.resize(m_runner.getThreadCount());
+}
+
+void ABMScanner::clearABMs()
+{
+	m_aabms.clear();
+	m_check_neighbors = false;
+}
+
+void ABMScanner::addABM(const ActiveABM &aabm, const std::vector<content_t> &contents)
+{
+	for (content_t c : contents) {
+		if (c >= m_aabms.size())
+			m_aabms.resize(c + 256);
+		m_aabms[c].push_back(aabm);
+	}
+	m_check_neighbors |= aabm.check_required_neighbors;
+}
+
+bool ABMScanner::wantsBlock(MapBlock *block) const
+{
+	// Check the content index first
+	// to see whether there are any ABMs
+	// to be run at all for this block.
+	for (const auto &entry : block->getContentIndex().getEntries()) {
+		if (entry.content < m_aabms.size() && !m_aabms[entry.content].empty())
+			return true;
+	}
+	return false;
+}
+
+void ABMScanner::scan(Map *map, const std::vector<MapBlock *> &blocks,
+		std::vector<ABMTrigger> &out, ABMScanStats *stats)
+{
+	if (m_aabms.empty())
+		return;
+
+	// Neighbors are looked up here, Map can't be used by several threads
+	m_scan_blocks.clear();
+	for (MapBlock *block : blocks) {
+		// Blocks without an index yet are left to the workers
+		if (block->hasContentIndex()) {
+			stats->blocks_cached++;
+			if (!wantsBlock(block))
+				continue;
+		}
+
+		ABMScanBlock sb;
+		sb.block = block;
+		const v3s16 blockpos = block->getPos();
+		u32 i = 0;
+		for (s16 z = -1; z <= 1; z++)
+		for (s16 y = -1; y <= 1; y++)
+		for (s16 x = -1; x <= 1; x++, i++) {
+			if (x == 0 && y == 0 && z == 0)
+				sb.neighbors[i] = block;
+			else if (m_check_neighbors)
+				sb.neighbors[i] = map->getBlockNoCreateNoEx(blockpos + v3s16(x, y, z));
+			else
+				sb.neighbors[i] = nullptr;
+		}
+		m_scan_blocks.push_back(sb);
+	}
+	if (m_scan_blocks.empty())
+		return;
+
+	const size_t count = m_scan_blocks.size();
+	const size_t num_tasks = MYMAX((size_t)1, MYMIN(m_tasks.size(),
+			count / ABM_SCAN_MIN_BLOCKS_PER_THREAD));
+	const size_t chunk = (count + num_tasks - 1) / num_tasks;
+	for (size_t i = 0; i < num_tasks; i++) {
+		Task &task = m_tasks[i];
+		task.scanner = this;
+		task.begin = m_scan_blocks.data() + MYMIN(count, i * chunk);
+		task.end = m_scan_blocks.data() + MYMIN(count, (i + 1) * chunk);
+		task.rand.seed(((u64)myrand() << 32) | myrand());
+		task.triggers.clear();
+		task.stats = ABMScanStats();
+	}
+	m_runner.run(num_tasks, [this] (u32 begin, u32 end) {
+		for (u32 i = begin; i < end; i++)
+			m_tasks[i].run();
+	});
+
+	for (size_t i = 0; i < num_tasks; i++) {
+		const Task &task = m_tasks[i];
+		out.insert(out.end(), task.triggers.begin(), task.triggers.end());
+		stats->blocks_scanned += task.stats.blocks_scanned;
+	}
+}
+
+// Content of a node at most one node outside of the scanned block
+static content_t getNeighborContent(const ABMScanBlock &sb, v3s16 p)
+{
+	const int bx = p.X < 0 ? 0 : (p.X >= MAP_BLOCKSIZE ? 2 : 1);
+	const int by = p.Y < 0 ? 0 : (p.Y >= MAP_BLOCKSIZE ? 2 : 1);
+	const int bz = p.Z < 0 ? 0 : (p.Z >= MAP_BLOCKSIZE ? 2 : 1);
+	MapBlock *block = sb.neighbors[bz * 9 + by * 3 + bx];
+	if (!block)
+		return CONTENT_IGNORE;
+	return block->getNodeNoCheck(p - v3s16(bx - 1, by - 1, bz - 1) * MAP_BLOCKSIZE)
+		.getContent();
+}
+
+void ABMScanner::scanBlock(const ABMScanBlock &sb, PcgRandom &rand,
+		std::vector<ABMTrigger> &out, ABMScanStats &stats) const
+{
+	MapBlock *block = sb.block;
+	stats.blocks_scanned++;
+
+	const v3s16 relpos = block->getPosRelative();
+
+	// Only the nodes with ABMs are visited
+	for (const auto &entry : block->getContentIndex().getEntries()) {
+		const content_t c = entry.content;
+		if (c >= m_aabms.size() || m_aabms[c].empty())
+			continue;
+
+		for (u16 i : entry.positions) {
+			const v3s16 p0 = MapBlockContentIndex::getPos(i);
+			const MapNode n = block->getNodeNoCheck(p0);
+			const v3s16 p = p0 + relpos;
+			for (const ActiveABM &aabm : m_aabms[c]) {
+				if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
+					continue;
+
+				if (rand.range((u32)aabm.chance) != 0)
+					continue;
+
+				// Check neighbors
+				if (aabm.check_required_neighbors) {
+					bool found = false;
+					v3s16 p1;
+					for(p1.X = p0.X-1; p1.X <= p0.X+1 && !found; p1.X++)
+					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1 && !found; p1.Y++)
+					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1 && !found; p1.Z++)
+					{
+						if (p1 == p0)
+							continue;
+						content_t c1 = block->isValidPosition(p1) ?
+							block->getNodeNoCheck(p1).getContent() :
+							getNeighborContent(sb, p1);
+						found = CONTAINS(aabm.required_neighbors, c1);
+					}
+					// No required neighbor found
+					if (!found)
+						continue;
+				}
+
+				out.push_back({aabm.abm, p, n});
+			}
+		}
+	}
+}
+
+void ABMScanner::Task::run()
+{
+	for (const ABMScanBlock *sb = begin; sb != end; ++sb)
+		scanner->scanBlock(*sb, rand, triggers, stats);
+}
@@ -0,0 +1,117 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+#include "mapnode.h"
+#include "noise.h"
+#include "util/thread.h"
+
+class ActiveBlockModifier;
+class Map;
+class MapBlock;
+
+// An ABM due to run in this interval, with its chance adjusted for catch-up
+struct ActiveABM
+{
+	ActiveBlockModifier *abm;
+	int chance;
+	std::vector<content_t> required_neighbors;
+	bool check_required_neighbors; // false if required_neighbors is known to be empty
+	s16 min_y;
+	s16 max_y;
+};
+
+// A node an ABM should be triggered on
+struct ABMTrigger
+{
+	ActiveBlockModifier *abm;
+	v3s16 p;
+	MapNode n;
+};
+
+// A block to scan, with its neighbors (nullptr if not loaded)
+struct ABMScanBlock
+{
+	MapBlock *block;
+	MapBlock *neighbors[27];
+};
+
+struct ABMScanStats
+{
+	int blocks_scanned = 0;
+	int blocks_cached = 0;
+};
+
+/*
+	Finds the nodes ABMs should be triggered on, without running them.
+
+	The blocks are split between the calling thread and a few workers. While
+	scan() runs, the scanned blocks and their neighbors must not be modified
+	or unloaded; the scan itself only builds the content index of the blocks
+	it scans, and visits just the nodes of contents with ABMs.
+*/
+class ABMScanner
+{
+public:
+	// num_threads includes the calling thread, 0 picks a value
+	ABMScanner(u32 num_threads);
+
+	void clearABMs();
+	void addABM(const ActiveABM &aabm, const std::vector<content_t> &contents);
+	bool hasABMs() const { return !m_aabms.empty(); }
+
+	/*
+		Appends the triggers found in blocks to out, grouped by block and in
+		the order of blocks. Blocks with a content index that lists no
+		ABM contents are skipped without being scanned.
+	*/
+	void scan(Map *map, const std::vector<MapBlock *> &blocks,
+			std::vector<ABMTrigger> &out, ABMScanStats *stats);
+
+	u32 getThreadCount() const { return m_runner.getThreadCount(); }
+
+	// The part of a scan done by one thread
+	struct Task
+	{
+		const ABMScanner *scanner = nullptr;
+		const ABMScanBlock *begin = nullptr;
+		const ABMScanBlock *end = nullptr;
+		PcgRandom rand;
+		std::vector<ABMTrigger> triggers;
+		ABMScanStats stats;
+
+		void run();
+	};
+
+private:
+	bool wantsBlock(MapBlock *block) const;
+	void scanBlock(const ABMScanBlock &sb, PcgRandom &rand,
+			std::vector<ABMTrigger> &out, ABMScanStats &stats) const;
+
+	// ABMs by trigger content
+	std::vector<std::vector<ActiveABM>> m_aabms;
+	bool m_check_neighbors = false;
+	ParallelRunner m_runner;
+	std::vector<Task> m_tasks;
+	std::vector<ABMScanBlock> m_scan_blocks;
+};
@@ -118,6 +118,14 @@ void ActiveObjectMgr::removeObject(u16 id)
 	}
 }
 
+void ActiveObjectMgr::getAllObjects(std::vector<ServerActiveObject *> &result)
+{
+	for (auto &activeObject : m_active_objects.iter()) {
+		if (ServerActiveObject *obj = activeObject.second.get())
+			result.push_back(obj);
+	}
+}
+
 void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
@@ -38,6 +38,8 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 	bool registerObject(std::unique_ptr<ServerActiveObject> obj) override;
 	void removeObject(u16 id) override;
 
+	// Collects all objects in the order of their ids
+	void getAllObjects(std::vector<ServerActiveObject *> &result);
 	void getObjectsInsideRadius(const v3f &pos, float radius,
 			std::vector<ServerActiveObject *> &result,
 			std::function<bool(ServerActiveObject *obj)> include_obj_cb);
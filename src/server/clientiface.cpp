@@ -65,7 +65,21 @@ std::string ClientInterface::state2Name(ClientState state)
 	return statenames[state];
 }
 
+static ObjectInterest makeObjectInterest()
+{
+	std::vector<ObjectInterest::Tier> tiers;
+	const std::string value = g_settings->get("active_object_update_tiers");
+	if (!ObjectInterest::parseTiers(value, tiers)) {
+		warningstream << "Invalid active_object_update_tiers \"" << value
+			<< "\", updating all objects at full rate" << std::endl;
+		tiers.clear();
+	}
+	return ObjectInterest(std::move(tiers),
+		g_settings->getFloat("active_object_update_out_of_view_factor"));
+}
+
 RemoteClient::RemoteClient() :
+	m_object_interest(makeObjectInterest()),
 	m_max_simul_sends(g_settings->getU16("max_simultaneous_block_sends_per_client")),
 	m_min_time_from_building(
 		g_settings->getFloat("full_block_send_enable_min_time_from_building")),
@@ -259,6 +273,9 @@ void RemoteClient::GetNextBlocks (
 	s16 d_max_gen = std::min(adjustDist(m_max_gen_distance, prop_zoom_fov),
 		wanted_range);
 
+	// Nearest blocks first, and forget about those out of reach by now
+	emerge->updatePeerPosition(peer_id, center, full_d_max);
+
 	//s16 d_max = full_d_max;
 
 	//// Don't loop very much at a time
@@ -830,16 +847,16 @@ void ClientInterface::send(session_t peer_id, NetworkPacket *pkt)
 	auto &ccf = clientCommandFactoryTable[pkt->getCommand()];
 	FATAL_ERROR_IF(!ccf.name, "packet type missing in table");
 
-	m_con->Send(peer_id, ccf.channel, pkt, ccf.reliable);
+	m_con->Send(peer_id, ccf.channel, pkt, ccf.reliable, ccf.stream);
 }
 
 void ClientInterface::sendCustom(session_t peer_id, u8 channel, NetworkPacket *pkt, bool reliable)
 {
 	// check table anyway to prevent mistakes
-	FATAL_ERROR_IF(!clientCommandFactoryTable[pkt->getCommand()].name,
-		"packet type missing in table");
+	auto &ccf = clientCommandFactoryTable[pkt->getCommand()];
+	FATAL_ERROR_IF(!ccf.name, "packet type missing in table");
 
-	m_con->Send(peer_id, channel, pkt, reliable);
+	m_con->Send(peer_id, channel, pkt, reliable, ccf.stream);
 }
 
 void ClientInterface::sendToAll(NetworkPacket *pkt)
@@ -851,11 +868,28 @@ void ClientInterface::sendToAll(NetworkPacket *pkt)
 		if (client->net_proto_version != 0) {
 			auto &ccf = clientCommandFactoryTable[pkt->getCommand()];
 			FATAL_ERROR_IF(!ccf.name, "packet type missing in table");
-			m_con->Send(client->peer_id, ccf.channel, pkt, ccf.reliable);
+			m_con->Send(client->peer_id, ccf.channel, pkt, ccf.reliable, ccf.stream);
 		}
 	}
 }
 
+void ClientInterface::sendToAllCompat(NetworkPacket *pkt, NetworkPacket *legacypkt,
+		u16 min_proto_ver)
+{
+	RecursiveMutexAutoLock clientslock(m_clients_mutex);
+	for (auto &client_it : m_clients) {
+		RemoteClient *client = client_it.second;
+		if (client->net_proto_version == 0)
+			continue;
+
+		NetworkPacket *pkt_to_send = client->net_proto_version >= min_proto_ver ?
+			pkt : legacypkt;
+		auto &ccf = clientCommandFactoryTable[pkt_to_send->getCommand()];
+		FATAL_ERROR_IF(!ccf.name, "packet type missing in table");
+		m_con->Send(client->peer_id, ccf.channel, pkt_to_send, ccf.reliable, ccf.stream);
+	}
+}
+
 RemoteClient* ClientInterface::getClientNoEx(session_t peer_id, ClientState state_min)
 {
 	RecursiveMutexAutoLock clientslock(m_clients_mutex);
@@ -25,10 +25,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serialization.h"             // for SER_FMT_VER_INVALID
 #include "network/networkpacket.h"
 #include "network/networkprotocol.h"
+#include "network/objectsnapshot.h"
 #include "network/address.h"
 #include "porting.h"
 #include "threading/mutex_auto_lock.h"
 #include "clientdynamicinfo.h"
+#include "server/objectinterest.h"
 #include "metadata.h"
 
 #include <list>
@@ -308,6 +310,18 @@ class RemoteClient
 		return insert_result.second; // true = was inserted
 	}
 
+	// Counts `len` bytes of a media file sent in chunks. Returns false if
+	// that would send the file more than twice, clients start over once
+	// at most.
+	bool markMediaChunkSent(const std::string &sha1, u32 file_size, u32 len)
+	{
+		u64 &sent = m_media_chunks_sent[sha1];
+		if (sent + len > 2 * (u64)file_size)
+			return false;
+		sent += len;
+		return true;
+	}
+
 	void PrintInfo(std::ostream &o)
 	{
 		o<<"RemoteClient "<<peer_id<<": "
@@ -327,6 +341,15 @@ class RemoteClient
 	*/
 	std::set<u16> m_known_objects;
 
+	/*
+		Positions of the known objects, for clients that take
+		TOCLIENT_OBJECT_SNAPSHOT
+	*/
+	ObjectSnapshotEncoder m_object_snapshots;
+
+	// Update rates of the known objects and traffic accounting
+	ObjectInterest m_object_interest;
+
 	ClientState getState() const { return m_state; }
 
 	const std::string &getName() const { return m_name; }
@@ -421,6 +444,8 @@ class RemoteClient
 		We won't send the same file twice to avoid bandwidth consumption attacks.
 	*/
 	std::unordered_set<std::string> m_media_sent;
+	// raw SHA1 -> bytes of the media file sent in chunks
+	std::unordered_map<std::string, u64> m_media_chunks_sent;
 
 	/*
 		Blocks that are currently on the line.
@@ -515,6 +540,9 @@ class ClientInterface {
 
 	/* send to all clients */
 	void sendToAll(NetworkPacket *pkt);
+	// Sends `legacypkt` to the clients older than `min_proto_ver`
+	void sendToAllCompat(NetworkPacket *pkt, NetworkPacket *legacypkt,
+		u16 min_proto_ver);
 
 	/* delete a client */
 	void DeleteClient(session_t peer_id);
@@ -0,0 +1,234 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "emergequeue.h"
+#include <algorithm>
+#include <cstdlib>
+#include "porting.h"
+
+// Blocks of a peer looked at for one that is not held back by its mapchunk
+#define POP_MAX_SCAN 64
+
+EmergeQueue::EmergeQueue(MetricsBackend *mb)
+{
+	m_length_gauge = mb->addGauge("minetest_emerge_queue_length",
+		"Number of blocks queued to emerge");
+	m_started_counter = mb->addCounter("minetest_emerge_queue_started",
+		"Number of queued blocks taken by emerge threads");
+	m_wait_time_counter = mb->addCounter("minetest_emerge_queue_wait_seconds",
+		"Total time queued blocks waited for an emerge thread");
+	m_stale_counter = mb->addCounter("minetest_emerge_stale_cancelled",
+		"Number of queued blocks cancelled because the player moved away or left");
+}
+
+u32 EmergeQueue::getPeerCount(session_t peer_id) const
+{
+	auto it = m_peers.find(peer_id);
+	return it == m_peers.end() ? 0 : it->second.blocks.size();
+}
+
+bool EmergeQueue::isCancellable(const BlockEmergeData &data)
+{
+	return data.callbacks.empty() && !(data.flags & BLOCK_EMERGE_FORCE_QUEUE);
+}
+
+u32 EmergeQueue::getPriority(const PeerQueue &peer, v3s16 pos)
+{
+	if (!peer.has_center)
+		return 0;
+	s32 dx = pos.X - peer.center.X;
+	s32 dy = pos.Y - peer.center.Y;
+	s32 dz = pos.Z - peer.center.Z;
+	return dx * dx + dy * dy + dz * dz;
+}
+
+v3s16 EmergeQueue::getChunk(v3s16 pos) const
+{
+	return EmergeManager::getContainingChunk(pos, m_chunksize);
+}
+
+void EmergeQueue::push(v3s16 pos, session_t peer_id, u16 flags,
+	EmergeCompletionCallback callback, void *callback_param,
+	bool *entry_already_exists)
+{
+	auto it = m_blocks.find(pos);
+	*entry_already_exists = it != m_blocks.end();
+	if (*entry_already_exists) {
+		it->second.data.flags |= flags;
+		if (callback)
+			it->second.data.callbacks.emplace_back(callback, callback_param);
+		return;
+	}
+
+	PeerQueue &peer = m_peers[peer_id];
+	peer.removed = false;
+
+	Entry &entry = m_blocks[pos];
+	entry.data.peer_requested = peer_id;
+	entry.data.flags = flags;
+	if (callback)
+		entry.data.callbacks.emplace_back(callback, callback_param);
+	entry.seq = m_next_seq++;
+	entry.time_enqueued_us = porting::getTimeUs();
+
+	if (peer.blocks.empty())
+		m_rotation.push_back(peer_id);
+	peer.blocks.emplace(std::make_pair(getPriority(peer, pos), entry.seq), pos);
+
+	m_length_gauge->set(m_blocks.size());
+}
+
+EmergeQueue::PeerBlocks::iterator EmergeQueue::findAvailable(PeerQueue &peer)
+{
+	u32 scanned = 0;
+	for (auto it = peer.blocks.begin(); it != peer.blocks.end() &&
+			scanned < POP_MAX_SCAN; ++it, scanned++) {
+		if (m_chunks_in_progress.find(getChunk(it->second)) ==
+				m_chunks_in_progress.end())
+			return it;
+	}
+	return peer.blocks.end();
+}
+
+bool EmergeQueue::pop(v3s16 *pos, BlockEmergeData *bedata)
+{
+	// Peers take turns. One whose blocks are all held back loses its turn.
+	for (size_t turns = m_rotation.size(); turns > 0; turns--) {
+		const session_t peer_id = m_rotation.front();
+		m_rotation.pop_front();
+		PeerQueue &peer = m_peers[peer_id];
+
+		auto block_it = findAvailable(peer);
+		if (block_it == peer.blocks.end()) {
+			m_rotation.push_back(peer_id);
+			continue;
+		}
+
+		*pos = block_it->second;
+		peer.blocks.erase(block_it);
+
+		auto it = m_blocks.find(*pos);
+		*bedata = std::move(it->second.data);
+		const u64 waited_us = porting::getTimeUs() - it->second.time_enqueued_us;
+		m_blocks.erase(it);
+		m_chunks_in_progress[getChunk(*pos)]++;
+
+		if (!peer.blocks.empty())
+			m_rotation.push_back(peer_id);
+		else if (peer.removed)
+			m_peers.erase(peer_id);
+
+		m_length_gauge->set(m_blocks.size());
+		m_started_counter->increment();
+		m_wait_time_counter->increment(waited_us / 1.0e6);
+		return true;
+	}
+	return false;
+}
+
+void EmergeQueue::finish(v3s16 pos)
+{
+	auto it = m_chunks_in_progress.find(getChunk(pos));
+	if (it == m_chunks_in_progress.end())
+		return;
+	if (--it->second == 0)
+		m_chunks_in_progress.erase(it);
+}
+
+void EmergeQueue::cancel(v3s16 pos, BlockList *cancelled)
+{
+	auto it = m_blocks.find(pos);
+	cancelled->emplace_back(pos, std::move(it->second.data));
+	m_blocks.erase(it);
+	m_stale_counter->increment();
+}
+
+void EmergeQueue::removeFromRotation(session_t peer_id)
+{
+	m_rotation.erase(std::remove(m_rotation.begin(), m_rotation.end(), peer_id),
+		m_rotation.end());
+}
+
+void EmergeQueue::setPeerPosition(session_t peer_id, v3s16 center, s16 radius,
+	BlockList *cancelled)
+{
+	PeerQueue &peer = m_peers[peer_id];
+	if (peer.has_center && peer.center == center)
+		return;
+	peer.has_center = true;
+	peer.center = center;
+	if (peer.blocks.empty())
+		return;
+
+	// Sort the blocks by the new distances, and drop those out of range
+	PeerBlocks blocks;
+	for (const auto &it : peer.blocks) {
+		const v3s16 pos = it.second;
+		const Entry &entry = m_blocks[pos];
+		if (isCancellable(entry.data) && (
+				std::abs(pos.X - center.X) > radius ||
+				std::abs(pos.Y - center.Y) > radius ||
+				std::abs(pos.Z - center.Z) > radius)) {
+			cancel(pos, cancelled);
+			continue;
+		}
+		blocks.emplace(std::make_pair(getPriority(peer, pos), entry.seq), pos);
+	}
+	peer.blocks = std::move(blocks);
+
+	if (peer.blocks.empty())
+		removeFromRotation(peer_id);
+	m_length_gauge->set(m_blocks.size());
+}
+
+void EmergeQueue::removePeer(session_t peer_id, BlockList *cancelled)
+{
+	auto peer_it = m_peers.find(peer_id);
+	if (peer_it == m_peers.end())
+		return;
+
+	PeerQueue &peer = peer_it->second;
+	for (auto it = peer.blocks.begin(); it != peer.blocks.end();) {
+		if (isCancellable(m_blocks[it->second].data)) {
+			cancel(it->second, cancelled);
+			it = peer.blocks.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	// The remaining blocks are still emerged, like for any other peer
+	if (peer.blocks.empty()) {
+		removeFromRotation(peer_id);
+		m_peers.erase(peer_it);
+	} else {
+		peer.removed = true;
+	}
+	m_length_gauge->set(m_blocks.size());
+}
+
+void EmergeQueue::clear(BlockList *cancelled)
+{
+	for (auto &it : m_blocks)
+		cancelled->emplace_back(it.first, std::move(it.second.data));
+	m_blocks.clear();
+	m_peers.clear();
+	m_rotation.clear();
+	m_length_gauge->set(0);
+}
@@ -0,0 +1,125 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "emerge.h"
+
+/*
+	The queue of blocks to emerge, shared by all emerge threads.
+
+	Every request is queued for the peer that first asked for the block.
+	Threads take blocks from the peers in turn, so that a peer requesting
+	many blocks does not hold up the others. Within the queue of a peer, the
+	block nearest to the peer's last known position comes first; requests
+	without a position (e.g. from mods) are served in order.
+
+	When a peer moves, its requests beyond its range are cancelled, unless
+	they have callbacks or were forced into the queue.
+
+	Not thread safe, EmergeManager locks it with its queue mutex.
+*/
+class EmergeQueue
+{
+public:
+	typedef std::vector<std::pair<v3s16, BlockEmergeData>> BlockList;
+
+	EmergeQueue(MetricsBackend *mb);
+
+	// Blocks of a mapchunk being generated are held back until it is done
+	void setChunkSize(s16 chunksize) { m_chunksize = chunksize; }
+
+	size_t size() const { return m_blocks.size(); }
+	bool contains(v3s16 pos) const { return m_blocks.count(pos) != 0; }
+	// Number of queued blocks first requested by the peer
+	u32 getPeerCount(session_t peer_id) const;
+
+	// Adds a request, or merges it into the queued one for the block
+	void push(v3s16 pos, session_t peer_id, u16 flags,
+		EmergeCompletionCallback callback, void *callback_param,
+		bool *entry_already_exists);
+
+	// Takes the next block for a thread. finish() must be called once the
+	// thread is done with it.
+	bool pop(v3s16 *pos, BlockEmergeData *bedata);
+	void finish(v3s16 pos);
+
+	/*
+		Sets the block the peer is at and reorders its requests. Requests
+		farther than radius from it (in blocks, along any axis) are removed
+		and added to cancelled.
+	*/
+	void setPeerPosition(session_t peer_id, v3s16 center, s16 radius,
+		BlockList *cancelled);
+	// Removes the requests of a peer that left, as far as they can be cancelled
+	void removePeer(session_t peer_id, BlockList *cancelled);
+	// Removes all requests
+	void clear(BlockList *cancelled);
+
+private:
+	typedef std::map<std::pair<u32, u64>, v3s16> PeerBlocks;
+
+	struct Entry
+	{
+		BlockEmergeData data;
+		// Order of the request
+		u64 seq;
+		u64 time_enqueued_us;
+	};
+
+	struct PeerQueue
+	{
+		// (squared distance to center, seq) -> block
+		PeerBlocks blocks;
+		bool has_center = false;
+		v3s16 center;
+		// Forget the peer once its last block is taken
+		bool removed = false;
+	};
+
+	static bool isCancellable(const BlockEmergeData &data);
+	// 0 for peers without position, so that their blocks stay in order
+	static u32 getPriority(const PeerQueue &peer, v3s16 pos);
+	v3s16 getChunk(v3s16 pos) const;
+	// First block of the peer that is not held back, or blocks.end()
+	PeerBlocks::iterator findAvailable(PeerQueue &peer);
+	// Moves a queued block to cancelled
+	void cancel(v3s16 pos, BlockList *cancelled);
+	void removeFromRotation(session_t peer_id);
+
+	std::unordered_map<v3s16, Entry> m_blocks;
+	std::unordered_map<session_t, PeerQueue> m_peers;
+	// Peers with queued blocks, the next one to serve first
+	std::deque<session_t> m_rotation;
+	u64 m_next_seq = 0;
+
+	s16 m_chunksize = 1;
+	// Mapchunks of the blocks threads are working on, with their count
+	std::unordered_map<v3s16, u32> m_chunks_in_progress;
+
+	MetricGaugePtr m_length_gauge;
+	MetricCounterPtr m_started_counter;
+	MetricCounterPtr m_wait_time_counter;
+	MetricCounterPtr m_stale_counter;
+};
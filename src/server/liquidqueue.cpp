@@ -0,0 +1,639 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "liquidqueue.h"
+#include <algorithm>
+#include "log.h"
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "porting.h"
+#include "util/numeric.h"
+
+// Nodes between checks of the time budget
+#define LIQUID_TIME_CHECK_INTERVAL 64
+
+/*
+	Transformation of a single node
+*/
+
+#define WATER_DROP_BOOST 4
+
+const static v3s16 liquid_6dirs[6] = {
+	// order: upper before same level before lower
+	v3s16( 0, 1, 0),
+	v3s16( 0, 0, 1),
+	v3s16( 1, 0, 0),
+	v3s16( 0, 0,-1),
+	v3s16(-1, 0, 0),
+	v3s16( 0,-1, 0)
+};
+
+enum NeighborType : u8 {
+	NEIGHBOR_UPPER,
+	NEIGHBOR_SAME_LEVEL,
+	NEIGHBOR_LOWER
+};
+
+struct NodeNeighbor {
+	MapNode n;
+	NeighborType t;
+	v3s16 p;
+
+	NodeNeighbor()
+		: n(CONTENT_AIR), t(NEIGHBOR_SAME_LEVEL)
+	{ }
+
+	NodeNeighbor(const MapNode &node, NeighborType n_type, const v3s16 &pos)
+		: n(node),
+		  t(n_type),
+		  p(pos)
+	{ }
+};
+
+static s8 get_max_liquid_level(NodeNeighbor nb, s8 current_max_node_level)
+{
+	s8 max_node_level = current_max_node_level;
+	u8 nb_liquid_level = (nb.n.param2 & LIQUID_LEVEL_MASK);
+	switch (nb.t) {
+		case NEIGHBOR_UPPER:
+			if (nb_liquid_level + WATER_DROP_BOOST > current_max_node_level) {
+				max_node_level = LIQUID_LEVEL_MAX;
+				if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+					max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+			} else if (nb_liquid_level > current_max_node_level) {
+				max_node_level = nb_liquid_level;
+			}
+			break;
+		case NEIGHBOR_LOWER:
+			break;
+		case NEIGHBOR_SAME_LEVEL:
+			if ((nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+					nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+				max_node_level = nb_liquid_level - 1;
+			break;
+	}
+	return max_node_level;
+}
+
+template <typename GetNode>
+static void transform_node(const NodeDefManager *ndef, const GetNode &get_node,
+		v3s16 p0, LiquidNodeUpdate &u)
+{
+	u = LiquidNodeUpdate();
+
+	MapNode n0 = get_node(p0);
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	// The liquid node which will be placed there if
+	// the liquid flows into this node.
+	content_t liquid_kind = CONTENT_IGNORE;
+	// The node which will be placed there if liquid
+	// can't flow into this node.
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = ndef->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = cf.liquid_alternative_flowing_id;
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+		case LiquidType_END:
+			break;
+	}
+
+	/*
+		Collect information about the environment
+	 */
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	NodeNeighbor airs[6]; // surrounding air
+	int num_airs = 0;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	bool ignored_sources = false;
+	bool floating_node_above = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 0:
+				nt = NEIGHBOR_UPPER;
+				break;
+			case 5:
+				nt = NEIGHBOR_LOWER;
+				break;
+			default:
+				break;
+		}
+		v3s16 npos = p0 + liquid_6dirs[i];
+		NodeNeighbor nb(get_node(npos), nt, npos);
+		const ContentFeatures &cfnb = ndef->get(nb.n);
+		if (nt == NEIGHBOR_UPPER && cfnb.floats)
+			floating_node_above = true;
+		switch (cfnb.liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					airs[num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
+						u.enqueue[u.num_enqueue++] = npos;
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					if (nb.n.getContent() == CONTENT_IGNORE) {
+						// If node below is ignore prevent water from
+						// spreading outwards and otherwise prevent from
+						// flowing away as ignore node might be the source
+						if (nb.t == NEIGHBOR_LOWER)
+							flowing_down = true;
+						else
+							ignored_sources = true;
+					}
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = cfnb.liquid_alternative_flowing_id;
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(nt != NEIGHBOR_LOWER)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				if (nb.t != NEIGHBOR_SAME_LEVEL ||
+					(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
+					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+					// but exclude falling liquids on the same level, they cannot flow here anyway
+
+					// used to determine if the neighbor can even flow into this node
+					s8 max_level_from_neighbor = get_max_liquid_level(nb, -1);
+					u8 range = ndef->get(cfnb.liquid_alternative_flowing_id).liquid_range;
+
+					if (liquid_kind == CONTENT_AIR &&
+							max_level_from_neighbor >= (LIQUID_LEVEL_MAX + 1 - range))
+						liquid_kind = cfnb.liquid_alternative_flowing_id;
+				}
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+			case LiquidType_END:
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = ndef->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && ndef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = ndef->get(liquid_kind).liquid_alternative_source_id;
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else if (ignored_sources && liquid_level >= 0) {
+		// Maybe there are neighboring sources that aren't loaded yet
+		// so prevent flowing away.
+		new_node_level = liquid_level;
+		new_node_content = liquid_kind;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			max_node_level = get_max_liquid_level(flows[i], max_node_level);
+		}
+
+		u8 viscosity = ndef->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				u.must_reflow = true;
+		} else {
+			new_node_level = max_node_level;
+		}
+
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(ndef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return;
+
+	u.changed = true;
+	u.floodable = floodable_node != CONTENT_AIR;
+
+	/*
+		check if there is a floating node above that needs to be updated.
+	 */
+	if (floating_node_above && new_node_content == CONTENT_AIR)
+		u.check_for_falling = true;
+
+	/*
+		update the current node
+	 */
+	u.n_old = n0;
+	if (ndef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bits to 0
+		n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+
+	// change the node.
+	n0.setContent(new_node_content);
+	u.n_new = n0;
+
+	/*
+		enqueue neighbors for update if necessary
+	 */
+	switch (ndef->get(n0.getContent()).liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < num_flows; i++)
+				if (flows[i].t != NEIGHBOR_UPPER)
+					u.enqueue_changed[u.num_enqueue_changed++] = flows[i].p;
+			for (u16 i = 0; i < num_airs; i++)
+				if (airs[i].t != NEIGHBOR_UPPER)
+					u.enqueue_changed[u.num_enqueue_changed++] = airs[i].p;
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < num_flows; i++)
+				u.enqueue_changed[u.num_enqueue_changed++] = flows[i].p;
+			break;
+		case LiquidType_END:
+			break;
+	}
+}
+
+/*
+	LiquidQueue
+*/
+
+LiquidQueue::LiquidQueue(const NodeDefManager *ndef, u32 num_threads,
+		s16 region_size) :
+	m_ndef(ndef),
+	m_region_size(MYMAX(1, region_size)),
+	m_runner("LiquidTransform", num_threads ? num_threads :
+			MYMAX(1U, MYMIN(4U, Thread::getNumberOfProcessors() / 2))),
+	m_next_region(0)
+{
+}
+
+v3s16 LiquidQueue::getRegionPos(v3s16 p) const
+{
+	// Same alignment as mapchunks, see EmergeManager::getContainingChunk()
+	const s16 coff = -m_region_size / 2;
+	return getContainerPos(getNodeBlockPos(p) - v3s16(coff, coff, coff),
+			m_region_size);
+}
+
+LiquidQueue::Region &LiquidQueue::getRegion(v3s16 region_pos)
+{
+	auto it = m_regions.find(region_pos);
+	if (it == m_regions.end()) {
+		it = m_regions.emplace(region_pos, Region()).first;
+		it->second.pos = region_pos;
+	}
+	return it->second;
+}
+
+void LiquidQueue::push(v3s16 p)
+{
+	if (getRegion(getRegionPos(p)).queue.push_back(p))
+		m_size++;
+}
+
+void LiquidQueue::push(UniqueQueue<v3s16> &queue)
+{
+	while (queue.size() > 0) {
+		push(queue.front());
+		queue.pop_front();
+	}
+}
+
+void LiquidQueue::purge(u32 max_size)
+{
+	if (m_size <= max_size)
+		return;
+
+	const u32 total = m_size;
+	const u32 dump_qty = m_size - max_size;
+	for (auto it = m_regions.begin(); it != m_regions.end();) {
+		UniqueQueue<v3s16> &queue = it->second.queue;
+		u32 dump = ((u64)dump_qty * queue.size() + total - 1) / total;
+		dump = MYMIN(dump, queue.size());
+		for (u32 i = 0; i < dump; i++)
+			queue.pop_front();
+		m_size -= dump;
+
+		if (queue.size() == 0)
+			it = m_regions.erase(it);
+		else
+			++it;
+	}
+}
+
+void LiquidQueue::prepareRegion(Map *map, Region &region)
+{
+	// Map can't be used by several threads, look up the blocks here
+	const s16 coff = -m_region_size / 2;
+	const s16 n = m_region_size + 2;
+	region.blocks_min = region.pos * m_region_size + v3s16(coff, coff, coff) -
+			v3s16(1, 1, 1);
+	region.blocks.resize(n * n * n);
+	u32 i = 0;
+	v3s16 bp;
+	for (bp.Z = 0; bp.Z < n; bp.Z++)
+	for (bp.Y = 0; bp.Y < n; bp.Y++)
+	for (bp.X = 0; bp.X < n; bp.X++, i++)
+		region.blocks[i] = map->getBlockNoCreateNoEx(region.blocks_min + bp);
+
+	region.modified_blocks.clear();
+	region.changed_nodes.clear();
+	region.check_for_falling.clear();
+	region.deferred.clear();
+	region.outbox.clear();
+	region.stats = LiquidTransformStats();
+}
+
+void LiquidQueue::transformRegion(Region &region)
+{
+	const s16 n = m_region_size + 2;
+	auto get_block = [&] (v3s16 blockpos) {
+		const v3s16 rel = blockpos - region.blocks_min;
+		return region.blocks[(rel.Z * n + rel.Y) * n + rel.X];
+	};
+	auto get_node = [&] (v3s16 p) -> MapNode {
+		const v3s16 blockpos = getNodeBlockPos(p);
+		MapBlock *block = get_block(blockpos);
+		if (!block)
+			return {CONTENT_IGNORE};
+		return block->getNodeNoCheck(p - blockpos * MAP_BLOCKSIZE);
+	};
+	auto enqueue = [&] (v3s16 p) {
+		if (getRegionPos(p) == region.pos)
+			region.queue.push_back(p);
+		else
+			region.outbox.push_back(p);
+	};
+
+	std::vector<v3s16> must_reflow;
+	MapBlock *last_block = nullptr;
+	LiquidNodeUpdate u;
+	while (region.budget > 0 && region.queue.size() > 0) {
+		if (region.stats.nodes_processed > 0 &&
+				region.stats.nodes_processed % LIQUID_TIME_CHECK_INTERVAL == 0 &&
+				porting::getTimeMs() >= m_phase_deadline) {
+			region.stats.regions_timed_out = 1;
+			break;
+		}
+		region.budget--;
+		region.stats.nodes_processed++;
+
+		const v3s16 p0 = region.queue.front();
+		region.queue.pop_front();
+
+		if (region.defer_all) {
+			region.deferred.push_back(p0);
+			continue;
+		}
+
+		transform_node(m_ndef, get_node, p0, u);
+
+		// on_flood() can only be called from the server thread
+		if (u.changed && u.floodable) {
+			region.deferred.push_back(p0);
+			continue;
+		}
+
+		for (u8 i = 0; i < u.num_enqueue; i++)
+			enqueue(u.enqueue[i]);
+		if (u.must_reflow)
+			must_reflow.push_back(p0);
+		if (!u.changed)
+			continue;
+
+		if (u.check_for_falling)
+			region.check_for_falling.push_back(p0);
+
+		// Ignore light (because calling voxalgo::update_lighting_nodes)
+		MapNode n0 = u.n_new;
+		ContentLightingFlags f0 = m_ndef->getLightingFlags(n0);
+		n0.setLight(LIGHTBANK_DAY, 0, f0);
+		n0.setLight(LIGHTBANK_NIGHT, 0, f0);
+
+		const v3s16 blockpos = getNodeBlockPos(p0);
+		MapBlock *block = get_block(blockpos);
+		if (block) {
+			if (n0.getContent() != CONTENT_IGNORE) {
+				block->setNodeNoCheck(p0 - blockpos * MAP_BLOCKSIZE, n0);
+			} else {
+				errorstream << "Not allowing to place CONTENT_IGNORE"
+						<< " while transforming liquid at " << p0 << std::endl;
+			}
+			if (block != last_block) {
+				if (std::find(region.modified_blocks.begin(),
+						region.modified_blocks.end(), block) ==
+						region.modified_blocks.end())
+					region.modified_blocks.push_back(block);
+				last_block = block;
+			}
+			region.changed_nodes.emplace_back(p0, u.n_old);
+			region.stats.nodes_changed++;
+		}
+
+		for (u8 i = 0; i < u.num_enqueue_changed; i++)
+			enqueue(u.enqueue_changed[i]);
+	}
+
+	for (v3s16 p : must_reflow)
+		region.queue.push_back(p);
+}
+
+void LiquidQueue::finishRegion(Region &region, LiquidTransformResult &result)
+{
+	for (MapBlock *block : region.modified_blocks)
+		result.modified_blocks[block->getPos()] = block;
+	result.changed_nodes.insert(result.changed_nodes.end(),
+			region.changed_nodes.begin(), region.changed_nodes.end());
+	result.check_for_falling.insert(result.check_for_falling.end(),
+			region.check_for_falling.begin(), region.check_for_falling.end());
+	result.deferred.insert(result.deferred.end(),
+			region.deferred.begin(), region.deferred.end());
+
+	result.stats.nodes_processed += region.stats.nodes_processed;
+	result.stats.nodes_changed += region.stats.nodes_changed;
+	result.stats.regions++;
+	result.stats.regions_timed_out += region.stats.regions_timed_out;
+
+	region.blocks.clear();
+	region.budget = 0;
+}
+
+void LiquidQueue::transform(Map *map, u32 max_nodes, u32 max_time_ms,
+		bool defer_all, LiquidTransformResult &result)
+{
+	if (m_size == 0)
+		return;
+
+	const u64 deadline = porting::getTimeMs() + max_time_ms;
+
+	// Give every region its share of the node budget
+	std::vector<Region *> phases[8];
+	for (auto &it : m_regions) {
+		Region &region = it.second;
+		const u32 queued = region.queue.size();
+		if (queued == 0)
+			continue;
+		if (m_size <= max_nodes)
+			region.budget = queued;
+		else
+			region.budget = MYMAX(1U, (u32)((u64)max_nodes * queued / m_size));
+		region.defer_all = defer_all;
+		prepareRegion(map, region);
+
+		const v3s16 &rp = region.pos;
+		phases[(rp.X & 1) | (rp.Y & 1) << 1 | (rp.Z & 1) << 2].push_back(&region);
+	}
+
+	u32 phases_left = 0;
+	for (const auto &phase : phases)
+		phases_left += phase.empty() ? 0 : 1;
+
+	for (const auto &phase : phases) {
+		if (phase.empty())
+			continue;
+
+		// Phases finishing early leave their time to the next ones
+		const u64 now = porting::getTimeMs();
+		m_phase_deadline = now + (deadline > now ? (deadline - now) / phases_left : 0);
+		phases_left--;
+
+		m_phase_regions = phase;
+		m_next_region = 0;
+		// Each thread keeps taking regions, so only the count of them matters
+		const u32 num_threads = MYMIN(m_runner.getThreadCount(),
+				(u32)m_phase_regions.size());
+		m_runner.run(num_threads, [this] (u32 begin, u32 end) {
+			transformPhase();
+		});
+	}
+	m_phase_regions.clear();
+
+	// Merge the results in a fixed order, then hand over the neighbors
+	// queued across region borders
+	std::vector<v3s16> outbox;
+	for (const auto &phase : phases) {
+		for (Region *region : phase) {
+			finishRegion(*region, result);
+			outbox.insert(outbox.end(), region->outbox.begin(),
+					region->outbox.end());
+			region->outbox.clear();
+		}
+	}
+	for (v3s16 p : outbox)
+		getRegion(getRegionPos(p)).queue.push_back(p);
+
+	m_size = 0;
+	for (auto it = m_regions.begin(); it != m_regions.end();) {
+		m_size += it->second.queue.size();
+		if (it->second.queue.size() == 0)
+			it = m_regions.erase(it);
+		else
+			++it;
+	}
+}
+
+void LiquidQueue::transformNode(Map *map, const NodeDefManager *ndef, v3s16 p,
+		LiquidNodeUpdate *update)
+{
+	transform_node(ndef, [map] (v3s16 pos) { return map->getNode(pos); }, p,
+			*update);
+}
+
+void LiquidQueue::transformPhase()
+{
+	size_t i;
+	while ((i = m_next_region++) < m_phase_regions.size())
+		transformRegion(*m_phase_regions[i]);
+}
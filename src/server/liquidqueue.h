@@ -0,0 +1,161 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+#include "mapnode.h"
+#include "util/container.h"
+#include "util/thread.h"
+
+class Map;
+class MapBlock;
+class NodeDefManager;
+
+// What transforming a single liquid node does, see LiquidQueue::transformNode()
+struct LiquidNodeUpdate
+{
+	// The node is to be replaced by n_new
+	bool changed = false;
+	// n_old is a floodable node, its on_flood callback must run first
+	bool floodable = false;
+	// The node did not reach its level yet, because of viscosity
+	bool must_reflow = false;
+	// The node turns into air below a floating node
+	bool check_for_falling = false;
+	MapNode n_old;
+	// Light is left as in n_old
+	MapNode n_new;
+	// Neighbors to queue in any case
+	u8 num_enqueue = 0;
+	v3s16 enqueue[6];
+	// Neighbors to queue only if the node is replaced
+	u8 num_enqueue_changed = 0;
+	v3s16 enqueue_changed[6];
+};
+
+struct LiquidTransformStats
+{
+	u32 nodes_processed = 0;
+	u32 nodes_changed = 0;
+	u32 regions = 0;
+	// Regions that ran out of time before their node budget
+	u32 regions_timed_out = 0;
+};
+
+struct LiquidTransformResult
+{
+	std::map<v3s16, MapBlock *> modified_blocks;
+	// Changed positions, with their old nodes
+	std::vector<std::pair<v3s16, MapNode>> changed_nodes;
+	std::vector<v3s16> check_for_falling;
+	// Nodes left for the caller to transform, e.g. because on_flood must run
+	std::vector<v3s16> deferred;
+	LiquidTransformStats stats;
+};
+
+/*
+	Queue of liquid nodes to transform, split into one queue per mapchunk.
+
+	A step transforms the regions in 8 phases, by the parity of their
+	coordinates, so regions transformed at the same time are never adjacent.
+	As a node only depends on its direct neighbors, the regions of a phase
+	can be transformed in parallel, and the result doesn't depend on the
+	number of threads. Neighbors queued across a region border are handed
+	over at the end of the step.
+
+	While transform() runs, the map must not be used by anything else.
+*/
+class LiquidQueue
+{
+public:
+	// num_threads includes the calling thread, 0 picks a value.
+	// region_size is the size of a mapchunk, in blocks.
+	LiquidQueue(const NodeDefManager *ndef, u32 num_threads, s16 region_size);
+
+	void push(v3s16 p);
+	// Moves all nodes of queue to this one
+	void push(UniqueQueue<v3s16> &queue);
+
+	u32 size() const { return m_size; }
+	// Drops the oldest nodes of every region until at most max_size are left
+	void purge(u32 max_size);
+
+	/*
+		Transforms up to max_nodes of the queued nodes, with each region
+		getting a share proportional to its queue. Like before queues were
+		split, nodes queued by this step are left to the next one.
+
+		The time left is spread over the remaining phases, a region stops
+		early when its phase runs out of time. If defer_all is set, nodes
+		are only taken from the queue and returned as deferred.
+	*/
+	void transform(Map *map, u32 max_nodes, u32 max_time_ms, bool defer_all,
+			LiquidTransformResult &result);
+
+	// Decides what to do with the liquid at p, from the nodes on map
+	static void transformNode(Map *map, const NodeDefManager *ndef, v3s16 p,
+			LiquidNodeUpdate *update);
+
+	u32 getThreadCount() const { return m_runner.getThreadCount(); }
+
+private:
+	struct Region
+	{
+		v3s16 pos; // in mapchunks
+		UniqueQueue<v3s16> queue;
+
+		// State of the current step
+		u32 budget = 0;
+		bool defer_all = false;
+		// The blocks of the region, with a border of one block
+		std::vector<MapBlock *> blocks;
+		v3s16 blocks_min;
+		std::vector<MapBlock *> modified_blocks;
+		std::vector<std::pair<v3s16, MapNode>> changed_nodes;
+		std::vector<v3s16> check_for_falling;
+		std::vector<v3s16> deferred;
+		// Neighbors queued outside of the region
+		std::vector<v3s16> outbox;
+		LiquidTransformStats stats;
+	};
+
+	v3s16 getRegionPos(v3s16 p) const;
+	Region &getRegion(v3s16 region_pos);
+	void prepareRegion(Map *map, Region &region);
+	void transformRegion(Region &region);
+	void finishRegion(Region &region, LiquidTransformResult &result);
+	// Transforms regions of the current phase until none are left
+	void transformPhase();
+
+	const NodeDefManager *m_ndef;
+	const s16 m_region_size;
+	std::map<v3s16, Region> m_regions;
+	u32 m_size = 0;
+
+	ParallelRunner m_runner;
+	// Regions of the current phase, handed out through m_next_region
+	std::vector<Region *> m_phase_regions;
+	std::atomic<size_t> m_next_region;
+	u64 m_phase_deadline = 0;
+};
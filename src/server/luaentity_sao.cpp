@@ -162,7 +162,7 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
 	if (auto *parent = getParent()) {
-		m_base_position = parent->getBasePosition();
+		setBasePosition(parent->getBasePosition());
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
 	} else {
@@ -174,18 +174,25 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 			v3f p_pos = m_base_position;
 			v3f p_velocity = m_velocity;
 			v3f p_acceleration = m_acceleration;
-			moveresult = collisionMoveSimple(m_env, m_env->getGameDef(),
-					pos_max_d, box, m_prop.stepheight, dtime,
-					&p_pos, &p_velocity, p_acceleration,
-					this, m_prop.collideWithObjects);
+			if (CollisionBatch *batch = m_env->getCollisionBatch()) {
+				moveresult = batch->move(pos_max_d, box, m_prop.stepheight,
+						dtime, &p_pos, &p_velocity, p_acceleration,
+						this, m_prop.collideWithObjects);
+			} else {
+				moveresult = collisionMoveSimple(m_env, m_env->getGameDef(),
+						pos_max_d, box, m_prop.stepheight, dtime,
+						&p_pos, &p_velocity, p_acceleration,
+						this, m_prop.collideWithObjects);
+			}
 			moveresult_p = &moveresult;
 
 			// Apply results
-			m_base_position = p_pos;
+			setBasePosition(p_pos);
 			m_velocity = p_velocity;
 			m_acceleration = p_acceleration;
 		} else {
-			m_base_position += (m_velocity + m_acceleration * 0.5f * dtime) * dtime;
+			setBasePosition(m_base_position +
+					(m_velocity + m_acceleration * 0.5f * dtime) * dtime);
 			m_velocity += dtime * m_acceleration;
 		}
 
@@ -375,7 +382,7 @@ void LuaEntitySAO::setPos(const v3f &pos)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	sendPosition(false, true);
 }
 
@@ -383,7 +390,7 @@ void LuaEntitySAO::moveTo(v3f pos, bool continuous)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	if(!continuous)
 		sendPosition(true, true);
 }
@@ -555,6 +562,24 @@ bool LuaEntitySAO::getCollisionBox(aabb3f *toset) const
 	return false;
 }
 
+bool LuaEntitySAO::getCollisionMove(CollisionBatch::Move *move) const
+{
+	// Same conditions and arguments as the collisionMoveSimple() call in step()
+	if (!m_prop.physical || getParent())
+		return false;
+
+	move->self = const_cast<LuaEntitySAO *>(this);
+	move->box_0 = m_prop.collisionbox;
+	move->box_0.MinEdge *= BS;
+	move->box_0.MaxEdge *= BS;
+	move->stepheight = m_prop.stepheight;
+	move->pos = m_base_position;
+	move->speed = m_velocity;
+	move->accel = m_acceleration;
+	move->collide_objects = m_prop.collideWithObjects;
+	return true;
+}
+
 bool LuaEntitySAO::getSelectionBox(aabb3f *toset) const
 {
 	if (!m_prop.is_visible) {
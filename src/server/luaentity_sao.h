@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include "collision.h"
 #include "unit_sao.h"
 
 class LuaEntitySAO : public UnitSAO
@@ -78,6 +79,8 @@ class LuaEntitySAO : public UnitSAO
 	bool getCollisionBox(aabb3f *toset) const;
 	bool getSelectionBox(aabb3f *toset) const;
 	bool collideWithObjects() const;
+	// The collision move the next step() will make, if any
+	bool getCollisionMove(CollisionBatch::Move *move) const;
 
 protected:
 	void dispatchScriptDeactivate(bool removal);
@@ -0,0 +1,216 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "objectinterest.h"
+#include "activeobject.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include "util/string.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// See UnitSAO::generateUpdatePositionCommand
+static constexpr size_t POSITION_COMMAND_SIZE = 1 + 4 * 12 + 2 + 4;
+static constexpr size_t DO_INTERPOLATE_OFFSET = 1 + 4 * 12;
+static constexpr size_t UPDATE_INTERVAL_OFFSET = 1 + 4 * 12 + 2;
+
+static f32 getUpdateInterval(const std::string &data)
+{
+	if (data.size() < POSITION_COMMAND_SIZE)
+		return 0.0f;
+	return readF32((const u8 *)&data[UPDATE_INTERVAL_OFFSET]);
+}
+
+static bool isInterpolated(const std::string &data)
+{
+	return data.size() < POSITION_COMMAND_SIZE || data[DO_INTERPOLATE_OFFSET] != 0;
+}
+
+static bool parseFloat(const std::string &str, f32 &value)
+{
+	if (str.empty())
+		return false;
+	char *end;
+	value = std::strtof(str.c_str(), &end);
+	return *end == '\0' && std::isfinite(value) && value >= 0.0f;
+}
+
+ObjectInterest::ObjectInterest(std::vector<Tier> tiers, f32 out_of_view_factor) :
+	m_tiers(std::move(tiers)),
+	m_out_of_view_factor(out_of_view_factor)
+{
+	std::sort(m_tiers.begin(), m_tiers.end(), [] (const Tier &a, const Tier &b) {
+		return a.distance < b.distance;
+	});
+}
+
+bool ObjectInterest::parseTiers(const std::string &value, std::vector<Tier> &tiers)
+{
+	tiers.clear();
+	for (const std::string &part : str_split(value, ',')) {
+		std::string tier(trim(part));
+		if (tier.empty())
+			continue;
+
+		size_t colon = tier.find(':');
+		if (colon == std::string::npos)
+			return false;
+		Tier t;
+		if (!parseFloat(trim(tier.substr(0, colon)), t.distance) ||
+				!parseFloat(trim(tier.substr(colon + 1)), t.interval))
+			return false;
+		tiers.push_back(t);
+	}
+	return true;
+}
+
+void ObjectInterest::step(f32 dtime, const v3f &camera_pos,
+		const v3f &camera_dir, f32 fov)
+{
+	m_time += dtime;
+	m_dtime = dtime;
+	m_camera_pos = camera_pos;
+	m_camera_dir = camera_dir;
+	// Half the field of view and a bit of margin
+	m_view_cos = fov > 0.0f ? std::cos(MYMIN(fov * 0.55f, M_PI)) : -1.0f;
+
+	m_window_time += dtime;
+	if (m_window_time >= 1.0f) {
+		m_bandwidth = m_window_bytes / m_window_time;
+		m_window_bytes = 0;
+		m_window_time = 0.0f;
+	}
+}
+
+f32 ObjectInterest::getInterval(const v3f &pos) const
+{
+	if (m_tiers.empty())
+		return 0.0f;
+
+	v3f delta = pos - m_camera_pos;
+	f32 distance = delta.getLength();
+	f32 interval = 0.0f;
+	for (const Tier &tier : m_tiers) {
+		if (distance < tier.distance * BS)
+			break;
+		interval = tier.interval;
+	}
+
+	if (interval > 0.0f && delta.dotProduct(m_camera_dir) < m_view_cos * distance)
+		interval *= m_out_of_view_factor;
+	return interval;
+}
+
+bool ObjectInterest::isDue(const ObjectTiming &timing) const
+{
+	// Steps don't match the intervals, round to the nearest one
+	return m_time - timing.last_sent + m_dtime * 0.5f >= timing.interval;
+}
+
+f32 ObjectInterest::markSent(ObjectTiming &timing, f32 message_interval)
+{
+	f32 interval = message_interval;
+	if (timing.interval > 0.0f) {
+		f32 since_last = m_time - timing.last_sent;
+		interval = MYMAX(interval, MYMIN(since_last, timing.interval));
+	}
+
+	timing.last_sent = m_time;
+	if (timing.held) {
+		timing.held = false;
+		timing.data.clear();
+		m_held_count--;
+	}
+	m_updates_sent++;
+	return interval;
+}
+
+bool ObjectInterest::update(u16 id, const v3f &pos, const std::string &data,
+		f32 &interval)
+{
+	ObjectTiming &timing = m_objects[id];
+	timing.interval = getInterval(pos);
+	if (!isInterpolated(data)) {
+		// A teleport replaces the held update but is never held itself,
+		// and the object jumps there no matter the interval
+		if (timing.held)
+			m_updates_coalesced++;
+		markSent(timing, 0.0f);
+		interval = getUpdateInterval(data);
+		return true;
+	}
+	if (isDue(timing)) {
+		// A newer message replaces the held one
+		if (timing.held)
+			m_updates_coalesced++;
+		interval = markSent(timing, getUpdateInterval(data));
+		return true;
+	}
+
+	if (timing.held) {
+		m_updates_coalesced++;
+	} else {
+		timing.held = true;
+		m_held_count++;
+	}
+	timing.data = data;
+	return false;
+}
+
+void ObjectInterest::release(std::vector<DueUpdate> &due)
+{
+	if (m_held_count == 0)
+		return;
+
+	for (auto &it : m_objects) {
+		ObjectTiming &timing = it.second;
+		if (!timing.held || !isDue(timing))
+			continue;
+
+		DueUpdate update;
+		update.id = it.first;
+		update.data = std::move(timing.data);
+		update.interval = markSent(timing, getUpdateInterval(update.data));
+		due.push_back(std::move(update));
+	}
+}
+
+void ObjectInterest::removeObject(u16 id)
+{
+	auto it = m_objects.find(id);
+	if (it == m_objects.end())
+		return;
+	if (it->second.held)
+		m_held_count--;
+	m_objects.erase(it);
+}
+
+void ObjectInterest::countSent(u32 bytes)
+{
+	m_bytes_sent += bytes;
+	m_window_bytes += bytes;
+}
+
+void ObjectInterest::setUpdateInterval(std::string &data, f32 interval)
+{
+	if (data.size() < POSITION_COMMAND_SIZE || (u8)data[0] != AO_CMD_UPDATE_POSITION)
+		return;
+	writeF32((u8 *)&data[UPDATE_INTERVAL_OFFSET], interval);
+}
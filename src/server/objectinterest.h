@@ -0,0 +1,126 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes_bloated.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Decides how often a client gets the position of each active object
+	it knows, and accounts the object traffic sent to it.
+
+	Objects fall into tiers by distance from the client's camera, and every
+	tier has a minimum interval between position updates. The interval is
+	multiplied for objects outside the field of view. Updates that come
+	sooner are held back, and only the newest one is sent once the interval
+	has passed. Teleports (updates without interpolation) are always sent
+	right away. Reliable object messages are not affected, they have to
+	stay in order.
+*/
+class ObjectInterest
+{
+public:
+	struct Tier {
+		// Nodes from the camera from which on the tier applies
+		f32 distance;
+		// Seconds between position updates
+		f32 interval;
+	};
+
+	struct DueUpdate {
+		u16 id;
+		std::string data;
+		f32 interval;
+	};
+
+	// No tiers, every update is sent right away
+	ObjectInterest() = default;
+	ObjectInterest(std::vector<Tier> tiers, f32 out_of_view_factor);
+
+	// Parses "distance:interval,...", false if the format is wrong
+	static bool parseTiers(const std::string &value, std::vector<Tier> &tiers);
+
+	// Advances the clock and moves the camera, `fov` is in radians
+	void step(f32 dtime, const v3f &camera_pos, const v3f &camera_dir, f32 fov);
+
+	// Minimum interval between the updates of an object at `pos`
+	f32 getInterval(const v3f &pos) const;
+
+	/*
+		A position update (AO_CMD_UPDATE_POSITION) of the object `id`.
+		Returns false if it is held back. Otherwise `interval` is how long
+		the client should take to move the object there: the interval of
+		the message, raised to the time since the last sent update of a
+		coalesced object.
+	*/
+	bool update(u16 id, const v3f &pos, const std::string &data,
+		f32 &interval);
+
+	// Held updates whose interval has passed
+	void release(std::vector<DueUpdate> &due);
+
+	// The object is no longer known by the client
+	void removeObject(u16 id);
+
+	// Bytes of active object packets sent to the client
+	void countSent(u32 bytes);
+	u64 getBytesSent() const { return m_bytes_sent; }
+	// Bytes per second during the last second
+	f32 getBandwidth() const { return m_bandwidth; }
+	// Position updates sent and coalesced
+	u64 getUpdatesSent() const { return m_updates_sent; }
+	u64 getUpdatesCoalesced() const { return m_updates_coalesced; }
+
+	// Sets the interpolation interval of an AO_CMD_UPDATE_POSITION message
+	static void setUpdateInterval(std::string &data, f32 interval);
+
+private:
+	struct ObjectTiming {
+		f64 last_sent = -1.0e9;
+		f32 interval = 0.0f;
+		bool held = false;
+		std::string data;
+	};
+
+	bool isDue(const ObjectTiming &timing) const;
+	// Returns the interpolation interval for the update sent now
+	f32 markSent(ObjectTiming &timing, f32 message_interval);
+
+	std::vector<Tier> m_tiers;
+	f32 m_out_of_view_factor = 1.0f;
+
+	v3f m_camera_pos;
+	v3f m_camera_dir = v3f(0.0f, 0.0f, 1.0f);
+	f32 m_view_cos = -1.0f;
+	f64 m_time = 0.0;
+	f32 m_dtime = 0.0f;
+
+	std::unordered_map<u16, ObjectTiming> m_objects;
+	u32 m_held_count = 0;
+
+	u64 m_bytes_sent = 0;
+	u64 m_updates_sent = 0;
+	u64 m_updates_coalesced = 0;
+	u32 m_window_bytes = 0;
+	f32 m_window_time = 0.0f;
+	f32 m_bandwidth = 0.0f;
+};
@@ -0,0 +1,223 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "pregenerator.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "constants.h"
+#include "filesys.h"
+#include "log.h"
+#include "mapblock.h"
+#include "settings.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/numeric.h"
+
+MapPregenerator::MapPregenerator(EmergeManager *emerge,
+		const std::string &path_world, MetricsBackend *mb) :
+	m_emerge(emerge),
+	m_path(path_world + DIR_DELIM "map_pregen.txt")
+{
+	m_done_gauge = mb->addGauge("minetest_pregen_chunks_done",
+		"Number of mapchunks pre-generated in the background");
+	m_total_gauge = mb->addGauge("minetest_pregen_chunks_total",
+		"Number of mapchunks to pre-generate in the background");
+}
+
+void MapPregenerator::load(s16 chunksize)
+{
+	m_radius = rangelim(g_settings->getS16("pregen_radius"), 0,
+		MAX_MAP_GENERATION_LIMIT);
+	if (m_radius == 0)
+		return;
+
+	const s16 limit = MAX_MAP_GENERATION_LIMIT;
+	v3f center = g_settings->getV3F("pregen_center");
+	m_center = v3s16(rangelim(center.X, -limit, limit),
+		rangelim(center.Y, -limit, limit), rangelim(center.Z, -limit, limit));
+	m_y_min = rangelim(g_settings->getS16("pregen_y_min"), -limit, limit);
+	m_y_max = rangelim(g_settings->getS16("pregen_y_max"), m_y_min, limit);
+	m_max_lag = g_settings->getFloat("pregen_max_lag");
+	m_chunksize = chunksize;
+
+	// Mapchunks containing the area
+	const s16 coff = -chunksize / 2;
+	auto to_chunk = [&] (s32 node) -> s16 {
+		s16 block = getNodeBlockPos(v3s16(rangelim(node, -limit, limit), 0, 0)).X;
+		return getContainerPos(block - coff, chunksize);
+	};
+	const s16 cx_min = to_chunk(m_center.X - m_radius);
+	const s16 cx_max = to_chunk(m_center.X + m_radius);
+	const s16 cz_min = to_chunk(m_center.Z - m_radius);
+	const s16 cz_max = to_chunk(m_center.Z + m_radius);
+	const s16 cx = to_chunk(m_center.X);
+	const s16 cz = to_chunk(m_center.Z);
+	m_layer_min = to_chunk(m_y_min);
+	m_layer_max = to_chunk(m_y_max);
+
+	// Square spiral around the center, ring by ring
+	m_columns.clear();
+	auto add = [&] (s16 dx, s16 dz) {
+		if (cx + dx >= cx_min && cx + dx <= cx_max &&
+				cz + dz >= cz_min && cz + dz <= cz_max)
+			m_columns.emplace_back(cx + dx, cz + dz);
+	};
+	const s16 rings = std::max(std::max(cx - cx_min, cx_max - cx),
+		std::max(cz - cz_min, cz_max - cz));
+	add(0, 0);
+	for (s16 ring = 1; ring <= rings; ring++) {
+		for (s16 i = -ring; i < ring; i++)
+			add(ring, i);
+		for (s16 i = ring; i > -ring; i--)
+			add(i, ring);
+		for (s16 i = ring; i > -ring; i--)
+			add(-ring, i);
+		for (s16 i = -ring; i < ring; i++)
+			add(i, -ring);
+	}
+	m_total = m_columns.size() * (m_layer_max - m_layer_min + 1);
+
+	// Go on where we left off, unless the area changed
+	Settings args("PregenArgsEnd");
+	std::ifstream is(m_path.c_str(), std::ios_base::binary);
+	if (is.good() && args.parseConfigLines(is) &&
+			args.exists("next") &&
+			args.get("area") == getAreaString())
+		m_next = std::min(args.getU32("next"), m_total);
+
+	infostream << "MapPregenerator: " << m_next << " of " << m_total
+		<< " mapchunks done in area " << getAreaString() << std::endl;
+	m_total_gauge->set(m_total);
+	m_done_gauge->set(m_next);
+}
+
+void MapPregenerator::save()
+{
+	if (!isEnabled())
+		return;
+
+	Settings args("PregenArgsEnd");
+	{
+		MutexAutoLock lock(m_mutex);
+		args.set("area", getAreaString());
+		args.setU64("next", getCheckpoint());
+	}
+
+	std::ostringstream os(std::ios_base::binary);
+	args.writeLines(os);
+	if (!fs::safeWriteToFile(m_path, os.str()))
+		errorstream << "MapPregenerator: Failed to write " << m_path << std::endl;
+}
+
+void MapPregenerator::stop()
+{
+	MutexAutoLock lock(m_mutex);
+	m_stopped = true;
+}
+
+std::string MapPregenerator::getAreaString() const
+{
+	std::ostringstream os;
+	os << m_center.X << "," << m_center.Y << "," << m_center.Z << " "
+		<< m_radius << " " << m_y_min << " " << m_y_max << " " << m_chunksize;
+	return os.str();
+}
+
+v3s16 MapPregenerator::getBlockPos(u32 index) const
+{
+	const u32 layers = m_layer_max - m_layer_min + 1;
+	const v2s16 column = m_columns[index / layers];
+	const s16 layer = m_layer_max - (s16)(index % layers);
+	// The middle block, the others may be beyond the map limits
+	const s16 coff = -m_chunksize / 2;
+	return v3s16(column.X, layer, column.Y) * m_chunksize +
+		v3s16(1, 1, 1) * (coff + m_chunksize / 2);
+}
+
+u32 MapPregenerator::getCheckpoint() const
+{
+	u32 checkpoint = m_next;
+	for (const auto &it : m_in_flight)
+		checkpoint = std::min(checkpoint, it.second);
+	return checkpoint;
+}
+
+void MapPregenerator::step(float dtime)
+{
+	if (!isEnabled())
+		return;
+
+	MutexAutoLock lock(m_mutex);
+
+	m_avg_dtime = m_avg_dtime * 0.9f + dtime * 0.1f;
+	m_throttled = m_avg_dtime > m_max_lag;
+	m_done_gauge->set(m_next - m_in_flight.size());
+
+	if (m_paused || m_throttled || m_stopped || m_next == m_total)
+		return;
+
+	// Yield to any other request
+	if (m_emerge->getQueueSize() != 0)
+		return;
+
+	const size_t max_in_flight = m_emerge->getThreadCount();
+	while (m_next < m_total && m_in_flight.size() < max_in_flight) {
+		const v3s16 blockpos = getBlockPos(m_next);
+		if (blockpos_over_max_limit(blockpos)) {
+			m_next++;
+			continue;
+		}
+		if (!m_emerge->enqueueBlockEmergeEx(blockpos, PEER_ID_INEXISTENT,
+				BLOCK_EMERGE_ALLOW_GEN, emergeCallback, this))
+			break;
+		m_in_flight[blockpos] = m_next++;
+	}
+
+	if (m_next == m_total && m_in_flight.empty())
+		infostream << "MapPregenerator: Done" << std::endl;
+}
+
+void MapPregenerator::emergeCallback(v3s16 blockpos, EmergeAction action,
+	void *param)
+{
+	MapPregenerator *pregen = (MapPregenerator *)param;
+	MutexAutoLock lock(pregen->m_mutex);
+
+	// Requests cancelled on shutdown are done next time
+	if (action == EMERGE_CANCELLED && pregen->m_stopped)
+		return;
+	pregen->m_in_flight.erase(blockpos);
+}
+
+void MapPregenerator::setPaused(bool paused)
+{
+	MutexAutoLock lock(m_mutex);
+	m_paused = paused;
+}
+
+MapPregenerator::Progress MapPregenerator::getProgress()
+{
+	MutexAutoLock lock(m_mutex);
+	Progress progress;
+	progress.done = m_next - m_in_flight.size();
+	progress.total = m_total;
+	progress.paused = m_paused;
+	progress.throttled = m_throttled;
+	return progress;
+}
@@ -0,0 +1,111 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+#include "emerge.h"
+#include "util/metricsbackend.h"
+
+/*
+	Generates the map of an area in the background, e.g. around the spawn
+	point before players spread out.
+
+	Mapchunks are queued one by one with EmergeManager::enqueueBlockEmergeEx,
+	column by column in a square spiral around the center of the area and
+	from top to bottom in each column. Only a few mapchunks are queued at
+	a time, and only while the emerge queue is otherwise empty and the server
+	keeps up, so players always come first.
+
+	Progress is saved to the world, so that it goes on after a restart.
+*/
+class MapPregenerator
+{
+public:
+	struct Progress
+	{
+		// Mapchunks
+		u32 done = 0;
+		u32 total = 0;
+		bool paused = false;
+		// Waiting for the server to catch up
+		bool throttled = false;
+	};
+
+	MapPregenerator(EmergeManager *emerge, const std::string &path_world,
+		MetricsBackend *mb);
+
+	// Reads the area from the settings and the progress made on it before
+	void load(s16 chunksize);
+	void save();
+	// Keeps requests that get cancelled from now on as not done
+	void stop();
+
+	// Queues more mapchunks when the emerge threads have nothing else to do
+	void step(float dtime);
+
+	void setPaused(bool paused);
+	bool isEnabled() const { return m_total != 0; }
+	Progress getProgress();
+
+private:
+	static void emergeCallback(v3s16 blockpos, EmergeAction action, void *param);
+
+	// Center, radius, Y range and chunk size, to tell whether progress saved
+	// before still applies
+	std::string getAreaString() const;
+	// The block to emerge for a mapchunk
+	v3s16 getBlockPos(u32 index) const;
+	// Nothing before is still to be done
+	u32 getCheckpoint() const;
+
+	EmergeManager *m_emerge;
+	std::string m_path;
+
+	// Area, as read from the settings
+	v3s16 m_center;
+	s16 m_radius = 0;
+	s16 m_y_min = 0;
+	s16 m_y_max = 0;
+	float m_max_lag = 0.0f;
+
+	// Mapchunk columns in order, and the mapchunk layers of every column
+	s16 m_chunksize = 0;
+	std::vector<v2s16> m_columns;
+	s16 m_layer_min = 0;
+	s16 m_layer_max = 0;
+	u32 m_total = 0;
+
+	std::mutex m_mutex;
+	// Next mapchunk to queue
+	u32 m_next = 0;
+	// Queued blocks and the index of their mapchunk
+	std::unordered_map<v3s16, u32> m_in_flight;
+	bool m_paused = false;
+	bool m_stopped = false;
+	bool m_throttled = false;
+	float m_avg_dtime = 0.0f;
+
+	MetricGaugePtr m_done_gauge;
+	MetricGaugePtr m_total_gauge;
+};
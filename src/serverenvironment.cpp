@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <algorithm>
+#include <cmath>
 #include <stack>
 #include <utility>
 #include "serverenvironment.h"
@@ -26,6 +27,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapblock.h"
 #include "nodedef.h"
 #include "nodemetadata.h"
+#include "collision.h"
+#include "pathfinder_hpa.h"
 #include "gamedef.h"
 #include "map.h"
 #include "porting.h"
@@ -264,36 +267,42 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 	v3s16 pos;
 	MapNode n;
 	content_t c;
+	std::vector<u16> positions;
 	auto it = getLBMsIntroducedAfter(stamp);
 	for (; it != m_lbm_lookup.end(); ++it) {
-		// Cache previous version to speedup lookup which has a very high performance
-		// penalty on each call
-		content_t previous_c = CONTENT_IGNORE;
-		const std::vector<LoadingBlockModifierDef *> *lbm_list = nullptr;
-
-		for (pos.X = 0; pos.X < MAP_BLOCKSIZE; pos.X++)
-			for (pos.Y = 0; pos.Y < MAP_BLOCKSIZE; pos.Y++)
-				for (pos.Z = 0; pos.Z < MAP_BLOCKSIZE; pos.Z++) {
-					n = block->getNodeNoCheck(pos);
-					c = n.getContent();
-
-					// If content_t are not matching perform an LBM lookup
-					if (previous_c != c) {
-						lbm_list = it->second.lookup(c);
-						previous_c = c;
-					}
+		// The LBMs may change the block, so the contents and their positions
+		// are copied from the index before running any of them
+		std::vector<content_t> contents;
+		for (const auto &entry : block->getContentIndex().getEntries()) {
+			if (it->second.lookup(entry.content))
+				contents.push_back(entry.content);
+		}
 
-					if (!lbm_list)
-						continue;
-					for (auto lbmdef : *lbm_list) {
-						lbmdef->trigger(env, pos + pos_of_block, n, dtime_s);
-						if (block->isOrphan())
-							return;
-						n = block->getNodeNoCheck(pos);
-						if (n.getContent() != c)
-							break; // The node was changed and the LBMs no longer apply
-					}
+		for (content_t lbm_c : contents) {
+			const std::vector<LoadingBlockModifierDef *> *lbm_list =
+				it->second.lookup(lbm_c);
+			const std::vector<u16> *found = block->getContentIndex().find(lbm_c);
+			if (!found)
+				continue;
+			positions = *found;
+
+			for (u16 i : positions) {
+				pos = MapBlockContentIndex::getPos(i);
+				n = block->getNodeNoCheck(pos);
+				c = n.getContent();
+				if (c != lbm_c)
+					continue; // Changed by an earlier LBM
+
+				for (auto lbmdef : *lbm_list) {
+					lbmdef->trigger(env, pos + pos_of_block, n, dtime_s);
+					if (block->isOrphan())
+						return;
+					n = block->getNodeNoCheck(pos);
+					if (n.getContent() != c)
+						break; // The node was changed and the LBMs no longer apply
 				}
+			}
+		}
 	}
 }
 
@@ -451,6 +460,19 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_path_world(path_world),
 	m_rgen(seed())
 {
+	m_abm_scanner = std::make_unique<ABMScanner>(
+		g_settings->getU32("abm_scan_threads"));
+
+	if (m_map) {
+		m_path_nav = std::make_unique<PathNavCache>(m_map, server->ndef(),
+			g_settings->getU32("pathfinder_threads"));
+		m_map->addEventReceiver(m_path_nav.get());
+
+		m_collision_batch = std::make_unique<CollisionBatch>(m_map,
+			server, &m_ao_manager, g_settings->getU32("collision_threads"));
+		m_map->addEventReceiver(m_collision_batch.get());
+	}
+
 	m_step_time_counter = mb->addCounter(
 		"minetest_env_step_time", "Time spent in environment step (in microseconds)");
 
@@ -549,6 +571,16 @@ ServerEnvironment::~ServerEnvironment()
 		m_server->addShutdownError(e);
 	}
 
+	// Stop the pathfinder threads before the map goes away
+	if (m_path_nav) {
+		m_map->removeEventReceiver(m_path_nav.get());
+		m_path_nav.reset();
+	}
+	if (m_collision_batch) {
+		m_map->removeEventReceiver(m_collision_batch.get());
+		m_collision_batch.reset();
+	}
+
 	// Drop/delete map
 	if (m_map)
 		m_map->drop();
@@ -844,234 +876,133 @@ void ServerEnvironment::loadDefaultMeta()
 	m_lbm_mgr.loadIntroductionTimes("", m_server, m_game_time);
 }
 
-struct ActiveABM
-{
-	ActiveBlockModifier *abm;
-	int chance;
-	std::vector<content_t> required_neighbors;
-	bool check_required_neighbors; // false if required_neighbors is known to be empty
-	s16 min_y;
-	s16 max_y;
-};
-
-#define CONTENT_TYPE_CACHE_MAX 64
-
-class ABMHandler
+// Find out how many objects the given block and its neighbors contain.
+// Returns the number of objects in the block, and also in 'wider' the
+// number of objects in the block and all its neighbors. The latter
+// may an estimate if any neighbors are unloaded.
+static u32 countObjects(MapBlock *block, ServerMap *map, u32 &wider)
 {
-private:
-	ServerEnvironment *m_env;
-	std::vector<std::vector<ActiveABM> *> m_aabms;
-public:
-	ABMHandler(std::vector<ABMWithState> &abms,
-		float dtime_s, ServerEnvironment *env,
-		bool use_timers):
-		m_env(env)
-	{
-		if(dtime_s < 0.001)
-			return;
-		const NodeDefManager *ndef = env->getGameDef()->ndef();
-		for (ABMWithState &abmws : abms) {
-			ActiveBlockModifier *abm = abmws.abm;
-			float trigger_interval = abm->getTriggerInterval();
-			if(trigger_interval < 0.001)
-				trigger_interval = 0.001;
-			float actual_interval = dtime_s;
-			if(use_timers){
-				abmws.timer += dtime_s;
-				if(abmws.timer < trigger_interval)
-					continue;
-				abmws.timer -= trigger_interval;
-				actual_interval = trigger_interval;
-			}
-			float chance = abm->getTriggerChance();
-			if (chance == 0)
-				chance = 1;
-			ActiveABM aabm;
-			aabm.abm = abm;
-			if (abm->getSimpleCatchUp()) {
-				float intervals = actual_interval / trigger_interval;
-				if (intervals == 0)
+	wider = 0;
+	u32 wider_unknown_count = 0;
+	for(s16 x=-1; x<=1; x++)
+		for(s16 y=-1; y<=1; y++)
+			for(s16 z=-1; z<=1; z++)
+			{
+				MapBlock *block2 = map->getBlockNoCreateNoEx(
+					block->getPos() + v3s16(x,y,z));
+				if(block2==NULL){
+					wider_unknown_count++;
 					continue;
-				aabm.chance = chance / intervals;
-				if (aabm.chance == 0)
-					aabm.chance = 1;
-			} else {
-				aabm.chance = chance;
-			}
-			// y limits
-			aabm.min_y = abm->getMinY();
-			aabm.max_y = abm->getMaxY();
-
-			// Trigger neighbors
-			const std::vector<std::string> &required_neighbors_s =
-				abm->getRequiredNeighbors();
-			for (const std::string &required_neighbor_s : required_neighbors_s) {
-				ndef->getIds(required_neighbor_s, aabm.required_neighbors);
-			}
-			aabm.check_required_neighbors = !required_neighbors_s.empty();
-
-			// Trigger contents
-			const std::vector<std::string> &contents_s = abm->getTriggerContents();
-			for (const std::string &content_s : contents_s) {
-				std::vector<content_t> ids;
-				ndef->getIds(content_s, ids);
-				for (content_t c : ids) {
-					if (c >= m_aabms.size())
-						m_aabms.resize(c + 256, NULL);
-					if (!m_aabms[c])
-						m_aabms[c] = new std::vector<ActiveABM>;
-					m_aabms[c]->push_back(aabm);
 				}
+				wider += block2->m_static_objects.size();
 			}
-		}
-	}
-
-	~ABMHandler()
-	{
-		for (auto &aabms : m_aabms)
-			delete aabms;
-	}
-
-	// Find out how many objects the given block and its neighbors contain.
-	// Returns the number of objects in the block, and also in 'wider' the
-	// number of objects in the block and all its neighbors. The latter
-	// may an estimate if any neighbors are unloaded.
-	u32 countObjects(MapBlock *block, ServerMap * map, u32 &wider)
-	{
-		wider = 0;
-		u32 wider_unknown_count = 0;
-		for(s16 x=-1; x<=1; x++)
-			for(s16 y=-1; y<=1; y++)
-				for(s16 z=-1; z<=1; z++)
-				{
-					MapBlock *block2 = map->getBlockNoCreateNoEx(
-						block->getPos() + v3s16(x,y,z));
-					if(block2==NULL){
-						wider_unknown_count++;
-						continue;
-					}
-					wider += block2->m_static_objects.size();
-				}
-		// Extrapolate
-		u32 active_object_count = block->m_static_objects.getActiveSize();
-		u32 wider_known_count = 3 * 3 * 3 - wider_unknown_count;
-		wider += wider_unknown_count * wider / wider_known_count;
-		return active_object_count;
-	}
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
-	{
-		if (m_aabms.empty())
-			return;
+	// Extrapolate
+	u32 active_object_count = block->m_static_objects.getActiveSize();
+	u32 wider_known_count = 3 * 3 * 3 - wider_unknown_count;
+	wider += wider_unknown_count * wider / wider_known_count;
+	return active_object_count;
+}
 
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (!block->contents.empty()) {
-			assert(!block->do_not_cache_contents); // invariant
-			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
-			}
-			if (!run_abms)
-				return;
+void ServerEnvironment::prepareABMs()
+{
+	m_abm_scanner->clearABMs();
+	const NodeDefManager *ndef = m_server->ndef();
+	for (ABMWithState &abmws : m_abms) {
+		ActiveBlockModifier *abm = abmws.abm;
+		float trigger_interval = abm->getTriggerInterval();
+		if(trigger_interval < 0.001)
+			trigger_interval = 0.001;
+		if(abmws.timer < trigger_interval)
+			continue;
+		// Several intervals pass if leftover triggers delayed the scan
+		float intervals = std::floor(abmws.timer / trigger_interval);
+		abmws.timer -= intervals * trigger_interval;
+		float chance = abm->getTriggerChance();
+		if (chance == 0)
+			chance = 1;
+		ActiveABM aabm;
+		aabm.abm = abm;
+		if (abm->getSimpleCatchUp()) {
+			aabm.chance = chance / intervals;
+			if (aabm.chance == 0)
+				aabm.chance = 1;
+		} else {
+			aabm.chance = chance;
 		}
-		blocks_scanned++;
-
-		ServerMap *map = &m_env->getServerMap();
-
-		u32 active_object_count_wider;
-		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
-		m_env->m_added_objects = 0;
-
-		bool want_contents_cached = block->contents.empty() && !block->do_not_cache_contents;
-
-		v3s16 p0;
-		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-		{
-			MapNode n = block->getNodeNoCheck(p0);
-			content_t c = n.getContent();
-
-			// Cache content types as we go
-			if (want_contents_cached && !CONTAINS(block->contents, c)) {
-				if (block->contents.size() >= CONTENT_TYPE_CACHE_MAX) {
-					// Too many different nodes... don't try to cache
-					want_contents_cached = false;
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-					block->contents.shrink_to_fit();
-				} else {
-					block->contents.push_back(c);
-				}
-			}
-
-			if (c >= m_aabms.size() || !m_aabms[c])
-				continue;
-
-			v3s16 p = p0 + block->getPosRelative();
-			for (ActiveABM &aabm : *m_aabms[c]) {
-				if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
-					continue;
+		// y limits
+		aabm.min_y = abm->getMinY();
+		aabm.max_y = abm->getMaxY();
+
+		// Trigger neighbors
+		const std::vector<std::string> &required_neighbors_s =
+			abm->getRequiredNeighbors();
+		for (const std::string &required_neighbor_s : required_neighbors_s) {
+			ndef->getIds(required_neighbor_s, aabm.required_neighbors);
+		}
+		aabm.check_required_neighbors = !required_neighbors_s.empty();
 
-				if (myrand() % aabm.chance != 0)
-					continue;
+		// Trigger contents
+		std::vector<content_t> ids;
+		for (const std::string &content_s : abm->getTriggerContents())
+			ndef->getIds(content_s, ids);
+		m_abm_scanner->addABM(aabm, ids);
+	}
+}
 
-				// Check neighbors
-				if (aabm.check_required_neighbors) {
-					v3s16 p1;
-					for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
-					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
-					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
-					{
-						if(p1 == p0)
-							continue;
-						content_t c;
-						if (block->isValidPosition(p1)) {
-							// if the neighbor is found on the same map block
-							// get it straight from there
-							const MapNode &n = block->getNodeNoCheck(p1);
-							c = n.getContent();
-						} else {
-							// otherwise consult the map
-							MapNode n = map->getNode(p1 + block->getPosRelative());
-							c = n.getContent();
-						}
-						if (CONTAINS(aabm.required_neighbors, c))
-							goto neighbor_found;
-					}
-					// No required neighbor found
-					continue;
-				}
-				neighbor_found:
+bool ServerEnvironment::runABMTriggers(TimeTaker &timer, u32 max_time_ms,
+	int &abms_run)
+{
+	// Triggers are grouped by block
+	MapBlock *block = nullptr;
+	v3s16 blockpos;
+	bool have_blockpos = false;
+	u32 active_object_count = 0;
+	u32 active_object_count_wider = 0;
 
-				abms_run++;
-				// Call all the trigger variations
-				aabm.abm->trigger(m_env, p, n);
-				aabm.abm->trigger(m_env, p, n,
-					active_object_count, active_object_count_wider);
+	while (m_abm_triggers_next < m_abm_triggers.size()) {
+		if (timer.getTimerTime() > max_time_ms)
+			return false;
 
-				if (block->isOrphan())
-					return;
+		const ABMTrigger t = m_abm_triggers[m_abm_triggers_next++];
+		const v3s16 bp = getNodeBlockPos(t.p);
+		if (!have_blockpos || bp != blockpos) {
+			blockpos = bp;
+			have_blockpos = true;
+			// Leftovers may be from blocks that are no longer active
+			block = m_active_blocks.m_abm_list.count(bp) ?
+				m_map->getBlockNoCreateNoEx(bp) : nullptr;
+			if (block)
+				active_object_count = countObjects(block, m_map, active_object_count_wider);
+			m_added_objects = 0;
+		}
+		if (!block)
+			continue;
 
-				// Count surrounding objects again if the abms added any
-				if(m_env->m_added_objects > 0) {
-					active_object_count = countObjects(block, map, active_object_count_wider);
-					m_env->m_added_objects = 0;
-				}
+		// The node may have changed since the scan
+		MapNode n = block->getNodeNoCheck(t.p - block->getPosRelative());
+		if (n.getContent() != t.n.getContent())
+			continue;
 
-				// Update and check node after possible modification
-				n = block->getNodeNoCheck(p0);
-				if (n.getContent() != c)
-					break;
-			}
+		abms_run++;
+		// Call all the trigger variations
+		t.abm->trigger(this, t.p, n);
+		t.abm->trigger(this, t.p, n,
+			active_object_count, active_object_count_wider);
+
+		if (block->isOrphan()) {
+			block = nullptr;
+			have_blockpos = false;
+		} else if (m_added_objects > 0) {
+			// Count surrounding objects again if the abms added any
+			active_object_count = countObjects(block, m_map, active_object_count_wider);
+			m_added_objects = 0;
 		}
 	}
-};
+
+	m_abm_triggers.clear();
+	m_abm_triggers_next = 0;
+	return true;
+}
 
 void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 {
@@ -1310,6 +1241,8 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 	};
 
 	m_ao_manager.clearIf(cb_removal);
+	if (m_collision_batch)
+		m_collision_batch->clear();
 
 	// Get list of loaded blocks
 	std::vector<v3s16> loaded_blocks;
@@ -1564,52 +1497,60 @@ void ServerEnvironment::step(float dtime)
 		ScopeProfiler sp(g_profiler, "SEnv: modify in blocks avg per interval", SPT_AVG);
 		TimeTaker timer("modify in active blocks per interval");
 
-		// Shuffle to prevent persistent artifacts of ordering
-		std::shuffle(m_abms.begin(), m_abms.end(), m_rgen);
-
-		// Initialize handling of ActiveBlockModifiers
-		ABMHandler abmhandler(m_abms, m_cache_abm_interval, this, true);
-
-		int blocks_scanned = 0;
-		int abms_run = 0;
-		int blocks_cached = 0;
-
-		std::vector<v3s16> output(m_active_blocks.m_abm_list.size());
-
-		// Shuffle the active blocks so that each block gets an equal chance
-		// of having its ABMs run.
-		std::copy(m_active_blocks.m_abm_list.begin(), m_active_blocks.m_abm_list.end(), output.begin());
-		std::shuffle(output.begin(), output.end(), m_rgen);
-
-		int i = 0;
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
-				continue;
+		int abms_run = 0;
 
-			i++;
+		// The timers advance even while no new scan starts
+		for (ABMWithState &abmws : m_abms)
+			abmws.timer += m_cache_abm_interval;
+
+		// Triggers left over from the previous interval run first, new
+		// ones are only searched for once they are done
+		bool done = runABMTriggers(timer, max_time_ms, abms_run);
+		if (done) {
+			// Shuffle to prevent persistent artifacts of ordering
+			std::shuffle(m_abms.begin(), m_abms.end(), m_rgen);
+
+			// Initialize handling of ActiveBlockModifiers
+			prepareABMs();
+
+			std::vector<MapBlock *> blocks;
+			blocks.reserve(m_active_blocks.m_abm_list.size());
+			for (const v3s16 &p : m_active_blocks.m_abm_list) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+				if (!block)
+					continue;
+				// Set current time as timestamp
+				block->setTimestampNoChangedFlag(m_game_time);
+				blocks.push_back(block);
+			}
 
-			// Set current time as timestamp
-			block->setTimestampNoChangedFlag(m_game_time);
+			// Shuffle the active blocks so that each block gets an equal chance
+			// of having its ABMs run.
+			std::shuffle(blocks.begin(), blocks.end(), m_rgen);
 
-			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			ABMScanStats stats;
+			{
+				ScopeProfiler sp2(g_profiler, "SEnv: ABM scan avg", SPT_AVG);
+				m_abm_scanner->scan(m_map, blocks, m_abm_triggers, &stats);
+			}
+			g_profiler->avg("ServerEnv: active blocks cached", stats.blocks_cached);
+			g_profiler->avg("ServerEnv: active blocks scanned for ABMs", stats.blocks_scanned);
+			g_profiler->avg("ServerEnv: ABM triggers found", m_abm_triggers.size());
 
-			u32 time_ms = timer.getTimerTime();
+			done = runABMTriggers(timer, max_time_ms, abms_run);
+		}
 
-			if (time_ms > max_time_ms) {
-				warningstream << "active block modifiers took "
-					  << time_ms << "ms (processed " << i << " of "
-					  << output.size() << " active blocks)" << std::endl;
-				break;
-			}
+		if (!done) {
+			warningstream << "active block modifiers took "
+				  << timer.getTimerTime() << "ms ("
+				  << m_abm_triggers.size() - m_abm_triggers_next
+				  << " triggers left for the next interval)" << std::endl;
 		}
 		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
-		g_profiler->avg("ServerEnv: active blocks cached", blocks_cached);
-		g_profiler->avg("ServerEnv: active blocks scanned for ABMs", blocks_scanned);
 		g_profiler->avg("ServerEnv: ABMs run", abms_run);
+		g_profiler->avg("ServerEnv: ABM triggers left", m_abm_triggers.size() - m_abm_triggers_next);
 
 		timer.stop(true);
 	}
@@ -1621,6 +1562,10 @@ void ServerEnvironment::step(float dtime)
 
 	m_script->stepAsync();
 
+	// Call back the finished pathfinder searches
+	if (m_path_nav)
+		m_path_nav->step(dtime);
+
 	/*
 		Step active objects
 	*/
@@ -1637,6 +1582,20 @@ void ServerEnvironment::step(float dtime)
 
 		u32 object_count = 0;
 
+		// Sweep the physical entities on the collision threads up front
+		if (m_collision_batch) {
+			std::vector<ServerActiveObject *> objects;
+			m_ao_manager.getAllObjects(objects);
+			std::vector<CollisionBatch::Move> moves;
+			CollisionBatch::Move move;
+			for (ServerActiveObject *obj : objects) {
+				if (obj->getType() == ACTIVEOBJECT_TYPE_LUAENTITY && !obj->isGone() &&
+						static_cast<LuaEntitySAO *>(obj)->getCollisionMove(&move))
+					moves.push_back(move);
+			}
+			m_collision_batch->prepare(dtime, moves);
+		}
+
 		auto cb_state = [&](ServerActiveObject *obj) {
 			if (obj->isGone())
 				return;
@@ -1649,6 +1608,14 @@ void ServerEnvironment::step(float dtime)
 		};
 		m_ao_manager.step(dtime, cb_state);
 
+		if (m_collision_batch) {
+			g_profiler->avg("ServerEnv: collision batch hits",
+				m_collision_batch->getHits());
+			g_profiler->avg("ServerEnv: collision batch misses",
+				m_collision_batch->getMisses());
+			m_collision_batch->clear();
+		}
+
 		m_active_object_gauge->set(object_count);
 	}
 
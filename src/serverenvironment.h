@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "environment.h"
 #include "map.h"
 #include "settings.h"
+#include "server/abmscanner.h"
 #include "server/activeobjectmgr.h"
 #include "util/numeric.h"
 #include "util/metricsbackend.h"
@@ -38,11 +39,14 @@ class PlayerDatabase;
 class AuthDatabase;
 class PlayerSAO;
 class ServerEnvironment;
+class TimeTaker;
 class ActiveBlockModifier;
 struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+class PathNavCache;
+class CollisionBatch;
 enum AccessDeniedCode : u8;
 typedef u16 session_t;
 
@@ -379,6 +383,14 @@ class ServerEnvironment final : public Environment
 
 	std::set<v3s16>* getForceloadedBlocks() { return &m_active_blocks.m_forceloaded_list; }
 
+	// Walkability cache and threads of the hierarchical pathfinder
+	PathNavCache *getPathNavCache() { return m_path_nav.get(); }
+
+	// Collisions of the entities stepped in this step
+	CollisionBatch *getCollisionBatch() { return m_collision_batch.get(); }
+
+	server::ActiveObjectMgr &getActiveObjectMgr() { return m_ao_manager; }
+
 	// Sorted by how ready a mapblock is
 	enum BlockStatus {
 		BS_UNKNOWN,
@@ -415,6 +427,12 @@ class ServerEnvironment final : public Environment
 			const std::string &savedir, const Settings &conf);
 	static AuthDatabase *openAuthDatabase(const std::string &name,
 			const std::string &savedir, const Settings &conf);
+
+	// Hands the ABMs whose timers are due to m_abm_scanner
+	void prepareABMs();
+	// Runs queued ABM triggers until the time budget is used up.
+	// Returns true if the queue was emptied.
+	bool runABMTriggers(TimeTaker &timer, u32 max_time_ms, int &abms_run);
 	/*
 		Internal ActiveObject interface
 		-------------------------------------------
@@ -503,7 +521,13 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	std::unique_ptr<ABMScanner> m_abm_scanner;
+	// Found by the scan, not run yet; may be carried over to the next interval
+	std::vector<ABMTrigger> m_abm_triggers;
+	size_t m_abm_triggers_next = 0;
 	LBMManager m_lbm_mgr;
+	std::unique_ptr<PathNavCache> m_path_nav;
+	std::unique_ptr<CollisionBatch> m_collision_batch;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
 	// Estimate for general maximum lag as determined by server.
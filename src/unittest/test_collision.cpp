@@ -19,7 +19,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <cstring>
 #include "collision.h"
+#include "dummymap.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "porting.h"
+#include "server/activeobjectmgr.h"
 
 class TestCollision : public TestBase {
 public:
@@ -29,6 +35,8 @@ class TestCollision : public TestBase {
 	void runTests(IGameDef *gamedef);
 
 	void testAxisAlignedCollision();
+	void testCollisionBatch(IGameDef *gamedef);
+	void testCollisionBatchMapChange(IGameDef *gamedef);
 };
 
 static TestCollision g_test_instance;
@@ -36,6 +44,8 @@ static TestCollision g_test_instance;
 void TestCollision::runTests(IGameDef *gamedef)
 {
 	TEST(testAxisAlignedCollision);
+	TEST(testCollisionBatch, gamedef);
+	TEST(testCollisionBatchMapChange, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -178,3 +188,216 @@ void TestCollision::testAxisAlignedCollision()
 		}
 	}
 }
+
+namespace {
+
+const v3s16 BPMIN(-2, -1, -2);
+const v3s16 BPMAX(1, 1, 1);
+const aabb3f ENTITY_BOX(-0.3f * BS, -0.5f * BS, -0.3f * BS,
+		0.3f * BS, 0.5f * BS, 0.3f * BS);
+const f32 ENTITY_STEPHEIGHT = 0.6f * BS;
+const v3f GRAVITY(0, -9.81f * BS, 0);
+
+class TestCollisionSAO : public ServerActiveObject
+{
+public:
+	TestCollisionSAO(const v3f &pos, const v3f &speed, bool collides) :
+		ServerActiveObject(nullptr, pos), speed(speed), collides(collides) {}
+
+	virtual ActiveObjectType getType() const { return ACTIVEOBJECT_TYPE_TEST; }
+	virtual bool getCollisionBox(aabb3f *toset) const
+	{
+		*toset = ENTITY_BOX;
+		toset->MinEdge += m_base_position;
+		toset->MaxEdge += m_base_position;
+		return true;
+	}
+	virtual bool getSelectionBox(aabb3f *toset) const { return false; }
+	virtual bool collideWithObjects() const { return collides; }
+
+	v3f speed;
+	bool collides;
+};
+
+// A floor with pillars and steps
+void makeTerrain(Map &map)
+{
+	for (s16 bz = BPMIN.Z; bz <= BPMAX.Z; bz++)
+	for (s16 by = BPMIN.Y; by <= BPMAX.Y; by++)
+	for (s16 bx = BPMIN.X; bx <= BPMAX.X; bx++) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(bx, by, bz));
+		for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+			v3s16 p = block->getPosRelative() + v3s16(x, y, z);
+			bool solid = p.Y <= 0 ||
+				(p.X % 7 == 0 && p.Z % 7 == 0 && p.Y <= 4) ||
+				(p.X % 11 == 3 && p.Y <= 1);
+			block->setNodeNoCheck(x, y, z,
+				MapNode(solid ? t_CONTENT_STONE : CONTENT_AIR));
+		}
+	}
+}
+
+struct CollisionWorld
+{
+	server::ActiveObjectMgr objects;
+	// in the order of the ids
+	std::vector<TestCollisionSAO *> saos;
+
+	CollisionWorld(u32 count)
+	{
+		PcgRandom pr(count);
+		for (u32 i = 0; i < count; i++) {
+			v3f pos(pr.range(-300, 290), pr.range(15, 250), pr.range(-300, 290));
+			v3f speed(pr.range(-40, 40), pr.range(-40, 20), pr.range(-40, 40));
+			auto sao = std::make_unique<TestCollisionSAO>(pos, speed, i % 4 != 0);
+			sao->setId(i + 1);
+			saos.push_back(sao.get());
+			objects.registerObject(std::move(sao));
+		}
+	}
+
+	~CollisionWorld()
+	{
+		objects.clear();
+	}
+};
+
+bool equalResults(const collisionMoveResult &a, const collisionMoveResult &b)
+{
+	if (a.touching_ground != b.touching_ground || a.collides != b.collides ||
+			a.standing_on_object != b.standing_on_object ||
+			a.collisions.size() != b.collisions.size())
+		return false;
+	for (size_t i = 0; i < a.collisions.size(); i++) {
+		const CollisionInfo &ca = a.collisions[i];
+		const CollisionInfo &cb = b.collisions[i];
+		// The worlds have their own objects with the same ids
+		if (ca.type != cb.type || ca.axis != cb.axis || ca.node_p != cb.node_p ||
+				ca.plane != cb.plane || !ca.object != !cb.object ||
+				(ca.object && ca.object->getId() != cb.object->getId()) ||
+				memcmp(&ca.old_speed, &cb.old_speed, sizeof(v3f)) != 0 ||
+				memcmp(&ca.new_speed, &cb.new_speed, sizeof(v3f)) != 0)
+			return false;
+	}
+	return true;
+}
+
+}
+
+void TestCollision::testCollisionBatch(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, BPMIN, BPMAX);
+	makeTerrain(map);
+	const f32 dtime = 0.09f;
+
+	for (u32 count : {10, 100, 1000}) {
+		// The same entities, moved one after the other and batched
+		CollisionWorld reference(count);
+		CollisionWorld world(count);
+		CollisionBatch batch(&map, gamedef, &world.objects, 4);
+		map.addEventReceiver(&batch);
+		u64 time_reference = 0, time_batch = 0;
+		u32 hits = 0;
+
+		for (int step = 0; step < 10; step++) {
+			std::vector<collisionMoveResult> results;
+			u64 t0 = porting::getTimeUs();
+			for (TestCollisionSAO *sao : reference.saos) {
+				v3f pos = sao->getBasePosition();
+				results.push_back(collisionMoveSimple(&map, gamedef,
+						&reference.objects, BS * 0.25f, ENTITY_BOX,
+						ENTITY_STEPHEIGHT, dtime, &pos, &sao->speed, GRAVITY,
+						sao, sao->collides));
+				sao->setBasePosition(pos);
+			}
+			time_reference += porting::getTimeUs() - t0;
+
+			t0 = porting::getTimeUs();
+			std::vector<CollisionBatch::Move> moves;
+			for (TestCollisionSAO *sao : world.saos) {
+				moves.push_back({sao, ENTITY_BOX, ENTITY_STEPHEIGHT,
+						sao->getBasePosition(), sao->speed, GRAVITY,
+						sao->collides});
+			}
+			batch.prepare(dtime, moves);
+			for (size_t i = 0; i < world.saos.size(); i++) {
+				TestCollisionSAO *sao = world.saos[i];
+				v3f pos = sao->getBasePosition();
+				collisionMoveResult result = batch.move(BS * 0.25f,
+						ENTITY_BOX, ENTITY_STEPHEIGHT, dtime, &pos, &sao->speed,
+						GRAVITY, sao, sao->collides);
+				// No environment to do this for us
+				sao->setBasePosition(pos);
+				batch.objectMoved(sao);
+				UASSERT(equalResults(result, results[i]));
+			}
+			hits += batch.getHits();
+			batch.clear();
+			time_batch += porting::getTimeUs() - t0;
+
+			for (size_t i = 0; i < world.saos.size(); i++) {
+				v3f pos_a = reference.saos[i]->getBasePosition();
+				v3f pos_b = world.saos[i]->getBasePosition();
+				UASSERT(memcmp(&pos_a, &pos_b, sizeof(v3f)) == 0);
+				UASSERT(memcmp(&reference.saos[i]->speed, &world.saos[i]->speed,
+						sizeof(v3f)) == 0);
+			}
+		}
+
+		map.removeEventReceiver(&batch);
+		UASSERT(hits > 0);
+		infostream << "TestCollision: " << count << " entities, 10 steps: "
+			<< time_reference << "us one by one, " << time_batch
+			<< "us batched, " << hits << " moves served from the batch"
+			<< std::endl;
+	}
+}
+
+void TestCollision::testCollisionBatchMapChange(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, BPMIN, BPMAX);
+	makeTerrain(map);
+	server::ActiveObjectMgr objects;
+	CollisionBatch batch(&map, gamedef, &objects, 2);
+	map.addEventReceiver(&batch);
+	const f32 dtime = 0.09f;
+
+	// Falls into (5, 2, 5) this step
+	TestCollisionSAO sao(v3f(5, 3.6f, 5) * BS, v3f(0, -10, 0) * BS, true);
+	CollisionBatch::Move move{&sao, ENTITY_BOX, ENTITY_STEPHEIGHT,
+			sao.getBasePosition(), sao.speed, GRAVITY, true};
+
+	auto check = [&] (bool expect_hit) {
+		batch.prepare(dtime, {move});
+		if (!expect_hit) {
+			v3s16 p(5, 2, 5);
+			map.setNode(p, MapNode(t_CONTENT_STONE));
+			MapEditEvent event;
+			event.setPositionModified(p);
+			map.dispatchEvent(event);
+		}
+
+		v3f pos = move.pos, speed = move.speed;
+		collisionMoveResult result = batch.move(BS * 0.25f, ENTITY_BOX,
+				ENTITY_STEPHEIGHT, dtime, &pos, &speed, GRAVITY, &sao, true);
+		UASSERT(batch.getHits() == (expect_hit ? 1 : 0));
+		UASSERT(batch.getMisses() == (expect_hit ? 0 : 1));
+
+		v3f pos2 = move.pos, speed2 = move.speed;
+		collisionMoveResult result2 = collisionMoveSimple(&map, gamedef,
+				&objects, BS * 0.25f, ENTITY_BOX, ENTITY_STEPHEIGHT, dtime,
+				&pos2, &speed2, GRAVITY, &sao, true);
+		UASSERT(equalResults(result, result2));
+		UASSERT(memcmp(&pos, &pos2, sizeof(v3f)) == 0);
+		UASSERT(memcmp(&speed, &speed2, sizeof(v3f)) == 0);
+		return result;
+	};
+
+	UASSERT(!check(true).collides);
+	// The node placed after prepare() stops the fall
+	UASSERT(check(false).collides);
+
+	map.removeEventReceiver(&batch);
+}
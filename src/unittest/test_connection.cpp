@@ -20,12 +20,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "log.h"
+#include "noise.h"
 #include "porting.h"
 #include "settings.h"
 #include "util/serialize.h"
 #include "network/connection.h"
 #include "network/networkpacket.h"
 #include "network/socket.h"
+#include <algorithm>
 
 class TestConnection : public TestBase {
 public:
@@ -41,7 +43,14 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testPacketBuffer();
+	void testReliableBufferLossReorder();
+	void testSplitBufferLossReorder();
+	void testCongestionControl();
+	void testStreamQueue();
 	void testConnectSendReceive();
+	void testLoopbackThroughput();
+	void testShardedSend();
 };
 
 static TestConnection g_test_instance;
@@ -50,7 +59,14 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testPacketBuffer);
+	TEST(testReliableBufferLossReorder);
+	TEST(testSplitBufferLossReorder);
+	TEST(testCongestionControl);
+	TEST(testStreamQueue);
 	TEST(testConnectSendReceive);
+	TEST(testLoopbackThroughput);
+	TEST(testShardedSend);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -156,6 +172,360 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p2[3]) == data1[0]);
 }
 
+void TestConnection::testPacketBuffer()
+{
+	// Growing keeps the data and the headroom
+	PacketBuffer buf(4, SEND_HEADROOM);
+	UASSERTEQ(u32, buf.getHeadroom(), SEND_HEADROOM);
+	writeU32(*buf, 0xdeadbeef);
+	for (u32 size = 8; size <= 100000; size *= 3) {
+		buf.resize(size);
+		UASSERTEQ(u32, buf.getSize(), size);
+		UASSERTEQ(u32, buf.getHeadroom(), SEND_HEADROOM);
+		UASSERT(readU32(*buf) == 0xdeadbeef);
+	}
+	buf.consume(2);
+	UASSERTEQ(u32, buf.getHeadroom(), SEND_HEADROOM + 2);
+	UASSERT(readU16(*buf) == 0xbeef);
+	writeU8(buf.prepend(1), 0xad);
+	UASSERT(readU16(*buf) == 0xadbe);
+
+	// Released slabs are handed out again
+	std::vector<PacketBufferStats> before, after;
+	PacketBufferPool::get()->getStats(before);
+	for (int i = 0; i < 100; i++)
+		PacketBuffer tmp(200);
+	PacketBufferPool::get()->getStats(after);
+	u64 allocations = 0, reuses = 0;
+	for (size_t i = 0; i < after.size(); i++) {
+		allocations += after[i].allocations - before[i].allocations;
+		reuses += after[i].reuses - before[i].reuses;
+	}
+	UASSERT(allocations <= 1);
+	UASSERTEQ(u64, allocations + reuses, 100);
+
+	// The command and data of a packet, with room for the headers in front
+	NetworkPacket pkt(0x4b, 0);
+	pkt << (u32)12345 << std::string("payload");
+	NetworkPacket pkt_copy = pkt;
+	pkt << (u8)1;
+	UASSERTEQ(u32, pkt_copy.getSize() + 1, pkt.getSize());
+
+	Buffer<u8> legacy = pkt.oldForgePacket();
+	PacketBuffer wire = pkt.forgePacket(SEND_HEADROOM);
+	UASSERTEQ(u32, wire.getSize(), legacy.getSize());
+	UASSERT(!memcmp(*wire, *legacy, legacy.getSize()));
+
+	// Prepending the headers in place gives the same datagram as copying
+	Address a(127, 0, 0, 1, 10);
+	const u16 seqnum = 65500;
+	std::list<SharedBuffer<u8>> originals;
+	u16 split_seqnum = 0;
+	con::makeAutoSplitPacket(legacy, 500, split_seqnum, &originals);
+	UASSERTEQ(size_t, originals.size(), 1);
+	con::BufferedPacketPtr p1 = con::makePacket(a,
+			con::makeReliablePacket(originals.front(), seqnum), 0x12345678, 123, 2);
+	con::BufferedPacketPtr p2 = con::makeOriginalReliablePacket(a,
+			std::move(wire), seqnum, 0x12345678, 123, 2);
+	UASSERTEQ(size_t, p2->size(), p1->size());
+	UASSERT(!memcmp(p2->data, p1->data, p1->size()));
+	UASSERT(p2->getSeqnum() == seqnum);
+}
+
+void TestConnection::testReliableBufferLossReorder()
+{
+	/*
+		Run the reliable buffers of both sides of a channel over a simulated
+		network that loses, duplicates and reorders packets and acks
+	*/
+	const u32 proto_id = 0x12345678;
+	const u32 count = 20000;
+	const u32 window = 1024;
+	Address address(127, 0, 0, 1, 10);
+	PcgRandom pr(1234);
+
+	con::ReliablePacketBuffer outgoing;
+	con::ReliablePacketBuffer incoming;
+	std::vector<con::BufferedPacketPtr> network;
+	std::vector<u16> acks;
+	u16 next_outgoing = SEQNUM_INITIAL;
+	u16 next_incoming = SEQNUM_INITIAL;
+	u32 sent = 0;
+	std::vector<u32> received;
+
+	const auto transmit = [&] (const con::BufferedPacketPtr &p) {
+		u32 r = pr.range(0, 99);
+		if (r < 10)
+			return; // lost
+		network.push_back(p);
+		if (r < 15)
+			network.push_back(p); // duplicated
+	};
+	const auto window_full = [&] () {
+		u16 first;
+		return outgoing.getFirstSeqnum(first) &&
+			(u16)(next_outgoing - first) >= window;
+	};
+	const auto deliver = [&] (const con::BufferedPacketPtr &p) {
+		received.push_back(readU32(&p->data[BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE]));
+		next_incoming++;
+	};
+
+	for (u32 step = 0; received.size() < count; step++) {
+		UASSERT(step < 100000);
+
+		// Send new packets while the window allows it
+		while (sent < count && !window_full()) {
+			SharedBuffer<u8> data(4);
+			writeU32(&data[0], sent++);
+			con::BufferedPacketPtr p = con::makePacket(address,
+				con::makeReliablePacket(data, next_outgoing++), proto_id, 2, 0);
+			// Same window as ConnectionSendThread::sendAsPacketReliable()
+			outgoing.insert(p, next_outgoing - MAX_RELIABLE_WINDOW_SIZE);
+			transmit(p);
+		}
+
+		// Resend what was not acked in time
+		outgoing.incrementTimeouts(0.1f);
+		for (const auto &p : outgoing.getResend(0.5f, window)) {
+			con::BufferedPacketPtr copy = con::makePacket(address,
+				SharedBuffer<u8>(p->data + BASE_HEADER_SIZE,
+					p->size() - BASE_HEADER_SIZE), proto_id, 2, 0);
+			transmit(copy);
+		}
+
+		// Deliver a random part of the network in random order
+		for (size_t i = network.size(); i > 1; i--)
+			std::swap(network[i - 1], network[pr.range(0, i - 1)]);
+		size_t n = network.size() / 2 + 1;
+		for (size_t i = 0; i < n && !network.empty(); i++) {
+			con::BufferedPacketPtr p = network.back();
+			network.pop_back();
+			u16 seqnum = p->getSeqnum();
+
+			if (seqnum == next_incoming) {
+				deliver(p);
+				u16 first;
+				while (incoming.getFirstSeqnum(first) && first == next_incoming)
+					deliver(incoming.popFirst());
+			} else if (con::seqnum_higher(seqnum, next_incoming)) {
+				incoming.insert(p, next_incoming);
+			}
+			if (pr.range(0, 99) >= 10)
+				acks.push_back(seqnum);
+		}
+
+		// Process the acks
+		for (u16 seqnum : acks) {
+			try {
+				outgoing.popSeqnum(seqnum);
+			} catch (con::NotFoundException &e) {
+				// duplicate ack
+			}
+		}
+		acks.clear();
+
+		// The first outgoing packet is the oldest one not acked
+		u16 first;
+		if (outgoing.getFirstSeqnum(first))
+			UASSERT(!con::seqnum_higher(first, next_incoming));
+	}
+
+	UASSERTEQ(size_t, received.size(), count);
+	for (u32 i = 0; i < count; i++)
+		UASSERTEQ(u32, received[i], i);
+	UASSERT(incoming.empty());
+}
+
+void TestConnection::testSplitBufferLossReorder()
+{
+	/*
+		Reassemble split packets from chunks that arrive duplicated and in
+		random order, with the seqnums wrapping around
+	*/
+	const u32 proto_id = 0x12345678;
+	const u32 count = 500;
+	Address address(127, 0, 0, 1, 10);
+	PcgRandom pr(4321);
+
+	con::IncomingSplitBuffer buffer;
+	std::vector<SharedBuffer<u8>> packets;
+	std::vector<std::pair<u32, con::BufferedPacketPtr>> chunks;
+	std::vector<con::BufferedPacketPtr> withheld;
+	u16 split_seqnum = 65400;
+
+	for (u32 i = 0; i < count; i++) {
+		SharedBuffer<u8> data(pr.range(600, 6000));
+		writeU32(&data[0], i);
+		for (u32 j = 4; j < data.getSize(); j++)
+			data[j] = pr.next();
+		packets.push_back(data);
+
+		std::list<SharedBuffer<u8>> list;
+		con::makeAutoSplitPacket(data, 500, split_seqnum, &list);
+		bool withhold = i % 10 == 0;
+		for (const SharedBuffer<u8> &chunk : list) {
+			auto p = con::makePacket(address, chunk, proto_id, 2, 0);
+			// Every tenth packet misses its last chunk
+			if (withhold && &chunk == &list.back()) {
+				withheld.push_back(p);
+				continue;
+			}
+			chunks.emplace_back(i, p);
+			if (pr.range(0, 9) == 0)
+				chunks.emplace_back(i, p);
+		}
+	}
+
+	for (size_t i = chunks.size(); i > 1; i--)
+		std::swap(chunks[i - 1], chunks[pr.range(0, i - 1)]);
+
+	std::vector<bool> done(count, false);
+	for (auto &chunk : chunks) {
+		// Unreliable ones with a missing chunk are dropped on timeout
+		bool reliable = chunk.first % 10 != 0;
+		SharedBuffer<u8> result = buffer.insert(chunk.second, reliable);
+		if (result.getSize() == 0)
+			continue;
+
+		u32 i = readU32(&result[0]);
+		UASSERTEQ(u32, i, chunk.first);
+		UASSERT(!done[i]);
+		done[i] = true;
+		UASSERTEQ(u32, result.getSize(), packets[i].getSize());
+		UASSERT(memcmp(*result, *packets[i], result.getSize()) == 0);
+	}
+
+	for (u32 i = 0; i < count; i++)
+		UASSERT(done[i] == (i % 10 != 0));
+
+	// The incomplete packets time out, the missing chunks come too late
+	buffer.removeUnreliableTimedOuts(1.0f, 0.5f);
+	for (auto &p : withheld)
+		UASSERTEQ(u32, buffer.insert(p, false).getSize(), 0);
+}
+
+void TestConnection::testCongestionControl()
+{
+	/*
+		Send through a simulated bottleneck with a bounded queue, the
+		controller has to find the bandwidth and the round trip time and
+		keep the queue short
+	*/
+	const float bandwidth = 1000000.0f; // bytes per second
+	const u64 base_rtt = 40000; // us
+	const u32 queue_limit = 128 * 1024;
+	const u32 size = 500;
+	const u64 duration = 5000000;
+
+	struct Event {
+		con::DeliveryState state;
+		bool lost;
+	};
+	con::CongestionControl cc;
+	std::multimap<u64, Event> events;
+	u64 link_free = 0;
+	u32 max_queued = 0;
+	u32 lost = 0;
+	u64 acked_late = 0;
+
+	for (u64 now = 1; now < duration; now += 100) {
+		while (!events.empty() && events.begin()->first <= now) {
+			Event ev = events.begin()->second;
+			events.erase(events.begin());
+			if (!ev.lost) {
+				cc.onAck(ev.state, size, false, now);
+				if (now > duration - 1000000)
+					acked_late += size;
+				continue;
+			}
+			// Resent after the timeout, the link is free by then
+			cc.onLoss(size);
+			cc.onResend(size, now);
+			events.emplace(now + base_rtt, Event{ev.state, false});
+		}
+
+		while (cc.canSend(size, now)) {
+			Event ev{{}, false};
+			cc.onSend(ev.state, size, now, false);
+
+			u32 queued = link_free > now ? (link_free - now) * bandwidth / 1e6f : 0;
+			max_queued = MYMAX(max_queued, queued);
+			if (queued + size > queue_limit) {
+				lost++;
+				ev.lost = true;
+				events.emplace(now + 500000, ev);
+				continue;
+			}
+			link_free = MYMAX(now, link_free) + (u64)(size * 1e6f / bandwidth);
+			events.emplace(link_free + base_rtt, ev);
+		}
+	}
+
+	infostream << "testCongestionControl: bandwidth=" << cc.getBandwidth()
+		<< " min_rtt=" << cc.getMinRTT() << " cwnd=" << cc.getCongestionWindow()
+		<< " max_queued=" << max_queued << " lost=" << lost << std::endl;
+
+	UASSERT(std::fabs(cc.getBandwidth() - bandwidth) < bandwidth * 0.05f);
+	UASSERT(cc.getMinRTT() >= base_rtt / 1e6f);
+	UASSERT(cc.getMinRTT() < base_rtt / 1e6f + 0.002f);
+	UASSERT(cc.getState() == con::CongestionControl::PROBE_BW);
+	// The link is used, but the window stays near twice the BDP
+	UASSERT(acked_late > bandwidth * 0.9f);
+	UASSERT(cc.getCongestionWindow() < 3 * bandwidth * base_rtt / 1e6f);
+	UASSERT(max_queued < queue_limit);
+	UASSERTEQ(u32, lost, 0);
+}
+
+void TestConnection::testStreamQueue()
+{
+	const auto make_command = [] (u16 command, u32 size, u8 stream) {
+		NetworkPacket pkt(command, size);
+		for (u32 i = 0; i < size; i++)
+			pkt << static_cast<u8>(i);
+		return con::ConnectionCommand::send(1, 0, &pkt, true, stream);
+	};
+
+	con::StreamQueue queue;
+	UASSERT(queue.empty());
+	UASSERT(!queue.front());
+
+	// A burst of map blocks, then chat messages and a large media file
+	for (u16 i = 1; i <= 100; i++)
+		queue.push_back(make_command(i, 1000, NETSTREAM_BLOCKS));
+	queue.push_back(make_command(1000, 10, NETSTREAM_CHAT));
+	queue.push_back(make_command(1001, 10, NETSTREAM_CHAT));
+	queue.push_back(make_command(2000, 20000, NETSTREAM_MEDIA));
+	UASSERTEQ(size_t, queue.size(), 103);
+	UASSERTEQ(size_t, queue.size(NETSTREAM_BLOCKS), 100);
+
+	std::vector<u16> order;
+	while (!queue.empty()) {
+		const con::ConnectionCommandPtr &c = queue.front();
+		UASSERT(c);
+		// front() doesn't change until the command is popped
+		UASSERT(queue.front() == c);
+		order.push_back(readU16(*c->data));
+		queue.pop_front();
+	}
+	UASSERTEQ(size_t, order.size(), 103);
+
+	// The chat messages don't wait for the blocks and stay in order
+	auto chat = std::find(order.begin(), order.end(), 1000);
+	UASSERT(chat - order.begin() < 3);
+	UASSERT(*(chat + 1) == 1001);
+
+	// The media file gets its share, at half the rate of the blocks
+	auto media = std::find(order.begin(), order.end(), 2000);
+	UASSERT(media - order.begin() > 20);
+	UASSERT(media - order.begin() < 60);
+
+	// The blocks stay in order
+	order.erase(std::remove_if(order.begin(), order.end(),
+		[] (u16 command) { return command >= 1000; }), order.end());
+	for (u16 i = 0; i < 100; i++)
+		UASSERTEQ(u16, order[i], i + 1);
+}
 
 void TestConnection::testConnectSendReceive()
 {
@@ -376,3 +746,202 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id >= 2);
 }
+
+void TestConnection::testLoopbackThroughput()
+{
+	/*
+		Stream reliable packets through the loopback interface, which goes
+		through the batched socket I/O of the connection threads
+	*/
+
+	u32 proto_id = 0xad26846a;
+
+	Handler hand_server("server");
+	Handler hand_client("client");
+
+	Address address(0, 0, 0, 0, 30002);
+	Address server_address(127, 0, 0, 1, 30002);
+	std::string bind_str = g_settings->get("bind_address");
+	try {
+		Address bind_addr(0, 0, 0, 0, 30002);
+		bind_addr.Resolve(bind_str.c_str());
+
+		if (!bind_addr.isIPv6()) {
+			address = bind_addr;
+			server_address = bind_addr;
+		}
+	} catch (ResolveError &e) {
+	}
+
+	con::Connection server(proto_id, 512, 5.0, false, &hand_server);
+	server.Serve(address);
+	con::Connection client(proto_id, 512, 5.0, false, &hand_client);
+	client.Connect(server_address);
+
+	u64 timems0 = porting::getTimeMs();
+	while (!client.Connected() || hand_server.count == 0) {
+		UASSERT(porting::getTimeMs() - timems0 < 5000);
+		NetworkPacket pkt;
+		client.TryReceive(&pkt);
+		server.TryReceive(&pkt);
+		sleep_ms(10);
+	}
+	const session_t peer_id_client = hand_server.last_id;
+
+	// Each packet is split into several datagrams
+	const u32 count = 2000;
+	const u32 datasize = 1200;
+
+	timems0 = porting::getTimeMs();
+	for (u32 i = 0; i < count; i++) {
+		NetworkPacket pkt(0x4b, datasize);
+		pkt << i;
+		for (u32 j = 4; j < datasize; j++)
+			pkt << static_cast<u8>(i + j);
+		server.Send(peer_id_client, 0, &pkt, true);
+	}
+
+	u32 received = 0;
+	while (received < count) {
+		UASSERT(porting::getTimeMs() - timems0 < 30000);
+		NetworkPacket pkt;
+		if (!client.TryReceive(&pkt)) {
+			sleep_ms(1);
+			continue;
+		}
+		if (pkt.getCommand() != 0x4b)
+			continue;
+
+		// Reliable packets arrive complete and in order
+		UASSERTEQ(u32, pkt.getSize(), datasize);
+		u32 i;
+		pkt >> i;
+		UASSERTEQ(u32, i, received);
+		const u8 *data = pkt.getU8Ptr(0);
+		for (u32 j = 4; j < datasize; j++)
+			UASSERT(data[j] == static_cast<u8>(i + j));
+		received++;
+	}
+
+	u64 dtime = MYMAX(porting::getTimeMs() - timems0, 1);
+	infostream << "testLoopbackThroughput: " << count << " packets, "
+		<< (count * datasize / 1024) << " KiB in " << dtime << " ms ("
+		<< (count * datasize / dtime) << " KB/s)" << std::endl;
+}
+
+void TestConnection::testShardedSend()
+{
+	/*
+		Serve several clients with more than one send thread, every client
+		has to receive its own packets complete and in order
+	*/
+
+	u32 proto_id = 0xad26846a;
+
+	Handler hand_server("server");
+
+	Address address(0, 0, 0, 0, 30003);
+	Address server_address(127, 0, 0, 1, 30003);
+	std::string bind_str = g_settings->get("bind_address");
+	try {
+		Address bind_addr(0, 0, 0, 0, 30003);
+		bind_addr.Resolve(bind_str.c_str());
+
+		if (!bind_addr.isIPv6()) {
+			address = bind_addr;
+			server_address = bind_addr;
+		}
+	} catch (ResolveError &e) {
+	}
+
+	con::Connection server(proto_id, 512, 5.0, false, &hand_server, 3);
+	server.Serve(address);
+
+	const u32 num_clients = 4;
+	std::vector<std::unique_ptr<Handler>> hand_clients;
+	std::vector<std::unique_ptr<con::Connection>> clients;
+	for (u32 i = 0; i < num_clients; i++) {
+		hand_clients.emplace_back(new Handler("client"));
+		clients.emplace_back(new con::Connection(proto_id, 512, 5.0, false,
+			hand_clients.back().get()));
+		clients.back()->Connect(server_address);
+	}
+
+	// Every client says hello with its index, so the server learns the peer ids
+	std::vector<session_t> peer_ids(num_clients, PEER_ID_INEXISTENT);
+	u64 timems0 = porting::getTimeMs();
+	for (u32 found = 0; found < num_clients;) {
+		UASSERT(porting::getTimeMs() - timems0 < 5000);
+		for (u32 i = 0; i < num_clients; i++) {
+			NetworkPacket pkt;
+			clients[i]->TryReceive(&pkt);
+			if (clients[i]->Connected() && peer_ids[i] == PEER_ID_INEXISTENT) {
+				NetworkPacket hello(0x4c, 4);
+				hello << i;
+				clients[i]->Send(PEER_ID_SERVER, 0, &hello, true);
+			}
+		}
+
+		NetworkPacket pkt;
+		if (server.TryReceive(&pkt) && pkt.getCommand() == 0x4c) {
+			u32 i;
+			pkt >> i;
+			UASSERT(i < num_clients);
+			if (peer_ids[i] == PEER_ID_INEXISTENT) {
+				peer_ids[i] = pkt.getPeerId();
+				found++;
+			}
+		}
+		sleep_ms(1);
+	}
+
+	const u32 count = 300;
+	const u32 datasize = 700;
+
+	// Interleave the peers so that all send threads are busy at once
+	for (u32 n = 0; n < count; n++) {
+		for (u32 i = 0; i < num_clients; i++) {
+			NetworkPacket pkt(0x4b, datasize);
+			pkt << n << i;
+			for (u32 j = 8; j < datasize; j++)
+				pkt << static_cast<u8>(n + i + j);
+			server.Send(peer_ids[i], 0, &pkt, true);
+		}
+	}
+
+	std::vector<u32> received(num_clients, 0);
+	timems0 = porting::getTimeMs();
+	for (u32 done = 0; done < num_clients;) {
+		UASSERT(porting::getTimeMs() - timems0 < 30000);
+		bool idle = true;
+		for (u32 i = 0; i < num_clients; i++) {
+			NetworkPacket pkt;
+			if (!clients[i]->TryReceive(&pkt) || pkt.getCommand() != 0x4b)
+				continue;
+			idle = false;
+
+			UASSERTEQ(u32, pkt.getSize(), datasize);
+			u32 n, client;
+			pkt >> n >> client;
+			UASSERTEQ(u32, client, i);
+			UASSERTEQ(u32, n, received[i]);
+			const u8 *data = pkt.getU8Ptr(0);
+			for (u32 j = 8; j < datasize; j++)
+				UASSERT(data[j] == static_cast<u8>(n + i + j));
+			if (++received[i] == count)
+				done++;
+		}
+		if (idle)
+			sleep_ms(1);
+	}
+
+	// The server still processes a disconnect of one of the peers
+	server.DisconnectPeer(peer_ids[0]);
+	timems0 = porting::getTimeMs();
+	while (hand_server.count > (s32)num_clients - 1) {
+		UASSERT(porting::getTimeMs() - timems0 < 5000);
+		NetworkPacket pkt;
+		server.TryReceive(&pkt);
+		sleep_ms(10);
+	}
+}
@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "client/mapblock_mesh.h"
 #include "client/meshgen/collector.h"
 #include "mesh_compare.h"
+#include "settings.h"
 #include "util/directiontables.h"
 
 namespace {
@@ -157,6 +158,7 @@ class TestMapblockMeshGenerator : public TestBase {
 	void testSurroundedNode();
 	void testInterliquidSame();
 	void testInterliquidDifferent();
+	void testGreedyMerge();
 };
 
 static TestMapblockMeshGenerator g_test_instance;
@@ -168,6 +170,7 @@ void TestMapblockMeshGenerator::runTests(IGameDef *gamedef)
 	TEST(testSurroundedNode);
 	TEST(testInterliquidSame);
 	TEST(testInterliquidDifferent);
+	TEST(testGreedyMerge);
 }
 
 namespace quad {
@@ -265,4 +268,50 @@ void TestMapblockMeshGenerator::testInterliquidDifferent()
 	UASSERT(checkMeshEqual(buf.vertices, buf.indices, {quad::xn, quad::xp, quad::yn, quad::yp, quad::zn, quad::zp}));
 }
 
+void TestMapblockMeshGenerator::testGreedyMerge()
+{
+	MockGameDef gamedef;
+	content_t stone = gamedef.addSimpleNode("stone", 42);
+	content_t wood = gamedef.addSimpleNode("wood", 13);
+	gamedef.finalize();
+
+	// 2x2x2 block: a row of two stone nodes next to a single wood node
+	MeshMakeData data{gamedef.ndef(), 2, true};
+	data.setSmoothLighting(false);
+	data.m_blockpos = {0, 0, 0};
+	for (s16 x = -1; x <= 2; x++)
+	for (s16 y = -1; y <= 2; y++)
+	for (s16 z = -1; z <= 2; z++)
+		data.m_vmanip.setNode({x, y, z}, {CONTENT_AIR, 0, 0});
+	data.m_vmanip.setNode({0, 0, 0}, {stone, 0, 0});
+	data.m_vmanip.setNode({1, 0, 0}, {stone, 0, 0});
+	data.m_vmanip.setNode({0, 1, 1}, {wood, 0, 0});
+
+	bool greedy = g_settings->getBool("enable_greedy_meshing");
+	g_settings->setBool("enable_greedy_meshing", true);
+	MeshCollector col{{}};
+	MapblockMeshGenerator mg{&data, &col, nullptr};
+	mg.generate();
+	g_settings->setBool("enable_greedy_meshing", greedy);
+
+	UASSERTEQ(std::size_t, col.prebuffers[0].size(), 2);
+	for (auto &&buf : col.prebuffers[0]) {
+		if (buf.layer.texture_id == 42) {
+			// The stone row is drawn as a 2x1x1 cuboid: 6 quads instead of 10
+			UASSERTEQ(std::size_t, buf.vertices.size(), 6 * 4);
+			UASSERTEQ(std::size_t, buf.indices.size(), 6 * 6);
+			f32 min_x = buf.vertices[0].Pos.X, max_x = min_x;
+			for (auto &&vertex : buf.vertices) {
+				min_x = std::min(min_x, vertex.Pos.X);
+				max_x = std::max(max_x, vertex.Pos.X);
+			}
+			UASSERTEQ(f32, min_x, -BS / 2.0f);
+			UASSERTEQ(f32, max_x, BS * 1.5f);
+		} else {
+			UASSERTEQ(u32, buf.layer.texture_id, 13);
+			UASSERTEQ(std::size_t, buf.vertices.size(), 6 * 4);
+		}
+	}
+}
+
 }
@@ -0,0 +1,230 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "server/emergequeue.h"
+
+class TestEmergeQueue : public TestBase
+{
+public:
+	TestEmergeQueue() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestEmergeQueue"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testNearestFirst();
+	void testPeerFairness();
+	void testMerge();
+	void testCancelStale();
+	void testRemovePeer();
+	void testHoldBackChunk();
+};
+
+static TestEmergeQueue g_test_instance;
+
+void TestEmergeQueue::runTests(IGameDef *gamedef)
+{
+	TEST(testNearestFirst);
+	TEST(testPeerFairness);
+	TEST(testMerge);
+	TEST(testCancelStale);
+	TEST(testRemovePeer);
+	TEST(testHoldBackChunk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void dummyCallback(v3s16 blockpos, EmergeAction action, void *param)
+{
+}
+
+static v3s16 popBlock(EmergeQueue &queue)
+{
+	v3s16 pos;
+	BlockEmergeData bedata;
+	UASSERT(queue.pop(&pos, &bedata));
+	queue.finish(pos);
+	return pos;
+}
+
+void TestEmergeQueue::testNearestFirst()
+{
+	MetricsBackend mb;
+	EmergeQueue queue(&mb);
+	EmergeQueue::BlockList cancelled;
+	bool exists;
+
+	queue.setPeerPosition(1, v3s16(0, 0, 0), 10, &cancelled);
+	queue.push(v3s16(5, 0, 0), 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, &exists);
+	queue.push(v3s16(0, 1, 0), 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, &exists);
+	queue.push(v3s16(0, 0, -3), 1, BLOCK_EMERGE_ALLOW_GEN, nullptr, nullptr, &exists);
+	UASSERTEQ(u32, queue.getPeerCount(1), 3);
+
+	UASSERT(popBlock(queue) == v3s16(0, 1, 0));
+
+	// The player turned around
+	queue.setPeerPosition(1, v3s16(6, 0, 0), 10, &cancelled);
+	UASSERT(cancelled.empty());
+	UASSERT(popBlock(queue) == v3s16(5, 0, 0));
+	UASSERT(popBlock(queue) == v3s16(0, 0, -3));
+	UASSERTEQ(size_t, queue.size(), 0);
+
+	// Requests without position are served in order
+	for (s16 x : {3, 1, 2})
+		queue.push(v3s16(x, 0, 0), PEER_ID_INEXISTENT, 0, nullptr, nullptr, &exists);
+	for (s16 x : {3, 1, 2})
+		UASSERT(popBlock(queue) == v3s16(x, 0, 0));
+}
+
+void TestEmergeQueue::testPeerFairness()
+{
+	MetricsBackend mb;
+	EmergeQueue queue(&mb);
+	bool exists;
+
+	// A fast player requests a lot, the other one a little later
+	for (s16 x = 0; x < 20; x++)
+		queue.push(v3s16(x, 0, 0), 1, 0, nullptr, nullptr, &exists);
+	for (s16 x = 0; x < 3; x++)
+		queue.push(v3s16(x, 10, 0), 2, 0, nullptr, nullptr, &exists);
+
+	// The players take turns
+	u32 served[3] = {0, 0, 0};
+	for (int i = 0; i < 6; i++) {
+		v3s16 pos;
+		BlockEmergeData bedata;
+		UASSERT(queue.pop(&pos, &bedata));
+		queue.finish(pos);
+		UASSERTEQ(int, bedata.peer_requested, i % 2 + 1);
+		served[bedata.peer_requested]++;
+	}
+	UASSERTEQ(u32, served[1], 3);
+	UASSERTEQ(u32, served[2], 3);
+	UASSERTEQ(u32, queue.getPeerCount(2), 0);
+	UASSERTEQ(u32, queue.getPeerCount(1), 17);
+}
+
+void TestEmergeQueue::testMerge()
+{
+	MetricsBackend mb;
+	EmergeQueue queue(&mb);
+	bool exists;
+
+	queue.push(v3s16(1, 2, 3), 1, 0, nullptr, nullptr, &exists);
+	UASSERT(!exists);
+	queue.push(v3s16(1, 2, 3), 2, BLOCK_EMERGE_ALLOW_GEN, dummyCallback,
+		nullptr, &exists);
+	UASSERT(exists);
+	UASSERT(queue.contains(v3s16(1, 2, 3)));
+	UASSERTEQ(u32, queue.getPeerCount(1), 1);
+	UASSERTEQ(u32, queue.getPeerCount(2), 0);
+
+	v3s16 pos;
+	BlockEmergeData bedata;
+	UASSERT(queue.pop(&pos, &bedata));
+	UASSERTEQ(int, bedata.peer_requested, 1);
+	UASSERTEQ(int, bedata.flags, BLOCK_EMERGE_ALLOW_GEN);
+	UASSERTEQ(size_t, bedata.callbacks.size(), 1);
+	UASSERT(!queue.contains(v3s16(1, 2, 3)));
+}
+
+void TestEmergeQueue::testCancelStale()
+{
+	MetricsBackend mb;
+	EmergeQueue queue(&mb);
+	EmergeQueue::BlockList cancelled;
+	bool exists;
+
+	queue.setPeerPosition(1, v3s16(0, 0, 0), 4, &cancelled);
+	queue.push(v3s16(-4, 0, 0), 1, 0, nullptr, nullptr, &exists);
+	queue.push(v3s16(-3, 0, 0), 1, BLOCK_EMERGE_FORCE_QUEUE, nullptr, nullptr, &exists);
+	queue.push(v3s16(-2, 0, 0), 1, 0, dummyCallback, nullptr, &exists);
+	queue.push(v3s16(2, 0, 0), 1, 0, nullptr, nullptr, &exists);
+
+	// Moving within the same block changes nothing
+	queue.setPeerPosition(1, v3s16(0, 0, 0), 4, &cancelled);
+	UASSERT(cancelled.empty());
+
+	// Forced requests and those with callbacks stay
+	queue.setPeerPosition(1, v3s16(4, 0, 0), 4, &cancelled);
+	UASSERTEQ(size_t, cancelled.size(), 1);
+	UASSERT(cancelled[0].first == v3s16(-4, 0, 0));
+	UASSERTEQ(size_t, queue.size(), 3);
+	UASSERT(popBlock(queue) == v3s16(2, 0, 0));
+	UASSERT(popBlock(queue) == v3s16(-2, 0, 0));
+	UASSERT(popBlock(queue) == v3s16(-3, 0, 0));
+}
+
+void TestEmergeQueue::testRemovePeer()
+{
+	MetricsBackend mb;
+	EmergeQueue queue(&mb);
+	bool exists;
+
+	queue.push(v3s16(0, 0, 0), 1, 0, nullptr, nullptr, &exists);
+	queue.push(v3s16(1, 0, 0), 1, 0, dummyCallback, nullptr, &exists);
+	queue.push(v3s16(2, 0, 0), 2, 0, nullptr, nullptr, &exists);
+
+	EmergeQueue::BlockList cancelled;
+	queue.removePeer(1, &cancelled);
+	UASSERTEQ(size_t, cancelled.size(), 1);
+	UASSERT(cancelled[0].first == v3s16(0, 0, 0));
+	UASSERTEQ(u32, queue.getPeerCount(1), 1);
+
+	// The request with a callback still runs
+	UASSERT(popBlock(queue) == v3s16(1, 0, 0));
+	UASSERT(popBlock(queue) == v3s16(2, 0, 0));
+	UASSERTEQ(u32, queue.getPeerCount(1), 0);
+
+	cancelled.clear();
+	queue.push(v3s16(3, 0, 0), 3, 0, nullptr, nullptr, &exists);
+	queue.clear(&cancelled);
+	UASSERTEQ(size_t, cancelled.size(), 1);
+	UASSERTEQ(size_t, queue.size(), 0);
+	v3s16 pos;
+	BlockEmergeData bedata;
+	UASSERT(!queue.pop(&pos, &bedata));
+}
+
+void TestEmergeQueue::testHoldBackChunk()
+{
+	MetricsBackend mb;
+	EmergeQueue queue(&mb);
+	queue.setChunkSize(5);
+	EmergeQueue::BlockList cancelled;
+	bool exists;
+
+	// (0, 0, 0) and (1, 0, 0) are in the same mapchunk, (3, 0, 0) is not
+	queue.setPeerPosition(1, v3s16(0, 0, 0), 10, &cancelled);
+	for (s16 x : {0, 1, 3})
+		queue.push(v3s16(x, 0, 0), 1, 0, nullptr, nullptr, &exists);
+
+	v3s16 first, second, pos;
+	BlockEmergeData bedata;
+	UASSERT(queue.pop(&first, &bedata));
+	UASSERT(first == v3s16(0, 0, 0));
+	UASSERT(queue.pop(&second, &bedata));
+	UASSERT(second == v3s16(3, 0, 0));
+	UASSERT(!queue.pop(&pos, &bedata));
+
+	queue.finish(first);
+	UASSERT(queue.pop(&pos, &bedata));
+	UASSERT(pos == v3s16(1, 0, 0));
+}
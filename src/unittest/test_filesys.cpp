@@ -41,6 +41,7 @@ class TestFileSys : public TestBase
 	void testRemoveRelativePathComponent();
 	void testSafeWriteToFile();
 	void testCopyFileContents();
+	void testReadFilePart();
 };
 
 static TestFileSys g_test_instance;
@@ -54,6 +55,7 @@ void TestFileSys::runTests(IGameDef *gamedef)
 	TEST(testRemoveRelativePathComponent);
 	TEST(testSafeWriteToFile);
 	TEST(testCopyFileContents);
+	TEST(testReadFilePart);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -311,3 +313,34 @@ void TestFileSys::testCopyFileContents()
 	UASSERT(fs::ReadFile(file2, contents_actual));
 	UASSERTEQ(auto, contents_actual, test_data);
 }
+
+void TestFileSys::testReadFilePart()
+{
+	const std::string path = getTestTempFile();
+	std::string test_data(10000, '\0');
+	for (size_t i = 0; i < test_data.size(); i++)
+		test_data[i] = (char)(i * 7 + i / 256);
+	UASSERT(fs::safeWriteToFile(path, test_data));
+
+	std::string part;
+	uint64_t size = 0;
+	UASSERT(fs::ReadFilePart(path, 0, 4096, part, size));
+	UASSERTEQ(uint64_t, size, test_data.size());
+	UASSERTEQ(auto, part, test_data.substr(0, 4096));
+
+	UASSERT(fs::ReadFilePart(path, 9000, 4096, part, size));
+	UASSERTEQ(auto, part, test_data.substr(9000));
+
+	UASSERT(fs::ReadFilePart(path, 10000, 4096, part, size));
+	UASSERT(part.empty());
+	UASSERT(fs::ReadFilePart(path, 20000, 4096, part, size));
+	UASSERT(part.empty());
+
+	// Changes to the file show up in the next read
+	UASSERT(fs::safeWriteToFile(path, test_data.substr(0, 5000)));
+	UASSERT(fs::ReadFilePart(path, 4096, 4096, part, size));
+	UASSERTEQ(uint64_t, size, 5000);
+	UASSERTEQ(auto, part, test_data.substr(4096, 904));
+
+	UASSERT(!fs::ReadFilePart(path + ".missing", 0, 4096, part, size));
+}
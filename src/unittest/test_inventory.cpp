@@ -32,6 +32,7 @@ class TestInventory : public TestBase {
 	void runTests(IGameDef *gamedef);
 
 	void testSerializeDeserialize(IItemDefManager *idef);
+	void testSerializeDelta(IItemDefManager *idef);
 
 	static const char *serialized_inventory_in;
 	static const char *serialized_inventory_out;
@@ -43,6 +44,7 @@ static TestInventory g_test_instance;
 void TestInventory::runTests(IGameDef *gamedef)
 {
 	TEST(testSerializeDeserialize, gamedef->getItemDefManager());
+	TEST(testSerializeDelta, gamedef->getItemDefManager());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -80,6 +82,71 @@ void TestInventory::testSerializeDeserialize(IItemDefManager *idef)
 	UASSERT(leftover == wanted);
 }
 
+void TestInventory::testSerializeDelta(IItemDefManager *idef)
+{
+	Inventory inv(idef);
+	std::istringstream is(serialized_inventory_in, std::ios::binary);
+	inv.deSerialize(is);
+	Inventory client_inv(inv);
+	inv.setModified(false);
+
+	auto apply_delta = [&] () -> size_t {
+		std::ostringstream os(std::ios::binary);
+		UASSERT(inv.serializeDelta(os));
+		inv.setModified(false);
+		std::istringstream is(os.str(), std::ios::binary);
+		client_inv.deSerializeDelta(is);
+		UASSERT(client_inv == inv);
+		return os.str().size();
+	};
+
+	// Nothing modified
+	UASSERTEQ(size_t, apply_delta(), 4);
+
+	// Single slots
+	InventoryList *list = inv.getList("0");
+	list->takeItem(7, 10);
+	list->deleteItem(2);
+	ItemStack stack("default:dirt", 5, 0, idef);
+	stack.metadata.setString("description", "Special dirt");
+	list->changeItem(0, stack);
+	list->changeItem(1, stack);
+	list->moveItem(8, inv.getList("abc"), 0);
+	UASSERT(!inv.getList("abc")->checkAllModified());
+	UASSERT(!list->checkSlotModified(3));
+	std::ostringstream os(std::ios::binary);
+	inv.serialize(os, true);
+	UASSERT(apply_delta() < os.str().size());
+
+	// Whole list
+	list->setWidth(2);
+	list->setSize(12);
+	list->changeItem(11, stack);
+	UASSERT(list->checkAllModified());
+	apply_delta();
+	UASSERTEQ(u32, client_inv.getList("0")->getWidth(), 2);
+
+	// Lists added
+	inv.addList("new", 4);
+	os.str("");
+	UASSERT(!inv.serializeDelta(os));
+	inv.setModified(false);
+
+	// Out of sync
+	inv.getList("0")->deleteItem(0);
+	client_inv.getList("0")->setSize(10);
+	os.str("");
+	UASSERT(inv.serializeDelta(os));
+	std::istringstream delta_is(os.str(), std::ios::binary);
+	EXCEPTION_CHECK(SerializationError, client_inv.deSerializeDelta(delta_is));
+
+	// Truncated
+	client_inv.getList("0")->setSize(12);
+	std::istringstream short_is(os.str().substr(0, os.str().size() - 1),
+		std::ios::binary);
+	EXCEPTION_CHECK(SerializationError, client_inv.deSerializeDelta(short_is));
+}
+
 const char *TestInventory::serialized_inventory_in =
 	"List 0 10\n"
 	"Width 3\n"
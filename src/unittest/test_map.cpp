@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <unordered_map>
 #include "mapblock.h"
 #include "dummymap.h"
+#include "util/basic_macros.h"
 
 class TestMap : public TestBase
 {
@@ -36,6 +37,8 @@ class TestMap : public TestBase
 	void testForEachNodeInArea(IGameDef *gamedef);
 	void testForEachNodeInAreaBlank(IGameDef *gamedef);
 	void testForEachNodeInAreaEmpty(IGameDef *gamedef);
+	void testForEachNodeInAreaWithContent(IGameDef *gamedef);
+	void testContentIndex(IGameDef *gamedef);
 };
 
 static TestMap g_test_instance;
@@ -46,6 +49,8 @@ void TestMap::runTests(IGameDef *gamedef)
 	TEST(testForEachNodeInArea, gamedef);
 	TEST(testForEachNodeInAreaBlank, gamedef);
 	TEST(testForEachNodeInAreaEmpty, gamedef);
+	TEST(testForEachNodeInAreaWithContent, gamedef);
+	TEST(testContentIndex, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +174,100 @@ void TestMap::testForEachNodeInAreaEmpty(IGameDef *gamedef)
 		return true;
 	});
 }
+
+void TestMap::testForEachNodeInAreaWithContent(IGameDef *gamedef)
+{
+	v3s16 minp(-10, -10, -10);
+	v3s16 maxp(20, 20, 10);
+	DummyMap map(gamedef, getNodeBlockPos(minp) - v3s16(1, 1, 1),
+		getNodeBlockPos(maxp));
+
+	// Some edits before the index of a block exists, some after
+	map.setNode(v3s16(0, 10, 5), MapNode(t_CONTENT_STONE));
+	map.setNode(minp - v3s16(1, 0, 0), MapNode(t_CONTENT_STONE));
+	map.forEachNodeInAreaWithContent(minp, maxp, {t_CONTENT_STONE},
+		[] (v3s16 p, MapNode n) -> bool { return true; });
+	map.setNode(v3s16(-1, 15, 5), MapNode(t_CONTENT_STONE));
+	map.setNode(maxp, MapNode(t_CONTENT_TORCH));
+	map.setNode(v3s16(0, 10, 5), MapNode(t_CONTENT_WATER));
+
+	const std::vector<content_t> filter = {t_CONTENT_STONE, t_CONTENT_TORCH,
+		t_CONTENT_STONE};
+	std::vector<std::pair<v3s16, content_t>> expected, found;
+	map.forEachNodeInArea(minp, maxp, [&] (v3s16 p, MapNode n) -> bool {
+		if (CONTAINS(filter, n.getContent()))
+			expected.emplace_back(p, n.getContent());
+		return true;
+	});
+	map.forEachNodeInAreaWithContent(minp, maxp, filter,
+		[&] (v3s16 p, MapNode n) -> bool {
+			found.emplace_back(p, n.getContent());
+			return true;
+		});
+
+	// Same nodes in the same order
+	UASSERTEQ(size_t, expected.size(), 2);
+	UASSERT(found == expected);
+
+	// Several contents in one block
+	map.setNode(v3s16(1, 1, 1), MapNode(t_CONTENT_TORCH));
+	map.setNode(v3s16(2, 1, 1), MapNode(t_CONTENT_STONE));
+	map.setNode(v3s16(1, 2, 1), MapNode(t_CONTENT_TORCH));
+	expected.clear();
+	found.clear();
+	map.forEachNodeInArea(minp, maxp, [&] (v3s16 p, MapNode n) -> bool {
+		if (CONTAINS(filter, n.getContent()))
+			expected.emplace_back(p, n.getContent());
+		return true;
+	});
+	map.forEachNodeInAreaWithContent(minp, maxp, filter,
+		[&] (v3s16 p, MapNode n) -> bool {
+			found.emplace_back(p, n.getContent());
+			return true;
+		});
+	UASSERTEQ(size_t, expected.size(), 5);
+	UASSERT(found == expected);
+
+	// Unloaded areas are ignore
+	size_t ignore_count = 0;
+	map.forEachNodeInAreaWithContent(maxp + v3s16(1, 0, 0), maxp + v3s16(2, 0, 0),
+		{CONTENT_IGNORE}, [&] (v3s16 p, MapNode n) -> bool {
+			ignore_count++;
+			return true;
+		});
+	UASSERTEQ(size_t, ignore_count, 2);
+}
+
+void TestMap::testContentIndex(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	for (u32 i = 0; i < MapBlock::nodecount; i++)
+		block.getData()[i] = MapNode(i % 3 == 0 ? t_CONTENT_STONE : CONTENT_AIR);
+	block.expireContentIndex();
+
+	const MapBlockContentIndex &index = block.getContentIndex();
+	UASSERTEQ(size_t, index.getEntries().size(), 2);
+	UASSERTEQ(size_t, index.find(t_CONTENT_STONE)->size(), (MapBlock::nodecount + 2) / 3);
+	UASSERT(index.find(t_CONTENT_WATER) == nullptr);
+
+	// Changes are applied to the index, which must then match a fresh one
+	block.setNodeNoCheck(0, 0, 0, MapNode(t_CONTENT_WATER));
+	block.setNodeNoCheck(1, 0, 0, MapNode(t_CONTENT_WATER));
+	block.setNodeNoCheck(15, 15, 15, MapNode(t_CONTENT_TORCH));
+	block.setNodeNoCheck(1, 0, 0, MapNode(CONTENT_AIR));
+	UASSERT(index.find(t_CONTENT_WATER) != nullptr);
+	UASSERTEQ(size_t, index.find(t_CONTENT_WATER)->size(), 1);
+	UASSERTEQ(u16, index.find(t_CONTENT_WATER)->front(), 0);
+	UASSERTEQ(u16, index.find(t_CONTENT_TORCH)->front(), MapBlock::nodecount - 1);
+
+	MapBlockContentIndex fresh;
+	fresh.build(block.getData());
+	UASSERTEQ(size_t, fresh.getEntries().size(), index.getEntries().size());
+	for (size_t i = 0; i < fresh.getEntries().size(); i++) {
+		UASSERTEQ(content_t, fresh.getEntries()[i].content, index.getEntries()[i].content);
+		UASSERT(fresh.getEntries()[i].positions == index.getEntries()[i].positions);
+	}
+
+	UASSERT(MapBlockContentIndex::getPos(MapBlock::nodecount - 1) == v3s16(15, 15, 15));
+	UASSERT(MapBlockContentIndex::getPos(MAP_BLOCKSIZE) == v3s16(0, 1, 0));
+}
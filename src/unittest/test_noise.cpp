@@ -20,8 +20,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <cmath>
+#include <cstring>
 #include "exceptions.h"
+#include "log.h"
 #include "noise.h"
+#include "noise_kernels.h"
 
 class TestNoise : public TestBase {
 public:
@@ -41,6 +44,7 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseKernels();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -61,6 +65,7 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseKernels);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,6 +180,54 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseKernels()
+{
+	const NoiseKernels *plain = getSupportedNoiseKernels().front();
+	// Odd sizes, so that the vector loops leave a tail
+	const u32 count = 37;
+
+	for (const NoiseKernels *kernels : getSupportedNoiseKernels()) {
+		infostream << "Noise kernels: " << kernels->name << std::endl;
+
+		// Lattice, with negative coordinates and extreme seeds
+		float expected[count], actual[count];
+		for (s32 seed : {0, 1337, -1, 2147483647}) {
+			plain->lattice2D(expected, count, -20, -4096, seed);
+			kernels->lattice2D(actual, count, -20, -4096, seed);
+			UASSERT(!memcmp(expected, actual, sizeof(expected)));
+			plain->lattice3D(expected, count, 4090, -1723, 7411, seed);
+			kernels->lattice3D(actual, count, 4090, -1723, 7411, seed);
+			UASSERT(!memcmp(expected, actual, sizeof(expected)));
+		}
+
+		// Whole maps, every flag combination and a persistence map
+		for (u32 flags : {0U, (u32)NOISE_FLAG_EASED, (u32)NOISE_FLAG_ABSVALUE,
+				(u32)(NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE)}) {
+			NoiseParams np(0, 1, v3f(50, 30, 70), 9, 4, 0.6, 2.0, flags);
+			std::vector<float> persistence(count * 29 * 23, 0.45f);
+
+			for (float *persistence_map : {(float *)nullptr, persistence.data()}) {
+				Noise a(&np, 1337, count, 29);
+				Noise b(&np, 1337, count, 29);
+				a.setKernels(plain);
+				b.setKernels(kernels);
+				a.perlinMap2D(-113.5f, 47.25f, persistence_map);
+				b.perlinMap2D(-113.5f, 47.25f, persistence_map);
+				UASSERT(!memcmp(a.result, b.result, sizeof(float) * count * 29));
+
+				Noise c(&np, 1337, count, 29, 23);
+				Noise d(&np, 1337, count, 29, 23);
+				c.setKernels(plain);
+				d.setKernels(kernels);
+				c.perlinMap3D(-113.5f, 47.25f, -2.75f, persistence_map);
+				d.perlinMap3D(-113.5f, 47.25f, -2.75f, persistence_map);
+				UASSERT(!memcmp(c.result, d.result,
+					sizeof(float) * count * 29 * 23));
+			}
+		}
+	}
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
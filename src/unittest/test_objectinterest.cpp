@@ -0,0 +1,213 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "server/objectinterest.h"
+#include "constants.h"
+#include "server/unit_sao.h"
+#include "util/serialize.h"
+
+class TestObjectInterest : public TestBase
+{
+public:
+	TestObjectInterest() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestObjectInterest"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testParseTiers();
+	void testIntervals();
+	void testCoalescing();
+	void testTeleport();
+	void testAccounting();
+};
+
+static TestObjectInterest g_test_instance;
+
+void TestObjectInterest::runTests(IGameDef *gamedef)
+{
+	TEST(testParseTiers);
+	TEST(testIntervals);
+	TEST(testCoalescing);
+	TEST(testTeleport);
+	TEST(testAccounting);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const f32 FOV = 72.0f * core::DEGTORAD;
+
+ObjectInterest makeInterest()
+{
+	std::vector<ObjectInterest::Tier> tiers;
+	UASSERT(ObjectInterest::parseTiers("0:0,32:0.2,64:0.5", tiers));
+	ObjectInterest interest(std::move(tiers), 2.0f);
+	interest.step(0.0f, v3f(), v3f(0, 0, 1), FOV);
+	return interest;
+}
+
+std::string positionCommand(const v3f &pos, f32 interval,
+	bool do_interpolate = true)
+{
+	return UnitSAO::generateUpdatePositionCommand(pos, v3f(), v3f(), v3f(),
+		do_interpolate, false, interval);
+}
+
+f32 readInterval(const std::string &data)
+{
+	return readF32((const u8 *)&data[data.size() - 4]);
+}
+
+}
+
+void TestObjectInterest::testParseTiers()
+{
+	std::vector<ObjectInterest::Tier> tiers;
+	UASSERT(ObjectInterest::parseTiers(" 64:0.5, 0:0 ,32:0.25", tiers));
+	UASSERTEQ(size_t, tiers.size(), 3);
+	UASSERT(tiers[2].distance == 32.0f && tiers[2].interval == 0.25f);
+
+	UASSERT(ObjectInterest::parseTiers("", tiers));
+	UASSERT(tiers.empty());
+
+	UASSERT(!ObjectInterest::parseTiers("32", tiers));
+	UASSERT(!ObjectInterest::parseTiers("32:", tiers));
+	UASSERT(!ObjectInterest::parseTiers("far:1", tiers));
+	UASSERT(!ObjectInterest::parseTiers("32:-1", tiers));
+	UASSERT(!ObjectInterest::parseTiers("0:0,32:0.2s", tiers));
+}
+
+void TestObjectInterest::testIntervals()
+{
+	ObjectInterest interest = makeInterest();
+	UASSERTEQ(f32, interest.getInterval(v3f(0, 0, 10) * BS), 0.0f);
+	UASSERTEQ(f32, interest.getInterval(v3f(0, 0, 40) * BS), 0.2f);
+	UASSERTEQ(f32, interest.getInterval(v3f(5, 0, 100) * BS), 0.5f);
+	// Out of view
+	UASSERTEQ(f32, interest.getInterval(v3f(0, 0, -10) * BS), 0.0f);
+	UASSERTEQ(f32, interest.getInterval(v3f(0, 0, -40) * BS), 0.4f);
+	UASSERTEQ(f32, interest.getInterval(v3f(40, 0, 0) * BS), 0.4f);
+
+	// Turn around
+	interest.step(0.1f, v3f(), v3f(0, 0, -1), FOV);
+	UASSERTEQ(f32, interest.getInterval(v3f(0, 0, -40) * BS), 0.2f);
+
+	// No tiers
+	ObjectInterest all;
+	UASSERTEQ(f32, all.getInterval(v3f(0, 0, 1000) * BS), 0.0f);
+}
+
+void TestObjectInterest::testCoalescing()
+{
+	ObjectInterest interest = makeInterest();
+	std::vector<ObjectInterest::DueUpdate> due;
+	const v3f near_pos = v3f(0, 0, 10) * BS, far_pos = v3f(0, 0, 100) * BS;
+	u32 near_sent = 0, far_sent = 0;
+	std::string last_far;
+
+	for (int n = 0; n < 50; n++) {
+		interest.step(0.1f, v3f(), v3f(0, 0, 1), FOV);
+		f32 interval;
+		UASSERT(interest.update(1, near_pos, positionCommand(near_pos, 0.1f), interval));
+		UASSERTEQ(f32, interval, 0.1f);
+		near_sent++;
+
+		// The far object stops moving half way
+		v3f pos = far_pos + v3f(n * 0.1f, 0, 0) * BS;
+		if (n < 25) {
+			last_far = positionCommand(pos, 0.1f);
+			if (interest.update(2, pos, last_far, interval)) {
+				far_sent++;
+				// Interpolated over the time since the last update
+				UASSERT(n == 0 || interval > 0.45f);
+			}
+		}
+
+		due.clear();
+		interest.release(due);
+		for (const ObjectInterest::DueUpdate &update : due) {
+			UASSERTEQ(u16, update.id, 2);
+			// The newest position
+			UASSERT(update.data == last_far);
+			UASSERT(update.interval > 0.45f && update.interval <= 0.5f);
+			far_sent++;
+		}
+	}
+
+	UASSERTEQ(u32, near_sent, 50);
+	// Every 0.5 seconds, plus the last position after it stopped
+	UASSERT(far_sent >= 5 && far_sent <= 7);
+	UASSERTEQ(u64, interest.getUpdatesSent(), near_sent + far_sent);
+	UASSERTEQ(u64, interest.getUpdatesCoalesced(), 25 - far_sent);
+
+	// Removed objects are not released anymore
+	f32 interval;
+	UASSERT(interest.update(3, far_pos, last_far, interval));
+	UASSERT(!interest.update(3, far_pos, last_far, interval));
+	interest.removeObject(3);
+	interest.step(1.0f, v3f(), v3f(0, 0, 1), FOV);
+	due.clear();
+	interest.release(due);
+	UASSERT(due.empty());
+
+	std::string data = last_far;
+	ObjectInterest::setUpdateInterval(data, 0.75f);
+	UASSERTEQ(f32, readInterval(data), 0.75f);
+}
+
+void TestObjectInterest::testTeleport()
+{
+	ObjectInterest interest = makeInterest();
+	std::vector<ObjectInterest::DueUpdate> due;
+	const v3f far_pos = v3f(0, 0, 100) * BS;
+	f32 interval;
+
+	interest.step(0.1f, v3f(), v3f(0, 0, 1), FOV);
+	UASSERT(interest.update(1, far_pos, positionCommand(far_pos, 0.1f), interval));
+	interest.step(0.1f, v3f(), v3f(0, 0, 1), FOV);
+	UASSERT(!interest.update(1, far_pos, positionCommand(far_pos, 0.1f), interval));
+
+	// Sent right away with its own interval, and the held update is dropped
+	const v3f target = far_pos + v3f(50, 0, 0) * BS;
+	const std::string teleport = positionCommand(target, 0.1f, false);
+	interest.step(0.1f, v3f(), v3f(0, 0, 1), FOV);
+	UASSERT(interest.update(1, target, teleport, interval));
+	UASSERTEQ(f32, interval, 0.1f);
+	UASSERT(interest.update(1, target, teleport, interval));
+
+	interest.step(1.0f, v3f(), v3f(0, 0, 1), FOV);
+	interest.release(due);
+	UASSERT(due.empty());
+	UASSERTEQ(u64, interest.getUpdatesCoalesced(), 1);
+}
+
+void TestObjectInterest::testAccounting()
+{
+	ObjectInterest interest = makeInterest();
+	for (int n = 0; n < 20; n++) {
+		interest.step(0.1f, v3f(), v3f(0, 0, 1), FOV);
+		interest.countSent(500);
+	}
+	UASSERTEQ(u64, interest.getBytesSent(), 10000);
+	f32 bandwidth = interest.getBandwidth();
+	UASSERT(bandwidth > 4500.0f && bandwidth < 5500.0f);
+}
@@ -0,0 +1,319 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "activeobject.h"
+#include "exceptions.h"
+#include "network/objectsnapshot.h"
+#include "noise.h"
+#include "server/unit_sao.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+
+class TestObjectSnapshot : public TestBase
+{
+public:
+	TestObjectSnapshot() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestObjectSnapshot"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testStateQuantization();
+	void testDeltaEncoding();
+	void testLossAndReorder();
+	void testRemoveObject();
+	void testSequenceWrap();
+	void testMalformed();
+};
+
+static TestObjectSnapshot g_test_instance;
+
+void TestObjectSnapshot::runTests(IGameDef *gamedef)
+{
+	TEST(testStateQuantization);
+	TEST(testDeltaEncoding);
+	TEST(testLossAndReorder);
+	TEST(testRemoveObject);
+	TEST(testSequenceWrap);
+	TEST(testMalformed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+ObjectState makeState(PcgRandom &pr, const ObjectState *prev = nullptr)
+{
+	ObjectState state;
+	if (prev) {
+		// Walk a bit from the previous state
+		state = *prev;
+		state.position += v3s32(pr.range(-20, 20), pr.range(-3, 3), pr.range(-20, 20));
+		state.velocity = v3s32(pr.range(-60, 60), 0, pr.range(-60, 60));
+		state.rotation.Y = (state.rotation.Y + pr.range(-900, 900)) & 0xFFFF;
+	} else {
+		state.position = v3s32(pr.range(-100000, 100000), pr.range(-1000, 1000),
+			pr.range(-100000, 100000));
+		state.acceleration.Y = -626;
+		state.rotation = v3s32(0, pr.range(0, 0xFFFF), 0);
+		state.update_interval = 90;
+	}
+	state.flags = ObjectState::DO_INTERPOLATE;
+	return state;
+}
+
+}
+
+void TestObjectSnapshot::testStateQuantization()
+{
+	const v3f pos(1234.56f, -78.9f, 31000.0f * BS);
+	std::string cmd = UnitSAO::generateUpdatePositionCommand(pos,
+		v3f(1.0f, -2.0f, 0.5f), v3f(0.0f, -9.81f * BS, 0.0f),
+		v3f(-30.0f, 725.0f, 0.0f), true, false, 0.09f);
+
+	ObjectState state;
+	UASSERT(state.fromPositionCommand(cmd));
+	UASSERT(state.update_interval == 90);
+	UASSERT(state.flags == ObjectState::DO_INTERPOLATE);
+	// Angles are wrapped
+	UASSERTEQ(s32, state.rotation.Y, myround(5 * 65536 / 360.0f));
+	UASSERTEQ(s32, state.rotation.X, myround(330 * 65536 / 360.0f));
+
+	std::string out = state.toPositionCommand();
+	UASSERTEQ(size_t, out.size(), cmd.size());
+	ObjectState state2;
+	UASSERT(state2.fromPositionCommand(out));
+	UASSERT(state2 == state);
+
+	std::istringstream is(out, std::ios::binary);
+	UASSERT(readU8(is) == AO_CMD_UPDATE_POSITION);
+	v3f pos2 = readV3F32(is);
+	UASSERT(pos2.getDistanceFrom(pos) <= OBJECT_STATE_POS_STEP);
+
+	// Other commands are not taken
+	UASSERT(!state2.fromPositionCommand(std::string(1, (char)AO_CMD_SET_TEXTURE_MOD)));
+	cmd[0] = AO_CMD_SET_PROPERTIES;
+	UASSERT(!state2.fromPositionCommand(cmd));
+}
+
+void TestObjectSnapshot::testDeltaEncoding()
+{
+	PcgRandom pr(7);
+	ObjectSnapshotEncoder encoder;
+	ObjectSnapshotDecoder decoder;
+	std::vector<ObjectState> states;
+	for (u16 id = 0; id < 100; id++)
+		states.push_back(makeState(pr));
+
+	std::vector<std::pair<u16, ObjectState>> updates;
+	size_t first_size = 0, last_size = 0;
+	for (int n = 0; n < 20; n++) {
+		for (u16 id = 0; id < 100; id++) {
+			if (n > 0)
+				states[id] = makeState(pr, &states[id]);
+			encoder.add(id * 3 + 1, states[id]);
+		}
+		UASSERT(!encoder.empty());
+
+		std::string data;
+		encoder.write(data);
+		UASSERT(encoder.empty());
+
+		updates.clear();
+		u16 seq = decoder.read((const u8 *)data.data(), data.size(), updates);
+		UASSERTEQ(u16, seq, n);
+		UASSERTEQ(size_t, updates.size(), 100);
+		for (u16 id = 0; id < 100; id++) {
+			UASSERTEQ(u16, updates[id].first, id * 3 + 1);
+			UASSERT(updates[id].second == states[id]);
+		}
+		encoder.acknowledge(seq);
+
+		if (n == 0)
+			first_size = data.size();
+		last_size = data.size();
+	}
+
+	// Full states take less than half the size of the position messages,
+	// deltas less than a quarter
+	const size_t message_size = 100 * (2 + 2 + states[0].toPositionCommand().size());
+	UASSERT(first_size * 2 < message_size);
+	UASSERT(last_size * 4 < message_size);
+	UASSERT(last_size < first_size);
+	UASSERTEQ(u64, encoder.getStatesWritten(), 2000);
+
+	// An unchanged object takes three bytes after the header
+	std::string data;
+	encoder.add(1, states[0]);
+	encoder.write(data);
+	UASSERTEQ(size_t, data.size(), 4 + 3);
+}
+
+void TestObjectSnapshot::testLossAndReorder()
+{
+	PcgRandom pr(11);
+	ObjectSnapshotEncoder encoder;
+	ObjectSnapshotDecoder decoder;
+	std::vector<ObjectState> states;
+	for (u16 id = 0; id < 20; id++)
+		states.push_back(makeState(pr));
+
+	// Snapshots in flight, the client receives them late and out of order
+	std::vector<std::pair<std::string, std::vector<ObjectState>>> in_flight;
+	std::vector<u16> pending_acks;
+	std::vector<ObjectState> applied(states.size());
+	std::vector<int> applied_snapshot(states.size(), -1);
+	std::vector<std::pair<u16, ObjectState>> updates;
+	u32 decoded = 0;
+
+	for (int n = 0; n < 2000; n++) {
+		// Half of the objects move in every snapshot
+		for (u16 id = 0; id < states.size(); id++) {
+			if (pr.range(0, 1) == 0)
+				continue;
+			states[id] = makeState(pr, &states[id]);
+			encoder.add(id, states[id]);
+		}
+		in_flight.emplace_back();
+		encoder.write(in_flight.back().first);
+		in_flight.back().second = states;
+
+		// Acknowledgements are lost and late, too
+		if (!pending_acks.empty() && pr.range(0, 2) == 0) {
+			if (pr.range(0, 4) != 0)
+				encoder.acknowledge(pending_acks.front());
+			pending_acks.erase(pending_acks.begin());
+		}
+
+		while (in_flight.size() > 3 || (!in_flight.empty() && pr.range(0, 1))) {
+			size_t i = pr.range(0, MYMIN(in_flight.size(), 2) - 1);
+			std::string data = std::move(in_flight[i].first);
+			in_flight.erase(in_flight.begin() + i);
+			// 20% loss
+			if (pr.range(0, 4) == 0)
+				continue;
+
+			updates.clear();
+			u16 seq = decoder.read((const u8 *)data.data(), data.size(), updates);
+			pending_acks.push_back(seq);
+			for (const auto &it : updates) {
+				// Never go back to an older state
+				UASSERT(applied_snapshot[it.first] < 0 ||
+					seq > applied_snapshot[it.first]);
+				applied[it.first] = it.second;
+				applied_snapshot[it.first] = seq;
+				decoded++;
+			}
+		}
+	}
+
+	// Drain, then everything is in sync again
+	for (u16 id = 0; id < states.size(); id++)
+		encoder.add(id, states[id]);
+	std::string data;
+	encoder.write(data);
+	updates.clear();
+	decoder.read((const u8 *)data.data(), data.size(), updates);
+	for (const auto &it : updates)
+		applied[it.first] = it.second;
+	for (u16 id = 0; id < states.size(); id++)
+		UASSERT(applied[id] == states[id]);
+	UASSERT(decoded > 2000 * 10 / 2);
+}
+
+void TestObjectSnapshot::testRemoveObject()
+{
+	PcgRandom pr(3);
+	ObjectSnapshotEncoder encoder;
+	ObjectSnapshotDecoder decoder;
+	std::vector<std::pair<u16, ObjectState>> updates;
+	std::string data;
+
+	ObjectState state = makeState(pr);
+	encoder.add(5, state);
+	encoder.write(data);
+	u16 seq = decoder.read((const u8 *)data.data(), data.size(), updates);
+
+	// The id is reused before the acknowledgement arrives
+	encoder.removeObject(5);
+	decoder.removeObject(5);
+	encoder.acknowledge(seq);
+
+	ObjectState other = makeState(pr);
+	encoder.add(5, other);
+	data.clear();
+	updates.clear();
+	encoder.write(data);
+	decoder.read((const u8 *)data.data(), data.size(), updates);
+	UASSERTEQ(size_t, updates.size(), 1);
+	UASSERT(updates[0].second == other);
+}
+
+void TestObjectSnapshot::testSequenceWrap()
+{
+	PcgRandom pr(5);
+	ObjectSnapshotEncoder encoder;
+	ObjectSnapshotDecoder decoder;
+	std::vector<std::pair<u16, ObjectState>> updates;
+	ObjectState busy = makeState(pr), idle = makeState(pr);
+	std::string data;
+
+	// One object moves all the time, the other one only every 40000
+	// snapshots, which must not be taken for old ones after a wrap
+	for (u32 n = 0; n < 100000; n++) {
+		busy = makeState(pr, &busy);
+		encoder.add(1, busy);
+		bool idle_moves = n % 40000 == 0;
+		if (idle_moves) {
+			idle = makeState(pr, &idle);
+			encoder.add(2, idle);
+		}
+		data.clear();
+		updates.clear();
+		encoder.write(data);
+		u16 seq = decoder.read((const u8 *)data.data(), data.size(), updates);
+		encoder.acknowledge(seq);
+
+		UASSERTEQ(size_t, updates.size(), idle_moves ? 2 : 1);
+		UASSERT(updates[0].second == busy);
+		if (idle_moves)
+			UASSERT(updates[1].second == idle);
+	}
+}
+
+void TestObjectSnapshot::testMalformed()
+{
+	PcgRandom pr(9);
+	ObjectSnapshotEncoder encoder;
+	std::vector<std::pair<u16, ObjectState>> updates;
+	for (u16 id = 0; id < 10; id++)
+		encoder.add(id, makeState(pr));
+	std::string data;
+	encoder.write(data);
+
+	for (size_t size = 0; size < data.size(); size++) {
+		ObjectSnapshotDecoder decoder;
+		try {
+			decoder.read((const u8 *)data.data(), size, updates);
+			UASSERT(false);
+		} catch (SerializationError &e) {
+		}
+	}
+}
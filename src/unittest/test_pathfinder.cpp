@@ -0,0 +1,230 @@
+/*
+Minetest
+Copyright (C) 2024 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "dummymap.h"
+#include "gamedef.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "noise.h"
+#include "pathfinder.h"
+#include "pathfinder_hpa.h"
+
+class TestPathfinder : public TestBase
+{
+public:
+	TestPathfinder() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestPathfinder"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testHierarchicalFindsPaths(IGameDef *gamedef);
+	void testHierarchicalMapChange(IGameDef *gamedef);
+	void testHierarchicalAsync(IGameDef *gamedef);
+};
+
+static TestPathfinder g_test_instance;
+
+void TestPathfinder::runTests(IGameDef *gamedef)
+{
+	TEST(testHierarchicalFindsPaths, gamedef);
+	TEST(testHierarchicalMapChange, gamedef);
+	TEST(testHierarchicalAsync, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const v3s16 BPMIN(-3, -2, -3);
+const v3s16 BPMAX(2, 1, 2);
+
+// Hilly terrain with walls, crossing mapblock borders in all directions
+s16 getHeight(s16 x, s16 z)
+{
+	return 6 * std::sin(x * 0.11f) + 5 * std::cos(z * 0.07f) +
+		3 * std::sin((x + z) * 0.23f);
+}
+
+void makeTerrain(Map &map)
+{
+	for (s16 bz = BPMIN.Z; bz <= BPMAX.Z; bz++)
+	for (s16 by = BPMIN.Y; by <= BPMAX.Y; by++)
+	for (s16 bx = BPMIN.X; bx <= BPMAX.X; bx++) {
+		MapBlock *block = map.getBlockNoCreateNoEx(v3s16(bx, by, bz));
+		for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+			v3s16 p = block->getPosRelative() + v3s16(x, y, z);
+			s16 h = getHeight(p.X, p.Z);
+			bool wall = p.X % 23 == 0 && (p.Z + 48) % 17 > 3 && p.Y <= h + 3;
+			block->setNodeNoCheck(x, y, z, MapNode(p.Y <= h || wall ?
+				t_CONTENT_STONE : CONTENT_AIR));
+		}
+	}
+}
+
+bool isStandable(Map &map, const NodeDefManager *ndef, v3s16 p)
+{
+	return !ndef->get(map.getNode(p)).walkable &&
+		ndef->get(map.getNode(p - v3s16(0, 1, 0))).walkable;
+}
+
+v3s16 getSurface(Map &map, const NodeDefManager *ndef, s16 x, s16 z)
+{
+	for (s16 y = 30; y > -30; y--) {
+		if (isStandable(map, ndef, v3s16(x, y, z)))
+			return v3s16(x, y, z);
+	}
+	return v3s16(x, 30, z);
+}
+
+// Every waypoint must be one step from the previous one
+bool isWalkable(Map &map, const NodeDefManager *ndef,
+	const std::vector<v3s16> &path, int max_jump, int max_drop)
+{
+	for (size_t i = 1; i < path.size(); i++) {
+		v3s16 d = path[i] - path[i - 1];
+		if (std::abs(d.X) + std::abs(d.Z) != 1 || d.Y > max_jump || -d.Y > max_drop)
+			return false;
+		if (!isStandable(map, ndef, path[i]))
+			return false;
+	}
+	return true;
+}
+
+}
+
+void TestPathfinder::testHierarchicalFindsPaths(IGameDef *gamedef)
+{
+	const NodeDefManager *ndef = gamedef->ndef();
+	DummyMap map(gamedef, BPMIN, BPMAX);
+	makeTerrain(map);
+	PathNavCache nav(&map, ndef, 1);
+
+	PcgRandom pr(42);
+	u32 found = 0;
+	for (int i = 0; i < 40; i++) {
+		v3s16 pos1 = getSurface(map, ndef, pr.range(-40, 40), pr.range(-40, 40));
+		v3s16 pos2 = getSurface(map, ndef, pr.range(-40, 40), pr.range(-40, 40));
+		std::vector<v3s16> plain = get_path(&map, ndef, pos1, pos2, 16, 1, 2,
+			PA_PLAIN);
+		std::vector<v3s16> path = nav.findPath(pos1, pos2, 16, 1, 2);
+
+		// A path to every place A* gets to, which is not much longer. The
+		// search area of HPA* may be a bit larger.
+		if (!plain.empty())
+			UASSERT(!path.empty() && path.size() <= plain.size() * 3 / 2);
+		if (path.empty())
+			continue;
+		found++;
+		UASSERT(path.front() == pos1);
+		UASSERT(path.back() == pos2);
+		UASSERT(isWalkable(map, ndef, path, 1, 2));
+	}
+	UASSERT(found > 20);
+
+	// Buried ends
+	UASSERT(nav.findPath(v3s16(0, -20, 0), getSurface(map, ndef, 5, 5),
+		16, 1, 2).empty());
+}
+
+void TestPathfinder::testHierarchicalMapChange(IGameDef *gamedef)
+{
+	const NodeDefManager *ndef = gamedef->ndef();
+	DummyMap map(gamedef, BPMIN, BPMAX);
+
+	// A floor split by a wall with a gap at z = 20
+	for (s16 z = -48; z < 48; z++)
+	for (s16 y = -32; y < 32; y++)
+	for (s16 x = -48; x < 48; x++)
+		map.setNode(v3s16(x, y, z), MapNode(y <= 0 ? t_CONTENT_STONE : CONTENT_AIR));
+	PathNavCache nav(&map, ndef, 1);
+	map.addEventReceiver(&nav);
+
+	const v3s16 pos1(-20, 1, 0), pos2(20, 1, 0);
+	std::vector<v3s16> path = nav.findPath(pos1, pos2, 32, 1, 2);
+	UASSERTEQ(size_t, path.size(), 41);
+
+	for (s16 z = -48; z < 48; z++) {
+		if (z == 20)
+			continue;
+		for (s16 y = 1; y <= 3; y++)
+			map.addNodeWithEvent(v3s16(0, y, z), MapNode(t_CONTENT_STONE));
+	}
+	path = nav.findPath(pos1, pos2, 32, 1, 2);
+	UASSERT(std::find(path.begin(), path.end(), v3s16(0, 1, 20)) != path.end());
+	UASSERT(isWalkable(map, ndef, path, 1, 2));
+
+	map.addNodeWithEvent(v3s16(0, 1, 20), MapNode(t_CONTENT_STONE));
+	UASSERT(nav.findPath(pos1, pos2, 32, 1, 2).empty());
+
+	map.removeEventReceiver(&nav);
+}
+
+void TestPathfinder::testHierarchicalAsync(IGameDef *gamedef)
+{
+	const NodeDefManager *ndef = gamedef->ndef();
+	DummyMap map(gamedef, BPMIN, BPMAX);
+	makeTerrain(map);
+	PathNavCache nav(&map, ndef, 2);
+
+	const v3s16 pos1 = getSurface(map, ndef, -40, -35);
+	const v3s16 pos2 = getSurface(map, ndef, 38, 30);
+	std::vector<v3s16> expected = nav.findPath(pos1, pos2, 16, 1, 2);
+	UASSERT(!expected.empty());
+
+	// Cold cache: the search needs to ask for blocks
+	PathNavCache nav2(&map, ndef, 2);
+	std::vector<v3s16> result;
+	int calls = 0;
+	auto callback = [] (const std::vector<v3s16> &path, bool cancelled,
+			void *param) {
+		auto *r = reinterpret_cast<std::pair<std::vector<v3s16> *, int *> *>(param);
+		*r->first = path;
+		(*r->second)++;
+	};
+	std::pair<std::vector<v3s16> *, int *> param(&result, &calls);
+	nav2.findPathAsync(pos1, pos2, 16, 1, 2, callback, &param);
+	UASSERTEQ(size_t, nav2.getPendingCount(), 1);
+
+	for (int i = 0; i < 1000 && calls == 0; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		nav2.step(0.005f);
+	}
+	UASSERTEQ(int, calls, 1);
+	UASSERTEQ(size_t, nav2.getPendingCount(), 0);
+	UASSERT(result == expected);
+
+	// Searches still pending are cancelled along with the cache
+	int cancelled_calls = 0;
+	{
+		PathNavCache nav3(&map, ndef, 2);
+		nav3.findPathAsync(pos1, pos2, 16, 1, 2,
+			[] (const std::vector<v3s16> &path, bool cancelled, void *param) {
+				if (cancelled)
+					(*(int *)param)++;
+			}, &cancelled_calls);
+	}
+	UASSERTEQ(int, cancelled_calls, 1);
+}
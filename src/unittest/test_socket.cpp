@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "settings.h"
 #include "network/socket.h"
+#include "util/string.h"
 
 class TestSocket : public TestBase {
 public:
@@ -37,6 +38,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatchedIO();
 
 	static const int port = 30003;
 };
@@ -46,6 +48,7 @@ static TestSocket g_test_instance;
 void TestSocket::runTests(IGameDef *gamedef)
 {
 	TEST(testIPv4Socket);
+	TEST(testBatchedIO);
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
@@ -147,3 +150,55 @@ void TestSocket::testIPv6Socket()
 				Address(&bytes, 0).getAddress6().s6_addr, 16) == 0);
 	}
 }
+
+void TestSocket::testBatchedIO()
+{
+	Address address(0, 0, 0, 0, port);
+	Address destination(127, 0, 0, 1, port);
+	std::string bind_str = g_settings->get("bind_address");
+	try {
+		Address bind_addr(0, 0, 0, 0, port);
+		bind_addr.Resolve(bind_str.c_str());
+
+		if (!bind_addr.isIPv6()) {
+			address = bind_addr;
+			destination = bind_addr;
+		}
+	} catch (ResolveError &e) {
+	}
+
+	UDPSocket socket(false);
+	socket.Bind(address);
+
+	// More datagrams than fit into one batch, of different sizes
+	const u32 count = 100;
+	std::vector<std::string> sent;
+	for (u32 i = 0; i < count; i++)
+		sent.push_back(std::string(1 + i % 37, 'a' + i % 26) + itos(i));
+
+	UDPSendBatch send_batch(32);
+	for (u32 i = 0; i < count; i++) {
+		send_batch.add(destination, sent[i].data(), sent[i].size());
+		if (send_batch.full() || i == count - 1) {
+			UASSERTEQ(u32, socket.SendBatch(send_batch), 0);
+			for (u32 j = 0; j < send_batch.size(); j++)
+				UASSERT(send_batch.wasSent(j));
+			send_batch.clear();
+		}
+	}
+
+	sleep_ms(50);
+
+	std::vector<std::string> received;
+	UDPReceiveBatch receive_batch(16, 256);
+	while (u32 n = socket.ReceiveBatch(receive_batch)) {
+		UASSERT(n <= receive_batch.capacity());
+		for (u32 i = 0; i < n; i++) {
+			UASSERT(receive_batch.getSender(i).getPort() == port);
+			received.emplace_back((const char *)receive_batch.getData(i),
+					receive_batch.getSize(i));
+		}
+	}
+
+	UASSERT(received == sent);
+}
@@ -34,6 +34,8 @@ class TestVoxelAlgorithms : public TestBase {
 
 	void testVoxelLineIterator();
 	void testLighting(IGameDef *gamedef);
+	void testLightingLargeEdit(IGameDef *gamedef);
+	void testLightingBlockBorder(IGameDef *gamedef);
 };
 
 static TestVoxelAlgorithms g_test_instance;
@@ -42,6 +44,8 @@ void TestVoxelAlgorithms::runTests(IGameDef *gamedef)
 {
 	TEST(testVoxelLineIterator);
 	TEST(testLighting, gamedef);
+	TEST(testLightingLargeEdit, gamedef);
+	TEST(testLightingBlockBorder, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +173,148 @@ void TestVoxelAlgorithms::testLighting(IGameDef *gamedef)
 		UASSERTEQ(int, n.getParam1(), 153);
 	}
 }
+
+// Night light must be the light source of a node or its brightest neighbor
+// minus one, whichever is brighter
+static bool is_night_light_correct(Map *map, const NodeDefManager *ndef,
+		v3s16 pmin, v3s16 pmax)
+{
+	static const v3s16 dirs[6] = {
+		v3s16(1, 0, 0), v3s16(-1, 0, 0), v3s16(0, 1, 0),
+		v3s16(0, -1, 0), v3s16(0, 0, 1), v3s16(0, 0, -1),
+	};
+	v3s16 p;
+	for (p.Z = pmin.Z; p.Z <= pmax.Z; p.Z++)
+	for (p.Y = pmin.Y; p.Y <= pmax.Y; p.Y++)
+	for (p.X = pmin.X; p.X <= pmax.X; p.X++) {
+		MapNode n = map->getNode(p);
+		ContentLightingFlags f = ndef->getLightingFlags(n);
+		if (!f.light_propagates)
+			continue;
+		u8 expected = f.light_source;
+		for (v3s16 dir : dirs) {
+			MapNode n2 = map->getNode(p + dir);
+			u8 light2 = n2.getLight(LIGHTBANK_NIGHT, ndef->getLightingFlags(n2));
+			if (light2 > expected + 1)
+				expected = light2 - 1;
+		}
+		if (n.getLightRaw(LIGHTBANK_NIGHT, f) != expected)
+			return false;
+	}
+	return true;
+}
+
+void TestVoxelAlgorithms::testLightingLargeEdit(IGameDef *gamedef)
+{
+	v3s16 pmin(-32, -32, -32);
+	v3s16 pmax(31, 31, 31);
+	v3s16 bpmin = getNodeBlockPos(pmin), bpmax = getNodeBlockPos(pmax);
+	DummyMap map(gamedef, bpmin, bpmax);
+	const NodeDefManager *ndef = gamedef->ndef();
+
+	// A stone cube with a large cave lit by many torches. Enough lights
+	// to be spread block by block.
+	{
+		std::map<v3s16, MapBlock*> modified_blocks;
+		MMVManip vm(&map);
+		vm.initialEmerge(bpmin, bpmax, false);
+		s32 volume = vm.m_area.getVolume();
+		for (s32 i = 0; i < volume; i++)
+			vm.m_data[i] = MapNode(t_CONTENT_STONE);
+		for (s16 z = -20; z <= 20; z++)
+		for (s16 y = -20; y <= 20; y++)
+		for (s16 x = -20; x <= 20; x++) {
+			bool torch = x % 9 == 0 && y % 9 == 0 && z % 9 == 0;
+			vm.setNodeNoEmerge(v3s16(x, y, z),
+				MapNode(torch ? t_CONTENT_TORCH : CONTENT_AIR));
+		}
+		voxalgo::blit_back_with_light(&map, &vm, &modified_blocks);
+	}
+	UASSERT(is_night_light_correct(&map, ndef, v3s16(-24), v3s16(24)));
+	{
+		MapNode n = map.getNode(v3s16(1, 0, 0));
+		UASSERTEQ(int, n.getLight(LIGHTBANK_NIGHT, ndef->getLightingFlags(n)), 12);
+	}
+
+	// Blow a hole into a wall of the cave, and put out some torches
+	{
+		std::vector<std::pair<v3s16, MapNode>> oldnodes;
+		v3s16 center(20, 0, 0);
+		v3s16 p;
+		for (p.Z = -8; p.Z <= 8; p.Z++)
+		for (p.Y = -8; p.Y <= 8; p.Y++)
+		for (p.X = 12; p.X <= 28; p.X++) {
+			if (p.getDistanceFromSQ(center) > 64)
+				continue;
+			oldnodes.emplace_back(p, map.getNode(p));
+			map.setNode(p, MapNode(CONTENT_AIR));
+		}
+		for (s16 z = -18; z <= 18; z += 9) {
+			p = v3s16(-18, 0, z);
+			oldnodes.emplace_back(p, map.getNode(p));
+			map.setNode(p, MapNode(CONTENT_AIR));
+		}
+		std::map<v3s16, MapBlock*> modified_blocks;
+		voxalgo::update_lighting_nodes(&map, oldnodes, modified_blocks);
+	}
+	UASSERT(is_night_light_correct(&map, ndef, v3s16(-24), v3s16(24)));
+	{
+		// 9 nodes from the nearest torch left
+		MapNode n = map.getNode(v3s16(-18, 0, 0));
+		UASSERTEQ(int, n.getLight(LIGHTBANK_NIGHT, ndef->getLightingFlags(n)), 4);
+	}
+}
+
+void TestVoxelAlgorithms::testLightingBlockBorder(IGameDef *gamedef)
+{
+	v3s16 pmin(-32, -32, -32);
+	v3s16 pmax(31, 31, 31);
+	v3s16 bpmin = getNodeBlockPos(pmin), bpmax = getNodeBlockPos(pmax);
+	DummyMap map(gamedef, bpmin, bpmax);
+	const NodeDefManager *ndef = gamedef->ndef();
+
+	// Two caves split by a wall on the border of their blocks, only the
+	// one on the -X side is lit
+	{
+		std::map<v3s16, MapBlock*> modified_blocks;
+		MMVManip vm(&map);
+		vm.initialEmerge(bpmin, bpmax, false);
+		s32 volume = vm.m_area.getVolume();
+		for (s32 i = 0; i < volume; i++)
+			vm.m_data[i] = MapNode(t_CONTENT_STONE);
+		for (s16 z = -12; z <= 11; z++)
+		for (s16 y = -12; y <= 11; y++)
+		for (s16 x = -14; x <= 14; x++) {
+			if (x == -1)
+				continue;
+			bool torch = x == -4 && y % 8 == 0 && z % 8 == 0;
+			vm.setNodeNoEmerge(v3s16(x, y, z),
+				MapNode(torch ? t_CONTENT_TORCH : CONTENT_AIR));
+		}
+		voxalgo::blit_back_with_light(&map, &vm, &modified_blocks);
+	}
+	{
+		MapNode n = map.getNode(v3s16(0, 0, 0));
+		UASSERTEQ(int, n.getLight(LIGHTBANK_NIGHT, ndef->getLightingFlags(n)), 0);
+	}
+
+	// Remove the wall. All of the changed nodes are lit by the cave next to
+	// them, and enough to be spread block by block.
+	{
+		std::vector<std::pair<v3s16, MapNode>> oldnodes;
+		for (s16 z = -12; z <= 11; z++)
+		for (s16 y = -12; y <= 11; y++) {
+			v3s16 p(-1, y, z);
+			oldnodes.emplace_back(p, map.getNode(p));
+			map.setNode(p, MapNode(CONTENT_AIR));
+		}
+		std::map<v3s16, MapBlock*> modified_blocks;
+		voxalgo::update_lighting_nodes(&map, oldnodes, modified_blocks);
+	}
+	UASSERT(is_night_light_correct(&map, ndef, v3s16(-24), v3s16(24)));
+	{
+		// 4 nodes from the torch at (-4, 0, 0)
+		MapNode n = map.getNode(v3s16(0, 0, 0));
+		UASSERTEQ(int, n.getLight(LIGHTBANK_NIGHT, ndef->getLightingFlags(n)), 9);
+	}
+}
@@ -24,6 +24,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "exceptions.h"
 #include "threading/mutex_auto_lock.h"
 #include "threading/semaphore.h"
+#include "basic_macros.h"
+#include <atomic>
 #include <list>
 #include <vector>
 #include <map>
@@ -276,6 +278,73 @@ class MutexedQueue
 	Semaphore m_signal;
 };
 
+/*
+	Lock-free queue for any number of producers and a single consumer.
+	push_back() may be called from any thread, pop_front() and empty() only
+	from the consumer thread.
+*/
+
+template<typename T>
+class MPSCQueue
+{
+public:
+	MPSCQueue() = default;
+
+	~MPSCQueue()
+	{
+		T t;
+		while (pop_front(t)) {
+		}
+		if (m_tail != &m_stub)
+			delete m_tail;
+	}
+
+	DISABLE_CLASS_COPY(MPSCQueue);
+
+	void push_back(T t)
+	{
+		Node *node = new Node(std::move(t));
+		Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+		// The consumer can not see the node until it is linked here
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	// Returns false if the queue is empty or the next push is not linked yet
+	bool pop_front(T &t)
+	{
+		Node *tail = m_tail;
+		Node *next = tail->next.load(std::memory_order_acquire);
+		if (!next)
+			return false;
+
+		// The popped node becomes the new (empty) tail
+		t = std::move(next->value);
+		m_tail = next;
+		if (tail != &m_stub)
+			delete tail;
+		return true;
+	}
+
+	bool empty() const
+	{
+		return !m_tail->next.load(std::memory_order_acquire);
+	}
+
+private:
+	struct Node
+	{
+		Node() = default;
+		Node(T &&t) : value(std::move(t)) {}
+
+		std::atomic<Node *> next{nullptr};
+		T value;
+	};
+
+	Node m_stub;
+	std::atomic<Node *> m_head{&m_stub};
+	Node *m_tail = &m_stub;
+};
+
 /*
 	LRU cache
 */
@@ -19,7 +19,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
 #include "irrlichttypes.h"
+#include "threading/event.h"
 #include "threading/thread.h"
 #include "threading/mutex_auto_lock.h"
 #include "porting.h"
@@ -226,3 +231,117 @@ class UpdateThread : public Thread
 private:
 	Semaphore m_update_sem;
 };
+
+/*
+	Runs one task at a time on its own thread while the caller does other
+	work: run() hands a task over, sync() waits until it is done. If the
+	thread isn't running, run() does the task right away, and sync() does a
+	task the stopped thread didn't get to.
+*/
+class BackgroundTask : public UpdateThread
+{
+public:
+	typedef std::function<void()> Task;
+
+	BackgroundTask(const std::string &name) : UpdateThread(name) {}
+
+	// Waits for the previous task first
+	void run(Task task)
+	{
+		sync();
+
+		m_task = std::move(task);
+		m_pending = true;
+		if (isRunning() && !stopRequested()) {
+			m_queued = true;
+			deferUpdate();
+		} else {
+			m_task();
+			m_pending = false;
+		}
+	}
+
+	void sync()
+	{
+		if (!m_pending)
+			return;
+
+		// Whoever takes the task off the queue runs it
+		if (stopRequested() && m_queued.exchange(false))
+			m_task();
+		else
+			m_done.wait();
+		m_pending = false;
+	}
+
+protected:
+	void doUpdate() override
+	{
+		if (m_queued.exchange(false)) {
+			m_task();
+			m_done.signal();
+		}
+	}
+
+private:
+	Task m_task;
+	Event m_done;
+	bool m_pending = false;
+	std::atomic<bool> m_queued{false};
+};
+
+/*
+	Splits a range of work into contiguous parts and runs them on a fixed set
+	of threads, the calling thread included. run() returns once all parts are
+	done. A job must not call run() of the same runner.
+*/
+class ParallelRunner
+{
+public:
+	typedef std::function<void(u32 begin, u32 end)> Job;
+
+	// num_threads includes the calling thread
+	ParallelRunner(const std::string &name, u32 num_threads)
+	{
+		for (u32 i = 1; i < num_threads; i++) {
+			m_workers.emplace_back(new BackgroundTask(name));
+			m_workers.back()->start();
+		}
+	}
+
+	~ParallelRunner()
+	{
+		for (auto &worker : m_workers) {
+			worker->stop();
+			worker->wait();
+		}
+	}
+
+	u32 getThreadCount() const { return m_workers.size() + 1; }
+
+	// Runs job on [0, count), split into one part per thread
+	void run(u32 count, const Job &job)
+	{
+		const u32 num_parts = getThreadCount();
+		if (num_parts == 1 || count < 2) {
+			job(0, count);
+			return;
+		}
+
+		auto part_begin = [&] (u32 part) {
+			return (u32)((u64)count * part / num_parts);
+		};
+		for (u32 i = 1; i < num_parts; i++) {
+			const u32 begin = part_begin(i);
+			const u32 end = part_begin(i + 1);
+			if (begin < end)
+				m_workers[i - 1]->run([&job, begin, end] { job(begin, end); });
+		}
+		job(0, part_begin(1));
+		for (auto &worker : m_workers)
+			worker->sync();
+	}
+
+private:
+	std::vector<std::unique_ptr<BackgroundTask>> m_workers;
+};
@@ -21,6 +21,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "mapblock.h"
 #include "map.h"
+#include <cstring>
+#include <memory>
+#include <utility>
+
+/*!
+ * Spreading this many lights or more is done block by block,
+ * see spread_light_in_blocks().
+ */
+#define LIGHT_BATCH_MIN_LIGHTS 512
 
 namespace voxalgo
 {
@@ -120,6 +129,15 @@ struct LightQueue {
 		return true;
 	}
 
+	//! Returns the number of ChangingLights in the queue.
+	size_t size() const
+	{
+		size_t count = 0;
+		for (const auto &level : lights)
+			count += level.size();
+		return count;
+	}
+
 	/*!
 	 * Adds an element to the queue.
 	 * The parameters are the same as in ChangingLight's constructor.
@@ -334,6 +352,236 @@ void unspread_light(Map *map, const NodeDefManager *nodemgr, LightBank bank,
 	}
 }
 
+/*!
+ * The light of a map block and of the nodes next to it, as bitmasks of
+ * rows of nodes along the X axis, so light can be spread through the
+ * whole block at once. Coordinates are relative to the block and moved
+ * by one: the block is at 1..16, the nodes of its neighbors at 0 and 17.
+ */
+struct PaddedBlockLight {
+	static constexpr s16 size = MAP_BLOCKSIZE + 2;
+	//! Bits of the nodes of the block in a row
+	static constexpr u32 inner_bits = ((1U << MAP_BLOCKSIZE) - 1) << 1;
+
+	//! Index of the row of nodes at the given Y and Z
+	static inline u32 row(s16 y, s16 z) { return z * size + y; }
+
+	//! Light of each node, or its light source if it is opaque
+	u8 light[size][size][size];
+	//! Nodes letting light through
+	u32 propagates[size * size];
+	//! Nodes having each light level
+	u32 levels[LIGHT_SUN + 1][size * size];
+	//! Nodes having at least the current light level, initially
+	u32 seeds[size * size];
+	//! Nodes having at least the current light level, and the next one
+	u32 lit[size * size];
+	u32 next[size * size];
+};
+
+static_assert(PaddedBlockLight::size <= 32, "Rows of PaddedBlockLight must fit in u32");
+
+/*!
+ * Loads the light of a block and of the nodes around it.
+ *
+ * \param neighbors the blocks next to the block, in the order of
+ * the directions, nullptr if not loaded
+ */
+static void load_padded_block_light(const NodeDefManager *nodemgr,
+	LightBank bank, MapBlock *block, MapBlock *const neighbors[6],
+	PaddedBlockLight &pad)
+{
+	memset(pad.propagates, 0, sizeof(pad.propagates));
+	memset(pad.levels, 0, sizeof(pad.levels));
+
+	auto add = [&](v3s16 p, MapNode n) {
+		ContentLightingFlags f = nodemgr->getLightingFlags(n);
+		u8 light = f.light_propagates ? n.getLightRaw(bank, f) : f.light_source;
+		pad.light[p.Z][p.Y][p.X] = light;
+		const u32 row = PaddedBlockLight::row(p.Y, p.Z);
+		if (f.light_propagates)
+			pad.propagates[row] |= 1U << p.X;
+		pad.levels[light][row] |= 1U << p.X;
+	};
+
+	const MapNode *data = block->getData();
+	u32 i = 0;
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++, i++)
+		add(v3s16(x + 1, y + 1, z + 1), data[i]);
+
+	for (direction d = 0; d < 6; d++) {
+		const v3s16 dir = neighbor_dirs[d];
+		MapBlock *neighbor = neighbors[d];
+		for (s16 a = 0; a < MAP_BLOCKSIZE; a++)
+		for (s16 b = 0; b < MAP_BLOCKSIZE; b++) {
+			// Node of the block on this side
+			relative_v3 q;
+			if (dir.X != 0)
+				q = relative_v3(dir.X > 0 ? MAP_BLOCKSIZE - 1 : 0, a, b);
+			else if (dir.Y != 0)
+				q = relative_v3(a, dir.Y > 0 ? MAP_BLOCKSIZE - 1 : 0, b);
+			else
+				q = relative_v3(a, b, dir.Z > 0 ? MAP_BLOCKSIZE - 1 : 0);
+			const v3s16 p = q + dir + v3s16(1, 1, 1);
+			if (neighbor)
+				add(p, neighbor->getNodeNoCheck(q + dir - dir * MAP_BLOCKSIZE));
+			else
+				pad.light[p.Z][p.Y][p.X] = 0;
+		}
+	}
+}
+
+/*!
+ * Spreads light through a block loaded by load_padded_block_light(),
+ * from all of its nodes and the nodes around it. Going from the brightest
+ * level down, the nodes having at least a level are those that had it
+ * before, and those letting light through next to a node of the level
+ * above. The nodes that got brighter are written back to the block.
+ *
+ * \param changed_sides output, bit i is set if a node on side i of the
+ * block got brighter
+ * \param spread_sides output, bit i is set if the light of a node on
+ * side i can spread to the neighbor in direction i
+ * \returns true if any node got brighter
+ */
+static bool spread_light_in_block(const NodeDefManager *nodemgr,
+	LightBank bank, MapBlock *block, PaddedBlockLight &pad,
+	u8 *changed_sides, u8 *spread_sides)
+{
+	const s16 size = PaddedBlockLight::size;
+	MapNode *data = block->getData();
+	bool changed = false;
+	*changed_sides = 0;
+	*spread_sides = 0;
+
+	memset(pad.seeds, 0, sizeof(pad.seeds));
+	memset(pad.lit, 0, sizeof(pad.lit));
+
+	for (u8 level = LIGHT_SUN; level > 0; level--) {
+		for (u32 r = 0; r < size * size; r++)
+			pad.seeds[r] |= pad.levels[level][r];
+
+		// Nodes next to the block only keep their light
+		for (s16 z = 0; z < size; z++)
+		for (s16 y = 0; y < size; y++) {
+			const u32 r = PaddedBlockLight::row(y, z);
+			if (z == 0 || z == size - 1 || y == 0 || y == size - 1) {
+				pad.next[r] = pad.seeds[r];
+				continue;
+			}
+			const u32 s = pad.lit[r];
+			const u32 around = (s << 1) | (s >> 1) |
+				pad.lit[r - 1] | pad.lit[r + 1] |
+				pad.lit[r - size] | pad.lit[r + size];
+			pad.next[r] = pad.seeds[r] | (around & pad.propagates[r] &
+				PaddedBlockLight::inner_bits);
+
+			// Nodes reaching this level only now got brighter
+			const u32 brighter = pad.next[r] & ~pad.lit[r] & ~pad.seeds[r];
+			if (brighter == 0)
+				continue;
+			changed = true;
+			for (s16 x = 1; x <= MAP_BLOCKSIZE; x++) {
+				if (!(brighter & (1U << x)))
+					continue;
+				MapNode &n = data[(z - 1) * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+					(y - 1) * MAP_BLOCKSIZE + (x - 1)];
+				n.setLight(bank, level, nodemgr->getLightingFlags(n));
+
+				const v3s16 p(x, y, z);
+				for (direction d = 0; d < 6; d++) {
+					const v3s16 p2 = p + neighbor_dirs[d];
+					if (p2.X > 0 && p2.X < size - 1 && p2.Y > 0 &&
+							p2.Y < size - 1 && p2.Z > 0 && p2.Z < size - 1)
+						continue;
+					*changed_sides |= 1 << d;
+					if (level > 1 && (pad.propagates[PaddedBlockLight::row(p2.Y, p2.Z)]
+							& (1U << p2.X)) &&
+							pad.light[p2.Z][p2.Y][p2.X] < level - 1)
+						*spread_sides |= 1 << d;
+				}
+			}
+		}
+		std::swap(pad.lit, pad.next);
+	}
+
+	if (changed)
+		block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
+	return changed;
+}
+
+/*
+ * Spreads light like spread_light(), but one map block at a time.
+ * The blocks of the starting nodes are updated as a whole, and then
+ * their neighbors as long as light flows into them.
+ *
+ * \param bank the light bank in which the procedure operates
+ * \param light_sources starting nodes, emptied
+ * \param modified_blocks output, all modified map blocks are added to this
+ */
+static void spread_light_in_blocks(Map *map, const NodeDefManager *nodemgr,
+	LightBank bank, LightQueue &light_sources,
+	std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	UniqueQueue<mapblock_v3> blocks;
+	for (u8 i = 0; i <= LIGHT_SUN; i++) {
+		for (const ChangingLight &light : light_sources.lights[i]) {
+			blocks.push_back(light.block_position);
+			if (i == 0)
+				continue;
+			// The starting nodes already have their light, so the update of
+			// their block doesn't see that it may flow into the neighbors.
+			for (direction d = 0; d < 6; d++) {
+				relative_v3 rel_pos = light.rel_position;
+				mapblock_v3 block_pos = light.block_position;
+				if (!step_rel_block_pos(d, rel_pos, block_pos))
+					continue;
+				MapBlock *neighbor = map->getBlockNoCreateNoEx(block_pos);
+				if (neighbor == NULL) {
+					light.block->setLightingComplete(bank, d, false);
+					continue;
+				}
+				MapNode n = neighbor->getNodeNoCheck(rel_pos);
+				ContentLightingFlags f = nodemgr->getLightingFlags(n);
+				if (f.light_propagates && n.getLightRaw(bank, f) < i - 1)
+					blocks.push_back(block_pos);
+			}
+		}
+		light_sources.lights[i].clear();
+	}
+
+	// Too large for the stack
+	std::unique_ptr<PaddedBlockLight> pad(new PaddedBlockLight());
+	MapBlock *neighbors[6];
+	while (blocks.size() > 0) {
+		mapblock_v3 blockpos = blocks.front();
+		blocks.pop_front();
+		MapBlock *block = map->getBlockNoCreateNoEx(blockpos);
+		if (block == NULL)
+			continue;
+		for (direction d = 0; d < 6; d++)
+			neighbors[d] = map->getBlockNoCreateNoEx(blockpos + neighbor_dirs[d]);
+
+		load_padded_block_light(nodemgr, bank, block, neighbors, *pad);
+		u8 changed_sides, spread_sides;
+		if (!spread_light_in_block(nodemgr, bank, block, *pad,
+				&changed_sides, &spread_sides))
+			continue;
+
+		modified_blocks[blockpos] = block;
+		for (direction d = 0; d < 6; d++) {
+			if (!(changed_sides & (1 << d)))
+				continue;
+			if (neighbors[d] == NULL)
+				block->setLightingComplete(bank, d, false);
+			else if (spread_sides & (1 << d))
+				blocks.push_back(blockpos + neighbor_dirs[d]);
+		}
+	}
+}
+
 /*
  * Spreads light from the specified starting nodes.
  *
@@ -350,6 +598,13 @@ void spread_light(Map *map, const NodeDefManager *nodemgr, LightBank bank,
 	LightQueue &light_sources,
 	std::map<v3s16, MapBlock*> &modified_blocks)
 {
+	// Large updates are faster block by block
+	if (light_sources.size() >= LIGHT_BATCH_MIN_LIGHTS) {
+		spread_light_in_blocks(map, nodemgr, bank, light_sources,
+			modified_blocks);
+		return;
+	}
+
 	// The light the current node can provide to its neighbors.
 	u8 spreading_light;
 	// The ChangingLight for the current node.